@@ -0,0 +1,156 @@
+/*
+* Node Web Bluetooth
+* Copyright (c) 2023 Rob Moran
+*
+* The MIT License (MIT)
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+// Brings a fleet of virtual peripherals online through the native binding and
+// SimplebleAdapter, then reports how long it took and what it cost.
+//
+//   node bench/connect-storm.js --count=200 --latency=lognormal:150:0.6
+//
+// Options:
+//   --count=N            peripherals (default 100)
+//   --latency=kind:a:b   connect latency in ms; kind is fixed, uniform, normal,
+//                        lognormal or exponential (default lognormal:150:0.5)
+//   --interval=ms        notification interval (default 100)
+//   --payload=bytes      notification size (default 20)
+//   --failure=rate       connection failure probability (default 0)
+//   --seed=n             random seed (default 1)
+
+const fs = require("fs");
+const { performance, monitorEventLoopDelay } = require("perf_hooks");
+const simpleble = require("../dist/adapters/simpleble");
+const { SimplebleAdapter } = require("../dist/adapters/simpleble-adapter");
+
+const SERVICE = "0000fff0-0000-1000-8000-00805f9b34fb";
+const CHARACTERISTIC = "0000fff1-0000-1000-8000-00805f9b34fb";
+
+const args = {};
+for (const arg of process.argv.slice(2)) {
+    const [key, value] = arg.replace(/^--/, "").split("=");
+    args[key] = value;
+}
+
+const count = Number(args.count || 100);
+const [kind, a, b] = (args.latency || "lognormal:150:0.5").split(":");
+const interval = Number(args.interval || 100);
+
+const threads = () => {
+    try {
+        const status = fs.readFileSync("/proc/self/status", "utf8");
+        return Number(/^Threads:\s+(\d+)/m.exec(status)[1]);
+    } catch (e) {
+        return NaN;
+    }
+};
+
+const percentile = (values, p) => {
+    if (values.length === 0) {
+        return NaN;
+    }
+    const sorted = [...values].sort((x, y) => x - y);
+    return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+};
+
+const waitFor = async (predicate, timeout) => {
+    const deadline = performance.now() + timeout;
+    while (!predicate() && performance.now() < deadline) {
+        await new Promise(resolve => setTimeout(resolve, 5));
+    }
+    return predicate();
+};
+
+(async () => {
+    const peak = { threads: threads(), rss: process.memoryUsage().rss };
+    const sampler = setInterval(() => {
+        peak.threads = Math.max(peak.threads, threads());
+        peak.rss = Math.max(peak.rss, process.memoryUsage().rss);
+    }, 10);
+    const lag = monitorEventLoopDelay({ resolution: 10 });
+    lag.enable();
+
+    const native = simpleble.createVirtualAdapter({
+        count,
+        connectLatency: { kind, a: Number(a), b: Number(b || 0) },
+        notifyInterval: interval,
+        payloadSize: Number(args.payload || 20),
+        failureRate: Number(args.failure || 0),
+        seed: Number(args.seed || 1)
+    });
+    const adapter = new SimplebleAdapter(native);
+
+    const start = performance.now();
+    const ids = [];
+    const session = await adapter.startScan([], device => ids.push(device.id));
+    await waitFor(() => ids.length === count, 10000);
+    adapter.stopScan(session);
+    const scanned = performance.now();
+
+    // Separate handles for measuring, the adapter keeps its own.
+    const handles = new Map(native.peripherals.map(peripheral => [peripheral.address, peripheral]));
+    const ready = new Map();
+    const firstNotify = new Map();
+    const failed = [];
+
+    await Promise.all(ids.map(async id => {
+        const begin = performance.now();
+        try {
+            await adapter.connect(id);
+            await adapter.discoverServices(id);
+        } catch (e) {
+            failed.push(id);
+            return;
+        }
+        ready.set(id, performance.now() - begin);
+
+        handles.get(id).notify(SERVICE, CHARACTERISTIC, () => {
+            if (!firstNotify.has(id)) {
+                firstNotify.set(id, performance.now() - begin);
+            }
+        });
+    }));
+    const online = performance.now();
+
+    await waitFor(() => firstNotify.size === ready.size, interval * 10 + 5000);
+    const done = performance.now();
+
+    clearInterval(sampler);
+    lag.disable();
+    for (const id of ready.keys()) {
+        await adapter.disconnect(id);
+    }
+
+    const ms = value => `${value.toFixed(1)} ms`;
+    const readyTimes = [...ready.values()];
+    const notifyTimes = [...firstNotify.values()];
+    console.log(`peripherals          ${count} (${failed.length} failed to connect)`);
+    console.log(`scan                 ${ms(scanned - start)}`);
+    console.log(`all ready            ${ms(online - scanned)}`);
+    console.log(`all notifying        ${ms(done - scanned)}`);
+    console.log(`ready p50/p99/max    ${ms(percentile(readyTimes, 0.5))} / ${ms(percentile(readyTimes, 0.99))} / ${ms(Math.max(...readyTimes))}`);
+    console.log(`first notify p50/p99 ${ms(percentile(notifyTimes, 0.5))} / ${ms(percentile(notifyTimes, 0.99))} (${notifyTimes.length}/${ready.size})`);
+    console.log(`event loop lag       p50 ${ms(lag.percentile(50) / 1e6)}, p99 ${ms(lag.percentile(99) / 1e6)}, max ${ms(lag.max / 1e6)}`);
+    console.log(`peak threads         ${peak.threads}`);
+    console.log(`peak rss             ${(peak.rss / 1048576).toFixed(1)} MiB`);
+    process.exit();
+})();
@@ -1,5 +1,101 @@
 #include "adapter.h"
+#include "async.h"
+#include "clock.h"
 #include "peripheral.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <mutex>
+#include <simpleble_c/simpleble.h>
+#include <thread>
+#include <vector>
+
+#ifdef WEBBLUETOOTH_HCI
+#include "hci.h"
+#endif
+
+// Paired peripheral handles as of a Peripheral::bondGeneration. Enumerating
+// bonds can take a long time on hosts with many of them, so the list is only
+// read again once a connect or unpair may have changed it.
+struct PairedCache {
+  std::mutex mutex;
+  std::shared_ptr<void> adapter;
+  bool valid = false;
+  uint64_t generation = 0;
+  std::vector<std::shared_ptr<void>> handles;
+
+  std::vector<std::shared_ptr<void>> get(bool refresh) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const uint64_t generation = Peripheral::bondGeneration;
+    if (this->valid && !refresh && this->generation == generation) {
+      return this->handles;
+    }
+
+    this->handles.clear();
+    if (this->adapter) {
+      auto handle = static_cast<simpleble_adapter_t>(this->adapter.get());
+      const size_t count =
+          simpleble_adapter_get_paired_peripherals_count(handle);
+      for (size_t i = 0; i < count; i++) {
+        simpleble_peripheral_t peripheral =
+            simpleble_adapter_get_paired_peripherals_handle(handle, i);
+        if (peripheral != nullptr) {
+          this->handles.emplace_back(peripheral,
+                                     simpleble_peripheral_release_handle);
+        }
+      }
+    }
+    this->generation = generation;
+    this->valid = true;
+    return this->handles;
+  }
+};
+
+// A connectOnMatch() request. Whoever takes it out of Adapter::matchConnect
+// releases the callback: the connect job, a replacement or a cancellation.
+struct MatchConnect {
+  ScanFilter filter;
+  Napi::ThreadSafeFunction fn;
+};
+
+// Stops an HCI scanFor() from a Clock timer. The adapter detaches itself
+// under the mutex before it goes away, or when the scan is restarted or
+// stopped by hand.
+struct TimedScan {
+  std::mutex mutex;
+  Adapter *adapter;
+  uint64_t timer = 0;
+};
+
+// Outcome of a connectOnMatch() connection, handed to the JS thread.
+struct MatchResult {
+  std::shared_ptr<const Advertisement> advertisement;
+  std::shared_ptr<void> handle;
+  std::shared_ptr<NativeDevice> device;
+  bool connected;
+};
+
+// Scan delivery, handed to the JS thread. The handle is a SimpleBLE
+// peripheral, a NativeDevice on native adapters or empty for replays.
+struct Sighting {
+  std::shared_ptr<const Advertisement> advertisement;
+  std::shared_ptr<void> handle;
+  bool native;
+};
+
+static Napi::Value fromSighting(Napi::Env env, const Sighting &sighting) {
+  if (!sighting.handle) {
+    return Peripheral::fromAdvertisement(env, sighting.advertisement);
+  } else if (sighting.native) {
+    return Peripheral::fromDevice(
+        env, std::static_pointer_cast<NativeDevice>(sighting.handle),
+        sighting.advertisement);
+  }
+  return Peripheral::fromHandle(env, sighting.handle);
+}
 
 Napi::FunctionReference Adapter::constructor;
 
@@ -11,6 +107,7 @@ Napi::Object Adapter::Init(Napi::Env env, Napi::Object exports) {
     InstanceAccessor<&Adapter::IsActive>("active"),
     InstanceAccessor<&Adapter::GetPeripherals>("peripherals"),
     InstanceAccessor<&Adapter::GetPairedPeripherals>("pairedPeripherals"),
+    InstanceMethod("getPairedPeripherals", &Adapter::GetPairedPeripheralsAsync),
     InstanceMethod("scanFor", &Adapter::ScanFor),
     InstanceMethod("scanStart", &Adapter::ScanStart),
     InstanceMethod("scanStop", &Adapter::ScanStop),
@@ -18,7 +115,15 @@ Napi::Object Adapter::Init(Napi::Env env, Napi::Object exports) {
     InstanceMethod("setCallbackOnScanStop", &Adapter::SetCallbackOnScanStop),
     InstanceMethod("setCallbackOnScanUpdated", &Adapter::SetCallbackOnScanUpdated),
     InstanceMethod("setCallbackOnScanFound", &Adapter::SetCallbackOnScanFound),
-    InstanceMethod("release", &Adapter::Release)
+    InstanceMethod("release", &Adapter::Release),
+    InstanceMethod("startCapture", &Adapter::StartCapture),
+    InstanceMethod("stopCapture", &Adapter::StopCapture),
+    InstanceMethod("replayCapture", &Adapter::ReplayCapture),
+    InstanceMethod("scanTableJson", &Adapter::ScanTableJson),
+    InstanceMethod("connectOnMatch", &Adapter::ConnectOnMatch),
+    InstanceMethod("cancelConnectOnMatch", &Adapter::CancelConnectOnMatch),
+    InstanceMethod("openScanSession", &Adapter::OpenScanSession),
+    InstanceMethod("closeScanSession", &Adapter::CloseScanSession)
   });
   // clang-format on
 
@@ -37,15 +142,57 @@ Adapter::Adapter(const Napi::CallbackInfo &info)
     Napi::TypeError::New(env, "Adapter should not be created directly")
         .ThrowAsJavaScriptException();
     return;
+  } else if (info[0].IsExternal()) {
+    // Simulated fleet or HCI controller, see fromFleet() and
+    // fromController().
+    const Origin *origin = info[0].As<Napi::External<Origin>>().Data();
+    this->fleet = origin->fleet;
+    this->simulated = !origin->hci;
+    this->hci = origin->hci;
+    this->paired = std::make_shared<PairedCache>();
+#ifdef WEBBLUETOOTH_HCI
+    if (this->hci) {
+      this->hci->setScanCallback(
+          [this](std::shared_ptr<const Advertisement> advertisement,
+                 std::shared_ptr<HciDevice> device) {
+            this->handleDeviceSighting(std::move(advertisement),
+                                       std::move(device));
+          });
+    }
+#endif
+    return;
   }
   size_t index = info[0].As<Napi::Number>().Int64Value();
   this->handle = simpleble_adapter_get_handle(index);
+  if (this->handle != nullptr) {
+    this->owner.reset(this->handle, simpleble_adapter_release_handle);
+  }
+  this->paired = std::make_shared<PairedCache>();
+  this->paired->adapter = this->owner;
 }
 
 Adapter::~Adapter() {
-  if (this->handle != nullptr) {
-    simpleble_adapter_release_handle(this->handle);
+#ifdef WEBBLUETOOTH_HCI
+  if (this->hci) {
+    // Waits for a sighting in progress; devices outlive the adapter.
+    this->hci->setScanCallback(nullptr);
+  }
+#endif
+  this->cancelTimedScan();
+  this->replay.stop();
+  {
+    std::lock_guard<std::mutex> lock(this->matchMutex);
+    if (this->matchConnect) {
+      this->matchConnect->fn.Release();
+      this->matchConnect.reset();
+    }
+  }
+  while (!this->sessionFns.empty()) {
+    bool last;
+    this->closeSession(this->sessionFns.begin()->first, last);
   }
+
+  this->owner.reset();
   if (this->onScanStartFn) {
     this->onScanStartFn.Release();
   }
@@ -65,9 +212,32 @@ Adapter::~Adapter() {
   this->handle = nullptr;
 }
 
+Napi::Value
+Adapter::fromFleet(Napi::Env env,
+                   std::vector<std::shared_ptr<VirtualDevice>> fleet) {
+  Origin origin{std::move(fleet), nullptr};
+  return constructor.New({Napi::External<Origin>::New(env, &origin)});
+}
+
+Napi::Value
+Adapter::fromController(Napi::Env env,
+                        std::shared_ptr<HciController> controller) {
+  Origin origin{{}, std::move(controller)};
+  return constructor.New({Napi::External<Origin>::New(env, &origin)});
+}
+
 Napi::Value Adapter::Identifier(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->simulated) {
+    return Napi::String::New(env, "Virtual");
+  }
+#ifdef WEBBLUETOOTH_HCI
+  if (this->hci) {
+    return Napi::String::New(env, "hci" + std::to_string(this->hci->index()));
+  }
+#endif
+
   char *identifier = simpleble_adapter_identifier(this->handle);
   auto ret = Napi::String::New(env, identifier);
   free(identifier);
@@ -77,6 +247,15 @@ Napi::Value Adapter::Identifier(const Napi::CallbackInfo &info) {
 Napi::Value Adapter::Address(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->simulated) {
+    return Napi::String::New(env, "00:00:00:00:00:00");
+  }
+#ifdef WEBBLUETOOTH_HCI
+  if (this->hci) {
+    return Napi::String::New(env, this->hci->address());
+  }
+#endif
+
   char *address = simpleble_adapter_address(this->handle);
   auto ret = Napi::String::New(env, address);
   free(address);
@@ -85,8 +264,17 @@ Napi::Value Adapter::Address(const Napi::CallbackInfo &info) {
 
 Napi::Value Adapter::IsActive(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
-  bool active;
 
+  if (this->simulated) {
+    return Napi::Boolean::New(env, this->scanning);
+  }
+#ifdef WEBBLUETOOTH_HCI
+  if (this->hci) {
+    return Napi::Boolean::New(env, this->hci->scanning());
+  }
+#endif
+
+  bool active;
   auto err = simpleble_adapter_scan_is_active(this->handle, &active);
   if (err != SIMPLEBLE_SUCCESS) {
     return Napi::Boolean::New(env, false);
@@ -98,6 +286,32 @@ Napi::Value Adapter::IsActive(const Napi::CallbackInfo &info) {
 Napi::Value Adapter::ScanStart(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  // Open sessions keep the scan running; join it without clearing what they
+  // have seen, and keep it running after they close until scanStop().
+  const bool joined = this->sessions->size() > 0;
+  if (joined) {
+    std::lock_guard<std::mutex> lock(this->scanMutex);
+    this->sessionScan = false;
+  } else {
+    this->scanTable->clear();
+  }
+
+  if (this->simulated) {
+    if (!this->scanning) {
+      this->scanning = true;
+      if (this->onScanStartFn) {
+        onScanStart(nullptr, this);
+      }
+    }
+    this->announceFleet();
+    return Napi::Boolean::New(env, true);
+  } else if (this->hci) {
+    this->cancelTimedScan();
+    return Napi::Boolean::New(env, this->startControllerScan());
+  } else if (joined) {
+    return Napi::Boolean::New(env, true);
+  }
+
   auto err = simpleble_adapter_scan_start(this->handle);
 
   return Napi::Boolean::New(env, err == SIMPLEBLE_SUCCESS);
@@ -106,6 +320,27 @@ Napi::Value Adapter::ScanStart(const Napi::CallbackInfo &info) {
 Napi::Value Adapter::ScanStop(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->hci) {
+    this->cancelTimedScan();
+  }
+  if (this->sessions->size() > 0) {
+    // Left to the last session to stop.
+    std::lock_guard<std::mutex> lock(this->scanMutex);
+    this->sessionScan = true;
+    return Napi::Boolean::New(env, true);
+  }
+
+  if (this->simulated) {
+    this->scanning = false;
+    if (this->onScanStopFn) {
+      onScanStop(nullptr, this);
+    }
+    return Napi::Boolean::New(env, true);
+  } else if (this->hci) {
+    this->stopControllerScan();
+    return Napi::Boolean::New(env, true);
+  }
+
   auto err = simpleble_adapter_scan_stop(this->handle);
 
   return Napi::Boolean::New(env, err == SIMPLEBLE_SUCCESS);
@@ -123,7 +358,65 @@ Napi::Value Adapter::ScanFor(const Napi::CallbackInfo &info) {
     return env.Null();
   }
 
+  // As for scanStart(), a scan kept running by sessions is joined.
+  const bool joined = this->sessions->size() > 0;
+  if (!joined) {
+    this->scanTable->clear();
+  }
+  if (this->simulated) {
+    // The whole fleet is in range immediately, so there is nothing to wait
+    // for.
+    if (!this->scanning && this->onScanStartFn) {
+      onScanStart(nullptr, this);
+    }
+    this->announceFleet();
+    if (!this->scanning && this->onScanStopFn) {
+      onScanStop(nullptr, this);
+    }
+    return Napi::Boolean::New(env, true);
+  }
+
   auto timeout = info[0].As<Napi::Number>().Int64Value();
+  if (this->hci) {
+    // Returns once the scan is running, like scanStart(); a Clock timer
+    // stops it rather than blocking the JS thread for the whole timeout.
+    this->cancelTimedScan();
+    if (!this->startControllerScan()) {
+      return Napi::Boolean::New(env, false);
+    }
+
+    auto scan = std::make_shared<TimedScan>();
+    scan->adapter = this;
+    std::lock_guard<std::mutex> lock(scan->mutex);
+    std::weak_ptr<TimedScan> weak = scan;
+    scan->timer = Clock::scheduleAfter(
+        static_cast<uint64_t>(std::max<int64_t>(timeout, 0)) * 1000000,
+        [weak]() {
+          auto scan = weak.lock();
+          if (!scan) {
+            return;
+          }
+          std::lock_guard<std::mutex> lock(scan->mutex);
+          Adapter *adapter = scan->adapter;
+          if (adapter == nullptr) {
+            return;
+          }
+          scan->adapter = nullptr;
+          std::lock_guard<std::mutex> scanLock(adapter->scanMutex);
+          if (adapter->sessions->size() > 0) {
+            adapter->sessionScan = true;
+          } else {
+            adapter->stopControllerScan();
+          }
+        });
+    this->timedScan = std::move(scan);
+    return Napi::Boolean::New(env, true);
+  } else if (joined) {
+    // Block for the timeout like SimpleBLE would, without stopping the scan.
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(std::max<int64_t>(timeout, 0)));
+    return Napi::Boolean::New(env, true);
+  }
   auto err = simpleble_adapter_scan_for(this->handle, timeout);
 
   return Napi::Boolean::New(env, err == SIMPLEBLE_SUCCESS);
@@ -132,6 +425,24 @@ Napi::Value Adapter::ScanFor(const Napi::CallbackInfo &info) {
 Napi::Value Adapter::GetPeripherals(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->simulated) {
+    Napi::Array peripherals = Napi::Array::New(env, this->fleet.size());
+    for (size_t i = 0; i < this->fleet.size(); i++) {
+      peripherals.Set(i, Peripheral::fromDevice(env, this->fleet[i]));
+    }
+    return peripherals;
+  }
+#ifdef WEBBLUETOOTH_HCI
+  if (this->hci) {
+    const auto devices = this->hci->results();
+    Napi::Array peripherals = Napi::Array::New(env, devices.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+      peripherals.Set(i, Peripheral::fromDevice(env, devices[i]));
+    }
+    return peripherals;
+  }
+#endif
+
   size_t count = simpleble_adapter_scan_get_results_count(this->handle);
   Napi::Array peripherals = Napi::Array::New(env);
 
@@ -149,20 +460,41 @@ Napi::Value Adapter::GetPeripherals(const Napi::CallbackInfo &info) {
 Napi::Value Adapter::GetPairedPeripherals(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
-  size_t count = simpleble_adapter_get_paired_peripherals_count(this->handle);
-  Napi::Array peripherals = Napi::Array::New(env, count);
-
-  for (size_t i = 0; i < count; i++) {
-    simpleble_peripheral_t peripheral =
-        simpleble_adapter_get_paired_peripherals_handle(this->handle, i);
-    Napi::Value peripheralInstance = Peripheral::constructor.New(
-        {Napi::BigInt::New(env, reinterpret_cast<uint64_t>(peripheral))});
-    peripherals.Set(i, peripheralInstance);
+  const auto handles = this->paired->get(false);
+  Napi::Array peripherals = Napi::Array::New(env, handles.size());
+  for (size_t i = 0; i < handles.size(); i++) {
+    peripherals.Set(i, Peripheral::fromHandle(env, handles[i]));
   }
 
   return peripherals;
 }
 
+Napi::Value
+Adapter::GetPairedPeripheralsAsync(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() > 0 && !info[0].IsUndefined() && !info[0].IsBoolean()) {
+    Napi::TypeError::New(env, "Refresh is not a boolean")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+  const bool refresh = info.Length() > 0 && info[0].IsBoolean() &&
+                       info[0].As<Napi::Boolean>().Value();
+
+  std::shared_ptr<PairedCache> paired = this->paired;
+  return runOnPool<std::vector<std::shared_ptr<void>>>(
+      env, "getPairedPeripherals",
+      [paired, refresh]() { return paired->get(refresh); },
+      [](Napi::Env env,
+         std::vector<std::shared_ptr<void>> &handles) -> Napi::Value {
+        Napi::Array peripherals = Napi::Array::New(env, handles.size());
+        for (size_t i = 0; i < handles.size(); i++) {
+          peripherals.Set(i, Peripheral::fromHandle(env, handles[i]));
+        }
+        return peripherals;
+      });
+}
+
 Napi::Value Adapter::SetCallbackOnScanStart(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
   Napi::HandleScope scope(env);
@@ -180,8 +512,10 @@ Napi::Value Adapter::SetCallbackOnScanStart(const Napi::CallbackInfo &info) {
       env, info[0].As<Napi::Function>(), "onScanStartFn", 0, 1);
   this->onScanStartFn.Unref(env);
 
-  const auto ret = simpleble_adapter_set_callback_on_scan_start(
-      this->handle, onScanStart, this);
+  const auto ret = this->native()
+                       ? SIMPLEBLE_SUCCESS
+                       : simpleble_adapter_set_callback_on_scan_start(
+                             this->handle, onScanStart, this);
 
   if (ret != SIMPLEBLE_SUCCESS) {
     return Napi::Boolean::New(env, false);
@@ -207,8 +541,10 @@ Napi::Value Adapter::SetCallbackOnScanStop(const Napi::CallbackInfo &info) {
       env, info[0].As<Napi::Function>(), "onScanStopFn", 0, 1);
   this->onScanStopFn.Unref(env);
 
-  const auto ret = simpleble_adapter_set_callback_on_scan_stop(
-      this->handle, onScanStop, this);
+  const auto ret = this->native()
+                       ? SIMPLEBLE_SUCCESS
+                       : simpleble_adapter_set_callback_on_scan_stop(
+                             this->handle, onScanStop, this);
 
   if (ret != SIMPLEBLE_SUCCESS) {
     return Napi::Boolean::New(env, false);
@@ -233,8 +569,10 @@ Napi::Value Adapter::SetCallbackOnScanUpdated(const Napi::CallbackInfo &info) {
       env, info[0].As<Napi::Function>(), "onScanUpdatedFn", 0, 1);
   this->onScanUpdatedFn.Unref(env);
 
-  const auto ret = simpleble_adapter_set_callback_on_scan_updated(
-      this->handle, onScanUpdated, this);
+  const auto ret = this->native()
+                       ? SIMPLEBLE_SUCCESS
+                       : simpleble_adapter_set_callback_on_scan_updated(
+                             this->handle, onScanUpdated, this);
 
   if (ret != SIMPLEBLE_SUCCESS) {
     return Napi::Boolean::New(env, false);
@@ -260,8 +598,10 @@ Napi::Value Adapter::SetCallbackOnScanFound(const Napi::CallbackInfo &info) {
       env, info[0].As<Napi::Function>(), "onScanFoundFn", 0, 1);
   this->onScanFoundFn.Unref(env);
 
-  const auto ret = simpleble_adapter_set_callback_on_scan_found(
-      this->handle, onScanFound, this);
+  const auto ret = this->native()
+                       ? SIMPLEBLE_SUCCESS
+                       : simpleble_adapter_set_callback_on_scan_found(
+                             this->handle, onScanFound, this);
 
   if (ret != SIMPLEBLE_SUCCESS) {
     return Napi::Boolean::New(env, false);
@@ -278,6 +618,806 @@ Napi::Value Adapter::Release(const Napi::CallbackInfo &info) {
   return env.Null();
 }
 
+Napi::Value Adapter::StartCapture(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing path").ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Path is not a string")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  const bool ret = this->capture.open(info[0].As<Napi::String>().Utf8Value());
+  this->capturing = ret;
+  return Napi::Boolean::New(env, ret);
+}
+
+Napi::Value Adapter::StopCapture(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  this->capturing = false;
+  return Napi::Number::New(env, this->capture.close());
+}
+
+Napi::Value Adapter::ReplayCapture(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing path").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Path is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  double speed = 1;
+  if (info.Length() > 1 && !info[1].IsUndefined()) {
+    if (!info[1].IsNumber() || info[1].As<Napi::Number>().DoubleValue() < 0) {
+      Napi::TypeError::New(env, "Speed is not a positive number")
+          .ThrowAsJavaScriptException();
+      return env.Undefined();
+    }
+    speed = info[1].As<Napi::Number>().DoubleValue();
+  }
+
+  std::vector<Advertisement> advertisements;
+  if (!CaptureReader::read(info[0].As<Napi::String>().Utf8Value(),
+                           advertisements)) {
+    return env.Undefined();
+  }
+
+  const size_t count = this->replay.start(
+      std::move(advertisements), speed,
+      [this](std::shared_ptr<const Advertisement> advertisement) {
+        this->handleDeviceSighting(std::move(advertisement), nullptr);
+      });
+  return Napi::Number::New(env, count);
+}
+
+// Lowercases a UUID and expands 16 and 32-bit aliases, like
+// BluetoothUUID.canonicalUUID().
+static std::string canonicalUuid(std::string uuid) {
+  std::transform(uuid.begin(), uuid.end(), uuid.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (uuid.size() <= 8) {
+    uuid = std::string(8 - uuid.size(), '0') + uuid +
+           "-0000-1000-8000-00805f9b34fb";
+  }
+  return uuid;
+}
+
+// Reads the scanTableJson() options. Returns false with a pending exception
+// when they are invalid.
+static bool scanQueryOption(const Napi::Object &options, ScanQuery &query) {
+  Napi::Env env = options.Env();
+
+  const Napi::Value fields = options.Get("fields");
+  if (fields.IsArray()) {
+    const Napi::Array names = fields.As<Napi::Array>();
+    query.fields = 0;
+    for (uint32_t i = 0; i < names.Length(); i++) {
+      ScanQuery::Field field;
+      const Napi::Value name = names.Get(i);
+      if (!name.IsString() ||
+          !ScanQuery::parseField(name.As<Napi::String>().Utf8Value(), field)) {
+        Napi::TypeError::New(env, "Unknown field").ThrowAsJavaScriptException();
+        return false;
+      }
+      query.fields |= field;
+    }
+  } else if (!fields.IsUndefined()) {
+    Napi::TypeError::New(env, "Fields is not an array")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+  if (options.Get("minRssi").IsNumber()) {
+    query.minRssi = static_cast<int16_t>(
+        options.Get("minRssi").As<Napi::Number>().Int32Value());
+  }
+  if (options.Get("maxAge").IsNumber()) {
+    query.maxAge = static_cast<uint64_t>(
+        std::max(options.Get("maxAge").As<Napi::Number>().DoubleValue(), 0.0) *
+        1e6);
+  }
+  if (options.Get("connectable").IsBoolean()) {
+    query.connectableOnly =
+        options.Get("connectable").As<Napi::Boolean>().Value();
+  }
+  if (options.Get("namePrefix").IsString()) {
+    query.identifierPrefix =
+        options.Get("namePrefix").As<Napi::String>().Utf8Value();
+  }
+  if (options.Get("service").IsString()) {
+    query.service =
+        canonicalUuid(options.Get("service").As<Napi::String>().Utf8Value());
+  }
+  if (options.Get("company").IsNumber()) {
+    query.company = options.Get("company").As<Napi::Number>().Int32Value();
+  }
+  if (options.Get("limit").IsNumber()) {
+    query.limit = options.Get("limit").As<Napi::Number>().Uint32Value();
+  }
+  return true;
+}
+
+Napi::Value Adapter::ScanTableJson(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  ScanQuery query;
+  if (info.Length() > 0 && !info[0].IsUndefined()) {
+    if (!info[0].IsObject()) {
+      Napi::TypeError::New(env, "Options is not an object")
+          .ThrowAsJavaScriptException();
+      return env.Undefined();
+    } else if (!scanQueryOption(info[0].As<Napi::Object>(), query)) {
+      return env.Undefined();
+    }
+  }
+
+  // The table is copied and serialized on the pool; the JS thread only
+  // wraps the finished string in a Buffer without copying it.
+  std::shared_ptr<ScanTable> table = this->scanTable;
+  return runOnPool<std::string>(
+      env, "scanTableJson",
+      [table, query]() {
+        std::string json;
+        table->toJson(query, Clock::now(), json);
+        return json;
+      },
+      [](Napi::Env env, std::string &json) -> Napi::Value {
+        auto data = new std::string(std::move(json));
+        return Napi::Buffer<char>::New(
+            env, &(*data)[0], data->size(),
+            [](Napi::Env, char *, std::string *data) { delete data; }, data);
+      });
+}
+
+// Reads the dataPrefix and mask of a manufacturerData or serviceData filter.
+// Returns false with a pending exception when they are invalid.
+static bool dataPrefixOption(const Napi::Object &entry, DataPrefix &prefix) {
+  Napi::Env env = entry.Env();
+
+  const char *keys[] = {"dataPrefix", "mask"};
+  std::vector<uint8_t> *values[] = {&prefix.prefix, &prefix.mask};
+  for (size_t i = 0; i < 2; i++) {
+    const Napi::Value value = entry.Get(keys[i]);
+    if (value.IsUndefined()) {
+      continue;
+    } else if (!value.IsTypedArray() ||
+               value.As<Napi::TypedArray>().TypedArrayType() !=
+                   napi_uint8_array) {
+      Napi::TypeError::New(env, "Data prefix is not a Uint8Array")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+    const Napi::Uint8Array data = value.As<Napi::Uint8Array>();
+    values[i]->assign(data.Data(), data.Data() + data.ElementLength());
+  }
+  return true;
+}
+
+// Compiles a list of Web Bluetooth scan filters with canonical or alias
+// UUIDs. Returns false with a pending exception when one is invalid.
+static bool scanFilterOption(const Napi::Value &value, ScanFilter &filter) {
+  Napi::Env env = value.Env();
+
+  if (!value.IsArray()) {
+    Napi::TypeError::New(env, "Filters is not an array")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+  const Napi::Array filters = value.As<Napi::Array>();
+  for (uint32_t i = 0; i < filters.Length(); i++) {
+    if (!filters.Get(i).IsObject()) {
+      Napi::TypeError::New(env, "Filter is not an object")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+    const Napi::Object options = filters.Get(i).As<Napi::Object>();
+    ScanFilterClause clause;
+
+    if (options.Get("name").IsString()) {
+      clause.matchName = true;
+      clause.name = options.Get("name").As<Napi::String>().Utf8Value();
+    }
+    if (options.Get("namePrefix").IsString()) {
+      clause.namePrefix =
+          options.Get("namePrefix").As<Napi::String>().Utf8Value();
+    }
+
+    if (options.Get("services").IsArray()) {
+      const Napi::Array services = options.Get("services").As<Napi::Array>();
+      for (uint32_t j = 0; j < services.Length(); j++) {
+        if (!services.Get(j).IsString()) {
+          Napi::TypeError::New(env, "Service is not a string")
+              .ThrowAsJavaScriptException();
+          return false;
+        }
+        clause.services.push_back(
+            canonicalUuid(services.Get(j).As<Napi::String>().Utf8Value()));
+      }
+    }
+
+    if (options.Get("manufacturerData").IsArray()) {
+      const Napi::Array entries =
+          options.Get("manufacturerData").As<Napi::Array>();
+      for (uint32_t j = 0; j < entries.Length(); j++) {
+        const Napi::Value entry = entries.Get(j);
+        if (!entry.IsObject() ||
+            !entry.As<Napi::Object>().Get("companyIdentifier").IsNumber()) {
+          Napi::TypeError::New(env, "Company identifier is not a number")
+              .ThrowAsJavaScriptException();
+          return false;
+        }
+        DataPrefix prefix;
+        if (!dataPrefixOption(entry.As<Napi::Object>(), prefix)) {
+          return false;
+        }
+        clause.manufacturerData.emplace_back(
+            entry.As<Napi::Object>()
+                .Get("companyIdentifier")
+                .As<Napi::Number>()
+                .Uint32Value(),
+            std::move(prefix));
+      }
+    }
+
+    if (options.Get("serviceData").IsArray()) {
+      const Napi::Array entries = options.Get("serviceData").As<Napi::Array>();
+      for (uint32_t j = 0; j < entries.Length(); j++) {
+        const Napi::Value entry = entries.Get(j);
+        if (!entry.IsObject() ||
+            !entry.As<Napi::Object>().Get("service").IsString()) {
+          Napi::TypeError::New(env, "Service is not a string")
+              .ThrowAsJavaScriptException();
+          return false;
+        }
+        DataPrefix prefix;
+        if (!dataPrefixOption(entry.As<Napi::Object>(), prefix)) {
+          return false;
+        }
+        clause.serviceData.emplace_back(
+            canonicalUuid(entry.As<Napi::Object>()
+                              .Get("service")
+                              .As<Napi::String>()
+                              .Utf8Value()),
+            std::move(prefix));
+      }
+    }
+
+    filter.add(std::move(clause));
+  }
+  return true;
+}
+
+Napi::Value Adapter::ConnectOnMatch(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Missing filters or callback")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Callback is not a function")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  auto match = std::make_shared<MatchConnect>();
+  if (!scanFilterOption(info[0], match->filter)) {
+    return Napi::Boolean::New(env, false);
+  }
+
+  // Matching runs in the scan callbacks, so they are needed even when JS
+  // only listens for the connection.
+  if (!this->native() &&
+      (simpleble_adapter_set_callback_on_scan_found(
+           this->handle, onScanFound, this) != SIMPLEBLE_SUCCESS ||
+       simpleble_adapter_set_callback_on_scan_updated(
+           this->handle, onScanUpdated, this) != SIMPLEBLE_SUCCESS)) {
+    return Napi::Boolean::New(env, false);
+  }
+
+  match->fn = Napi::ThreadSafeFunction::New(
+      env, info[1].As<Napi::Function>(), "connectOnMatchFn", 0, 1);
+  match->fn.Unref(env);
+
+  std::shared_ptr<MatchConnect> previous;
+  {
+    std::lock_guard<std::mutex> lock(this->matchMutex);
+    previous = std::move(this->matchConnect);
+    this->matchConnect = match;
+  }
+  if (previous) {
+    previous->fn.Release();
+  }
+
+  // A simulated scan reports the whole fleet when it starts, so one in
+  // progress has nothing left to deliver.
+  if (this->simulated && this->scanning) {
+    for (const auto &device : this->fleet) {
+      if (this->claimMatch(std::shared_ptr<const Advertisement>(
+                               device, &device->advertisement()),
+                           nullptr, std::shared_ptr<NativeDevice>(device))) {
+        this->stopSimulatedScan();
+        break;
+      }
+    }
+  }
+
+  return Napi::Boolean::New(env, true);
+}
+
+Napi::Value Adapter::CancelConnectOnMatch(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  std::shared_ptr<MatchConnect> match;
+  {
+    std::lock_guard<std::mutex> lock(this->matchMutex);
+    match = std::move(this->matchConnect);
+  }
+  if (!match) {
+    return Napi::Boolean::New(env, false);
+  }
+
+  match->fn.Release();
+  return Napi::Boolean::New(env, true);
+}
+
+bool Adapter::claimMatch(std::shared_ptr<const Advertisement> advertisement,
+                         std::shared_ptr<void> handle,
+                         std::shared_ptr<NativeDevice> device) {
+  std::shared_ptr<MatchConnect> match;
+  {
+    std::lock_guard<std::mutex> lock(this->matchMutex);
+    if (!this->matchConnect || !advertisement->connectable ||
+        !this->matchConnect->filter.matches(*advertisement)) {
+      return false;
+    }
+    match = std::move(this->matchConnect);
+  }
+
+  // Connecting blocks, and SimpleBLE and the HCI controller deliver scan
+  // results on their event threads, so the scan is stopped and the
+  // connection made on the I/O pool. The job holds the adapter handle or
+  // controller in case the wrapper goes away meanwhile, and the scan stop
+  // callback to report stopping the controller's scan. Open scan sessions
+  // keep the scan running.
+  std::shared_ptr<void> adapter = this->owner;
+  std::shared_ptr<HciController> hci = this->hci;
+  std::shared_ptr<ScanMultiplexer> sessions = this->sessions;
+  Napi::ThreadSafeFunction stopFn;
+  if (hci && this->onScanStopFn && this->onScanStopFn.Acquire() == napi_ok) {
+    stopFn = this->onScanStopFn;
+  }
+  ThreadPool::io().submit([match, adapter, hci, sessions, stopFn,
+                           advertisement, handle, device]() mutable {
+    // Replayed advertisements have nothing to connect to.
+    bool connected = false;
+    if (device) {
+#ifdef WEBBLUETOOTH_HCI
+      if (hci && sessions->size() == 0 && hci->scanning() && hci->stopScan() &&
+          stopFn) {
+        stopFn.NonBlockingCall(
+            [](Napi::Env env, Napi::Function jsCallback) {
+              jsCallback.Call({});
+            });
+      }
+#endif
+      connected = device->connect();
+    } else if (handle) {
+      if (sessions->size() == 0) {
+        simpleble_adapter_scan_stop(
+            static_cast<simpleble_adapter_t>(adapter.get()));
+      }
+      auto peripheral = static_cast<simpleble_peripheral_t>(handle.get());
+      GattTrace trace("connect", peripheral);
+      const auto ret = simpleble_peripheral_connect(peripheral);
+      trace.result(ret);
+      connected = ret == SIMPLEBLE_SUCCESS;
+      if (connected) {
+        // Connecting may bond with the device.
+        Peripheral::bondGeneration++;
+      }
+    }
+
+    auto result = new MatchResult{advertisement, handle, device, connected};
+    auto callback = [](Napi::Env env, Napi::Function jsCallback,
+                       MatchResult *result) {
+      Napi::Value peripheralInstance =
+          result->device   ? Peripheral::fromDevice(env, result->device)
+          : result->handle ? Peripheral::fromHandle(env, result->handle)
+                           : Peripheral::fromAdvertisement(
+                                 env, result->advertisement);
+      const bool connected = result->connected;
+      delete result;
+      if (connected) {
+        Peripheral::Unwrap(peripheralInstance.As<Napi::Object>())->activate();
+      }
+      jsCallback.Call(
+          {peripheralInstance, Napi::Boolean::New(env, connected)});
+    };
+    if (match->fn.NonBlockingCall(result, callback) != napi_ok) {
+      delete result;
+    }
+    match->fn.Release();
+    if (stopFn) {
+      stopFn.Release();
+    }
+  });
+  return true;
+}
+
+Napi::Value Adapter::OpenScanSession(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Missing filters or callback")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Callback is not a function")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  ScanFilter filter;
+  if (!scanFilterOption(info[0], filter)) {
+    return env.Undefined();
+  }
+
+  ScanMultiplexer::Options options;
+  if (info.Length() > 2 && !info[2].IsUndefined()) {
+    if (!info[2].IsObject()) {
+      Napi::TypeError::New(env, "Options is not an object")
+          .ThrowAsJavaScriptException();
+      return env.Undefined();
+    }
+    const Napi::Object object = info[2].As<Napi::Object>();
+    options.duplicates = object.Get("duplicates").IsBoolean() &&
+                         object.Get("duplicates").As<Napi::Boolean>().Value();
+    if (object.Get("quietPeriod").IsNumber()) {
+      options.quietPeriod = static_cast<uint64_t>(
+          std::max(object.Get("quietPeriod").As<Napi::Number>().DoubleValue(),
+                   0.0) *
+          1e6);
+    }
+
+    const Napi::Value addresses = object.Get("addresses");
+    if (addresses.IsArray()) {
+      const Napi::Array list = addresses.As<Napi::Array>();
+      for (uint32_t i = 0; i < list.Length(); i++) {
+        if (!list.Get(i).IsString()) {
+          Napi::TypeError::New(env, "Address is not a string")
+              .ThrowAsJavaScriptException();
+          return env.Undefined();
+        }
+        filter.addAddress(list.Get(i).As<Napi::String>().Utf8Value());
+      }
+    } else if (!addresses.IsUndefined()) {
+      Napi::TypeError::New(env, "Addresses is not an array")
+          .ThrowAsJavaScriptException();
+      return env.Undefined();
+    }
+  }
+
+  if (info.Length() > 3 && !info[3].IsUndefined() && !info[3].IsFunction()) {
+    Napi::TypeError::New(env, "Done callback is not a function")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  // Sessions are fed by the scan callbacks, which JS may not have set.
+  if (!this->native() &&
+      (simpleble_adapter_set_callback_on_scan_found(
+           this->handle, onScanFound, this) != SIMPLEBLE_SUCCESS ||
+       simpleble_adapter_set_callback_on_scan_updated(
+           this->handle, onScanUpdated, this) != SIMPLEBLE_SUCCESS)) {
+    return env.Undefined();
+  }
+
+  // The completion callback rides the session's queue, so that it runs after
+  // every device reported before it. The queue owns the reference.
+  Napi::FunctionReference *done = nullptr;
+  if (info.Length() > 3 && info[3].IsFunction()) {
+    done = new Napi::FunctionReference(
+        Napi::Persistent(info[3].As<Napi::Function>()));
+  }
+  Napi::ThreadSafeFunction fn = Napi::ThreadSafeFunction::New(
+      env, info[1].As<Napi::Function>(), "scanSessionFn", 0, 1, done,
+      [](Napi::Env, Napi::FunctionReference *done) { delete done; });
+  fn.Unref(env);
+  if (done != nullptr) {
+    options.done = [fn, done](bool allSeen) mutable {
+      auto callback = [done, allSeen](Napi::Env env, Napi::Function) {
+        done->Call({Napi::Boolean::New(env, allSeen)});
+      };
+      fn.NonBlockingCall(callback);
+    };
+  }
+
+  const bool native = this->native();
+  const uint32_t id = this->sessions->open(
+      std::move(filter), std::move(options),
+      [fn, native](const std::shared_ptr<const Advertisement> &advertisement,
+                   const std::shared_ptr<void> &handle) mutable {
+        auto data = new Sighting{advertisement, handle, native};
+        auto callback = [](Napi::Env env, Napi::Function jsCallback,
+                           Sighting *sighting) {
+          Napi::Value peripheralInstance = fromSighting(env, *sighting);
+          delete sighting;
+          jsCallback.Call({peripheralInstance});
+        };
+        if (fn.NonBlockingCall(data, callback) != napi_ok) {
+          delete data;
+        }
+      });
+  this->sessionFns.emplace(id, fn);
+
+  if (this->simulated) {
+    if (this->scanning) {
+      // The fleet was announced when the scan started, so only the new
+      // session needs it.
+      for (const auto &device : this->fleet) {
+        this->sessions->dispatch(std::shared_ptr<const Advertisement>(
+                                     device, &device->advertisement()),
+                                 std::shared_ptr<NativeDevice>(device), id);
+      }
+    } else {
+      this->sessionScan = true;
+      this->scanning = true;
+      this->scanTable->clear();
+      if (this->onScanStartFn) {
+        onScanStart(nullptr, this);
+      }
+      this->announceFleet();
+    }
+    return Napi::Number::New(env, id);
+  }
+
+#ifdef WEBBLUETOOTH_HCI
+  if (this->hci) {
+    if (!this->hci->scanning()) {
+      if (!this->startControllerScan()) {
+        bool last;
+        this->closeSession(id, last);
+        return env.Undefined();
+      }
+      this->sessionScan = true;
+    }
+    return Napi::Number::New(env, id);
+  }
+#endif
+
+  // Join a scan in progress rather than restarting it.
+  bool active = false;
+  if (simpleble_adapter_scan_is_active(this->handle, &active) !=
+          SIMPLEBLE_SUCCESS ||
+      !active) {
+    this->scanTable->clear();
+    if (simpleble_adapter_scan_start(this->handle) != SIMPLEBLE_SUCCESS) {
+      bool last;
+      this->closeSession(id, last);
+      return env.Undefined();
+    }
+    this->sessionScan = true;
+  }
+
+  return Napi::Number::New(env, id);
+}
+
+Napi::Value Adapter::CloseScanSession(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing session").ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Session is not a number")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  const uint32_t id = info[0].As<Napi::Number>().Uint32Value();
+  std::lock_guard<std::mutex> lock(this->scanMutex);
+  bool last;
+  if (!this->closeSession(id, last)) {
+    return Napi::Boolean::New(env, false);
+  }
+
+  if (last && this->sessionScan) {
+    this->sessionScan = false;
+    if (this->simulated) {
+      this->stopSimulatedScan();
+    } else if (this->hci) {
+      this->stopControllerScan();
+    } else {
+      simpleble_adapter_scan_stop(this->handle);
+    }
+  }
+
+  return Napi::Boolean::New(env, true);
+}
+
+bool Adapter::closeSession(uint32_t id, bool &last) {
+  if (!this->sessions->close(id, last)) {
+    return false;
+  }
+
+  auto it = this->sessionFns.find(id);
+  it->second.Release();
+  this->sessionFns.erase(it);
+  return true;
+}
+
+void Adapter::stopSimulatedScan() {
+  if (!this->scanning || this->sessions->size() > 0) {
+    return;
+  }
+
+  this->scanning = false;
+  if (this->onScanStopFn) {
+    onScanStop(nullptr, this);
+  }
+}
+
+void Adapter::announceFleet() {
+  const uint64_t now = Clock::now();
+  for (const auto &device : this->fleet) {
+    this->scanTable->update(
+        std::shared_ptr<const Advertisement>(device, &device->advertisement()),
+        now);
+  }
+
+  for (const auto &device : this->fleet) {
+    auto advertisement =
+        std::shared_ptr<const Advertisement>(device, &device->advertisement());
+    std::shared_ptr<NativeDevice> native = device;
+    if (this->claimMatch(advertisement, nullptr, native)) {
+      this->stopSimulatedScan();
+      return;
+    }
+    this->sessions->dispatch(advertisement, native);
+    if (!this->onScanFoundFn) {
+      continue;
+    }
+
+    auto data = new Sighting{advertisement, native, true};
+    auto callback = [](Napi::Env env, Napi::Function jsCallback,
+                       Sighting *sighting) {
+      Napi::Value peripheralInstance = fromSighting(env, *sighting);
+      delete sighting;
+      jsCallback.Call({peripheralInstance});
+    };
+    if (this->onScanFoundFn.NonBlockingCall(data, callback) != napi_ok) {
+      delete data;
+    }
+  }
+}
+
+std::shared_ptr<const Advertisement>
+Adapter::recordAdvertisement(simpleble_peripheral_t peripheral, bool updated) {
+  auto advertisement =
+      std::make_shared<Advertisement>(Peripheral::snapshot(peripheral));
+  advertisement->updated = updated;
+  if (this->capturing) {
+    this->capture.write(*advertisement);
+  }
+  this->scanTable->update(advertisement, advertisement->timestamp);
+  return advertisement;
+}
+
+void Adapter::handleSighting(simpleble_peripheral_t peripheral,
+                             bool updated) {
+  // Sessions and the scan callbacks share the handle SimpleBLE allocated
+  // for this sighting.
+  std::shared_ptr<void> handle(peripheral, simpleble_peripheral_release_handle);
+  auto advertisement = this->recordAdvertisement(peripheral, updated);
+  if (this->claimMatch(advertisement, handle, nullptr)) {
+    // Reported to JS by the connectOnMatch() callback instead.
+    return;
+  }
+  this->sessions->dispatch(advertisement, handle);
+
+  Napi::ThreadSafeFunction &fn =
+      updated ? this->onScanUpdatedFn : this->onScanFoundFn;
+  if (!fn) {
+    return;
+  }
+
+  auto data = new std::shared_ptr<void>(std::move(handle));
+  auto callback = [](Napi::Env env, Napi::Function jsCallback,
+                     std::shared_ptr<void> *handle) {
+    Napi::Value peripheralInstance = Peripheral::fromHandle(env, *handle);
+    delete handle;
+    jsCallback.Call({peripheralInstance});
+  };
+  if (fn.NonBlockingCall(data, callback) != napi_ok) {
+    delete data;
+  }
+}
+
+void Adapter::handleDeviceSighting(
+    std::shared_ptr<const Advertisement> advertisement,
+    std::shared_ptr<NativeDevice> device) {
+  if (advertisement->updated) {
+    WB_PROBE(scan_updated, advertisement->address.c_str(),
+             advertisement->identifier.c_str(), advertisement->rssi);
+  } else {
+    WB_PROBE(scan_found, advertisement->address.c_str(),
+             advertisement->identifier.c_str(), advertisement->rssi);
+  }
+  if (this->capturing) {
+    this->capture.write(*advertisement);
+  }
+  this->scanTable->update(advertisement, advertisement->timestamp);
+  if (this->claimMatch(advertisement, nullptr, device)) {
+    return;
+  }
+  this->sessions->dispatch(advertisement, device);
+
+  Napi::ThreadSafeFunction &fn =
+      advertisement->updated ? this->onScanUpdatedFn : this->onScanFoundFn;
+  if (!fn) {
+    return;
+  }
+
+  auto data = new Sighting{std::move(advertisement), std::move(device), true};
+  auto callback = [](Napi::Env env, Napi::Function jsCallback,
+                     Sighting *sighting) {
+    Napi::Value peripheralInstance = fromSighting(env, *sighting);
+    delete sighting;
+    jsCallback.Call({peripheralInstance});
+  };
+  if (fn.NonBlockingCall(data, callback) != napi_ok) {
+    delete data;
+  }
+}
+
+bool Adapter::startControllerScan() {
+#ifdef WEBBLUETOOTH_HCI
+  if (this->hci->scanning()) {
+    return true;
+  }
+  this->scanTable->clear();
+  if (!this->hci->startScan()) {
+    return false;
+  }
+  if (this->onScanStartFn) {
+    onScanStart(nullptr, this);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Adapter::stopControllerScan() {
+#ifdef WEBBLUETOOTH_HCI
+  if (this->hci->scanning() && this->hci->stopScan() && this->onScanStopFn) {
+    onScanStop(nullptr, this);
+  }
+#endif
+}
+
+void Adapter::cancelTimedScan() {
+  // Keep the scan alive until its lock is released.
+  std::shared_ptr<TimedScan> scan = std::move(this->timedScan);
+  if (!scan) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(scan->mutex);
+  Clock::cancel(scan->timer);
+  scan->adapter = nullptr;
+}
+
 void Adapter::onScanStart(simpleble_adapter_t handle, void *userdata) {
   auto adapter = reinterpret_cast<Adapter *>(userdata);
   auto callback = [](Napi::Env env, Napi::Function jsCallback) {
@@ -297,23 +1437,27 @@ void Adapter::onScanStop(simpleble_adapter_t handle, void *userdata) {
 void Adapter::onScanUpdated(simpleble_adapter_t handle,
                             simpleble_peripheral_t peripheral, void *userdata) {
   auto adapter = reinterpret_cast<Adapter *>(userdata);
-  auto callback = [](Napi::Env env, Napi::Function jsCallback,
-                     simpleble_peripheral_t peripheral) {
-    Napi::Value peripheralInstance = Peripheral::constructor.New(
-        {Napi::BigInt::New(env, reinterpret_cast<uint64_t>(peripheral))});
-    jsCallback.Call({peripheralInstance});
-  };
-  adapter->onScanUpdatedFn.NonBlockingCall(peripheral, callback);
+  if (WB_PROBE_ENABLED(scan_updated)) {
+    char *address = simpleble_peripheral_address(peripheral);
+    char *identifier = simpleble_peripheral_identifier(peripheral);
+    WB_PROBE(scan_updated, address, identifier, simpleble_peripheral_rssi(peripheral));
+    simpleble_free(address);
+    simpleble_free(identifier);
+  }
+
+  adapter->handleSighting(peripheral, true);
 }
 
 void Adapter::onScanFound(simpleble_adapter_t handle,
                           simpleble_peripheral_t peripheral, void *userdata) {
   auto adapter = reinterpret_cast<Adapter *>(userdata);
-  auto callback = [](Napi::Env env, Napi::Function jsCallback,
-                     simpleble_peripheral_t peripheral) {
-    Napi::Value peripheralInstance = Peripheral::constructor.New(
-        {Napi::BigInt::New(env, reinterpret_cast<uint64_t>(peripheral))});
-    jsCallback.Call({peripheralInstance});
-  };
-  adapter->onScanFoundFn.NonBlockingCall(peripheral, callback);
+  if (WB_PROBE_ENABLED(scan_found)) {
+    char *address = simpleble_peripheral_address(peripheral);
+    char *identifier = simpleble_peripheral_identifier(peripheral);
+    WB_PROBE(scan_found, address, identifier, simpleble_peripheral_rssi(peripheral));
+    simpleble_free(address);
+    simpleble_free(identifier);
+  }
+
+  adapter->handleSighting(peripheral, false);
 }
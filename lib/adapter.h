@@ -1,7 +1,26 @@
 #pragma once
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <napi.h>
 #include <simpleble_c/adapter.h>
+#include <vector>
+
+#include "advertisement.h"
+#include "capture.h"
+#include "nativedevice.h"
+#include "replay.h"
+#include "scanfilter.h"
+#include "scanmux.h"
+#include "scantable.h"
+#include "virtual.h"
+
+class HciController;
+struct MatchConnect;
+struct PairedCache;
+struct TimedScan;
 
 class Adapter : public Napi::ObjectWrap<Adapter> {
 public:
@@ -11,12 +30,74 @@ public:
 
   static Napi::FunctionReference constructor;
 
+  static Napi::Value
+  fromFleet(Napi::Env env, std::vector<std::shared_ptr<VirtualDevice>> fleet);
+  static Napi::Value fromController(Napi::Env env,
+                                    std::shared_ptr<HciController> controller);
+
 private:
-  simpleble_adapter_t handle;
+  // Handed to the constructor by fromFleet() and fromController().
+  struct Origin {
+    std::vector<std::shared_ptr<VirtualDevice>> fleet;
+    std::shared_ptr<HciController> hci;
+  };
+
+  simpleble_adapter_t handle = nullptr;
+  // Owns handle; the paired cache holds a copy for enumerations in flight.
+  std::shared_ptr<void> owner;
+  std::shared_ptr<PairedCache> paired;
+  // Set for adapters from createVirtualAdapter(), which scan a simulated
+  // fleet instead of the radio.
+  bool simulated = false;
+  bool scanning = false;
+  std::vector<std::shared_ptr<VirtualDevice>> fleet;
+  // Set for adapters from createHciAdapter(), which drive the controller
+  // directly instead of through SimpleBLE.
+  std::shared_ptr<HciController> hci;
   Napi::ThreadSafeFunction onScanStartFn;
   Napi::ThreadSafeFunction onScanStopFn;
   Napi::ThreadSafeFunction onScanUpdatedFn;
   Napi::ThreadSafeFunction onScanFoundFn;
+  std::atomic<bool> capturing{false};
+  CaptureWriter capture;
+  ScanReplay replay;
+  // Shared with in-flight scanTableJson() jobs, which may outlive the adapter.
+  std::shared_ptr<ScanTable> scanTable = std::make_shared<ScanTable>();
+  // Armed connectOnMatch() request; taken by the first matching sighting.
+  std::mutex matchMutex;
+  std::shared_ptr<MatchConnect> matchConnect;
+  // Discovery sessions sharing the scan; the scan callbacks and connect
+  // jobs hold a copy.
+  std::shared_ptr<ScanMultiplexer> sessions =
+      std::make_shared<ScanMultiplexer>();
+  // Scan session callbacks by id, JS thread only.
+  std::map<uint32_t, Napi::ThreadSafeFunction> sessionFns;
+  // Set when a session started the scan, or a direct scan ended while
+  // sessions were open, so that the last session stops it.
+  bool sessionScan = false;
+  // Guards sessionScan and closing sessions against the scanFor() timer on
+  // the HCI controller.
+  std::mutex scanMutex;
+  // Pending end of a scanFor() on the HCI controller.
+  std::shared_ptr<TimedScan> timedScan;
+
+  std::shared_ptr<const Advertisement>
+  recordAdvertisement(simpleble_peripheral_t peripheral, bool updated);
+  bool claimMatch(std::shared_ptr<const Advertisement> advertisement,
+                  std::shared_ptr<void> handle,
+                  std::shared_ptr<NativeDevice> device);
+  void handleSighting(simpleble_peripheral_t peripheral, bool updated);
+  // The device is null for replayed advertisements.
+  void handleDeviceSighting(std::shared_ptr<const Advertisement> advertisement,
+                            std::shared_ptr<NativeDevice> device);
+  // Whether scans are served by this library rather than SimpleBLE.
+  bool native() const { return this->simulated || this->hci; }
+  bool startControllerScan();
+  void stopControllerScan();
+  void cancelTimedScan();
+  void stopSimulatedScan();
+  bool closeSession(uint32_t id, bool &last);
+  void announceFleet();
 
   static void onScanStart(simpleble_adapter_t handle, void *userdata);
   static void onScanStop(simpleble_adapter_t handle, void *userdata);
@@ -31,9 +112,18 @@ private:
   Napi::Value ScanFor(const Napi::CallbackInfo &info);
   Napi::Value GetPeripherals(const Napi::CallbackInfo &info);
   Napi::Value GetPairedPeripherals(const Napi::CallbackInfo &info);
+  Napi::Value GetPairedPeripheralsAsync(const Napi::CallbackInfo &info);
   Napi::Value SetCallbackOnScanStart(const Napi::CallbackInfo &info);
   Napi::Value SetCallbackOnScanStop(const Napi::CallbackInfo &info);
   Napi::Value SetCallbackOnScanUpdated(const Napi::CallbackInfo &info);
   Napi::Value SetCallbackOnScanFound(const Napi::CallbackInfo &info);
   Napi::Value Release(const Napi::CallbackInfo &info);
+  Napi::Value StartCapture(const Napi::CallbackInfo &info);
+  Napi::Value StopCapture(const Napi::CallbackInfo &info);
+  Napi::Value ReplayCapture(const Napi::CallbackInfo &info);
+  Napi::Value ScanTableJson(const Napi::CallbackInfo &info);
+  Napi::Value ConnectOnMatch(const Napi::CallbackInfo &info);
+  Napi::Value CancelConnectOnMatch(const Napi::CallbackInfo &info);
+  Napi::Value OpenScanSession(const Napi::CallbackInfo &info);
+  Napi::Value CloseScanSession(const Napi::CallbackInfo &info);
 };
@@ -0,0 +1,17 @@
+#include "addon.h"
+#include "dispatcher.h"
+
+AddonState::~AddonState() {
+  if (this->dispatcher) {
+    this->dispatcher->close();
+  }
+}
+
+AddonState &AddonState::get(Napi::Env env) {
+  auto *instance = env.GetInstanceData<AddonState>();
+  if (instance == nullptr) {
+    instance = new AddonState();
+    env.SetInstanceData(instance);
+  }
+  return *instance;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <memory>
+#include <napi.h>
+
+class Dispatcher;
+struct StringTableState;
+
+// What the addon keeps for each env, such as a worker thread's, held as the
+// env's instance data and freed by its cleanup. Each module creates its part
+// on first use. JS thread only.
+struct AddonState {
+  std::shared_ptr<StringTableState> strings;
+  // Also held by the threads that post to it, so it is closed rather than
+  // destroyed with the env.
+  std::shared_ptr<Dispatcher> dispatcher;
+
+  ~AddonState();
+
+  static AddonState &get(Napi::Env env);
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <functional>
+#include <napi.h>
+
+#include "threadpool.h"
+
+// Runs blocking work on the native I/O pool and settles a promise with its
+// result on the JS thread. Work must not touch N-API; settle converts the
+// result.
+template <typename Result>
+Napi::Promise runOnPool(
+    Napi::Env env, const char *name, std::function<Result()> work,
+    std::function<Napi::Value(Napi::Env, Result &)> settle) {
+  struct Job {
+    Napi::Promise::Deferred deferred;
+    std::function<Result()> work;
+    std::function<Napi::Value(Napi::Env, Result &)> settle;
+    Result result;
+  };
+
+  auto job = new Job{Napi::Promise::Deferred::New(env), std::move(work),
+                     std::move(settle), Result()};
+  Napi::Promise promise = job->deferred.Promise();
+
+  // The thread-safe function keeps the event loop alive until the promise
+  // is settled.
+  auto fn = Napi::ThreadSafeFunction::New(
+      env, Napi::Function::New(env, [](const Napi::CallbackInfo &) {}), name, 0,
+      1);
+  ThreadPool::io().submit([fn, job]() mutable {
+    job->result = job->work();
+    auto callback = [](Napi::Env env, Napi::Function, Job *job) {
+      if (env != nullptr) {
+        job->deferred.Resolve(job->settle(env, job->result));
+      }
+      delete job;
+    };
+    if (fn.BlockingCall(job, callback) != napi_ok) {
+      delete job;
+    }
+    fn.Release();
+  });
+
+  return promise;
+}
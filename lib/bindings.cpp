@@ -1,9 +1,25 @@
+#include <algorithm>
 #include <cstdio>
 #include <napi.h>
 #include <simpleble_c/simpleble.h>
 
 #include "adapter.h"
+#include "clock.h"
+#include "codec.h"
+#include "dispatcher.h"
+#include "keystore.h"
 #include "peripheral.h"
+#include "quota.h"
+#include "recorder.h"
+#include "ring.h"
+#include "stream.h"
+#include "stringtable.h"
+#include "templates.h"
+#include "virtual.h"
+
+#ifdef WEBBLUETOOTH_HCI
+#include "hci.h"
+#endif
 
 Napi::Value GetAdapters(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
@@ -28,11 +44,329 @@ Napi::Value IsEnabled(const Napi::CallbackInfo &info) {
   return Napi::Boolean::New(env, enabled);
 }
 
+Napi::Value SetFlightRecorderDirectory(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing directory").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsString() && !info[0].IsNull()) {
+    Napi::TypeError::New(env, "Directory is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  FlightRecorder::setDumpDirectory(
+      info[0].IsString() ? info[0].As<Napi::String>().Utf8Value() : "");
+  return env.Undefined();
+}
+
+// Clock times are uint64_t nanoseconds; JS passes milliseconds.
+static constexpr double MAX_NANOSECONDS = 18446744073709551616.0;
+
+Napi::Value SetVirtualClock(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing enabled").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsBoolean()) {
+    Napi::TypeError::New(env, "Enabled is not a boolean")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  double start = 0;
+  if (info.Length() > 1 && info[1].IsNumber()) {
+    start = info[1].As<Napi::Number>().DoubleValue();
+  }
+  // Also rejects NaN, which fails every comparison.
+  if (!(start >= 0 && start * 1e6 < MAX_NANOSECONDS)) {
+    Napi::RangeError::New(env, "Start is out of range")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  Clock::setVirtual(info[0].As<Napi::Boolean>().Value(),
+                    static_cast<uint64_t>(start * 1e6));
+  return env.Undefined();
+}
+
+Napi::Value AdvanceClock(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing duration").ThrowAsJavaScriptException();
+    return env.Null();
+  } else if (!info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Duration is not a number")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  const double ms = info[0].As<Napi::Number>().DoubleValue();
+  if (!(ms >= 0 && ms * 1e6 < MAX_NANOSECONDS)) {
+    Napi::RangeError::New(env, "Duration is out of range")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  const size_t fired = Clock::advance(static_cast<uint64_t>(ms * 1e6));
+  return Napi::Number::New(env, fired);
+}
+
+Napi::Value StepClock(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  return Napi::Boolean::New(env, Clock::step());
+}
+
+Napi::Value GetClockTime(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  return Napi::Number::New(env, Clock::now() / 1e6);
+}
+
+Napi::Value SetEncryptionKey(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing address").ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Address is not a string")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  const std::string address = info[0].As<Napi::String>().Utf8Value();
+  if (info.Length() < 2 || info[1].IsNull() || info[1].IsUndefined()) {
+    return Napi::Boolean::New(env, KeyStore::remove(address));
+  } else if (!info[1].IsTypedArray() ||
+             info[1].As<Napi::Uint8Array>().ByteLength() != 16) {
+    Napi::TypeError::New(env, "Key is not a 16 byte array")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  KeyStore::set(address, info[1].As<Napi::Uint8Array>().Data());
+  return Napi::Boolean::New(env, true);
+}
+
+Napi::Value GetDecryptionStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing address").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Address is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  DecryptionStats stats;
+  if (!KeyStore::stats(info[0].As<Napi::String>().Utf8Value(), stats)) {
+    return env.Undefined();
+  }
+
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("decrypted", static_cast<double>(stats.decrypted));
+  obj.Set("micFailures", static_cast<double>(stats.micFailures));
+  return obj;
+}
+
+Napi::Value GetGattTemplateStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  const GattTemplateStats stats = GattTemplateRegistry::stats();
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("templates", static_cast<double>(stats.templates));
+  obj.Set("hits", static_cast<double>(stats.hits));
+  obj.Set("misses", static_cast<double>(stats.misses));
+  obj.Set("overlays", static_cast<double>(stats.overlays));
+  return obj;
+}
+
+Napi::Value SetStringTableCapacity(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing capacity").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Capacity is not a number")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  StringTable::setCapacity(env, info[0].As<Napi::Number>().Uint32Value());
+  return env.Undefined();
+}
+
+Napi::Value GetStringTableStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  const StringTableStats stats = StringTable::stats(env);
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("size", static_cast<double>(stats.size));
+  obj.Set("capacity", static_cast<double>(stats.capacity));
+  obj.Set("hits", static_cast<double>(stats.hits));
+  obj.Set("misses", static_cast<double>(stats.misses));
+  obj.Set("evictions", static_cast<double>(stats.evictions));
+  return obj;
+}
+
+Napi::Value SetDefaultPeripheralQuota(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing quota").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsObject()) {
+    Napi::TypeError::New(env, "Quota is not an object")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  PeripheralQuota quota = PeripheralQuota::defaults();
+  if (Peripheral::quotaOption(info[0].As<Napi::Object>(), quota)) {
+    PeripheralQuota::setDefaults(quota);
+  }
+  return env.Undefined();
+}
+
+// Reads an optional `{kind, a, b}` latency option. Returns false with a
+// pending exception when it is invalid.
+static bool latencyOption(const Napi::Object &options, const char *name,
+                          LatencyModel &model) {
+  const Napi::Value value = options.Get(name);
+  if (value.IsUndefined()) {
+    return true;
+  } else if (value.IsNumber()) {
+    model = {LatencyModel::Kind::Fixed, value.As<Napi::Number>().DoubleValue(),
+             0};
+    return true;
+  } else if (!value.IsObject()) {
+    Napi::TypeError::New(options.Env(), std::string(name) +
+                                            " is not a number or an object")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+  const Napi::Object obj = value.As<Napi::Object>();
+  const Napi::Value kind = obj.Get("kind");
+  if (!kind.IsString() ||
+      !LatencyModel::parse(kind.As<Napi::String>().Utf8Value(), model.kind)) {
+    Napi::TypeError::New(options.Env(), "Unknown " + std::string(name) +
+                                            " kind")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  model.a = obj.Get("a").IsNumber()
+                ? obj.Get("a").As<Napi::Number>().DoubleValue()
+                : 0;
+  model.b = obj.Get("b").IsNumber()
+                ? obj.Get("b").As<Napi::Number>().DoubleValue()
+                : 0;
+  return true;
+}
+
+Napi::Value CreateVirtualAdapter(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing options").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsObject()) {
+    Napi::TypeError::New(env, "Options is not an object")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  const Napi::Object options = info[0].As<Napi::Object>();
+  if (!options.Get("count").IsNumber()) {
+    Napi::TypeError::New(env, "Count is not a number")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  VirtualDeviceConfig config;
+  if (!latencyOption(options, "connectLatency", config.connectLatency) ||
+      !latencyOption(options, "notifyInterval", config.notifyInterval)) {
+    return env.Undefined();
+  }
+  if (options.Get("payloadSize").IsNumber()) {
+    config.payloadSize =
+        options.Get("payloadSize").As<Napi::Number>().Uint32Value();
+  }
+  if (options.Get("failureRate").IsNumber()) {
+    config.failureRate = std::min(
+        std::max(options.Get("failureRate").As<Napi::Number>().DoubleValue(),
+                 0.0),
+        1.0);
+  }
+  if (options.Get("seed").IsNumber()) {
+    config.seed = options.Get("seed").As<Napi::Number>().Int64Value();
+  }
+
+  const uint32_t count = options.Get("count").As<Napi::Number>().Uint32Value();
+  return Adapter::fromFleet(env, createVirtualFleet(count, config));
+}
+
+#ifdef WEBBLUETOOTH_HCI
+Napi::Value CreateHciAdapter(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing index").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Index is not a number")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  // Blocks while the controller resets, which takes a few milliseconds.
+  auto controller =
+      HciController::open(info[0].As<Napi::Number>().Uint32Value());
+  if (!controller) {
+    return env.Undefined();
+  }
+  return Adapter::fromController(env, std::move(controller));
+}
+#endif
+
 static Napi::Object Init(Napi::Env env, Napi::Object exports) {
+  Dispatcher::Init(env);
   Adapter::Init(env, exports);
   Peripheral::Init(env, exports);
+  NotificationStream::Init(env, exports);
+  GattRing::Init(env, exports);
+  Codec::Init(env, exports);
   exports.Set("getAdapters", Napi::Function::New(env, GetAdapters));
   exports.Set("isEnabled", Napi::Function::New(env, IsEnabled));
+  exports.Set("setFlightRecorderDirectory",
+              Napi::Function::New(env, SetFlightRecorderDirectory));
+  exports.Set("setVirtualClock", Napi::Function::New(env, SetVirtualClock));
+  exports.Set("advanceClock", Napi::Function::New(env, AdvanceClock));
+  exports.Set("stepClock", Napi::Function::New(env, StepClock));
+  exports.Set("getClockTime", Napi::Function::New(env, GetClockTime));
+  exports.Set("setEncryptionKey", Napi::Function::New(env, SetEncryptionKey));
+  exports.Set("getDecryptionStats",
+              Napi::Function::New(env, GetDecryptionStats));
+  exports.Set("getGattTemplateStats",
+              Napi::Function::New(env, GetGattTemplateStats));
+  exports.Set("setStringTableCapacity",
+              Napi::Function::New(env, SetStringTableCapacity));
+  exports.Set("getStringTableStats",
+              Napi::Function::New(env, GetStringTableStats));
+  exports.Set("setDefaultPeripheralQuota",
+              Napi::Function::New(env, SetDefaultPeripheralQuota));
+  exports.Set("createVirtualAdapter",
+              Napi::Function::New(env, CreateVirtualAdapter));
+#ifdef WEBBLUETOOTH_HCI
+  exports.Set("createHciAdapter", Napi::Function::New(env, CreateHciAdapter));
+#endif
 
   return exports;
 }
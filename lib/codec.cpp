@@ -0,0 +1,405 @@
+#include "codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static bool fieldType(const std::string &name, FieldType &type) {
+  static const std::pair<const char *, FieldType> types[] = {
+      {"u8", FieldType::U8},   {"i8", FieldType::I8},
+      {"u16", FieldType::U16}, {"i16", FieldType::I16},
+      {"u24", FieldType::U24}, {"i24", FieldType::I24},
+      {"u32", FieldType::U32}, {"i32", FieldType::I32},
+      {"u64", FieldType::U64}, {"i64", FieldType::I64},
+      {"f32", FieldType::F32}, {"f64", FieldType::F64},
+      {"pad", FieldType::Pad},
+  };
+  for (const auto &[key, value] : types) {
+    if (name == key) {
+      type = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Data of any other element type would be read with the wrong length.
+static bool isBytes(const Napi::Value &value) {
+  if (!value.IsTypedArray()) {
+    return false;
+  }
+  const napi_typedarray_type type =
+      value.As<Napi::TypedArray>().TypedArrayType();
+  return type == napi_uint8_array || type == napi_uint8_clamped_array;
+}
+
+static const char *fieldTypeName(FieldType type) {
+  switch (type) {
+  case FieldType::U8:
+    return "u8";
+  case FieldType::I8:
+    return "i8";
+  case FieldType::U16:
+    return "u16";
+  case FieldType::I16:
+    return "i16";
+  case FieldType::U24:
+    return "u24";
+  case FieldType::I24:
+    return "i24";
+  case FieldType::U32:
+    return "u32";
+  case FieldType::I32:
+    return "i32";
+  case FieldType::U64:
+    return "u64";
+  case FieldType::I64:
+    return "i64";
+  case FieldType::F32:
+    return "f32";
+  case FieldType::F64:
+    return "f64";
+  case FieldType::Pad:
+    break;
+  }
+  return "pad";
+}
+
+// Reads the endian option of a schema or field object: 'little' or 'big'.
+// Returns false with a pending exception when it is invalid.
+static bool endianOption(Napi::Env env, const Napi::Object &object,
+                         bool &bigEndian) {
+  const Napi::Value endian = object.Get("endian");
+  if (endian.IsUndefined()) {
+    return true;
+  }
+
+  const std::string name =
+      endian.IsString() ? endian.As<Napi::String>().Utf8Value() : "";
+  if (name == "little") {
+    bigEndian = false;
+  } else if (name == "big") {
+    bigEndian = true;
+  } else {
+    Napi::TypeError::New(env, "Endian is not 'little' or 'big'")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+static Napi::Value column(Napi::Env env, const std::vector<double> &values,
+                          size_t width, size_t records,
+                          const CodecColumn &layout) {
+  auto array = Napi::TypedArrayOf<T>::New(env, records * layout.count);
+  T *data = array.Data();
+  for (size_t record = 0; record < records; record++) {
+    const double *source = values.data() + record * width + layout.index;
+    for (size_t i = 0; i < layout.count; i++) {
+      *data++ = static_cast<T>(source[i]);
+    }
+  }
+  return array;
+}
+
+// Typed array of the field's own type, or float64 for fields that scale or
+// exceed 32 bits.
+static Napi::Value column(Napi::Env env, const std::vector<double> &values,
+                          size_t width, size_t records,
+                          const CodecColumn &layout) {
+  if (layout.scaled) {
+    return column<double>(env, values, width, records, layout);
+  }
+
+  switch (layout.type) {
+  case FieldType::U8:
+    return column<uint8_t>(env, values, width, records, layout);
+  case FieldType::I8:
+    return column<int8_t>(env, values, width, records, layout);
+  case FieldType::U16:
+    return column<uint16_t>(env, values, width, records, layout);
+  case FieldType::I16:
+    return column<int16_t>(env, values, width, records, layout);
+  case FieldType::U24:
+  case FieldType::U32:
+    return column<uint32_t>(env, values, width, records, layout);
+  case FieldType::I24:
+  case FieldType::I32:
+    return column<int32_t>(env, values, width, records, layout);
+  case FieldType::F32:
+    return column<float>(env, values, width, records, layout);
+  default:
+    return column<double>(env, values, width, records, layout);
+  }
+}
+
+// Reads a value to encode; undefined encodes as zero. Returns false with a
+// pending exception for anything else that is not a number or boolean.
+static bool encodeValue(Napi::Env env, const Napi::Value &value,
+                        double &out) {
+  if (value.IsNumber()) {
+    out = value.As<Napi::Number>().DoubleValue();
+  } else if (value.IsBoolean()) {
+    out = value.As<Napi::Boolean>().Value() ? 1 : 0;
+  } else if (value.IsUndefined()) {
+    out = 0;
+  } else {
+    Napi::TypeError::New(env, "Value is not a number")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  return true;
+}
+
+Napi::FunctionReference Codec::constructor;
+
+Napi::Object Codec::Init(Napi::Env env, Napi::Object exports) {
+  // clang-format off
+  Napi::Function func = DefineClass(env, "Codec", {
+    InstanceAccessor<&Codec::Size>("size"),
+    InstanceAccessor<&Codec::Width>("width"),
+    InstanceAccessor<&Codec::Columns>("columns"),
+    InstanceMethod("decode", &Codec::Decode),
+    InstanceMethod("decodeColumns", &Codec::DecodeColumns),
+    InstanceMethod("encode", &Codec::Encode),
+  });
+  // clang-format on
+
+  constructor = Napi::Persistent(func);
+  constructor.SuppressDestruct();
+
+  exports.Set("Codec", func);
+  return exports;
+}
+
+Codec::Codec(const Napi::CallbackInfo &info) : Napi::ObjectWrap<Codec>(info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing fields").ThrowAsJavaScriptException();
+    return;
+  } else if (!info[0].IsArray()) {
+    Napi::TypeError::New(env, "Fields is not an array")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+
+  bool bigEndian = false;
+  if (info.Length() > 1 && info[1].IsObject() &&
+      !endianOption(env, info[1].As<Napi::Object>(), bigEndian)) {
+    return;
+  }
+
+  const Napi::Array array = info[0].As<Napi::Array>();
+  std::vector<FieldSpec> fields(array.Length());
+  for (uint32_t i = 0; i < array.Length(); i++) {
+    const Napi::Value value = array.Get(i);
+    if (!value.IsObject()) {
+      Napi::TypeError::New(env, "Field is not an object")
+          .ThrowAsJavaScriptException();
+      return;
+    }
+
+    const Napi::Object object = value.As<Napi::Object>();
+    FieldSpec &field = fields[i];
+    const Napi::Value type = object.Get("type");
+    if (!type.IsString() ||
+        !fieldType(type.As<Napi::String>().Utf8Value(), field.type)) {
+      Napi::TypeError::New(env, "Unknown field type")
+          .ThrowAsJavaScriptException();
+      return;
+    }
+
+    field.bigEndian = bigEndian;
+    if (!endianOption(env, object, field.bigEndian)) {
+      return;
+    }
+    if (object.Get("name").IsString()) {
+      field.name = object.Get("name").As<Napi::String>().Utf8Value();
+    }
+    if (object.Get("count").IsNumber()) {
+      field.count = object.Get("count").As<Napi::Number>().Uint32Value();
+    }
+    if (object.Get("bits").IsNumber()) {
+      const uint32_t bits = object.Get("bits").As<Napi::Number>().Uint32Value();
+      field.bits = static_cast<uint8_t>(std::min<uint32_t>(bits, 255));
+    }
+    if (object.Get("scale").IsNumber()) {
+      field.scale = object.Get("scale").As<Napi::Number>().DoubleValue();
+    }
+    if (object.Get("offset").IsNumber()) {
+      field.offset = object.Get("offset").As<Napi::Number>().DoubleValue();
+    }
+  }
+
+  auto codec = std::make_shared<StructCodec>();
+  std::string error;
+  if (!StructCodec::compile(fields, *codec, error)) {
+    Napi::TypeError::New(env, error).ThrowAsJavaScriptException();
+    return;
+  }
+  this->compiled = std::move(codec);
+}
+
+std::shared_ptr<const StructCodec> Codec::codec() const {
+  return this->compiled;
+}
+
+Napi::Value Codec::Size(const Napi::CallbackInfo &info) {
+  return Napi::Number::New(info.Env(),
+                           static_cast<double>(this->compiled->size()));
+}
+
+Napi::Value Codec::Width(const Napi::CallbackInfo &info) {
+  return Napi::Number::New(info.Env(),
+                           static_cast<double>(this->compiled->width()));
+}
+
+Napi::Value Codec::Columns(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  const auto &columns = this->compiled->columns();
+  Napi::Array array = Napi::Array::New(env, columns.size());
+  for (size_t i = 0; i < columns.size(); i++) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("name", columns[i].name);
+    obj.Set("type", fieldTypeName(columns[i].type));
+    obj.Set("index", static_cast<double>(columns[i].index));
+    obj.Set("count", static_cast<double>(columns[i].count));
+    array.Set(static_cast<uint32_t>(i), obj);
+  }
+  return array;
+}
+
+Napi::Value Codec::Decode(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing data").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!isBytes(info[0])) {
+    Napi::TypeError::New(env, "Invalid data").ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  Napi::Uint8Array data = info[0].As<Napi::Uint8Array>();
+  const StructCodec &codec = *this->compiled;
+  if (data.ByteLength() < codec.size()) {
+    return env.Undefined();
+  }
+
+  std::vector<double> values(codec.width());
+  codec.decode(data.Data(), values.data());
+
+  // Scalars as numbers, arrays as typed columns of one record.
+  Napi::Object obj = Napi::Object::New(env);
+  for (const CodecColumn &layout : codec.columns()) {
+    if (layout.count == 1) {
+      obj.Set(layout.name, values[layout.index]);
+    } else {
+      obj.Set(layout.name, column(env, values, codec.width(), 1, layout));
+    }
+  }
+  return obj;
+}
+
+Napi::Value Codec::DecodeColumns(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing data").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!isBytes(info[0])) {
+    Napi::TypeError::New(env, "Invalid data").ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  size_t stride = 0;
+  if (info.Length() > 1 && info[1].IsNumber()) {
+    stride = info[1].As<Napi::Number>().Uint32Value();
+  }
+
+  Napi::Uint8Array data = info[0].As<Napi::Uint8Array>();
+  const StructCodec &codec = *this->compiled;
+  std::vector<double> values;
+  const size_t records =
+      codec.decode(data.Data(), data.ByteLength(), values, stride);
+
+  Napi::Object obj = Napi::Object::New(env);
+  for (const CodecColumn &layout : codec.columns()) {
+    obj.Set(layout.name, column(env, values, codec.width(), records, layout));
+  }
+  return obj;
+}
+
+Napi::Value Codec::Encode(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing values").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsObject()) {
+    Napi::TypeError::New(env, "Values is not an object")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  const StructCodec &codec = *this->compiled;
+  std::vector<double> values(codec.width());
+
+  if (info[0].IsTypedArray() &&
+      info[0].As<Napi::TypedArray>().TypedArrayType() ==
+          napi_float64_array) {
+    // Values in column order, as decoded.
+    Napi::Float64Array array = info[0].As<Napi::Float64Array>();
+    if (array.ElementLength() != values.size()) {
+      Napi::RangeError::New(env, "Values do not match the codec width")
+          .ThrowAsJavaScriptException();
+      return env.Undefined();
+    }
+    std::memcpy(values.data(), array.Data(), values.size() * sizeof(double));
+  } else if (info[0].IsArray()) {
+    Napi::Array array = info[0].As<Napi::Array>();
+    if (array.Length() != values.size()) {
+      Napi::RangeError::New(env, "Values do not match the codec width")
+          .ThrowAsJavaScriptException();
+      return env.Undefined();
+    }
+    for (uint32_t i = 0; i < array.Length(); i++) {
+      if (!encodeValue(env, array.Get(i), values[i])) {
+        return env.Undefined();
+      }
+    }
+  } else {
+    // Fields by name; arrays take an array or typed array each.
+    Napi::Object object = info[0].As<Napi::Object>();
+    for (const CodecColumn &layout : codec.columns()) {
+      const Napi::Value value = object.Get(layout.name);
+      if (layout.count == 1) {
+        if (!encodeValue(env, value, values[layout.index])) {
+          return env.Undefined();
+        }
+        continue;
+      } else if (value.IsUndefined()) {
+        continue;
+      } else if (!value.IsObject()) {
+        Napi::TypeError::New(env, "Array value is not an array")
+            .ThrowAsJavaScriptException();
+        return env.Undefined();
+      }
+
+      Napi::Object elements = value.As<Napi::Object>();
+      for (uint32_t i = 0; i < layout.count; i++) {
+        if (!encodeValue(env, elements.Get(i), values[layout.index + i])) {
+          return env.Undefined();
+        }
+      }
+    }
+  }
+
+  Napi::Uint8Array out = Napi::Uint8Array::New(env, codec.size());
+  codec.encode(values.data(), out.Data());
+  return out;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <napi.h>
+
+#include "structcodec.h"
+
+// A StructCodec compiled from a JS schema. Peripherals accept one as their
+// decode option; on its own it decodes buffers into typed columns and
+// encodes write payloads, each in one call.
+class Codec : public Napi::ObjectWrap<Codec> {
+public:
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+  Codec(const Napi::CallbackInfo &info);
+
+  static Napi::FunctionReference constructor;
+
+  // Null until the constructor has succeeded.
+  std::shared_ptr<const StructCodec> codec() const;
+
+private:
+  std::shared_ptr<const StructCodec> compiled;
+
+  Napi::Value Size(const Napi::CallbackInfo &info);
+  Napi::Value Width(const Napi::CallbackInfo &info);
+  Napi::Value Columns(const Napi::CallbackInfo &info);
+  Napi::Value Decode(const Napi::CallbackInfo &info);
+  Napi::Value DecodeColumns(const Napi::CallbackInfo &info);
+  Napi::Value Encode(const Napi::CallbackInfo &info);
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Everything a scan callback reports about a peripheral, detached from the
+// SimpleBLE handle so that it can be captured, replayed and compared.
+struct Advertisement {
+  // Clock::now() when the advertisement was seen.
+  uint64_t timestamp = 0;
+  // False for the first sighting (scan found), true for later ones.
+  bool updated = false;
+  std::string identifier;
+  std::string address;
+  uint8_t addressType = 2;
+  int16_t rssi = 0;
+  int16_t txPower = 0;
+  bool connectable = false;
+  std::vector<std::pair<uint16_t, std::vector<uint8_t>>> manufacturerData;
+  // Every advertised service UUID, with empty data when it carries none.
+  std::vector<std::pair<std::string, std::vector<uint8_t>>> serviceData;
+};
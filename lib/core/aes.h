@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// AES-128 block encryption, using AES-NI when the CPU has it and a portable
+// implementation otherwise. Only the forward cipher is needed for CCM.
+class Aes128 {
+public:
+  explicit Aes128(const uint8_t key[16]);
+
+  void encryptBlock(const uint8_t in[16], uint8_t out[16]) const;
+
+  static bool hardwareAccelerated();
+
+private:
+  alignas(16) uint8_t roundKeys[176];
+};
+
+// Verifies and decrypts AES-CCM (RFC 3610) with a 13-byte nonce and a
+// micLength-byte tag. Returns false, leaving plaintext unspecified, when the
+// tag does not match.
+bool aesCcmDecrypt(const Aes128 &aes, const uint8_t nonce[13],
+                   const uint8_t *aad, size_t aadLength,
+                   const uint8_t *ciphertext, size_t length,
+                   const uint8_t *mic, size_t micLength, uint8_t *plaintext);
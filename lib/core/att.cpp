@@ -0,0 +1,426 @@
+#include "att.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// Opcodes, Core Specification Vol 3 Part F 3.4.
+static constexpr uint8_t ATT_ERROR_RSP = 0x01;
+static constexpr uint8_t ATT_EXCHANGE_MTU_REQ = 0x02;
+static constexpr uint8_t ATT_EXCHANGE_MTU_RSP = 0x03;
+static constexpr uint8_t ATT_FIND_INFORMATION_REQ = 0x04;
+static constexpr uint8_t ATT_FIND_BY_TYPE_VALUE_REQ = 0x06;
+static constexpr uint8_t ATT_READ_BY_TYPE_REQ = 0x08;
+static constexpr uint8_t ATT_READ_REQ = 0x0a;
+static constexpr uint8_t ATT_READ_BLOB_REQ = 0x0c;
+static constexpr uint8_t ATT_READ_MULTIPLE_REQ = 0x0e;
+static constexpr uint8_t ATT_READ_BY_GROUP_TYPE_REQ = 0x10;
+static constexpr uint8_t ATT_WRITE_REQ = 0x12;
+static constexpr uint8_t ATT_PREPARE_WRITE_REQ = 0x16;
+static constexpr uint8_t ATT_EXECUTE_WRITE_REQ = 0x18;
+static constexpr uint8_t ATT_HANDLE_VALUE_NTF = 0x1b;
+static constexpr uint8_t ATT_HANDLE_VALUE_IND = 0x1d;
+static constexpr uint8_t ATT_HANDLE_VALUE_CFM = 0x1e;
+static constexpr uint8_t ATT_READ_MULTIPLE_VARIABLE_REQ = 0x20;
+static constexpr uint8_t ATT_WRITE_CMD = 0x52;
+
+static constexpr uint8_t ATT_INVALID_HANDLE = 0x01;
+static constexpr uint8_t ATT_REQUEST_NOT_SUPPORTED = 0x06;
+static constexpr uint8_t ATT_INVALID_OFFSET = 0x07;
+static constexpr uint8_t ATT_ATTRIBUTE_NOT_FOUND = 0x0a;
+static constexpr uint8_t ATT_ATTRIBUTE_NOT_LONG = 0x0b;
+
+static constexpr uint16_t GATT_PRIMARY_SERVICE = 0x2800;
+static constexpr uint16_t GATT_CHARACTERISTIC = 0x2803;
+static constexpr uint16_t GATT_CLIENT_CONFIGURATION = 0x2902;
+
+static constexpr uint8_t PROPERTY_READ = 0x02;
+static constexpr uint8_t PROPERTY_WRITE_WITHOUT_RESPONSE = 0x04;
+static constexpr uint8_t PROPERTY_WRITE = 0x08;
+static constexpr uint8_t PROPERTY_NOTIFY = 0x10;
+static constexpr uint8_t PROPERTY_INDICATE = 0x20;
+
+static uint16_t get16(const uint8_t *data) {
+  return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+static void put16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(static_cast<uint8_t>(value));
+  out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+std::string attUuid(const uint8_t *data, size_t length) {
+  char text[37];
+  if (length == 2 || length == 4) {
+    uint32_t alias = get16(data);
+    if (length == 4) {
+      alias |= static_cast<uint32_t>(get16(data + 2)) << 16;
+    }
+    snprintf(text, sizeof(text), "%08x-0000-1000-8000-00805f9b34fb", alias);
+    return text;
+  } else if (length != 16) {
+    return std::string();
+  }
+
+  size_t pos = 0;
+  for (size_t i = 0; i < 16; i++) {
+    if (i == 4 || i == 6 || i == 8 || i == 10) {
+      text[pos++] = '-';
+    }
+    snprintf(text + pos, 3, "%02x", data[15 - i]);
+    pos += 2;
+  }
+  return std::string(text, pos);
+}
+
+AttClient::AttClient(Send send, uint16_t preferredMtu,
+                     std::chrono::milliseconds timeout)
+    : send(std::move(send)),
+      preferredMtu(std::max(preferredMtu, DEFAULT_MTU)), timeout(timeout) {}
+
+void AttClient::setNotifyCallback(NotifyCallback callback) {
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  this->notify = std::move(callback);
+}
+
+uint16_t AttClient::mtu() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->currentMtu;
+}
+
+void AttClient::close() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->closed = true;
+  this->answered.notify_all();
+}
+
+void AttClient::receive(const uint8_t *pdu, size_t length) {
+  if (length == 0) {
+    return;
+  }
+
+  const uint8_t opcode = pdu[0];
+  if (opcode == ATT_HANDLE_VALUE_NTF || opcode == ATT_HANDLE_VALUE_IND) {
+    if (length < 3) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(this->callbackMutex);
+      if (this->notify) {
+        this->notify(get16(pdu + 1), pdu + 3, length - 3);
+      }
+    }
+    if (opcode == ATT_HANDLE_VALUE_IND) {
+      this->send({ATT_HANDLE_VALUE_CFM});
+    }
+    return;
+  }
+
+  if (opcode == ATT_EXCHANGE_MTU_REQ) {
+    if (length < 3) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->currentMtu = std::max(
+          DEFAULT_MTU, std::min(get16(pdu + 1), this->preferredMtu));
+    }
+    std::vector<uint8_t> rsp = {ATT_EXCHANGE_MTU_RSP};
+    put16(rsp, this->preferredMtu);
+    this->send(std::move(rsp));
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const bool isResponse =
+        this->pending != 0 &&
+        (opcode == this->pending + 1 ||
+         (opcode == ATT_ERROR_RSP && length >= 5 && pdu[1] == this->pending));
+    if (isResponse) {
+      this->response.assign(pdu, pdu + length);
+      this->hasResponse = true;
+      this->pending = 0;
+      this->answered.notify_all();
+      return;
+    }
+  }
+
+  // We host no attributes, so discovery finds nothing and everything else
+  // is refused. Commands and stray responses need no answer.
+  uint8_t error;
+  uint16_t handle = length >= 3 ? get16(pdu + 1) : 0;
+  switch (opcode) {
+  case ATT_FIND_INFORMATION_REQ:
+  case ATT_FIND_BY_TYPE_VALUE_REQ:
+  case ATT_READ_BY_TYPE_REQ:
+  case ATT_READ_BY_GROUP_TYPE_REQ:
+    error = ATT_ATTRIBUTE_NOT_FOUND;
+    break;
+  case ATT_READ_REQ:
+  case ATT_READ_BLOB_REQ:
+  case ATT_WRITE_REQ:
+  case ATT_PREPARE_WRITE_REQ:
+    error = ATT_INVALID_HANDLE;
+    break;
+  case ATT_READ_MULTIPLE_REQ:
+  case ATT_EXECUTE_WRITE_REQ:
+  case ATT_READ_MULTIPLE_VARIABLE_REQ:
+    error = ATT_REQUEST_NOT_SUPPORTED;
+    handle = 0;
+    break;
+  default:
+    return;
+  }
+  std::vector<uint8_t> rsp = {ATT_ERROR_RSP, opcode};
+  put16(rsp, handle);
+  rsp.push_back(error);
+  this->send(std::move(rsp));
+}
+
+bool AttClient::request(std::vector<uint8_t> pdu,
+                        std::vector<uint8_t> &response, uint8_t &error) {
+  std::lock_guard<std::mutex> transaction(this->requestMutex);
+  error = 0;
+  const uint8_t opcode = pdu[0];
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->closed) {
+      return false;
+    }
+    this->pending = opcode;
+    this->hasResponse = false;
+  }
+
+  if (!this->send(std::move(pdu))) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->pending = 0;
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+  if (!this->answered.wait_for(lock, this->timeout, [this]() {
+        return this->hasResponse || this->closed;
+      })) {
+    // A transaction that timed out leaves the bearer unusable.
+    this->closed = true;
+  }
+  this->pending = 0;
+  if (!this->hasResponse) {
+    return false;
+  }
+
+  response = std::move(this->response);
+  this->hasResponse = false;
+  if (response[0] == ATT_ERROR_RSP) {
+    error = response[4];
+    return false;
+  }
+  return true;
+}
+
+bool AttClient::exchangeMtu() {
+  std::vector<uint8_t> pdu = {ATT_EXCHANGE_MTU_REQ};
+  put16(pdu, this->preferredMtu);
+  std::vector<uint8_t> rsp;
+  uint8_t error;
+  if (!this->request(std::move(pdu), rsp, error) || rsp.size() < 3) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->currentMtu =
+      std::max(DEFAULT_MTU, std::min(get16(rsp.data() + 1), this->preferredMtu));
+  return true;
+}
+
+bool AttClient::read(uint16_t handle, std::vector<uint8_t> &out) {
+  std::vector<uint8_t> pdu = {ATT_READ_REQ};
+  put16(pdu, handle);
+  std::vector<uint8_t> rsp;
+  uint8_t error;
+  if (!this->request(std::move(pdu), rsp, error)) {
+    return false;
+  }
+  out.assign(rsp.begin() + 1, rsp.end());
+
+  // A full response may have been truncated to the MTU.
+  while (rsp.size() == this->mtu()) {
+    pdu = {ATT_READ_BLOB_REQ};
+    put16(pdu, handle);
+    put16(pdu, static_cast<uint16_t>(out.size()));
+    if (!this->request(std::move(pdu), rsp, error)) {
+      return error == ATT_ATTRIBUTE_NOT_LONG || error == ATT_INVALID_OFFSET;
+    }
+    out.insert(out.end(), rsp.begin() + 1, rsp.end());
+  }
+  return true;
+}
+
+bool AttClient::write(uint16_t handle, const uint8_t *data, size_t length,
+                      bool response) {
+  if (length + 3 > this->mtu()) {
+    return false;
+  }
+
+  std::vector<uint8_t> pdu = {response ? ATT_WRITE_REQ : ATT_WRITE_CMD};
+  put16(pdu, handle);
+  pdu.insert(pdu.end(), data, data + length);
+  if (!response) {
+    return this->send(std::move(pdu));
+  }
+
+  std::vector<uint8_t> rsp;
+  uint8_t error;
+  return this->request(std::move(pdu), rsp, error);
+}
+
+bool AttClient::discover(GattDatabase &database,
+                         std::vector<AttCharacteristic> &characteristics) {
+  database.clear();
+  characteristics.clear();
+  std::vector<std::pair<uint16_t, uint16_t>> ranges;
+  std::vector<uint8_t> rsp;
+  uint8_t error;
+
+  uint32_t start = 0x0001;
+  while (start <= 0xffff) {
+    std::vector<uint8_t> pdu = {ATT_READ_BY_GROUP_TYPE_REQ};
+    put16(pdu, static_cast<uint16_t>(start));
+    put16(pdu, 0xffff);
+    put16(pdu, GATT_PRIMARY_SERVICE);
+    if (!this->request(std::move(pdu), rsp, error)) {
+      if (error == ATT_ATTRIBUTE_NOT_FOUND) {
+        break;
+      }
+      return false;
+    }
+
+    const size_t size = rsp.size() >= 2 ? rsp[1] : 0;
+    if (size != 6 && size != 20) {
+      return false;
+    }
+    // A response without entries ends discovery rather than repeating the
+    // same request forever.
+    if (rsp.size() < 2 + size) {
+      break;
+    }
+    for (size_t offset = 2; offset + size <= rsp.size(); offset += size) {
+      const uint16_t first = get16(&rsp[offset]);
+      const uint16_t last = get16(&rsp[offset + 2]);
+      if (first < start || last < first) {
+        return false;
+      }
+      GattService service;
+      service.uuid = attUuid(&rsp[offset + 4], size - 4);
+      database.push_back(std::move(service));
+      ranges.emplace_back(first, last);
+      start = static_cast<uint32_t>(last) + 1;
+    }
+  }
+
+  for (size_t i = 0; i < database.size(); i++) {
+    GattService &service = database[i];
+    const auto [first, last] = ranges[i];
+    // Declaration handles, to bound each characteristic's descriptors.
+    std::vector<uint16_t> declarations;
+    const size_t firstCharacteristic = characteristics.size();
+
+    start = first;
+    while (start <= last) {
+      std::vector<uint8_t> pdu = {ATT_READ_BY_TYPE_REQ};
+      put16(pdu, static_cast<uint16_t>(start));
+      put16(pdu, last);
+      put16(pdu, GATT_CHARACTERISTIC);
+      if (!this->request(std::move(pdu), rsp, error)) {
+        if (error == ATT_ATTRIBUTE_NOT_FOUND) {
+          break;
+        }
+        return false;
+      }
+
+      const size_t size = rsp.size() >= 2 ? rsp[1] : 0;
+      if (size != 7 && size != 21) {
+        return false;
+      }
+      if (rsp.size() < 2 + size) {
+        break;
+      }
+      for (size_t offset = 2; offset + size <= rsp.size(); offset += size) {
+        const uint16_t declaration = get16(&rsp[offset]);
+        if (declaration < start) {
+          return false;
+        }
+        AttCharacteristic handles;
+        handles.service = service.uuid;
+        handles.properties = rsp[offset + 2];
+        handles.value = get16(&rsp[offset + 3]);
+        handles.uuid = attUuid(&rsp[offset + 5], size - 5);
+
+        GattCharacteristic characteristic;
+        characteristic.uuid = handles.uuid;
+        characteristic.canRead = handles.properties & PROPERTY_READ;
+        characteristic.canWriteRequest = handles.properties & PROPERTY_WRITE;
+        characteristic.canWriteCommand =
+            handles.properties & PROPERTY_WRITE_WITHOUT_RESPONSE;
+        characteristic.canNotify = handles.properties & PROPERTY_NOTIFY;
+        characteristic.canIndicate = handles.properties & PROPERTY_INDICATE;
+        service.characteristics.push_back(std::move(characteristic));
+        characteristics.push_back(std::move(handles));
+        declarations.push_back(declaration);
+        start = static_cast<uint32_t>(declaration) + 1;
+      }
+    }
+
+    for (size_t j = 0; j < declarations.size(); j++) {
+      AttCharacteristic &handles = characteristics[firstCharacteristic + j];
+      const uint16_t end = j + 1 < declarations.size()
+                               ? declarations[j + 1] - 1
+                               : last;
+      if (handles.value < end &&
+          !this->discoverDescriptors(handles.value + 1, end,
+                                     service.characteristics[j], handles)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool AttClient::discoverDescriptors(uint16_t first, uint16_t last,
+                                    GattCharacteristic &characteristic,
+                                    AttCharacteristic &handles) {
+  std::vector<uint8_t> rsp;
+  uint8_t error;
+  uint32_t start = first;
+  while (start <= last) {
+    std::vector<uint8_t> pdu = {ATT_FIND_INFORMATION_REQ};
+    put16(pdu, static_cast<uint16_t>(start));
+    put16(pdu, last);
+    if (!this->request(std::move(pdu), rsp, error)) {
+      return error == ATT_ATTRIBUTE_NOT_FOUND;
+    }
+
+    const size_t size =
+        rsp.size() < 2 ? 0 : rsp[1] == 1 ? 4 : rsp[1] == 2 ? 18 : 0;
+    if (size == 0) {
+      return false;
+    } else if (rsp.size() < 2 + size) {
+      break;
+    }
+    for (size_t offset = 2; offset + size <= rsp.size(); offset += size) {
+      const uint16_t handle = get16(&rsp[offset]);
+      if (handle < start) {
+        return false;
+      }
+      if (size == 4 && get16(&rsp[offset + 2]) == GATT_CLIENT_CONFIGURATION) {
+        handles.cccd = handle;
+      }
+      characteristic.descriptors.push_back(
+          attUuid(&rsp[offset + 2], size - 2));
+      handles.descriptors.emplace_back(characteristic.descriptors.back(),
+                                       handle);
+      start = static_cast<uint32_t>(handle) + 1;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gatt.h"
+
+// Formats a little-endian 16, 32 or 128-bit UUID as it appears on the air,
+// lowercase and fully expanded. Returns an empty string for other lengths.
+std::string attUuid(const uint8_t *data, size_t length);
+
+// Attribute handles of one discovered characteristic.
+struct AttCharacteristic {
+  std::string service;
+  std::string uuid;
+  uint8_t properties = 0;
+  uint16_t value = 0;
+  // Client Characteristic Configuration descriptor, or 0 when absent.
+  uint16_t cccd = 0;
+  // Every descriptor's UUID and handle, in handle order.
+  std::vector<std::pair<std::string, uint16_t>> descriptors;
+};
+
+// GATT client over an ATT bearer that it does not own: PDUs go out through
+// send() and come back through receive(), on another thread. Requests block
+// until answered. ATT allows one transaction at a time, so concurrent
+// callers queue.
+class AttClient {
+public:
+  using Send = std::function<bool(std::vector<uint8_t> pdu)>;
+  using NotifyCallback =
+      std::function<void(uint16_t handle, const uint8_t *data, size_t length)>;
+
+  static constexpr uint16_t DEFAULT_MTU = 23;
+
+  explicit AttClient(Send send, uint16_t preferredMtu = 517,
+                     std::chrono::milliseconds timeout =
+                         std::chrono::milliseconds(30000));
+
+  // Receives notifications and indications, which are confirmed after it
+  // returns. Called from receive().
+  void setNotifyCallback(NotifyCallback callback);
+  uint16_t mtu();
+  // Fails the transaction in progress and every later one, for a lost link.
+  void close();
+  // Handles one PDU from the peer. Requests the peer makes of our (empty)
+  // server are answered with errors, except MTU exchange.
+  void receive(const uint8_t *pdu, size_t length);
+
+  bool exchangeMtu();
+  // Reads values longer than the MTU allows with Read Blob.
+  bool read(uint16_t handle, std::vector<uint8_t> &out);
+  // Values must fit in one PDU; prepared writes are not supported.
+  bool write(uint16_t handle, const uint8_t *data, size_t length,
+             bool response);
+  // Walks primary services, characteristics and their descriptors.
+  bool discover(GattDatabase &database,
+                std::vector<AttCharacteristic> &characteristics);
+
+private:
+  // Returns false for transport failures, with error 0, and for Error
+  // Responses, with their code.
+  bool request(std::vector<uint8_t> pdu, std::vector<uint8_t> &response,
+               uint8_t &error);
+  bool discoverDescriptors(uint16_t start, uint16_t end,
+                           GattCharacteristic &characteristic,
+                           AttCharacteristic &handles);
+
+  Send send;
+  const uint16_t preferredMtu;
+  const std::chrono::milliseconds timeout;
+
+  // Serializes transactions.
+  std::mutex requestMutex;
+  std::mutex mutex;
+  std::condition_variable answered;
+  uint16_t currentMtu = DEFAULT_MTU;
+  bool closed = false;
+  // Opcode of the request awaiting a response, or 0.
+  uint8_t pending = 0;
+  bool hasResponse = false;
+  std::vector<uint8_t> response;
+
+  std::mutex callbackMutex;
+  NotifyCallback notify;
+};
@@ -0,0 +1,275 @@
+#include "capture.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+static const char CAPTURE_MAGIC[4] = {'W', 'B', 'S', 'C'};
+static constexpr uint16_t CAPTURE_VERSION = 1;
+static constexpr uint8_t FLAG_UPDATED = 0x01;
+static constexpr uint8_t FLAG_CONNECTABLE = 0x02;
+
+static void putInteger(std::vector<uint8_t> &out, uint64_t value,
+                       size_t width) {
+  for (size_t i = 0; i < width; i++) {
+    out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+static void putString(std::vector<uint8_t> &out, const std::string &value) {
+  const size_t length = std::min<size_t>(value.size(), UINT8_MAX);
+  out.push_back(static_cast<uint8_t>(length));
+  out.insert(out.end(), value.begin(), value.begin() + length);
+}
+
+static void putBytes(std::vector<uint8_t> &out,
+                     const std::vector<uint8_t> &value) {
+  const size_t length = std::min<size_t>(value.size(), UINT8_MAX);
+  out.push_back(static_cast<uint8_t>(length));
+  out.insert(out.end(), value.begin(), value.begin() + length);
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+static void putUuid(std::vector<uint8_t> &out, const std::string &uuid) {
+  uint8_t bytes[16] = {0};
+  size_t n = 0;
+  for (size_t i = 0; i + 1 < uuid.size() && n < 16; i++) {
+    if (uuid[i] == '-') {
+      continue;
+    }
+    const int high = hexValue(uuid[i]);
+    const int low = hexValue(uuid[i + 1]);
+    if (high < 0 || low < 0) {
+      break;
+    }
+    bytes[n++] = static_cast<uint8_t>(high << 4 | low);
+    i++;
+  }
+  out.insert(out.end(), bytes, bytes + 16);
+}
+
+static std::string uuidFromBytes(const uint8_t *bytes) {
+  static const char HEX[] = "0123456789abcdef";
+  std::string uuid;
+  uuid.reserve(36);
+  for (size_t i = 0; i < 16; i++) {
+    if (i == 4 || i == 6 || i == 8 || i == 10) {
+      uuid.push_back('-');
+    }
+    uuid.push_back(HEX[bytes[i] >> 4]);
+    uuid.push_back(HEX[bytes[i] & 0x0f]);
+  }
+  return uuid;
+}
+
+// Bounds-checked cursor over one record.
+class RecordParser {
+public:
+  RecordParser(const uint8_t *data, size_t length)
+      : data(data), length(length) {}
+
+  bool integer(uint64_t &value, size_t width) {
+    if (this->position + width > this->length) {
+      return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < width; i++) {
+      value |= static_cast<uint64_t>(this->data[this->position++]) << (8 * i);
+    }
+    return true;
+  }
+
+  bool bytes(const uint8_t *&value, size_t count) {
+    if (this->position + count > this->length) {
+      return false;
+    }
+    value = this->data + this->position;
+    this->position += count;
+    return true;
+  }
+
+  bool string(std::string &value) {
+    uint64_t count;
+    const uint8_t *start;
+    if (!this->integer(count, 1) || !this->bytes(start, count)) {
+      return false;
+    }
+    value.assign(reinterpret_cast<const char *>(start), count);
+    return true;
+  }
+
+  bool vector(std::vector<uint8_t> &value) {
+    uint64_t count;
+    const uint8_t *start;
+    if (!this->integer(count, 1) || !this->bytes(start, count)) {
+      return false;
+    }
+    value.assign(start, start + count);
+    return true;
+  }
+
+private:
+  const uint8_t *data;
+  size_t length;
+  size_t position = 0;
+};
+
+CaptureWriter::~CaptureWriter() { this->close(); }
+
+bool CaptureWriter::open(const std::string &path) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->file != nullptr) {
+    return false;
+  }
+
+  this->file = std::fopen(path.c_str(), "wb");
+  if (this->file == nullptr) {
+    return false;
+  }
+
+  std::vector<uint8_t> header(CAPTURE_MAGIC, CAPTURE_MAGIC + 4);
+  putInteger(header, CAPTURE_VERSION, 2);
+  putInteger(header, 0, 2);
+  this->count = 0;
+  return std::fwrite(header.data(), header.size(), 1, this->file) == 1;
+}
+
+bool CaptureWriter::write(const Advertisement &advertisement) {
+  std::vector<uint8_t> record;
+  record.reserve(128);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->file == nullptr) {
+    return false;
+  }
+  if (this->count == 0) {
+    this->start = advertisement.timestamp;
+  }
+
+  putInteger(record, 0, 4);
+  putInteger(record,
+             advertisement.timestamp > this->start
+                 ? advertisement.timestamp - this->start
+                 : 0,
+             8);
+  record.push_back((advertisement.updated ? FLAG_UPDATED : 0) |
+                   (advertisement.connectable ? FLAG_CONNECTABLE : 0));
+  record.push_back(advertisement.addressType);
+  putInteger(record, static_cast<uint16_t>(advertisement.rssi), 2);
+  putInteger(record, static_cast<uint16_t>(advertisement.txPower), 2);
+  putString(record, advertisement.identifier);
+  putString(record, advertisement.address);
+
+  const size_t companies =
+      std::min<size_t>(advertisement.manufacturerData.size(), UINT8_MAX);
+  record.push_back(static_cast<uint8_t>(companies));
+  for (size_t i = 0; i < companies; i++) {
+    putInteger(record, advertisement.manufacturerData[i].first, 2);
+    putBytes(record, advertisement.manufacturerData[i].second);
+  }
+
+  const size_t services =
+      std::min<size_t>(advertisement.serviceData.size(), UINT8_MAX);
+  record.push_back(static_cast<uint8_t>(services));
+  for (size_t i = 0; i < services; i++) {
+    putUuid(record, advertisement.serviceData[i].first);
+    putBytes(record, advertisement.serviceData[i].second);
+  }
+
+  const uint32_t length = static_cast<uint32_t>(record.size() - 4);
+  for (size_t i = 0; i < 4; i++) {
+    record[i] = static_cast<uint8_t>(length >> (8 * i));
+  }
+
+  this->count++;
+  return std::fwrite(record.data(), record.size(), 1, this->file) == 1;
+}
+
+size_t CaptureWriter::close() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->file != nullptr) {
+    std::fclose(this->file);
+    this->file = nullptr;
+  }
+  return this->count;
+}
+
+bool CaptureReader::read(const std::string &path,
+                         std::vector<Advertisement> &out) {
+  FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  uint8_t header[8];
+  if (std::fread(header, sizeof(header), 1, file) != 1 ||
+      std::memcmp(header, CAPTURE_MAGIC, 4) != 0 ||
+      (header[4] | header[5] << 8) != CAPTURE_VERSION) {
+    std::fclose(file);
+    return false;
+  }
+
+  std::vector<uint8_t> record;
+  uint8_t prefix[4];
+  while (std::fread(prefix, sizeof(prefix), 1, file) == 1) {
+    const uint32_t length =
+        prefix[0] | prefix[1] << 8 | prefix[2] << 16 | prefix[3] << 24;
+    record.resize(length);
+    if (length > 0 && std::fread(record.data(), length, 1, file) != 1) {
+      break;
+    }
+
+    RecordParser parser(record.data(), record.size());
+    Advertisement advertisement;
+    uint64_t flags, addressType, rssi, txPower, count;
+    if (!parser.integer(advertisement.timestamp, 8) ||
+        !parser.integer(flags, 1) || !parser.integer(addressType, 1) ||
+        !parser.integer(rssi, 2) || !parser.integer(txPower, 2) ||
+        !parser.string(advertisement.identifier) ||
+        !parser.string(advertisement.address) || !parser.integer(count, 1)) {
+      break;
+    }
+    advertisement.updated = flags & FLAG_UPDATED;
+    advertisement.connectable = flags & FLAG_CONNECTABLE;
+    advertisement.addressType = static_cast<uint8_t>(addressType);
+    advertisement.rssi = static_cast<int16_t>(rssi);
+    advertisement.txPower = static_cast<int16_t>(txPower);
+
+    bool ok = true;
+    for (uint64_t i = 0; ok && i < count; i++) {
+      uint64_t company = 0;
+      std::vector<uint8_t> data;
+      ok = parser.integer(company, 2) && parser.vector(data);
+      if (ok) {
+        advertisement.manufacturerData.emplace_back(
+            static_cast<uint16_t>(company), std::move(data));
+      }
+    }
+
+    ok = ok && parser.integer(count, 1);
+    for (uint64_t i = 0; ok && i < count; i++) {
+      const uint8_t *uuid;
+      std::vector<uint8_t> data;
+      ok = parser.bytes(uuid, 16) && parser.vector(data);
+      if (ok) {
+        advertisement.serviceData.emplace_back(uuidFromBytes(uuid),
+                                               std::move(data));
+      }
+    }
+    if (!ok) {
+      break;
+    }
+
+    out.push_back(std::move(advertisement));
+  }
+
+  std::fclose(file);
+  return true;
+}
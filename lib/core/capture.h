@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "advertisement.h"
+
+// Compact capture of scan traffic. The file starts with "WBSC", a u16
+// version and u16 reserved word, followed by length-prefixed records:
+//   u32 length, u64 nanoseconds since the first record, u8 flags
+//   (bit 0 updated, bit 1 connectable), u8 address type, i16 rssi,
+//   i16 tx power, u8 + identifier, u8 + address,
+//   u8 count of (u16 company, u8 length, data),
+//   u8 count of (16-byte uuid, u8 length, data)
+// Integers are little-endian; UUIDs are stored as their 16 bytes.
+class CaptureWriter {
+public:
+  ~CaptureWriter();
+
+  bool open(const std::string &path);
+  bool write(const Advertisement &advertisement);
+  // Returns the number of records written.
+  size_t close();
+
+private:
+  std::mutex mutex;
+  FILE *file = nullptr;
+  uint64_t start = 0;
+  size_t count = 0;
+};
+
+class CaptureReader {
+public:
+  // Reads every record; stops at the first truncated or malformed one.
+  static bool read(const std::string &path, std::vector<Advertisement> &out);
+};
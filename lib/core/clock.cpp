@@ -0,0 +1,185 @@
+#include "clock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+static uint64_t steadyNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+namespace {
+
+class TimerQueue {
+public:
+  ~TimerQueue() {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->stopping = true;
+    }
+    this->wake.notify_all();
+    if (this->worker.joinable()) {
+      this->worker.join();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  // Ordered by (deadline, id) so timers sharing a deadline fire in the order
+  // they were scheduled.
+  std::map<std::pair<uint64_t, uint64_t>, Clock::Callback> timers;
+  std::map<uint64_t, uint64_t> deadlines;
+  uint64_t nextId = 1;
+  std::atomic<bool> virtualTime{false};
+  std::atomic<uint64_t> virtualNow{0};
+  std::thread worker;
+  bool stopping = false;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (!this->stopping) {
+      if (this->virtualTime || this->timers.empty()) {
+        this->wake.wait(lock);
+        continue;
+      }
+
+      const auto it = this->timers.begin();
+      const uint64_t deadline = it->first.first;
+      const uint64_t now = steadyNow();
+      if (deadline > now) {
+        this->wake.wait_for(lock, std::chrono::nanoseconds(deadline - now));
+        continue;
+      }
+
+      auto callback = std::move(it->second);
+      this->deadlines.erase(it->first.second);
+      this->timers.erase(it);
+
+      lock.unlock();
+      callback();
+      lock.lock();
+    }
+  }
+
+  size_t fireUntil(uint64_t until) {
+    size_t fired = 0;
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (!this->timers.empty() &&
+           this->timers.begin()->first.first <= until) {
+      const auto it = this->timers.begin();
+      const uint64_t deadline = it->first.first;
+      if (deadline > this->virtualNow) {
+        this->virtualNow = deadline;
+      }
+
+      auto callback = std::move(it->second);
+      this->deadlines.erase(it->first.second);
+      this->timers.erase(it);
+
+      lock.unlock();
+      callback();
+      fired++;
+      lock.lock();
+    }
+
+    if (until > this->virtualNow) {
+      this->virtualNow = until;
+    }
+    return fired;
+  }
+};
+
+TimerQueue &timerQueue() {
+  static TimerQueue queue;
+  return queue;
+}
+
+} // namespace
+
+uint64_t Clock::now() {
+  auto &queue = timerQueue();
+  if (queue.virtualTime) {
+    return queue.virtualNow;
+  }
+  return steadyNow();
+}
+
+uint64_t Clock::schedule(uint64_t deadline, Callback callback) {
+  auto &queue = timerQueue();
+  uint64_t id;
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    id = queue.nextId++;
+    queue.timers.emplace(std::make_pair(deadline, id), std::move(callback));
+    queue.deadlines.emplace(id, deadline);
+    if (!queue.worker.joinable()) {
+      queue.worker = std::thread([&queue]() { queue.run(); });
+    }
+  }
+  queue.wake.notify_one();
+  return id;
+}
+
+uint64_t Clock::scheduleAfter(uint64_t delay, Callback callback) {
+  return schedule(now() + delay, std::move(callback));
+}
+
+bool Clock::cancel(uint64_t id) {
+  auto &queue = timerQueue();
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  const auto it = queue.deadlines.find(id);
+  if (it == queue.deadlines.end()) {
+    return false;
+  }
+
+  queue.timers.erase(std::make_pair(it->second, id));
+  queue.deadlines.erase(it);
+  return true;
+}
+
+void Clock::setVirtual(bool enabled, uint64_t start) {
+  auto &queue = timerQueue();
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.virtualNow = enabled ? (start != 0 ? start : steadyNow()) : 0;
+    queue.virtualTime = enabled;
+  }
+  queue.wake.notify_one();
+}
+
+bool Clock::isVirtual() { return timerQueue().virtualTime; }
+
+size_t Clock::advance(uint64_t delta) {
+  auto &queue = timerQueue();
+  if (!queue.virtualTime) {
+    return 0;
+  }
+  // Saturates rather than wrapping to a time already passed.
+  const uint64_t now = queue.virtualNow;
+  return queue.fireUntil(delta > UINT64_MAX - now ? UINT64_MAX : now + delta);
+}
+
+bool Clock::step() {
+  auto &queue = timerQueue();
+  if (!queue.virtualTime) {
+    return false;
+  }
+
+  uint64_t deadline;
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.timers.empty()) {
+      return false;
+    }
+    deadline = queue.timers.begin()->first.first;
+  }
+  queue.fireUntil(std::max<uint64_t>(deadline, queue.virtualNow));
+  return true;
+}
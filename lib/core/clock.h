@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Time source for native timestamps and timers. By default it follows the
+// steady clock and timers fire on a background thread. In virtual mode time
+// only moves when advance() or step() is called, and due timers fire in
+// deadline order on the calling thread, so long-running scenarios can be
+// replayed deterministically in a fraction of the wall time.
+class Clock {
+public:
+  using Callback = std::function<void()>;
+
+  // Nanoseconds on the active time base.
+  static uint64_t now();
+
+  // Returns a timer id that can be passed to cancel(). Callbacks must not
+  // assume which thread they run on.
+  static uint64_t schedule(uint64_t deadline, Callback callback);
+  static uint64_t scheduleAfter(uint64_t delay, Callback callback);
+  static bool cancel(uint64_t id);
+
+  // Switches the time base. Pending timers keep their absolute deadlines,
+  // so switch before scheduling anything.
+  static void setVirtual(bool enabled, uint64_t start = 0);
+  static bool isVirtual();
+
+  // Virtual mode only: fires every timer due up to now() + delta, moving
+  // time to each deadline in turn. Returns the number of timers fired.
+  static size_t advance(uint64_t delta);
+  // Virtual mode only: jumps to the next pending deadline and fires the
+  // timers due at it. Returns false when nothing is pending.
+  static bool step();
+};
@@ -0,0 +1,110 @@
+#include "drift.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Once the window is full the fit is refreshed every few samples; a single
+// sample moves a median very little.
+static constexpr size_t REFIT_INTERVAL = 8;
+
+static double median(std::vector<double> &values) {
+  const auto middle = values.begin() + values.size() / 2;
+  std::nth_element(values.begin(), middle, values.end());
+  if (values.size() % 2 == 1) {
+    return *middle;
+  }
+  return (*middle + *std::max_element(values.begin(), middle)) / 2;
+}
+
+DriftEstimator::DriftEstimator(size_t window, unsigned tickBits)
+    : window(std::min(std::max<size_t>(window, 2), MAX_WINDOW)),
+      mask(tickBits >= 64 ? UINT64_MAX : (uint64_t(1) << tickBits) - 1) {}
+
+uint64_t DriftEstimator::add(uint64_t tick, uint64_t received) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  tick &= this->mask;
+
+  // Half the counter range either way decides between a wrap and a step
+  // backwards.
+  const uint64_t delta = (tick - this->lastTick) & this->mask;
+  if (this->samples.empty() || delta > this->mask / 2) {
+    this->samples.clear();
+    this->originTick = tick;
+    this->originHost = received;
+    this->unwrapped = 0;
+    this->sinceFit = 0;
+  } else {
+    this->unwrapped += static_cast<int64_t>(delta);
+  }
+  this->lastTick = tick;
+
+  const int64_t host =
+      static_cast<int64_t>(received) - static_cast<int64_t>(this->originHost);
+  this->samples.push_back(Sample{this->unwrapped, host});
+  if (this->samples.size() > this->window) {
+    this->samples.pop_front();
+  }
+
+  if (this->samples.size() < 2) {
+    return received;
+  }
+  if (this->samples.size() < this->window ||
+      ++this->sinceFit >= REFIT_INTERVAL) {
+    this->fit();
+    this->sinceFit = 0;
+  }
+
+  const double estimate = static_cast<double>(this->originHost) +
+                          this->predict(this->unwrapped);
+  return static_cast<uint64_t>(std::max(0.0, estimate));
+}
+
+bool DriftEstimator::estimate(ClockFit &out) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->samples.size() < 2) {
+    return false;
+  }
+
+  out.slope = this->slope;
+  out.jitter = this->jitter;
+  out.samples = this->samples.size();
+  return true;
+}
+
+void DriftEstimator::fit() {
+  const size_t count = this->samples.size();
+  std::vector<double> values;
+  values.reserve(count * (count - 1) / 2);
+
+  for (size_t i = 0; i < count; i++) {
+    for (size_t j = i + 1; j < count; j++) {
+      const int64_t ticks = this->samples[j].tick - this->samples[i].tick;
+      if (ticks != 0) {
+        values.push_back(
+            static_cast<double>(this->samples[j].host - this->samples[i].host) /
+            static_cast<double>(ticks));
+      }
+    }
+  }
+  if (values.empty()) {
+    return;
+  }
+  this->slope = median(values);
+
+  values.clear();
+  for (const Sample &sample : this->samples) {
+    values.push_back(static_cast<double>(sample.host) -
+                     this->slope * static_cast<double>(sample.tick));
+  }
+  this->intercept = median(values);
+
+  for (double &value : values) {
+    value = std::fabs(value - this->intercept);
+  }
+  this->jitter = median(values);
+}
+
+double DriftEstimator::predict(int64_t tick) const {
+  return this->intercept + this->slope * static_cast<double>(tick);
+}
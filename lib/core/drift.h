@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+struct ClockFit {
+  // Host nanoseconds per device tick.
+  double slope = 0;
+  // Median absolute residual of the window in nanoseconds.
+  double jitter = 0;
+  size_t samples = 0;
+};
+
+// Linear model of a device tick counter against host receive time, fitted
+// with the Theil-Sen estimator over a sliding window: the slope is the
+// median of the pairwise slopes and the intercept the median residual, so
+// delayed or bunched deliveries barely move the fit. Counters narrower
+// than 64 bits are unwrapped; a counter that runs backwards is taken to be
+// a device reset and starts a new fit.
+class DriftEstimator {
+public:
+  // Largest window; each fit takes time quadratic in it.
+  static constexpr size_t MAX_WINDOW = 1024;
+
+  // The window is clamped to between 2 and MAX_WINDOW samples.
+  explicit DriftEstimator(size_t window = 64, unsigned tickBits = 32);
+
+  // Adds a sample and returns the estimated host time of the tick on the
+  // same time base as received. Until there are two samples that is the
+  // receive time itself.
+  uint64_t add(uint64_t tick, uint64_t received);
+  bool estimate(ClockFit &out);
+
+private:
+  struct Sample {
+    int64_t tick;
+    int64_t host;
+  };
+
+  void fit();
+  double predict(int64_t tick) const;
+
+  std::mutex mutex;
+  size_t window;
+  uint64_t mask;
+  std::deque<Sample> samples;
+  // First sample of the current fit. Samples are stored relative to it to
+  // keep full precision in doubles.
+  uint64_t originTick = 0;
+  uint64_t originHost = 0;
+  uint64_t lastTick = 0;
+  int64_t unwrapped = 0;
+  size_t sinceFit = 0;
+  double slope = 0;
+  double intercept = 0;
+  double jitter = 0;
+};
@@ -0,0 +1,215 @@
+#include "format.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Format type values from the Bluetooth assigned numbers.
+enum : uint8_t {
+  FORMAT_BOOLEAN = 0x01,
+  FORMAT_UINT2 = 0x02,
+  FORMAT_UINT4 = 0x03,
+  FORMAT_UINT8 = 0x04,
+  FORMAT_UINT12 = 0x05,
+  FORMAT_UINT16 = 0x06,
+  FORMAT_UINT24 = 0x07,
+  FORMAT_UINT32 = 0x08,
+  FORMAT_UINT48 = 0x09,
+  FORMAT_UINT64 = 0x0a,
+  FORMAT_SINT8 = 0x0c,
+  FORMAT_SINT12 = 0x0d,
+  FORMAT_SINT16 = 0x0e,
+  FORMAT_SINT24 = 0x0f,
+  FORMAT_SINT32 = 0x10,
+  FORMAT_SINT48 = 0x11,
+  FORMAT_SINT64 = 0x12,
+  FORMAT_FLOAT32 = 0x14,
+  FORMAT_FLOAT64 = 0x15,
+  FORMAT_SFLOAT = 0x16,
+  FORMAT_FLOAT = 0x17,
+  FORMAT_DUINT16 = 0x18,
+};
+
+static uint64_t readLittleEndian(const uint8_t *data, size_t width) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < width; i++) {
+    value |= static_cast<uint64_t>(data[i]) << (8 * i);
+  }
+  return value;
+}
+
+static int64_t signExtend(uint64_t value, size_t bits) {
+  if (bits >= 64) {
+    return static_cast<int64_t>(value);
+  }
+  const uint64_t sign = uint64_t(1) << (bits - 1);
+  return static_cast<int64_t>((value ^ sign) - sign);
+}
+
+// IEEE 11073-20601 medical float, with its reserved special values.
+static double medicalFloat(int64_t mantissa, int exponent, int64_t nan,
+                           int64_t nres, int64_t positiveInfinity,
+                           int64_t negativeInfinity, int64_t reserved) {
+  if (mantissa == nan || mantissa == nres || mantissa == reserved) {
+    return std::numeric_limits<double>::quiet_NaN();
+  } else if (mantissa == positiveInfinity) {
+    return std::numeric_limits<double>::infinity();
+  } else if (mantissa == negativeInfinity) {
+    return -std::numeric_limits<double>::infinity();
+  }
+  return static_cast<double>(mantissa) * std::pow(10.0, exponent);
+}
+
+bool PresentationFormat::parse(const uint8_t *data, size_t length,
+                               PresentationFormat &out) {
+  if (length < 7) {
+    return false;
+  }
+
+  out.format = data[0];
+  out.exponent = static_cast<int8_t>(data[1]);
+  out.unit = static_cast<uint16_t>(readLittleEndian(data + 2, 2));
+  out.nameSpace = data[4];
+  out.description = static_cast<uint16_t>(readLittleEndian(data + 5, 2));
+  return true;
+}
+
+ValueDecoder::ValueDecoder(const PresentationFormat &format)
+    : scale(std::pow(10.0, format.exponent)) {
+  switch (format.format) {
+  case FORMAT_BOOLEAN:
+    this->kind = Kind::Unsigned, this->width = 1, this->mask = 0x01;
+    break;
+  case FORMAT_UINT2:
+    this->kind = Kind::Unsigned, this->width = 1, this->mask = 0x03;
+    break;
+  case FORMAT_UINT4:
+    this->kind = Kind::Unsigned, this->width = 1, this->mask = 0x0f;
+    break;
+  case FORMAT_UINT8:
+    this->kind = Kind::Unsigned, this->width = 1;
+    break;
+  case FORMAT_UINT12:
+    this->kind = Kind::Unsigned, this->width = 2, this->mask = 0x0fff;
+    break;
+  case FORMAT_UINT16:
+  case FORMAT_DUINT16:
+    this->kind = Kind::Unsigned, this->width = 2;
+    break;
+  case FORMAT_UINT24:
+    this->kind = Kind::Unsigned, this->width = 3;
+    break;
+  case FORMAT_UINT32:
+    this->kind = Kind::Unsigned, this->width = 4;
+    break;
+  case FORMAT_UINT48:
+    this->kind = Kind::Unsigned, this->width = 6;
+    break;
+  case FORMAT_UINT64:
+    this->kind = Kind::Unsigned, this->width = 8;
+    break;
+  case FORMAT_SINT8:
+    this->kind = Kind::Signed, this->width = 1;
+    break;
+  case FORMAT_SINT12:
+    this->kind = Kind::Signed, this->width = 2, this->mask = 0x0fff;
+    break;
+  case FORMAT_SINT16:
+    this->kind = Kind::Signed, this->width = 2;
+    break;
+  case FORMAT_SINT24:
+    this->kind = Kind::Signed, this->width = 3;
+    break;
+  case FORMAT_SINT32:
+    this->kind = Kind::Signed, this->width = 4;
+    break;
+  case FORMAT_SINT48:
+    this->kind = Kind::Signed, this->width = 6;
+    break;
+  case FORMAT_SINT64:
+    this->kind = Kind::Signed, this->width = 8;
+    break;
+  case FORMAT_FLOAT32:
+    this->kind = Kind::Float32, this->width = 4;
+    break;
+  case FORMAT_FLOAT64:
+    this->kind = Kind::Float64, this->width = 8;
+    break;
+  case FORMAT_SFLOAT:
+    this->kind = Kind::SFloat, this->width = 2;
+    break;
+  case FORMAT_FLOAT:
+    this->kind = Kind::Float, this->width = 4;
+    break;
+  default:
+    break;
+  }
+}
+
+bool ValueDecoder::valid() const { return this->kind != Kind::None; }
+
+size_t ValueDecoder::decode(const uint8_t *data, size_t length,
+                            std::vector<double> &out) const {
+  if (!this->valid()) {
+    return 0;
+  }
+
+  const size_t count = length / this->width;
+  for (size_t i = 0; i < count; i++) {
+    const uint64_t raw = readLittleEndian(data + i * this->width, this->width);
+    double value = 0;
+
+    switch (this->kind) {
+    case Kind::Unsigned:
+      value = static_cast<double>(raw & this->mask) * this->scale;
+      break;
+    case Kind::Signed: {
+      const size_t bits = this->mask == 0x0fff ? 12 : 8 * this->width;
+      value = static_cast<double>(signExtend(raw & this->mask, bits)) *
+              this->scale;
+      break;
+    }
+    case Kind::Float32: {
+      const uint32_t bits = static_cast<uint32_t>(raw);
+      float f;
+      std::memcpy(&f, &bits, sizeof(f));
+      value = f;
+      break;
+    }
+    case Kind::Float64:
+      std::memcpy(&value, &raw, sizeof(value));
+      break;
+    case Kind::SFloat:
+      value = medicalFloat(signExtend(raw & 0x0fff, 12),
+                           static_cast<int>(signExtend(raw >> 12, 4)), 0x07ff,
+                           -0x0800, 0x07fe, -0x07fe, -0x07ff);
+      break;
+    case Kind::Float:
+      value = medicalFloat(signExtend(raw & 0xffffff, 24),
+                           static_cast<int>(signExtend(raw >> 24, 8)),
+                           0x7fffff, 0x800000 - 0x1000000, 0x7ffffe,
+                           -0x7ffffe, 0x800001 - 0x1000000);
+      break;
+    case Kind::None:
+      break;
+    }
+
+    out.push_back(value);
+  }
+  return count;
+}
+
+Transform ValueDecoder::transform() const {
+  const ValueDecoder decoder = *this;
+  return [decoder](const uint8_t *data, size_t length,
+                   std::vector<uint8_t> &out) {
+    std::vector<double> values;
+    if (decoder.decode(data, length, values) == 0) {
+      return false;
+    }
+
+    out.resize(values.size() * sizeof(double));
+    std::memcpy(out.data(), values.data(), out.size());
+    return true;
+  };
+}
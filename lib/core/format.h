@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "transforms.h"
+
+// Characteristic Presentation Format descriptor (0x2904).
+struct PresentationFormat {
+  uint8_t format = 0;
+  int8_t exponent = 0;
+  uint16_t unit = 0;
+  uint8_t nameSpace = 0;
+  uint16_t description = 0;
+
+  static bool parse(const uint8_t *data, size_t length,
+                    PresentationFormat &out);
+};
+
+// Decodes values of a presentation format into doubles, applying the
+// decimal exponent to integer formats. Payloads holding several values back
+// to back decode to one double each.
+class ValueDecoder {
+public:
+  explicit ValueDecoder(const PresentationFormat &format);
+
+  // False for formats without a numeric decoding (strings, structs, 128-bit).
+  bool valid() const;
+  size_t decode(const uint8_t *data, size_t length,
+                std::vector<double> &out) const;
+  // Transform producing host-order float64 values.
+  Transform transform() const;
+
+private:
+  enum class Kind { None, Unsigned, Signed, Float32, Float64, SFloat, Float };
+
+  Kind kind = Kind::None;
+  size_t width = 0;
+  uint64_t mask = ~uint64_t(0);
+  double scale = 1;
+};
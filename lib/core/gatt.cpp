@@ -0,0 +1,131 @@
+#include "gatt.h"
+
+#include <unordered_map>
+
+bool GattCharacteristic::operator==(const GattCharacteristic &other) const {
+  return this->uuid == other.uuid && this->canRead == other.canRead &&
+         this->canWriteRequest == other.canWriteRequest &&
+         this->canWriteCommand == other.canWriteCommand &&
+         this->canNotify == other.canNotify &&
+         this->canIndicate == other.canIndicate &&
+         this->descriptors == other.descriptors;
+}
+
+static constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325;
+static constexpr uint64_t FNV_PRIME = 0x100000001b3;
+
+static void hashBytes(uint64_t &hash, const void *data, size_t length) {
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+}
+
+// Strings are length-prefixed so that adjacent fields cannot run together.
+static void hashString(uint64_t &hash, const std::string &value) {
+  const uint32_t length = static_cast<uint32_t>(value.size());
+  hashBytes(hash, &length, sizeof(length));
+  hashBytes(hash, value.data(), value.size());
+}
+
+uint64_t gattFingerprint(const GattDatabase &database) {
+  uint64_t hash = FNV_OFFSET;
+  for (const auto &service : database) {
+    hashString(hash, service.uuid);
+    const auto count = static_cast<uint32_t>(service.characteristics.size());
+    hashBytes(hash, &count, sizeof(count));
+
+    for (const auto &chr : service.characteristics) {
+      hashString(hash, chr.uuid);
+      const uint8_t properties =
+          chr.canRead | chr.canWriteRequest << 1 | chr.canWriteCommand << 2 |
+          chr.canNotify << 3 | chr.canIndicate << 4;
+      hashBytes(hash, &properties, sizeof(properties));
+      const auto descriptors = static_cast<uint32_t>(chr.descriptors.size());
+      hashBytes(hash, &descriptors, sizeof(descriptors));
+      for (const auto &descriptor : chr.descriptors) {
+        hashString(hash, descriptor);
+      }
+    }
+  }
+  return hash;
+}
+
+template <typename T>
+static std::unordered_map<std::string, const T *>
+indexByUuid(const std::vector<T> &items) {
+  std::unordered_map<std::string, const T *> index;
+  index.reserve(items.size());
+  for (const auto &item : items) {
+    index.emplace(item.uuid, &item);
+  }
+  return index;
+}
+
+size_t gattSize(const GattDatabase &database) {
+  size_t size = database.capacity() * sizeof(GattService);
+  for (const auto &service : database) {
+    size += gattSize(service);
+  }
+  return size;
+}
+
+size_t gattSize(const GattService &service) {
+  size_t size = service.uuid.capacity() + service.data.capacity() +
+                service.characteristics.capacity() * sizeof(GattCharacteristic);
+  for (const auto &chr : service.characteristics) {
+    size +=
+        chr.uuid.capacity() + chr.descriptors.capacity() * sizeof(std::string);
+    for (const auto &descriptor : chr.descriptors) {
+      size += descriptor.capacity();
+    }
+  }
+  return size;
+}
+
+std::vector<GattChange> diffGattDatabase(const GattDatabase &previous,
+                                         const GattDatabase &next) {
+  std::vector<GattChange> changes;
+  const auto previousServices = indexByUuid(previous);
+  const auto nextServices = indexByUuid(next);
+
+  for (const auto &service : previous) {
+    if (nextServices.find(service.uuid) == nextServices.end()) {
+      changes.push_back({GattChangeType::Removed, &service, nullptr});
+    }
+  }
+
+  for (const auto &service : next) {
+    const auto found = previousServices.find(service.uuid);
+    if (found == previousServices.end()) {
+      changes.push_back({GattChangeType::Added, &service, nullptr});
+      for (const auto &characteristic : service.characteristics) {
+        changes.push_back({GattChangeType::Added, &service, &characteristic});
+      }
+      continue;
+    }
+
+    const auto &oldCharacteristics = found->second->characteristics;
+    const auto oldIndex = indexByUuid(oldCharacteristics);
+    const auto newIndex = indexByUuid(service.characteristics);
+
+    for (const auto &characteristic : oldCharacteristics) {
+      if (newIndex.find(characteristic.uuid) == newIndex.end()) {
+        changes.push_back(
+            {GattChangeType::Removed, &service, &characteristic});
+      }
+    }
+
+    for (const auto &characteristic : service.characteristics) {
+      const auto old = oldIndex.find(characteristic.uuid);
+      if (old == oldIndex.end()) {
+        changes.push_back({GattChangeType::Added, &service, &characteristic});
+      } else if (*old->second != characteristic) {
+        changes.push_back(
+            {GattChangeType::Changed, &service, &characteristic});
+      }
+    }
+  }
+
+  return changes;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct GattCharacteristic {
+  std::string uuid;
+  bool canRead = false;
+  bool canWriteRequest = false;
+  bool canWriteCommand = false;
+  bool canNotify = false;
+  bool canIndicate = false;
+  std::vector<std::string> descriptors;
+
+  bool operator==(const GattCharacteristic &other) const;
+  bool operator!=(const GattCharacteristic &other) const {
+    return !(*this == other);
+  }
+};
+
+struct GattService {
+  std::string uuid;
+  std::vector<uint8_t> data;
+  std::vector<GattCharacteristic> characteristics;
+};
+
+using GattDatabase = std::vector<GattService>;
+
+enum class GattChangeType : uint8_t { Added, Removed, Changed };
+
+// A service-level change leaves characteristic null. Removed services and
+// characteristics point into the old database, everything else into the new
+// one.
+struct GattChange {
+  GattChangeType type;
+  const GattService *service;
+  const GattCharacteristic *characteristic;
+};
+
+// FNV-1a hash of the attribute table: service and characteristic UUIDs,
+// properties and descriptors in order. Service data is ignored, so devices
+// of one model and firmware share a fingerprint.
+uint64_t gattFingerprint(const GattDatabase &database);
+
+// Approximate heap footprint of a database or service, for quotas.
+size_t gattSize(const GattDatabase &database);
+size_t gattSize(const GattService &service);
+
+// Structural diff keyed by UUID. Service data is advertisement payload
+// rather than part of the attribute table, so it is not compared.
+std::vector<GattChange> diffGattDatabase(const GattDatabase &previous,
+                                         const GattDatabase &next);
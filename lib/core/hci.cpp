@@ -0,0 +1,1122 @@
+#include "hci.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Linux Bluetooth socket constants, from BlueZ's hci.h, which is not a
+// build dependency.
+#ifndef AF_BLUETOOTH
+#define AF_BLUETOOTH 31
+#endif
+static constexpr int BTPROTO_HCI = 1;
+static constexpr unsigned short HCI_CHANNEL_USER = 1;
+
+struct sockaddr_hci {
+  sa_family_t hci_family;
+  unsigned short hci_dev;
+  unsigned short hci_channel;
+};
+
+// Packet types, commands and events, Core Specification Vol 4 Part E.
+static constexpr uint8_t HCI_COMMAND_PKT = 0x01;
+static constexpr uint8_t HCI_ACLDATA_PKT = 0x02;
+static constexpr uint8_t HCI_EVENT_PKT = 0x04;
+
+static constexpr uint16_t HCI_DISCONNECT = 0x0406;
+static constexpr uint16_t HCI_SET_EVENT_MASK = 0x0c01;
+static constexpr uint16_t HCI_RESET = 0x0c03;
+static constexpr uint16_t HCI_READ_BUFFER_SIZE = 0x1005;
+static constexpr uint16_t HCI_READ_BD_ADDR = 0x1009;
+static constexpr uint16_t HCI_LE_READ_BUFFER_SIZE = 0x2002;
+static constexpr uint16_t HCI_LE_SET_SCAN_PARAMETERS = 0x200b;
+static constexpr uint16_t HCI_LE_SET_SCAN_ENABLE = 0x200c;
+static constexpr uint16_t HCI_LE_CREATE_CONNECTION = 0x200d;
+static constexpr uint16_t HCI_LE_CREATE_CONNECTION_CANCEL = 0x200e;
+
+static constexpr uint8_t EVT_DISCONNECTION_COMPLETE = 0x05;
+static constexpr uint8_t EVT_COMMAND_COMPLETE = 0x0e;
+static constexpr uint8_t EVT_COMMAND_STATUS = 0x0f;
+static constexpr uint8_t EVT_NUMBER_OF_COMPLETED_PACKETS = 0x13;
+static constexpr uint8_t EVT_LE_META = 0x3e;
+static constexpr uint8_t EVT_LE_CONNECTION_COMPLETE = 0x01;
+static constexpr uint8_t EVT_LE_ADVERTISING_REPORT = 0x02;
+static constexpr uint8_t EVT_LE_ENHANCED_CONNECTION_COMPLETE = 0x0a;
+
+// Advertising report event types.
+static constexpr uint8_t ADV_IND = 0x00;
+static constexpr uint8_t ADV_DIRECT_IND = 0x01;
+static constexpr uint8_t SCAN_RSP = 0x04;
+
+// L2CAP fixed channels and LE signaling codes, Vol 3 Part A.
+static constexpr uint16_t L2CAP_ATT_CID = 0x0004;
+static constexpr uint16_t L2CAP_SIGNALING_CID = 0x0005;
+static constexpr uint8_t L2CAP_COMMAND_REJECT = 0x01;
+static constexpr uint8_t L2CAP_CONNECTION_PARAMETER_UPDATE_REQ = 0x12;
+static constexpr uint8_t L2CAP_CONNECTION_PARAMETER_UPDATE_RSP = 0x13;
+
+static constexpr auto COMMAND_TIMEOUT = std::chrono::seconds(2);
+static constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(10);
+// Longer than the supervision timeout we ask for.
+static constexpr auto DISCONNECT_TIMEOUT = std::chrono::seconds(6);
+
+static uint16_t get16(const uint8_t *data) {
+  return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+static void put16(std::vector<uint8_t> &out, uint16_t value) {
+  out.push_back(static_cast<uint8_t>(value));
+  out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+static std::string addressString(const uint8_t *address) {
+  char text[18];
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", address[5],
+           address[4], address[3], address[2], address[1], address[0]);
+  return text;
+}
+
+static bool parseAddress(const std::string &text, uint8_t *address) {
+  unsigned int bytes[6];
+  if (sscanf(text.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x", &bytes[5], &bytes[4],
+             &bytes[3], &bytes[2], &bytes[1], &bytes[0]) != 6) {
+    return false;
+  }
+  for (size_t i = 0; i < 6; i++) {
+    address[i] = static_cast<uint8_t>(bytes[i]);
+  }
+  return true;
+}
+
+// Lists a service UUID unless it is already there, with or without data.
+static void addService(Advertisement &out, std::string uuid,
+                       std::vector<uint8_t> data) {
+  auto it = std::find_if(out.serviceData.begin(), out.serviceData.end(),
+                         [&uuid](const auto &entry) {
+                           return entry.first == uuid;
+                         });
+  if (it == out.serviceData.end()) {
+    out.serviceData.emplace_back(std::move(uuid), std::move(data));
+  } else if (!data.empty()) {
+    it->second = std::move(data);
+  }
+}
+
+bool parseAdvertisingData(const uint8_t *data, size_t length,
+                          Advertisement &out) {
+  size_t offset = 0;
+  while (offset < length) {
+    const size_t size = data[offset];
+    if (size == 0) {
+      // Significant part ends, the rest is padding.
+      return true;
+    } else if (offset + 1 + size > length) {
+      return false;
+    }
+
+    const uint8_t type = data[offset + 1];
+    const uint8_t *field = data + offset + 2;
+    const size_t fieldLength = size - 1;
+    offset += 1 + size;
+
+    switch (type) {
+    case 0x02: // Incomplete and complete lists of service UUIDs, by size.
+    case 0x03:
+    case 0x04:
+    case 0x05:
+    case 0x06:
+    case 0x07: {
+      const size_t width = type <= 0x03 ? 2 : type <= 0x05 ? 4 : 16;
+      for (size_t i = 0; i + width <= fieldLength; i += width) {
+        addService(out, attUuid(field + i, width), {});
+      }
+      break;
+    }
+    case 0x08: // Shortened and complete local name.
+    case 0x09:
+      out.identifier.assign(reinterpret_cast<const char *>(field),
+                            fieldLength);
+      break;
+    case 0x0a:
+      if (fieldLength >= 1) {
+        out.txPower = static_cast<int8_t>(field[0]);
+      }
+      break;
+    case 0x16: // Service data with 16, 32 and 128-bit UUIDs.
+    case 0x20:
+    case 0x21: {
+      const size_t width = type == 0x16 ? 2 : type == 0x20 ? 4 : 16;
+      if (fieldLength >= width) {
+        addService(out, attUuid(field, width),
+                   std::vector<uint8_t>(field + width, field + fieldLength));
+      }
+      break;
+    }
+    case 0xff:
+      if (fieldLength >= 2) {
+        const uint16_t company = get16(field);
+        std::vector<uint8_t> payload(field + 2, field + fieldLength);
+        auto it = std::find_if(out.manufacturerData.begin(),
+                               out.manufacturerData.end(),
+                               [company](const auto &entry) {
+                                 return entry.first == company;
+                               });
+        if (it == out.manufacturerData.end()) {
+          out.manufacturerData.emplace_back(company, std::move(payload));
+        } else {
+          it->second = std::move(payload);
+        }
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  return true;
+}
+
+HciDevice::HciDevice(std::weak_ptr<HciController> controller,
+                     Advertisement advertisement)
+    : controller(std::move(controller)), info(std::move(advertisement)) {}
+
+const Advertisement &HciDevice::advertisement() const { return this->info; }
+
+GattDatabase HciDevice::gatt() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->database;
+}
+
+uint16_t HciDevice::mtu() {
+  std::shared_ptr<HciController> owner;
+  auto att = this->client(owner);
+  return att ? att->mtu() : AttClient::DEFAULT_MTU;
+}
+
+bool HciDevice::connect() {
+  std::lock_guard<std::mutex> serial(this->linkMutex);
+  auto owner = this->controller.lock();
+  if (!owner) {
+    return false;
+  } else if (this->connected()) {
+    return true;
+  }
+
+  uint16_t handle;
+  if (!owner->connect(this->info, handle)) {
+    return false;
+  }
+
+  std::shared_ptr<AttClient> att;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    att = this->att;
+  }
+  if (!att) {
+    // Dropped already.
+    return false;
+  }
+
+  // A peer that refuses the exchange stays at the default MTU.
+  att->exchangeMtu();
+  GattDatabase database;
+  std::vector<AttCharacteristic> handles;
+  if (!att->discover(database, handles)) {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->disconnecting = true;
+    }
+    owner->disconnect(handle);
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->database = std::move(database);
+  this->handles = std::move(handles);
+  return true;
+}
+
+bool HciDevice::disconnect() {
+  std::lock_guard<std::mutex> serial(this->linkMutex);
+  auto owner = this->controller.lock();
+  uint16_t handle;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!owner || this->connection == NO_CONNECTION) {
+      return false;
+    }
+    handle = this->connection;
+    this->disconnecting = true;
+  }
+
+  const bool sent = owner->disconnect(handle);
+  std::unique_lock<std::mutex> lock(this->mutex);
+  if (!sent && this->connection != NO_CONNECTION) {
+    this->disconnecting = false;
+    return false;
+  }
+  return this->linkChanged.wait_for(lock, DISCONNECT_TIMEOUT, [this]() {
+    return this->connection == NO_CONNECTION;
+  });
+}
+
+bool HciDevice::connected() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->connection != NO_CONNECTION;
+}
+
+bool HciDevice::subscribe(const std::string &service,
+                          const std::string &characteristic, bool indicate) {
+  return this->configure(service, characteristic,
+                         indicate ? 0x0002 : 0x0001);
+}
+
+bool HciDevice::unsubscribe(const std::string &service,
+                            const std::string &characteristic) {
+  return this->configure(service, characteristic, 0x0000);
+}
+
+bool HciDevice::read(const std::string &service,
+                     const std::string &characteristic,
+                     std::vector<uint8_t> &out) {
+  std::shared_ptr<HciController> owner;
+  auto att = this->client(owner);
+  AttCharacteristic handles;
+  return att && this->findHandles(service, characteristic, handles) &&
+         att->read(handles.value, out);
+}
+
+bool HciDevice::write(const std::string &service,
+                      const std::string &characteristic, const uint8_t *data,
+                      size_t length, bool response) {
+  std::shared_ptr<HciController> owner;
+  auto att = this->client(owner);
+  AttCharacteristic handles;
+  return att && this->findHandles(service, characteristic, handles) &&
+         att->write(handles.value, data, length, response);
+}
+
+bool HciDevice::readDescriptor(const std::string &service,
+                               const std::string &characteristic,
+                               const std::string &descriptor,
+                               std::vector<uint8_t> &out) {
+  std::shared_ptr<HciController> owner;
+  auto att = this->client(owner);
+  AttCharacteristic handles;
+  if (!att || !this->findHandles(service, characteristic, handles)) {
+    return false;
+  }
+
+  for (const auto &[uuid, handle] : handles.descriptors) {
+    if (uuid == descriptor) {
+      return att->read(handle, out);
+    }
+  }
+  return false;
+}
+
+bool HciDevice::writeDescriptor(const std::string &service,
+                                const std::string &characteristic,
+                                const std::string &descriptor,
+                                const uint8_t *data, size_t length) {
+  std::shared_ptr<HciController> owner;
+  auto att = this->client(owner);
+  AttCharacteristic handles;
+  if (!att || !this->findHandles(service, characteristic, handles)) {
+    return false;
+  }
+
+  for (const auto &[uuid, handle] : handles.descriptors) {
+    if (uuid == descriptor) {
+      return att->write(handle, data, length, true);
+    }
+  }
+  return false;
+}
+
+void HciDevice::setNotifyCallback(const void *owner, NotifyCallback callback) {
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  this->notifyOwner = owner;
+  this->notify = std::move(callback);
+}
+
+void HciDevice::clearNotifyCallback(const void *owner) {
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  if (this->notifyOwner == owner) {
+    this->notifyOwner = nullptr;
+    this->notify = nullptr;
+  }
+}
+
+void HciDevice::setDisconnectCallback(const void *owner,
+                                      DisconnectCallback callback) {
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  this->disconnectOwner = owner;
+  this->disconnected = std::move(callback);
+}
+
+void HciDevice::clearDisconnectCallback(const void *owner) {
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  if (this->disconnectOwner == owner) {
+    this->disconnectOwner = nullptr;
+    this->disconnected = nullptr;
+  }
+}
+
+void HciDevice::linkUp(HciController *controller, uint16_t handle) {
+  // The client is created before any data of the link is read, since the
+  // peer may start with a request of its own. It calls the controller
+  // through a plain pointer: callers hold the controller, and the reader
+  // thread runs only while it lives.
+  auto att = std::make_shared<AttClient>(
+      [controller, handle](std::vector<uint8_t> pdu) {
+        return controller->sendL2cap(handle, L2CAP_ATT_CID, pdu);
+      });
+  att->setNotifyCallback(
+      [this](uint16_t handle, const uint8_t *data, size_t length) {
+        this->onNotify(handle, data, length);
+      });
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->connection = handle;
+  this->att = std::move(att);
+  this->linkChanged.notify_all();
+}
+
+void HciDevice::linkDown() {
+  std::shared_ptr<AttClient> att;
+  bool requested;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->connection == NO_CONNECTION) {
+      return;
+    }
+    this->connection = NO_CONNECTION;
+    att = std::move(this->att);
+    requested = this->disconnecting;
+    this->disconnecting = false;
+    this->linkChanged.notify_all();
+  }
+  att->close();
+
+  if (!requested) {
+    std::lock_guard<std::mutex> lock(this->callbackMutex);
+    if (this->disconnected) {
+      this->disconnected();
+    }
+  }
+}
+
+void HciDevice::receive(const uint8_t *pdu, size_t length) {
+  std::shared_ptr<AttClient> att;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    att = this->att;
+  }
+  if (att) {
+    att->receive(pdu, length);
+  }
+}
+
+void HciDevice::onNotify(uint16_t handle, const uint8_t *data,
+                         size_t length) {
+  std::string service;
+  std::string characteristic;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = std::find_if(
+        this->handles.begin(), this->handles.end(),
+        [handle](const AttCharacteristic &chr) { return chr.value == handle; });
+    if (it == this->handles.end()) {
+      return;
+    }
+    service = it->service;
+    characteristic = it->uuid;
+  }
+
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  if (this->notify) {
+    this->notify(service, characteristic, data, length);
+  }
+}
+
+std::shared_ptr<AttClient>
+HciDevice::client(std::shared_ptr<HciController> &owner) {
+  owner = this->controller.lock();
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (!owner || !this->att) {
+    owner.reset();
+    return nullptr;
+  }
+  return this->att;
+}
+
+// Characteristic UUIDs repeat across services, as with several instances of
+// one service, so the service is matched first.
+bool HciDevice::findHandles(const std::string &service,
+                            const std::string &characteristic,
+                            AttCharacteristic &out) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const auto it =
+      std::find_if(this->handles.begin(), this->handles.end(),
+                   [&service, &characteristic](const AttCharacteristic &chr) {
+                     return chr.service == service &&
+                            chr.uuid == characteristic;
+                   });
+  if (it == this->handles.end()) {
+    return false;
+  }
+  out = *it;
+  return true;
+}
+
+bool HciDevice::configure(const std::string &service,
+                          const std::string &characteristic, uint16_t value) {
+  std::shared_ptr<HciController> owner;
+  auto att = this->client(owner);
+  AttCharacteristic handles;
+  if (!att || !this->findHandles(service, characteristic, handles) ||
+      handles.cccd == 0) {
+    return false;
+  }
+
+  const uint8_t data[2] = {static_cast<uint8_t>(value),
+                           static_cast<uint8_t>(value >> 8)};
+  return att->write(handles.cccd, data, sizeof(data), true);
+}
+
+std::shared_ptr<HciController> HciController::open(uint16_t index) {
+  const int fd =
+      socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  sockaddr_hci address = {};
+  address.hci_family = AF_BLUETOOTH;
+  address.hci_dev = index;
+  address.hci_channel = HCI_CHANNEL_USER;
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  const int wakeFd = eventfd(0, EFD_CLOEXEC);
+  if (wakeFd < 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  std::shared_ptr<HciController> controller(
+      new HciController(fd, wakeFd, index));
+  if (!controller->initialize()) {
+    return nullptr;
+  }
+  return controller;
+}
+
+HciController::HciController(int fd, int wakeFd, uint16_t index)
+    : fd(fd), wakeFd(wakeFd), hciIndex(index) {
+  this->reader = std::thread(&HciController::run, this);
+}
+
+HciController::~HciController() {
+  const uint64_t one = 1;
+  if (::write(this->wakeFd, &one, sizeof(one)) < 0) {
+    // The reader also stops once the socket closes under it.
+    shutdown(this->fd, SHUT_RDWR);
+  }
+  this->reader.join();
+
+  // Closing the user channel resets the controller, which drops every link.
+  std::map<uint16_t, std::shared_ptr<HciDevice>> links;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    links.swap(this->links);
+  }
+  for (const auto &[handle, device] : links) {
+    device->linkDown();
+  }
+  close(this->fd);
+  close(this->wakeFd);
+}
+
+uint16_t HciController::index() const { return this->hciIndex; }
+
+const std::string &HciController::address() const { return this->bdaddr; }
+
+bool HciController::initialize() {
+  // Everything the default mask reports, plus LE Meta.
+  std::vector<uint8_t> mask = {0xff, 0xff, 0xff, 0xff, 0xff, 0x1f, 0x00, 0x20};
+  std::vector<uint8_t> ret;
+  if (!this->command(HCI_RESET, {}) ||
+      !this->command(HCI_SET_EVENT_MASK, mask) ||
+      !this->command(HCI_READ_BD_ADDR, {}, &ret) || ret.size() < 7) {
+    return false;
+  }
+  this->bdaddr = addressString(&ret[1]);
+
+  // Controllers without dedicated LE buffers share the BR/EDR ones.
+  uint16_t mtu = 0;
+  uint16_t packets = 0;
+  if (this->command(HCI_LE_READ_BUFFER_SIZE, {}, &ret) && ret.size() >= 4) {
+    mtu = get16(&ret[1]);
+    packets = ret[3];
+  }
+  if ((mtu == 0 || packets == 0) &&
+      this->command(HCI_READ_BUFFER_SIZE, {}, &ret) && ret.size() >= 8) {
+    mtu = get16(&ret[1]);
+    packets = get16(&ret[4]);
+  }
+  if (mtu == 0 || packets == 0) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(this->aclMutex);
+  this->aclMtu = mtu;
+  this->aclPackets = packets;
+  this->aclCredits = packets;
+  return true;
+}
+
+void HciController::setScanCallback(ScanCallback callback) {
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  this->scanCallback = std::move(callback);
+}
+
+bool HciController::startScan() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->isScanning) {
+      return true;
+    }
+  }
+
+  // Active scanning, so that scan responses fill in names, with an interval
+  // and window of 10ms. Duplicates are not filtered: every report updates
+  // the RSSI.
+  const std::vector<uint8_t> parameters = {0x01, 0x10, 0x00, 0x10,
+                                           0x00, 0x00, 0x00};
+  if (!this->command(HCI_LE_SET_SCAN_PARAMETERS, parameters) ||
+      !this->command(HCI_LE_SET_SCAN_ENABLE, {0x01, 0x00})) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->isScanning = true;
+  this->seen.clear();
+  this->seenAddresses.clear();
+  return true;
+}
+
+bool HciController::stopScan() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->isScanning) {
+      return true;
+    }
+  }
+
+  if (!this->command(HCI_LE_SET_SCAN_ENABLE, {0x00, 0x00})) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->isScanning = false;
+  return true;
+}
+
+bool HciController::scanning() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->isScanning;
+}
+
+std::vector<std::shared_ptr<HciDevice>> HciController::results() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->seen;
+}
+
+bool HciController::command(uint16_t opcode,
+                            const std::vector<uint8_t> &params,
+                            std::vector<uint8_t> *ret) {
+  std::lock_guard<std::mutex> serial(this->commandMutex);
+  std::vector<uint8_t> packet = {HCI_COMMAND_PKT};
+  put16(packet, opcode);
+  packet.push_back(static_cast<uint8_t>(params.size()));
+  packet.insert(packet.end(), params.begin(), params.end());
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->pendingOpcode = opcode;
+  this->commandDone = false;
+  if (::write(this->fd, packet.data(), packet.size()) !=
+      static_cast<ssize_t>(packet.size())) {
+    this->pendingOpcode = 0;
+    return false;
+  }
+
+  const bool done = this->changed.wait_for(
+      lock, COMMAND_TIMEOUT, [this]() { return this->commandDone; });
+  this->pendingOpcode = 0;
+  if (!done || this->commandResult.empty()) {
+    return false;
+  }
+  if (ret != nullptr) {
+    *ret = this->commandResult;
+  }
+  // Every command used here leads its return parameters with a status.
+  return this->commandResult[0] == 0;
+}
+
+bool HciController::connect(const Advertisement &peer, uint16_t &handle) {
+  std::lock_guard<std::mutex> serial(this->connectMutex);
+  uint8_t address[6];
+  if (!parseAddress(peer.address, address)) {
+    return false;
+  }
+
+  // Scan interval and window of 60 and 30ms, connection interval of 30 to
+  // 50ms and a supervision timeout of 5s.
+  std::vector<uint8_t> parameters = {0x60, 0x00, 0x30, 0x00, 0x00};
+  parameters.push_back(peer.addressType == 1 ? 0x01 : 0x00);
+  parameters.insert(parameters.end(), address, address + 6);
+  parameters.push_back(0x00);
+  for (const uint16_t value : {0x0018, 0x0028, 0x0000, 0x01f4, 0x0000,
+                               0x0000}) {
+    put16(parameters, value);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->connectAddress = peer.address;
+    this->connectDone = false;
+  }
+  if (!this->command(HCI_LE_CREATE_CONNECTION, parameters)) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->connectAddress.clear();
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+  if (!this->changed.wait_for(lock, CONNECT_TIMEOUT,
+                              [this]() { return this->connectDone; })) {
+    // Cancelling completes the attempt, unless it won the race.
+    lock.unlock();
+    this->command(HCI_LE_CREATE_CONNECTION_CANCEL, {});
+    lock.lock();
+    this->changed.wait_for(lock, COMMAND_TIMEOUT,
+                           [this]() { return this->connectDone; });
+  }
+  this->connectAddress.clear();
+  if (!this->connectDone || this->connectStatus != 0) {
+    return false;
+  }
+  handle = this->connectHandle;
+  return true;
+}
+
+bool HciController::disconnect(uint16_t handle) {
+  // Remote User Terminated Connection.
+  std::vector<uint8_t> parameters;
+  put16(parameters, handle);
+  parameters.push_back(0x13);
+  return this->command(HCI_DISCONNECT, parameters);
+}
+
+bool HciController::sendL2cap(uint16_t handle, uint16_t cid,
+                              const std::vector<uint8_t> &payload) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->links.count(handle) == 0) {
+      return false;
+    }
+  }
+
+  std::vector<uint8_t> frame;
+  put16(frame, static_cast<uint16_t>(payload.size()));
+  put16(frame, cid);
+  frame.insert(frame.end(), payload.begin(), payload.end());
+
+  std::lock_guard<std::mutex> lock(this->aclMutex);
+  for (size_t offset = 0; offset < frame.size(); offset += this->aclMtu) {
+    const size_t size =
+        std::min<size_t>(frame.size() - offset, this->aclMtu);
+    // The first fragment is not automatically flushable, as LE requires;
+    // the rest continue it.
+    const uint16_t flags = offset == 0 ? 0x0000 : 0x1000;
+    std::vector<uint8_t> packet = {HCI_ACLDATA_PKT};
+    put16(packet, static_cast<uint16_t>(handle | flags));
+    put16(packet, static_cast<uint16_t>(size));
+    packet.insert(packet.end(), frame.begin() + offset,
+                  frame.begin() + offset + size);
+    this->aclQueue.emplace_back(handle, std::move(packet));
+  }
+  this->flushAcl();
+  return true;
+}
+
+void HciController::flushAcl() {
+  while (this->aclCredits > 0 && !this->aclQueue.empty()) {
+    auto &[handle, packet] = this->aclQueue.front();
+    if (::write(this->fd, packet.data(), packet.size()) ==
+        static_cast<ssize_t>(packet.size())) {
+      this->aclCredits--;
+      this->aclInFlight[handle]++;
+    }
+    this->aclQueue.pop_front();
+  }
+}
+
+void HciController::run() {
+  std::vector<uint8_t> buffer(4 + 65535 + 1);
+  pollfd fds[2] = {{this->fd, POLLIN, 0}, {this->wakeFd, POLLIN, 0}};
+  while (true) {
+    if (poll(fds, 2, -1) < 0 || fds[1].revents != 0 ||
+        (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) != 0) {
+      return;
+    } else if ((fds[0].revents & POLLIN) == 0) {
+      continue;
+    }
+
+    const ssize_t length = ::read(this->fd, buffer.data(), buffer.size());
+    if (length <= 0) {
+      return;
+    }
+    if (buffer[0] == HCI_EVENT_PKT && length >= 3 &&
+        static_cast<size_t>(length) >= 3u + buffer[2]) {
+      this->onEvent(&buffer[1], 2 + buffer[2]);
+    } else if (buffer[0] == HCI_ACLDATA_PKT && length >= 5 &&
+               static_cast<size_t>(length) >= 5u + get16(&buffer[3])) {
+      this->onAcl(&buffer[1], 4 + get16(&buffer[3]));
+    }
+  }
+}
+
+void HciController::onEvent(const uint8_t *data, size_t length) {
+  const uint8_t code = data[0];
+  const uint8_t *params = data + 2;
+  const size_t size = length - 2;
+  switch (code) {
+  case EVT_COMMAND_COMPLETE:
+  case EVT_COMMAND_STATUS: {
+    const size_t header = code == EVT_COMMAND_COMPLETE ? 3 : 4;
+    if (size < header) {
+      return;
+    }
+    const uint16_t opcode = get16(params + header - 2);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (opcode == 0 || opcode != this->pendingOpcode || this->commandDone) {
+      return;
+    }
+    if (code == EVT_COMMAND_COMPLETE) {
+      this->commandResult.assign(params + 3, params + size);
+    } else {
+      this->commandResult.assign(params, params + 1);
+    }
+    this->commandDone = true;
+    this->changed.notify_all();
+    break;
+  }
+  case EVT_DISCONNECTION_COMPLETE:
+    this->onDisconnectionComplete(params, size);
+    break;
+  case EVT_NUMBER_OF_COMPLETED_PACKETS:
+    this->onCompletedPackets(params, size);
+    break;
+  case EVT_LE_META:
+    this->onLeMeta(params, size);
+    break;
+  default:
+    break;
+  }
+}
+
+void HciController::onLeMeta(const uint8_t *data, size_t length) {
+  if (length < 1) {
+    return;
+  }
+  switch (data[0]) {
+  case EVT_LE_ADVERTISING_REPORT:
+    this->onAdvertisingReport(data + 1, length - 1);
+    break;
+  case EVT_LE_CONNECTION_COMPLETE:
+  case EVT_LE_ENHANCED_CONNECTION_COMPLETE:
+    // Both begin with status, handle, role and peer address.
+    this->onConnectionComplete(data + 1, length - 1);
+    break;
+  default:
+    break;
+  }
+}
+
+void HciController::onAdvertisingReport(const uint8_t *data, size_t length) {
+  if (length < 1) {
+    return;
+  }
+
+  // Reports are laid out one after the other, as every controller does,
+  // rather than as the parallel arrays of early specifications.
+  const size_t count = data[0];
+  size_t offset = 1;
+  for (size_t i = 0; i < count; i++) {
+    if (offset + 9 > length || offset + 10 + data[offset + 8] > length) {
+      return;
+    }
+    const uint8_t type = data[offset];
+    const uint8_t addressType = data[offset + 1];
+    const uint8_t *address = data + offset + 2;
+    const size_t dataLength = data[offset + 8];
+    const uint8_t *payload = data + offset + 9;
+    const int8_t rssi = static_cast<int8_t>(payload[dataLength]);
+    offset += 10 + dataLength;
+
+    const std::string key = addressString(address);
+    std::shared_ptr<HciDevice> device;
+    std::shared_ptr<Advertisement> advertisement;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      const auto previous = this->sightings.find(key);
+      if (type == SCAN_RSP && previous != this->sightings.end()) {
+        // A scan response completes the advertisement it answers.
+        advertisement = std::make_shared<Advertisement>(*previous->second);
+      } else {
+        advertisement = std::make_shared<Advertisement>();
+        advertisement->address = key;
+        // Public and random addresses, also when resolved from an IRK.
+        advertisement->addressType = addressType & 0x01;
+        advertisement->connectable =
+            type == ADV_IND || type == ADV_DIRECT_IND;
+        if (previous != this->sightings.end()) {
+          // Names often come only in scan responses.
+          advertisement->identifier = previous->second->identifier;
+        }
+      }
+      parseAdvertisingData(payload, dataLength, *advertisement);
+      advertisement->rssi = rssi;
+      advertisement->timestamp = Clock::now();
+      this->sightings[key] = advertisement;
+
+      auto &known = this->devices[key];
+      if (!known) {
+        known = std::make_shared<HciDevice>(this->weak_from_this(),
+                                            *advertisement);
+      }
+      device = known;
+      advertisement->updated = !this->seenAddresses.insert(key).second;
+      if (!advertisement->updated) {
+        this->seen.push_back(device);
+      }
+      this->prune();
+    }
+
+    std::lock_guard<std::mutex> lock(this->callbackMutex);
+    if (this->scanCallback) {
+      this->scanCallback(advertisement, device);
+    }
+  }
+}
+
+void HciController::prune() {
+  if (this->devices.size() <= MAX_DEVICES) {
+    return;
+  }
+
+  // Least recently seen first, down to three quarters of the limit. Devices
+  // referenced outside these maps, by a link or a wrapper, stay so that an
+  // address never has two.
+  std::vector<std::pair<uint64_t, std::string>> candidates;
+  for (const auto &[address, device] : this->devices) {
+    const long internal = 1 + static_cast<long>(
+                                  this->seenAddresses.count(address));
+    if (device.use_count() > internal || address == this->connectAddress) {
+      continue;
+    }
+    const auto it = this->sightings.find(address);
+    candidates.emplace_back(
+        it != this->sightings.end() ? it->second->timestamp : 0, address);
+  }
+  std::sort(candidates.begin(), candidates.end());
+
+  const size_t excess = this->devices.size() - MAX_DEVICES * 3 / 4;
+  std::unordered_set<std::string> evicted;
+  for (size_t i = 0; i < excess && i < candidates.size(); i++) {
+    const std::string &address = candidates[i].second;
+    this->devices.erase(address);
+    this->sightings.erase(address);
+    this->seenAddresses.erase(address);
+    evicted.insert(address);
+  }
+  this->seen.erase(
+      std::remove_if(this->seen.begin(), this->seen.end(),
+                     [&evicted](const std::shared_ptr<HciDevice> &device) {
+                       return evicted.count(device->info.address) != 0;
+                     }),
+      this->seen.end());
+}
+
+void HciController::onConnectionComplete(const uint8_t *data,
+                                         size_t length) {
+  if (length < 11) {
+    return;
+  }
+  const uint8_t status = data[0];
+  const uint16_t handle = get16(data + 1) & 0x0fff;
+  const std::string address = addressString(data + 5);
+
+  // Connections are only ever made to devices seen by a scan.
+  std::shared_ptr<HciDevice> device;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->devices.find(address);
+    if (status == 0 && it != this->devices.end()) {
+      device = it->second;
+      this->links[handle] = device;
+    }
+  }
+  if (device) {
+    device->linkUp(this, handle);
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (!this->connectAddress.empty() &&
+      (status != 0 || address == this->connectAddress)) {
+    this->connectDone = true;
+    this->connectStatus = status;
+    this->connectHandle = handle;
+    this->changed.notify_all();
+  }
+}
+
+void HciController::onDisconnectionComplete(const uint8_t *data,
+                                            size_t length) {
+  if (length < 4 || data[0] != 0) {
+    return;
+  }
+  const uint16_t handle = get16(data + 1) & 0x0fff;
+
+  {
+    // Packets of the link are gone, and the credits for them come back.
+    std::lock_guard<std::mutex> lock(this->aclMutex);
+    this->aclCredits += this->aclInFlight[handle];
+    this->aclInFlight.erase(handle);
+    this->aclQueue.erase(
+        std::remove_if(this->aclQueue.begin(), this->aclQueue.end(),
+                       [handle](const auto &entry) {
+                         return entry.first == handle;
+                       }),
+        this->aclQueue.end());
+    this->flushAcl();
+  }
+  this->reassembly.erase(handle);
+
+  std::shared_ptr<HciDevice> device;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->links.find(handle);
+    if (it == this->links.end()) {
+      return;
+    }
+    device = std::move(it->second);
+    this->links.erase(it);
+  }
+  device->linkDown();
+}
+
+void HciController::onCompletedPackets(const uint8_t *data, size_t length) {
+  if (length < 1 || length < 1 + 4 * static_cast<size_t>(data[0])) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(this->aclMutex);
+  for (size_t i = 0; i < data[0]; i++) {
+    const uint16_t handle = get16(data + 1 + 4 * i) & 0x0fff;
+    const uint16_t count = get16(data + 3 + 4 * i);
+    auto &inFlight = this->aclInFlight[handle];
+    const uint16_t returned = std::min(count, inFlight);
+    inFlight -= returned;
+    this->aclCredits =
+        std::min<uint16_t>(this->aclCredits + returned, this->aclPackets);
+  }
+  this->flushAcl();
+}
+
+void HciController::onAcl(const uint8_t *data, size_t length) {
+  const uint16_t header = get16(data);
+  const uint16_t handle = header & 0x0fff;
+  const uint16_t boundary = (header >> 12) & 0x03;
+  const uint8_t *payload = data + 4;
+  const size_t size = length - 4;
+
+  std::vector<uint8_t> &pending = this->reassembly[handle];
+  if (boundary == 0x01) {
+    if (pending.empty()) {
+      // Continuation of nothing.
+      return;
+    }
+    pending.insert(pending.end(), payload, payload + size);
+  } else {
+    pending.assign(payload, payload + size);
+  }
+
+  if (pending.size() < 4 || pending.size() < 4u + get16(pending.data())) {
+    return;
+  }
+  std::vector<uint8_t> frame = std::move(pending);
+  this->reassembly.erase(handle);
+  this->onL2cap(handle, frame.data(), 4 + get16(frame.data()));
+}
+
+void HciController::onL2cap(uint16_t handle, const uint8_t *data,
+                            size_t length) {
+  const uint16_t cid = get16(data + 2);
+  if (cid == L2CAP_SIGNALING_CID) {
+    this->onSignaling(handle, data + 4, length - 4);
+    return;
+  } else if (cid != L2CAP_ATT_CID) {
+    return;
+  }
+
+  std::shared_ptr<HciDevice> device;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->links.find(handle);
+    if (it == this->links.end()) {
+      return;
+    }
+    device = it->second;
+  }
+  device->receive(data + 4, length - 4);
+}
+
+void HciController::onSignaling(uint16_t handle, const uint8_t *data,
+                                size_t length) {
+  if (length < 4) {
+    return;
+  }
+  const uint8_t code = data[0];
+  const uint8_t identifier = data[1];
+
+  std::vector<uint8_t> response;
+  switch (code) {
+  case L2CAP_CONNECTION_PARAMETER_UPDATE_REQ:
+    // We keep the parameters we connected with.
+    response = {L2CAP_CONNECTION_PARAMETER_UPDATE_RSP, identifier, 0x02, 0x00,
+                0x01, 0x00};
+    break;
+  case 0x01: // Responses and indications need no answer.
+  case 0x07:
+  case 0x13:
+  case 0x15:
+  case 0x16:
+  case 0x18:
+  case 0x1a:
+    return;
+  default:
+    // Credit based channels and everything else are not understood.
+    response = {L2CAP_COMMAND_REJECT, identifier, 0x02, 0x00, 0x00, 0x00};
+    break;
+  }
+  this->sendL2cap(handle, L2CAP_SIGNALING_CID, response);
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "advertisement.h"
+#include "att.h"
+#include "gatt.h"
+#include "nativedevice.h"
+
+class HciController;
+
+// Decodes advertising data into out, adding to what it already holds. Returns
+// false when a structure overruns the data; those before it are kept.
+bool parseAdvertisingData(const uint8_t *data, size_t length,
+                          Advertisement &out);
+
+// A peripheral reached through an HciController. Connecting also exchanges
+// the MTU and discovers the attribute table, like SimpleBLE does. Operations
+// fail once the controller is gone.
+class HciDevice : public NativeDevice {
+public:
+  HciDevice(std::weak_ptr<HciController> controller,
+            Advertisement advertisement);
+
+  const Advertisement &advertisement() const override;
+  GattDatabase gatt() const override;
+  uint16_t mtu() override;
+
+  bool connect() override;
+  bool disconnect() override;
+  bool connected() override;
+
+  bool subscribe(const std::string &service, const std::string &characteristic,
+                 bool indicate) override;
+  bool unsubscribe(const std::string &service,
+                   const std::string &characteristic) override;
+  bool read(const std::string &service, const std::string &characteristic,
+            std::vector<uint8_t> &out) override;
+  bool write(const std::string &service, const std::string &characteristic,
+             const uint8_t *data, size_t length, bool response) override;
+  bool readDescriptor(const std::string &service,
+                      const std::string &characteristic,
+                      const std::string &descriptor,
+                      std::vector<uint8_t> &out) override;
+  bool writeDescriptor(const std::string &service,
+                       const std::string &characteristic,
+                       const std::string &descriptor, const uint8_t *data,
+                       size_t length) override;
+
+  void setNotifyCallback(const void *owner, NotifyCallback callback) override;
+  void clearNotifyCallback(const void *owner) override;
+  void setDisconnectCallback(const void *owner,
+                             DisconnectCallback callback) override;
+  void clearDisconnectCallback(const void *owner) override;
+
+private:
+  friend class HciController;
+
+  static constexpr uint16_t NO_CONNECTION = 0xffff;
+
+  // Called on the controller's reader thread.
+  void linkUp(HciController *controller, uint16_t handle);
+  void linkDown();
+  void receive(const uint8_t *pdu, size_t length);
+  void onNotify(uint16_t handle, const uint8_t *data, size_t length);
+
+  // Returns the client of the current link, with the controller it needs
+  // kept alive, or nulls when not connected.
+  std::shared_ptr<AttClient> client(std::shared_ptr<HciController> &owner);
+  bool findHandles(const std::string &service,
+                   const std::string &characteristic, AttCharacteristic &out);
+  bool configure(const std::string &service,
+                 const std::string &characteristic, uint16_t value);
+
+  std::weak_ptr<HciController> controller;
+  const Advertisement info;
+
+  // Serializes connect() and disconnect().
+  std::mutex linkMutex;
+  mutable std::mutex mutex;
+  std::condition_variable linkChanged;
+  uint16_t connection = NO_CONNECTION;
+  bool disconnecting = false;
+  std::shared_ptr<AttClient> att;
+  GattDatabase database;
+  std::vector<AttCharacteristic> handles;
+
+  std::mutex callbackMutex;
+  const void *notifyOwner = nullptr;
+  NotifyCallback notify;
+  const void *disconnectOwner = nullptr;
+  DisconnectCallback disconnected;
+};
+
+// LE central on a controller opened through the HCI user channel, which
+// hands this process the raw controller instead of going through BlueZ and
+// D-Bus. A reader thread handles events and ACL data; commands block for
+// their completion, one at a time.
+class HciController : public std::enable_shared_from_this<HciController> {
+public:
+  // Receives every advertising report with the device for its address. The
+  // advertisement merges the latest scan response.
+  using ScanCallback =
+      std::function<void(std::shared_ptr<const Advertisement>,
+                         std::shared_ptr<HciDevice>)>;
+
+  // Opens and resets hci<index>. Returns null when the user channel cannot
+  // be bound: the controller must be down and the process needs
+  // CAP_NET_ADMIN. Works with virtual controllers from vhci or btvirt.
+  static std::shared_ptr<HciController> open(uint16_t index);
+  ~HciController();
+
+  uint16_t index() const;
+  const std::string &address() const;
+
+  // Called on the reader thread. Replacing it waits for a call in progress.
+  void setScanCallback(ScanCallback callback);
+  bool startScan();
+  bool stopScan();
+  bool scanning();
+  // Devices seen since the scan started, in order.
+  std::vector<std::shared_ptr<HciDevice>> results();
+
+  // Addresses tracked before the least recently seen are dropped, since
+  // devices rotating resolvable private addresses never repeat one.
+  static constexpr size_t MAX_DEVICES = 1024;
+
+private:
+  friend class HciDevice;
+
+  HciController(int fd, int wakeFd, uint16_t index);
+  bool initialize();
+
+  bool command(uint16_t opcode, const std::vector<uint8_t> &params,
+               std::vector<uint8_t> *ret = nullptr);
+  bool connect(const Advertisement &peer, uint16_t &handle);
+  bool disconnect(uint16_t handle);
+  bool sendL2cap(uint16_t handle, uint16_t cid,
+                 const std::vector<uint8_t> &payload);
+  // Caller holds aclMutex.
+  void flushAcl();
+
+  void run();
+  void onEvent(const uint8_t *data, size_t length);
+  void onLeMeta(const uint8_t *data, size_t length);
+  void onAdvertisingReport(const uint8_t *data, size_t length);
+  // Caller holds mutex.
+  void prune();
+  void onConnectionComplete(const uint8_t *data, size_t length);
+  void onDisconnectionComplete(const uint8_t *data, size_t length);
+  void onCompletedPackets(const uint8_t *data, size_t length);
+  void onAcl(const uint8_t *data, size_t length);
+  void onL2cap(uint16_t handle, const uint8_t *data, size_t length);
+  void onSignaling(uint16_t handle, const uint8_t *data, size_t length);
+
+  const int fd;
+  // Wakes the reader thread to exit.
+  const int wakeFd;
+  const uint16_t hciIndex;
+  std::string bdaddr;
+  std::thread reader;
+
+  // Serializes commands and LE Create Connection respectively.
+  std::mutex commandMutex;
+  std::mutex connectMutex;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  // Command awaiting Command Complete or Status, and its return parameters.
+  uint16_t pendingOpcode = 0;
+  bool commandDone = false;
+  std::vector<uint8_t> commandResult;
+  // Connection being created, and the outcome of LE Connection Complete.
+  std::string connectAddress;
+  bool connectDone = false;
+  uint8_t connectStatus = 0;
+  uint16_t connectHandle = 0;
+  bool isScanning = false;
+  // Devices by address, so that every sighting of an address shares one
+  // link. Kept until prune() makes room for new addresses.
+  std::map<std::string, std::shared_ptr<HciDevice>> devices;
+  std::map<std::string, std::shared_ptr<const Advertisement>> sightings;
+  std::vector<std::shared_ptr<HciDevice>> seen;
+  std::unordered_set<std::string> seenAddresses;
+  std::map<uint16_t, std::shared_ptr<HciDevice>> links;
+  // Reader thread only.
+  std::map<uint16_t, std::vector<uint8_t>> reassembly;
+
+  // ACL flow control: the controller takes a limited number of packets,
+  // returned through Number Of Completed Packets. Sending never blocks, so
+  // that the reader thread can answer the peer; packets wait here instead.
+  std::mutex aclMutex;
+  uint16_t aclMtu = 27;
+  uint16_t aclPackets = 1;
+  uint16_t aclCredits = 1;
+  std::deque<std::pair<uint16_t, std::vector<uint8_t>>> aclQueue;
+  std::map<uint16_t, uint16_t> aclInFlight;
+
+  std::mutex callbackMutex;
+  ScanCallback scanCallback;
+};
@@ -0,0 +1,164 @@
+#include "keystore.h"
+#include "aes.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+
+static constexpr size_t COUNTER_LENGTH = 4;
+static constexpr size_t MIC_LENGTH = 4;
+static constexpr uint8_t BTHOME_UUID[2] = {0xd2, 0xfc};
+static constexpr uint8_t BTHOME_ENCRYPTED = 0x01;
+
+namespace {
+
+struct Entry {
+  std::shared_ptr<const Aes128> aes;
+  DecryptionStats counters;
+};
+
+struct Store {
+  std::mutex mutex;
+  std::map<std::string, Entry> entries;
+};
+
+Store &store() {
+  static Store instance;
+  return instance;
+}
+
+} // namespace
+
+static std::string normalize(const std::string &address) {
+  std::string key(address);
+  std::transform(key.begin(), key.end(), key.begin(),
+                 [](unsigned char c) { return std::toupper(c); });
+  return key;
+}
+
+// Parses "AA:BB:CC:DD:EE:FF" in display order.
+static bool addressBytes(const std::string &address, uint8_t out[6]) {
+  if (address.size() != 17) {
+    return false;
+  }
+
+  for (size_t i = 0; i < 6; i++) {
+    if (i > 0 && address[3 * i - 1] != ':') {
+      return false;
+    }
+    const std::string byte = address.substr(3 * i, 2);
+    if (!std::isxdigit(static_cast<unsigned char>(byte[0])) ||
+        !std::isxdigit(static_cast<unsigned char>(byte[1]))) {
+      return false;
+    }
+    out[i] = static_cast<uint8_t>(std::stoul(byte, nullptr, 16));
+  }
+  return true;
+}
+
+void KeyStore::set(const std::string &address, const uint8_t key[16]) {
+  auto aes = std::make_shared<const Aes128>(key);
+  std::lock_guard<std::mutex> lock(store().mutex);
+  store().entries[normalize(address)].aes = std::move(aes);
+}
+
+bool KeyStore::remove(const std::string &address) {
+  std::lock_guard<std::mutex> lock(store().mutex);
+  return store().entries.erase(normalize(address)) != 0;
+}
+
+bool KeyStore::stats(const std::string &address, DecryptionStats &out) {
+  std::lock_guard<std::mutex> lock(store().mutex);
+  const auto it = store().entries.find(normalize(address));
+  if (it == store().entries.end()) {
+    return false;
+  }
+
+  out = it->second.counters;
+  return true;
+}
+
+bool KeyStore::decrypt(const std::string &address, const uint8_t nonce[13],
+                       const uint8_t *ciphertext, size_t length,
+                       const uint8_t *mic, size_t micLength,
+                       uint8_t *plaintext) {
+  const std::string key = normalize(address);
+  std::shared_ptr<const Aes128> aes;
+  {
+    std::lock_guard<std::mutex> lock(store().mutex);
+    const auto it = store().entries.find(key);
+    if (it == store().entries.end()) {
+      return false;
+    }
+    aes = it->second.aes;
+  }
+
+  const bool ok = aesCcmDecrypt(*aes, nonce, nullptr, 0, ciphertext, length,
+                                mic, micLength, plaintext);
+
+  std::lock_guard<std::mutex> lock(store().mutex);
+  if (const auto it = store().entries.find(key); it != store().entries.end()) {
+    if (ok) {
+      it->second.counters.decrypted++;
+    } else {
+      it->second.counters.micFailures++;
+    }
+  }
+  return ok;
+}
+
+bool decryptBthome(const std::string &address, const uint8_t *data,
+                   size_t length, std::vector<uint8_t> &out) {
+  if (length < 1 + COUNTER_LENGTH + MIC_LENGTH ||
+      !(data[0] & BTHOME_ENCRYPTED)) {
+    return false;
+  }
+
+  const size_t cipherLength = length - 1 - COUNTER_LENGTH - MIC_LENGTH;
+  const uint8_t *counter = data + 1 + cipherLength;
+  uint8_t nonce[13];
+  if (!addressBytes(address, nonce)) {
+    return false;
+  }
+  std::memcpy(nonce + 6, BTHOME_UUID, 2);
+  nonce[8] = data[0];
+  std::memcpy(nonce + 9, counter, COUNTER_LENGTH);
+
+  std::vector<uint8_t> plaintext(1 + cipherLength);
+  if (!KeyStore::decrypt(address, nonce, data + 1, cipherLength,
+                         counter + COUNTER_LENGTH, MIC_LENGTH,
+                         plaintext.data() + 1)) {
+    return false;
+  }
+
+  plaintext[0] = data[0] & ~BTHOME_ENCRYPTED;
+  out = std::move(plaintext);
+  return true;
+}
+
+Transform aesCcmTransform(const std::string &address) {
+  uint8_t device[6];
+  if (!addressBytes(address, device)) {
+    return Transform();
+  }
+
+  return [address, nonce = std::vector<uint8_t>(device, device + 6)](
+             const uint8_t *data, size_t length, std::vector<uint8_t> &out) {
+    if (length < COUNTER_LENGTH + MIC_LENGTH) {
+      return false;
+    }
+
+    const size_t cipherLength = length - COUNTER_LENGTH - MIC_LENGTH;
+    uint8_t packetNonce[13] = {0};
+    std::memcpy(packetNonce, nonce.data(), 6);
+    std::memcpy(packetNonce + 6, data + cipherLength, COUNTER_LENGTH);
+
+    out.resize(cipherLength);
+    return KeyStore::decrypt(address, packetNonce, data, cipherLength,
+                             data + cipherLength + COUNTER_LENGTH, MIC_LENGTH,
+                             out.data());
+  };
+}
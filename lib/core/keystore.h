@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "transforms.h"
+
+struct DecryptionStats {
+  uint64_t decrypted = 0;
+  uint64_t micFailures = 0;
+};
+
+// AES-128 keys of encrypted devices, keyed by address. Addresses compare
+// case-insensitively.
+class KeyStore {
+public:
+  static void set(const std::string &address, const uint8_t key[16]);
+  static bool remove(const std::string &address);
+  static bool stats(const std::string &address, DecryptionStats &out);
+
+  // AES-CCM with the device's key, counting the outcome. Returns false when
+  // there is no key or the MIC does not match.
+  static bool decrypt(const std::string &address, const uint8_t nonce[13],
+                      const uint8_t *ciphertext, size_t length,
+                      const uint8_t *mic, size_t micLength,
+                      uint8_t *plaintext);
+};
+
+// Decrypts BTHome v2 service data laid out as
+//   [device info][ciphertext][u32 counter][u32 mic]
+// into [device info with the encryption flag cleared][plaintext]. Returns
+// false for plaintext payloads and when decryption is not possible.
+bool decryptBthome(const std::string &address, const uint8_t *data,
+                   size_t length, std::vector<uint8_t> &out);
+
+// Transform for notification payloads framed as
+//   [ciphertext][u32 counter LE][u32 mic]
+// with the nonce [6 address bytes][counter LE][0x00 0x00 0x00].
+Transform aesCcmTransform(const std::string &address);
@@ -0,0 +1,137 @@
+#include "merge.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <tuple>
+
+static void appendRecord(std::vector<uint8_t> &out, uint64_t timestamp,
+                         uint16_t channel, const std::vector<uint8_t> &data) {
+  const uint16_t length = static_cast<uint16_t>(data.size());
+  const size_t offset = out.size();
+  out.resize(offset + ReorderMerger::HEADER_SIZE + length);
+
+  uint8_t *p = out.data() + offset;
+  for (size_t i = 0; i < 8; i++) {
+    p[i] = static_cast<uint8_t>(timestamp >> (8 * i));
+  }
+  p[8] = static_cast<uint8_t>(channel);
+  p[9] = static_cast<uint8_t>(channel >> 8);
+  p[10] = static_cast<uint8_t>(length);
+  p[11] = static_cast<uint8_t>(length >> 8);
+  std::copy(data.begin(), data.begin() + length,
+            p + ReorderMerger::HEADER_SIZE);
+}
+
+ReorderMerger::ReorderMerger(uint64_t window, size_t capacity)
+    : window(window), capacity(capacity) {}
+
+void ReorderMerger::addChannel(uint16_t channel) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->channels[channel];
+}
+
+void ReorderMerger::removeChannel(uint16_t channel) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const auto it = this->channels.find(channel);
+  if (it == this->channels.end()) {
+    return;
+  }
+
+  this->counters.buffered -= it->second.size();
+  this->channels.erase(it);
+}
+
+void ReorderMerger::push(uint16_t channel, uint64_t timestamp,
+                         const uint8_t *data, size_t length) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const auto it = this->channels.find(channel);
+  if (it == this->channels.end()) {
+    return;
+  }
+
+  if (timestamp < this->watermark) {
+    this->counters.late++;
+    return;
+  } else if (this->counters.buffered >= this->capacity &&
+             this->releasedCount >= this->capacity) {
+    this->counters.dropped++;
+    return;
+  }
+
+  // Records of one channel normally arrive in order, so this is an append.
+  auto &queue = it->second;
+  auto position = queue.end();
+  while (position != queue.begin() &&
+         std::prev(position)->timestamp > timestamp) {
+    --position;
+  }
+  queue.insert(position,
+               Record{timestamp, std::vector<uint8_t>(data, data + length)});
+  this->counters.buffered++;
+
+  // Bound memory by releasing the oldest record ahead of the window.
+  if (this->counters.buffered > this->capacity) {
+    this->releasedCount +=
+        this->emit(std::numeric_limits<uint64_t>::max(), 1, this->released);
+    this->counters.forced++;
+  }
+}
+
+size_t ReorderMerger::emit(uint64_t cutoff, size_t limit,
+                           std::vector<uint8_t> &out) {
+  using Head = std::tuple<uint64_t, uint16_t, std::deque<Record> *>;
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+
+  for (auto &[channel, queue] : this->channels) {
+    if (!queue.empty()) {
+      heads.emplace(queue.front().timestamp, channel, &queue);
+    }
+  }
+
+  size_t count = 0;
+  while (!heads.empty() && count < limit) {
+    const auto [timestamp, channel, queue] = heads.top();
+    if (timestamp > cutoff) {
+      break;
+    }
+    heads.pop();
+
+    appendRecord(out, timestamp, channel, queue->front().data);
+    this->watermark = timestamp;
+    queue->pop_front();
+    count++;
+
+    if (!queue->empty()) {
+      heads.emplace(queue->front().timestamp, channel, queue);
+    }
+  }
+
+  this->counters.delivered += count;
+  this->counters.buffered -= count;
+  return count;
+}
+
+size_t ReorderMerger::drain(uint64_t now, std::vector<uint8_t> &out,
+                            bool flush) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const uint64_t cutoff = flush ? std::numeric_limits<uint64_t>::max()
+                          : now > this->window ? now - this->window
+                                               : 0;
+
+  // Released records are older than anything still buffered.
+  size_t count = this->releasedCount;
+  out.insert(out.end(), this->released.begin(), this->released.end());
+  this->released.clear();
+  this->releasedCount = 0;
+
+  count += this->emit(cutoff, std::numeric_limits<size_t>::max(), out);
+  return count;
+}
+
+ReorderStats ReorderMerger::stats() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->counters;
+}
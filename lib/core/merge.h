@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+struct ReorderStats {
+  uint64_t delivered = 0;
+  uint64_t late = 0;
+  uint64_t forced = 0;
+  // Refused on arrival because a full buffer's oldest records were already
+  // waiting for a drain.
+  uint64_t dropped = 0;
+  size_t buffered = 0;
+};
+
+// K-way merge of per-channel record streams on their receive timestamps.
+// Records are held for `window` nanoseconds so that stragglers from other
+// channels can still be ordered ahead of them; anything arriving older than
+// the last delivered record is dropped and counted as late. A push beyond
+// `capacity` buffered records releases the oldest early, to go out with the
+// next drain; once `capacity` records are waiting that way, further arrivals
+// are dropped until the drain.
+//
+// Drained records are packed back to back as
+//   [u64 timestamp][u16 channel][u16 length][payload]
+// with little-endian integers.
+class ReorderMerger {
+public:
+  static constexpr size_t HEADER_SIZE = 12;
+
+  ReorderMerger(uint64_t window, size_t capacity);
+
+  void addChannel(uint16_t channel);
+  void removeChannel(uint16_t channel);
+  void push(uint16_t channel, uint64_t timestamp, const uint8_t *data,
+            size_t length);
+  // Appends every record older than now - window (or everything when flush
+  // is set) to out in timestamp order. Returns the number of records.
+  size_t drain(uint64_t now, std::vector<uint8_t> &out, bool flush = false);
+  ReorderStats stats();
+
+private:
+  struct Record {
+    uint64_t timestamp;
+    std::vector<uint8_t> data;
+  };
+
+  size_t emit(uint64_t cutoff, size_t limit, std::vector<uint8_t> &out);
+
+  std::mutex mutex;
+  std::map<uint16_t, std::deque<Record>> channels;
+  // Records released early, packed for the next drain.
+  std::vector<uint8_t> released;
+  size_t releasedCount = 0;
+  uint64_t window;
+  size_t capacity;
+  uint64_t watermark = 0;
+  ReorderStats counters;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "advertisement.h"
+#include "gatt.h"
+
+// A peripheral driven by this library rather than by SimpleBLE: a simulated
+// device, or one reached over a raw HCI controller. Characteristics are
+// addressed by service and characteristic UUID, lowercase and fully
+// expanded.
+class NativeDevice {
+public:
+  using NotifyCallback = std::function<void(
+      const std::string &service, const std::string &characteristic,
+      const uint8_t *data, size_t length)>;
+  using DisconnectCallback = std::function<void()>;
+
+  virtual ~NativeDevice() = default;
+
+  // The sighting the device was created from. It does not change, so that
+  // it may be aliased for as long as the device lives.
+  virtual const Advertisement &advertisement() const = 0;
+  virtual GattDatabase gatt() const = 0;
+  virtual uint16_t mtu() = 0;
+
+  // Blocking, like their SimpleBLE counterparts.
+  virtual bool connect() = 0;
+  virtual bool disconnect() = 0;
+  virtual bool connected() = 0;
+
+  virtual bool subscribe(const std::string &service,
+                         const std::string &characteristic,
+                         bool indicate) = 0;
+  virtual bool unsubscribe(const std::string &service,
+                           const std::string &characteristic) = 0;
+  virtual bool read(const std::string &service,
+                    const std::string &characteristic,
+                    std::vector<uint8_t> &out) = 0;
+  virtual bool write(const std::string &service,
+                     const std::string &characteristic, const uint8_t *data,
+                     size_t length, bool response) = 0;
+  // Devices without descriptors fail every read and write.
+  virtual bool readDescriptor(const std::string &service,
+                              const std::string &characteristic,
+                              const std::string &descriptor,
+                              std::vector<uint8_t> &out) {
+    return false;
+  }
+  virtual bool writeDescriptor(const std::string &service,
+                               const std::string &characteristic,
+                               const std::string &descriptor,
+                               const uint8_t *data, size_t length) {
+    return false;
+  }
+
+  // Like a SimpleBLE handle, the most recent owner receives notifications.
+  // Clearing only succeeds for the current owner.
+  virtual void setNotifyCallback(const void *owner,
+                                 NotifyCallback callback) = 0;
+  virtual void clearNotifyCallback(const void *owner) = 0;
+
+  // Reports links lost without disconnect() being called, under the same
+  // ownership rules. Devices that never lose their link ignore it.
+  virtual void setDisconnectCallback(const void *owner,
+                                     DisconnectCallback callback) {}
+  virtual void clearDisconnectCallback(const void *owner) {}
+};
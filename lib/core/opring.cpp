@@ -0,0 +1,151 @@
+#include "opring.h"
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "ring counters are shared with JS Atomics");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "ring counters must be plain u32 in shared memory");
+
+static uint16_t readU16(const uint8_t *data) {
+  return uint16_t(data[0]) | uint16_t(data[1]) << 8;
+}
+
+static uint32_t readU32(const uint8_t *data) {
+  return uint32_t(data[0]) | uint32_t(data[1]) << 8 |
+         uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24;
+}
+
+static void writeU32(uint8_t *data, uint32_t value) {
+  data[0] = value & 0xff;
+  data[1] = (value >> 8) & 0xff;
+  data[2] = (value >> 16) & 0xff;
+  data[3] = (value >> 24) & 0xff;
+}
+
+uint32_t OpRing::entryCount(uint32_t requested) {
+  uint32_t count = 1;
+  while (count < requested && count < MAX_ENTRIES) {
+    count <<= 1;
+  }
+  return count;
+}
+
+size_t OpRing::byteLength(uint32_t entries, uint32_t dataSize) {
+  const size_t count = entryCount(entries);
+  return HEADER_SIZE + count * ENTRY_SIZE + 2 * count * COMPLETION_SIZE +
+         dataSize;
+}
+
+OpRing::OpRing(uint8_t *memory, uint32_t entries, uint32_t dataSize)
+    : memory(memory), sqEntries(entryCount(entries)),
+      cqEntries(2 * sqEntries), dataBytes(dataSize) {}
+
+uint32_t OpRing::entries() const { return this->sqEntries; }
+
+uint32_t OpRing::completions() const { return this->cqEntries; }
+
+size_t OpRing::sqOffset() const { return HEADER_SIZE; }
+
+size_t OpRing::cqOffset() const {
+  return this->sqOffset() + size_t(this->sqEntries) * ENTRY_SIZE;
+}
+
+size_t OpRing::dataOffset() const {
+  return this->cqOffset() + size_t(this->cqEntries) * COMPLETION_SIZE;
+}
+
+uint32_t OpRing::dataSize() const { return this->dataBytes; }
+
+std::atomic<uint32_t> &OpRing::counter(size_t offset) {
+  return *reinterpret_cast<std::atomic<uint32_t> *>(this->memory + offset);
+}
+
+size_t OpRing::consume(std::vector<RingEntry> &out) {
+  std::atomic<uint32_t> &head = this->counter(SQ_HEAD);
+  const uint32_t tail =
+      this->counter(SQ_TAIL).load(std::memory_order_acquire);
+  uint32_t position = head.load(std::memory_order_relaxed);
+
+  // A tail that runs further ahead than the ring is a producer bug; only
+  // the last ring's worth of entries can still be intact.
+  if (tail - position > this->sqEntries) {
+    position = tail - this->sqEntries;
+  }
+
+  const size_t count = tail - position;
+  const uint8_t *entries = this->memory + this->sqOffset();
+  for (; position != tail; position++) {
+    const uint8_t *entry =
+        entries + size_t(position & (this->sqEntries - 1)) * ENTRY_SIZE;
+    out.push_back(RingEntry{readU16(entry), entry[2], entry[3],
+                            readU32(entry + 4), readU32(entry + 8),
+                            readU32(entry + 12)});
+  }
+  head.store(tail, std::memory_order_release);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->counters.submitted += count;
+  return count;
+}
+
+bool OpRing::publish(const RingCompletion &completion) {
+  std::atomic<uint32_t> &tail = this->counter(CQ_TAIL);
+  const uint32_t head =
+      this->counter(CQ_HEAD).load(std::memory_order_acquire);
+  const uint32_t position = tail.load(std::memory_order_relaxed);
+  if (position - head >= this->cqEntries) {
+    return false;
+  }
+
+  uint8_t *entry = this->memory + this->cqOffset() +
+                   size_t(position & (this->cqEntries - 1)) * COMPLETION_SIZE;
+  writeU32(entry, completion.user);
+  writeU32(entry + 4, static_cast<uint32_t>(completion.result));
+  writeU32(entry + 8, completion.length);
+  writeU32(entry + 12, completion.reserved);
+  tail.store(position + 1, std::memory_order_release);
+  this->counters.completed++;
+  return true;
+}
+
+bool OpRing::complete(const RingCompletion &completion) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  // Held completions go first, so that none overtakes another.
+  while (!this->overflow.empty() && this->publish(this->overflow.front())) {
+    this->overflow.pop_front();
+  }
+  if (this->overflow.empty() && this->publish(completion)) {
+    return true;
+  }
+
+  if (this->overflow.size() >= this->cqEntries) {
+    this->counters.dropped++;
+    return false;
+  }
+  this->overflow.push_back(completion);
+  this->counters.overflowed++;
+  return false;
+}
+
+size_t OpRing::flush() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  size_t published = 0;
+  while (!this->overflow.empty() && this->publish(this->overflow.front())) {
+    this->overflow.pop_front();
+    published++;
+  }
+  return published;
+}
+
+uint8_t *OpRing::data(uint32_t offset, uint32_t length) {
+  if (uint64_t(offset) + length > this->dataBytes) {
+    return nullptr;
+  }
+  return this->memory + this->dataOffset() + offset;
+}
+
+OpRingStats OpRing::stats() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  OpRingStats stats = this->counters;
+  stats.pending = this->overflow.size();
+  return stats;
+}
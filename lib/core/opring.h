@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// One submitted operation, as laid out in the submission ring:
+//   [u16 handle][u8 opcode][u8 flags][u32 user][u32 offset][u32 length]
+// offset and length select the payload (or, for reads, the destination) in
+// the data area.
+struct RingEntry {
+  uint16_t handle;
+  uint8_t opcode;
+  uint8_t flags;
+  uint32_t user;
+  uint32_t offset;
+  uint32_t length;
+};
+
+// One finished operation, as laid out in the completion ring:
+//   [u32 user][i32 result][u32 length][u32 reserved]
+struct RingCompletion {
+  uint32_t user;
+  int32_t result;
+  uint32_t length;
+  uint32_t reserved;
+};
+
+struct OpRingStats {
+  uint64_t submitted = 0;
+  uint64_t completed = 0;
+  // Completions that found the completion ring full and had to wait.
+  uint64_t overflowed = 0;
+  // Completions lost because as many as the ring holds were already waiting.
+  uint64_t dropped = 0;
+  size_t pending = 0;
+};
+
+// Submission and completion rings over memory shared with another thread
+// that owns the other end of each, in the manner of io_uring. The producer
+// writes entries and then publishes them by storing the tail; the consumer
+// reads them and then frees them by storing the head. Heads and tails are
+// free-running u32 counters, each on its own cache line of the header:
+//   [sq head @0][sq tail @64][cq head @128][cq tail @192]
+// followed by the submission entries, the completion entries (twice as
+// many) and the data area. Integers are little-endian.
+//
+// The submission ring is consumed and the completion ring produced here;
+// completions that do not fit are held until the other side frees space, up
+// to another ring's worth, beyond which they are dropped and counted.
+class OpRing {
+public:
+  static constexpr size_t HEADER_SIZE = 256;
+  static constexpr size_t SQ_HEAD = 0;
+  static constexpr size_t SQ_TAIL = 64;
+  static constexpr size_t CQ_HEAD = 128;
+  static constexpr size_t CQ_TAIL = 192;
+  static constexpr size_t ENTRY_SIZE = 16;
+  static constexpr size_t COMPLETION_SIZE = 16;
+  static constexpr uint32_t MAX_ENTRIES = 32768;
+
+  // Entries are rounded up to a power of two within [1, MAX_ENTRIES].
+  static uint32_t entryCount(uint32_t requested);
+  // Bytes of shared memory needed for entryCount(entries) entries.
+  static size_t byteLength(uint32_t entries, uint32_t dataSize);
+
+  // memory must be byteLength(entries, dataSize) zeroed bytes that outlive
+  // the ring.
+  OpRing(uint8_t *memory, uint32_t entries, uint32_t dataSize);
+
+  uint32_t entries() const;
+  uint32_t completions() const;
+  size_t sqOffset() const;
+  size_t cqOffset() const;
+  size_t dataOffset() const;
+  uint32_t dataSize() const;
+
+  // Appends the entries submitted since the last call to out and frees
+  // their slots. Returns how many there were.
+  size_t consume(std::vector<RingEntry> &out);
+  // Publishes a completion, or holds or drops it when the completion ring is
+  // full. Returns false in the latter cases.
+  bool complete(const RingCompletion &completion);
+  // Publishes held completions that now fit. Returns how many it published.
+  size_t flush();
+  // The given span of the data area, or null when it does not fit.
+  uint8_t *data(uint32_t offset, uint32_t length);
+  OpRingStats stats();
+
+private:
+  std::atomic<uint32_t> &counter(size_t offset);
+  bool publish(const RingCompletion &completion);
+
+  uint8_t *const memory;
+  const uint32_t sqEntries;
+  const uint32_t cqEntries;
+  const uint32_t dataBytes;
+
+  // Serializes producers of completions.
+  std::mutex mutex;
+  std::deque<RingCompletion> overflow;
+  OpRingStats counters;
+};
@@ -0,0 +1,61 @@
+#include "pipeline.h"
+
+OrderedPipeline::OrderedPipeline(Transform transform, Output output,
+                                 ThreadPool *pool, size_t maxInFlight)
+    : transform(std::move(transform)), output(std::move(output)), pool(pool),
+      maxInFlight(maxInFlight) {}
+
+void OrderedPipeline::submit(const uint8_t *data, size_t length,
+                             uint64_t timestamp) {
+  uint64_t sequence;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->nextSequence - this->nextOutput >= this->maxInFlight) {
+      this->counters.dropped++;
+      return;
+    }
+    sequence = this->nextSequence++;
+    this->counters.submitted++;
+  }
+
+  if (this->pool == nullptr) {
+    Result result;
+    result.ok = this->transform(data, length, result.data);
+    result.timestamp = timestamp;
+    this->complete(sequence, std::move(result));
+    return;
+  }
+
+  auto self = this->shared_from_this();
+  std::vector<uint8_t> input(data, data + length);
+  this->pool->submit([self, sequence, timestamp, input = std::move(input)]() {
+    Result result;
+    result.ok = self->transform(input.data(), input.size(), result.data);
+    result.timestamp = timestamp;
+    self->complete(sequence, std::move(result));
+  });
+}
+
+void OrderedPipeline::complete(uint64_t sequence, Result result) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->ready.emplace(sequence, std::move(result));
+
+  // Output runs under the lock so that results leave in sequence order.
+  auto it = this->ready.begin();
+  while (it != this->ready.end() && it->first == this->nextOutput) {
+    if (it->second.ok) {
+      this->output(it->second.data.data(), it->second.data.size(),
+                   it->second.timestamp);
+      this->counters.delivered++;
+    } else {
+      this->counters.failed++;
+    }
+    it = this->ready.erase(it);
+    this->nextOutput++;
+  }
+}
+
+PipelineStats OrderedPipeline::stats() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->counters;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "threadpool.h"
+#include "transforms.h"
+
+struct PipelineStats {
+  uint64_t submitted = 0;
+  uint64_t delivered = 0;
+  uint64_t failed = 0;
+  uint64_t dropped = 0;
+};
+
+// Transforms the packets of one subscription on a thread pool and hands the
+// results to output in submission order. At most maxInFlight packets are
+// outstanding; further packets are dropped until the backlog clears. Without
+// a pool, cheap transforms run inline on the submitting thread.
+class OrderedPipeline : public std::enable_shared_from_this<OrderedPipeline> {
+public:
+  using Output = std::function<void(const uint8_t *data, size_t length,
+                                    uint64_t timestamp)>;
+
+  OrderedPipeline(Transform transform, Output output,
+                  ThreadPool *pool = &ThreadPool::shared(),
+                  size_t maxInFlight = 256);
+
+  // The timestamp travels with the packet untouched.
+  void submit(const uint8_t *data, size_t length, uint64_t timestamp = 0);
+  PipelineStats stats();
+
+private:
+  struct Result {
+    bool ok;
+    std::vector<uint8_t> data;
+    uint64_t timestamp;
+  };
+
+  void complete(uint64_t sequence, Result result);
+
+  Transform transform;
+  Output output;
+  ThreadPool *pool;
+  size_t maxInFlight;
+
+  std::mutex mutex;
+  uint64_t nextSequence = 0;
+  uint64_t nextOutput = 0;
+  std::map<uint64_t, Result> ready;
+  PipelineStats counters;
+};
@@ -0,0 +1,16 @@
+#include "quota.h"
+
+#include <mutex>
+
+static std::mutex defaultsMutex;
+static PeripheralQuota defaultQuota;
+
+PeripheralQuota PeripheralQuota::defaults() {
+  std::lock_guard<std::mutex> lock(defaultsMutex);
+  return defaultQuota;
+}
+
+void PeripheralQuota::setDefaults(const PeripheralQuota &quota) {
+  std::lock_guard<std::mutex> lock(defaultsMutex);
+  defaultQuota = quota;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+// Caps on what one peripheral may hold natively. Zero means unlimited for
+// every field but history.
+struct PeripheralQuota {
+  // Notification bytes queued for JS. Arrivals that do not fit are dropped
+  // and counted like queue overflows. Payloads of batched operations waiting
+  // to run count separately against the same limit.
+  size_t queuedBytes = 0;
+  // Estimated size of the attribute table. A larger table is still diffed
+  // by refreshServices() but not cached.
+  size_t gattBytes = 0;
+  // Flight recorder events, rounded down to a power of two.
+  size_t history = 256;
+  // Characteristics subscribed at once. Further subscriptions fail; the
+  // existing ones are kept when the quota is lowered.
+  size_t subscriptions = 0;
+
+  // Quota of peripherals created afterwards. Their history ring is allocated
+  // with this size, so a peripheral's own quota can only shrink it.
+  static PeripheralQuota defaults();
+  static void setDefaults(const PeripheralQuota &quota);
+};
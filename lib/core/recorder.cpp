@@ -0,0 +1,183 @@
+#include "recorder.h"
+#include "clock.h"
+#include "threadpool.h"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+static std::mutex dumpDirectoryMutex;
+static std::string dumpDirectory;
+
+static uint32_t uuidTag(const char *uuid) {
+  uint32_t tag = 0;
+  if (uuid == nullptr) {
+    return tag;
+  }
+
+  for (size_t i = 0; i < 8 && uuid[i] != '\0'; i++) {
+    const char c = uuid[i];
+    uint32_t nibble;
+    if (c >= '0' && c <= '9') {
+      nibble = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      nibble = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      nibble = c - 'A' + 10;
+    } else {
+      break;
+    }
+    tag = (tag << 4) | nibble;
+  }
+  return tag;
+}
+
+FlightRecorder::FlightRecorder(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  this->slots = std::make_unique<Slot[]>(size);
+  this->allocated = size;
+  this->mask = size - 1;
+}
+
+size_t FlightRecorder::setCapacity(size_t capacity) {
+  size_t size = this->allocated;
+  while (size > 1 && size > capacity) {
+    size >>= 1;
+  }
+  this->mask.store(size - 1, std::memory_order_relaxed);
+  return size;
+}
+
+size_t FlightRecorder::capacity() const {
+  return this->mask.load(std::memory_order_relaxed) + 1;
+}
+
+uint64_t FlightRecorder::timestamp() { return Clock::now(); }
+
+void FlightRecorder::record(RecorderEventType type, const char *uuid,
+                            size_t length, int status, uint64_t start) {
+  RecorderEvent event;
+  event.timestamp = timestamp();
+  event.duration =
+      start != 0 ? static_cast<uint32_t>((event.timestamp - start) / 1000) : 0;
+  event.length = static_cast<uint32_t>(length);
+  event.tag = uuidTag(uuid);
+  event.type = static_cast<uint16_t>(type);
+  event.status = static_cast<int16_t>(status);
+
+  uint64_t words[WORDS];
+  std::memcpy(words, &event, sizeof(event));
+
+  const uint64_t index = this->head.fetch_add(1, std::memory_order_relaxed);
+  Slot &slot =
+      this->slots[index & this->mask.load(std::memory_order_relaxed)];
+  slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < WORDS; i++) {
+    slot.words[i].store(words[i], std::memory_order_relaxed);
+  }
+  slot.sequence.store(index * 2 + 2, std::memory_order_release);
+}
+
+std::vector<RecorderEvent> FlightRecorder::snapshot() const {
+  const uint64_t end = this->head.load(std::memory_order_acquire);
+  const uint64_t mask = this->mask.load(std::memory_order_relaxed);
+  const uint64_t capacity = mask + 1;
+  const uint64_t begin = end > capacity ? end - capacity : 0;
+
+  std::vector<RecorderEvent> events;
+  events.reserve(end - begin);
+
+  for (uint64_t index = begin; index < end; index++) {
+    const Slot &slot = this->slots[index & mask];
+    const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+    if (before != index * 2 + 2) {
+      // Still being written, or already overwritten by a newer event.
+      continue;
+    }
+
+    uint64_t words[WORDS];
+    for (size_t i = 0; i < WORDS; i++) {
+      words[i] = slot.words[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != before) {
+      continue;
+    }
+
+    RecorderEvent event;
+    std::memcpy(&event, words, sizeof(event));
+    events.push_back(event);
+  }
+
+  return events;
+}
+
+bool FlightRecorder::dump(const std::string &path,
+                          const std::string &address) const {
+  return write(path, address, this->snapshot());
+}
+
+bool FlightRecorder::dumpInBackground(const std::string &path,
+                                      const std::string &address) {
+  const uint64_t now = Clock::now();
+  uint64_t last = this->lastDump.load(std::memory_order_relaxed);
+  do {
+    if (last != 0 && now - last < DUMP_INTERVAL) {
+      return false;
+    }
+  } while (!this->lastDump.compare_exchange_weak(last, now == 0 ? 1 : now,
+                                                 std::memory_order_relaxed));
+
+  ThreadPool::io().submit(
+      [path, address, events = this->snapshot()]() {
+        write(path, address, events);
+      });
+  return true;
+}
+
+bool FlightRecorder::write(const std::string &path, const std::string &address,
+                           const std::vector<RecorderEvent> &events) {
+  RecorderHeader header = {};
+  std::memcpy(header.magic, "WBFR", sizeof(header.magic));
+  header.version = 1;
+  header.recordSize = sizeof(RecorderEvent);
+  header.count = static_cast<uint32_t>(events.size());
+  std::strncpy(header.address, address.c_str(), sizeof(header.address) - 1);
+
+  FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  if (ok && !events.empty()) {
+    ok = std::fwrite(events.data(), sizeof(RecorderEvent), events.size(),
+                     file) == events.size();
+  }
+  return std::fclose(file) == 0 && ok;
+}
+
+void FlightRecorder::setDumpDirectory(const std::string &directory) {
+  std::lock_guard<std::mutex> lock(dumpDirectoryMutex);
+  dumpDirectory = directory;
+}
+
+std::string FlightRecorder::dumpPath(const std::string &address) {
+  std::lock_guard<std::mutex> lock(dumpDirectoryMutex);
+  if (dumpDirectory.empty()) {
+    return "";
+  }
+
+  std::string name = address;
+  for (auto &c : name) {
+    if (c == ':' || c == '/' || c == '\\') {
+      c = '-';
+    }
+  }
+  return dumpDirectory + "/" + name + ".wbfr";
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class RecorderEventType : uint16_t {
+  Connect = 1,
+  Disconnect,
+  Connected,
+  Disconnected,
+  Read,
+  WriteRequest,
+  WriteCommand,
+  Notify,
+  Indicate,
+  Unsubscribe,
+  ReadDescriptor,
+  WriteDescriptor,
+  NotifyReceived,
+  IndicateReceived,
+};
+
+// Fixed-size record, written to dump files as-is (host byte order).
+struct RecorderEvent {
+  uint64_t timestamp; // Clock::now()
+  uint32_t duration;  // microseconds, 0 for instantaneous events
+  uint32_t length;    // payload bytes
+  uint32_t tag;       // leading 32 bits of the characteristic UUID
+  uint16_t type;      // RecorderEventType
+  int16_t status;     // simpleble_err_t for operations
+};
+static_assert(sizeof(RecorderEvent) == 24, "RecorderEvent must stay packed");
+
+struct RecorderHeader {
+  char magic[4]; // "WBFR"
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t count;
+  uint32_t reserved;
+  char address[24];
+};
+
+// Always-on ring of the most recent events for one peripheral. Writers claim
+// a slot with a single atomic increment and publish it through a per-slot
+// sequence number, so recording never blocks and readers never see torn
+// records.
+class FlightRecorder {
+public:
+  explicit FlightRecorder(size_t capacity = 256);
+
+  // Limits the ring to the most recent capacity events, rounded down to a
+  // power of two and at most the size allocated at construction. Returns
+  // the capacity in effect.
+  size_t setCapacity(size_t capacity);
+  size_t capacity() const;
+
+  static uint64_t timestamp();
+
+  // Events recorded with a non-zero start get the elapsed time as duration.
+  void record(RecorderEventType type, const char *uuid = nullptr,
+              size_t length = 0, int status = 0, uint64_t start = 0);
+  std::vector<RecorderEvent> snapshot() const;
+  bool dump(const std::string &path, const std::string &address) const;
+  // Snapshots the ring and writes it on the I/O thread pool, so that it
+  // may be called from the JS or BLE thread. Dumps within DUMP_INTERVAL of
+  // the previous one are skipped, so a burst of failures writes one file.
+  // Returns false when skipped.
+  bool dumpInBackground(const std::string &path, const std::string &address);
+
+  // Nanoseconds.
+  static constexpr uint64_t DUMP_INTERVAL = 1000000000;
+
+  // Directory for automatic dumps on disconnect or failed operations; empty
+  // disables them.
+  static void setDumpDirectory(const std::string &directory);
+  static std::string dumpPath(const std::string &address);
+
+private:
+  static constexpr size_t WORDS = sizeof(RecorderEvent) / sizeof(uint64_t);
+
+  struct Slot {
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<uint64_t> words[WORDS];
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  size_t allocated;
+  // Writers racing a capacity change may still use the old mask; both stay
+  // within the allocation, and readers skip slots whose sequence does not
+  // match.
+  std::atomic<size_t> mask;
+  std::atomic<uint64_t> head{0};
+  // Time of the last background dump, 0 before the first.
+  std::atomic<uint64_t> lastDump{0};
+
+  static bool write(const std::string &path, const std::string &address,
+                    const std::vector<RecorderEvent> &events);
+};
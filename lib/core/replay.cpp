@@ -0,0 +1,81 @@
+#include "replay.h"
+#include "clock.h"
+
+#include <mutex>
+
+struct ScanReplay::Session {
+  std::mutex mutex;
+  Callback callback;
+  std::vector<Advertisement> advertisements;
+  size_t next = 0;
+  double speed = 0;
+  // Clock time of the first record.
+  uint64_t base = 0;
+  // Pending timer, 0 when there is none.
+  uint64_t timer = 0;
+};
+
+ScanReplay::~ScanReplay() { this->stop(); }
+
+size_t ScanReplay::start(std::vector<Advertisement> advertisements,
+                         double speed, Callback callback) {
+  this->stop();
+  auto session = std::make_shared<Session>();
+  session->callback = std::move(callback);
+  session->advertisements = std::move(advertisements);
+  session->speed = speed;
+  session->base = Clock::now();
+
+  std::lock_guard<std::mutex> lock(session->mutex);
+  scheduleNext(session);
+  this->session = session;
+  return session->advertisements.size();
+}
+
+void ScanReplay::scheduleNext(const std::shared_ptr<Session> &session) {
+  session->timer = 0;
+  if (session->next >= session->advertisements.size()) {
+    return;
+  }
+
+  const Advertisement &advertisement = session->advertisements[session->next];
+  const uint64_t deadline =
+      session->base +
+      (session->speed > 0
+           ? static_cast<uint64_t>(advertisement.timestamp / session->speed)
+           : 0);
+  std::weak_ptr<Session> weak = session;
+  session->timer = Clock::schedule(deadline, [weak]() {
+    auto session = weak.lock();
+    if (!session) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (!session->callback) {
+      return;
+    }
+
+    auto advertisement = std::make_shared<Advertisement>(
+        std::move(session->advertisements[session->next++]));
+    advertisement->timestamp = Clock::now();
+    std::shared_ptr<const Advertisement> snapshot = std::move(advertisement);
+    scheduleNext(session);
+    session->callback(snapshot);
+  });
+}
+
+void ScanReplay::stop() {
+  // Keep the session alive until its lock is released.
+  std::shared_ptr<Session> session = std::move(this->session);
+  if (!session) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(session->mutex);
+  if (session->timer != 0) {
+    Clock::cancel(session->timer);
+  }
+  session->callback = nullptr;
+  session->advertisements.clear();
+}
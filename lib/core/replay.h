@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "advertisement.h"
+
+// Plays captured advertisements back on Clock timers, preserving their
+// relative timing. One timer is pending at a time: each firing delivers a
+// record and schedules the next. Destroying the replay or calling stop()
+// detaches the callback, so a timer already firing drops its advertisement.
+class ScanReplay {
+public:
+  using Callback = std::function<void(std::shared_ptr<const Advertisement>)>;
+
+  ~ScanReplay();
+
+  // Replaces any replay in progress. Capture timestamps are relative to the
+  // first record; a speed of 0 delivers everything as fast as possible.
+  // Advertisements are delivered stamped with the Clock time they play at,
+  // like live sightings.
+  // Returns the number of advertisements scheduled.
+  size_t start(std::vector<Advertisement> advertisements, double speed,
+               Callback callback);
+  void stop();
+
+private:
+  struct Session;
+  std::shared_ptr<Session> session;
+
+  // Caller holds the session's mutex.
+  static void scheduleNext(const std::shared_ptr<Session> &session);
+};
@@ -0,0 +1,86 @@
+#include "scanfilter.h"
+
+#include <algorithm>
+
+bool DataPrefix::matches(const std::vector<uint8_t> &data) const {
+  if (data.size() < this->prefix.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < this->prefix.size(); i++) {
+    const uint8_t mask = i < this->mask.size() ? this->mask[i] : 0xff;
+    if ((data[i] & mask) != (this->prefix[i] & mask)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ScanFilterClause::matches(const Advertisement &advertisement) const {
+  if (this->matchName && advertisement.identifier != this->name) {
+    return false;
+  }
+  if (advertisement.identifier.compare(0, this->namePrefix.size(),
+                                       this->namePrefix) != 0) {
+    return false;
+  }
+
+  for (const auto &service : this->services) {
+    if (std::none_of(advertisement.serviceData.begin(),
+                     advertisement.serviceData.end(),
+                     [&service](const auto &data) {
+                       return data.first == service;
+                     })) {
+      return false;
+    }
+  }
+
+  for (const auto &[company, prefix] : this->manufacturerData) {
+    if (std::none_of(advertisement.manufacturerData.begin(),
+                     advertisement.manufacturerData.end(),
+                     [&company = company, &prefix = prefix](const auto &data) {
+                       return data.first == company &&
+                              prefix.matches(data.second);
+                     })) {
+      return false;
+    }
+  }
+
+  for (const auto &[service, prefix] : this->serviceData) {
+    if (std::none_of(advertisement.serviceData.begin(),
+                     advertisement.serviceData.end(),
+                     [&service = service, &prefix = prefix](const auto &data) {
+                       return data.first == service &&
+                              prefix.matches(data.second);
+                     })) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void ScanFilter::add(ScanFilterClause clause) {
+  this->clauses.push_back(std::move(clause));
+}
+
+void ScanFilter::addAddress(std::string address) {
+  this->addresses.insert(std::move(address));
+}
+
+bool ScanFilter::empty() const {
+  return this->clauses.empty() && this->addresses.empty();
+}
+
+size_t ScanFilter::addressCount() const { return this->addresses.size(); }
+
+bool ScanFilter::matches(const Advertisement &advertisement) const {
+  if (!this->addresses.empty() &&
+      this->addresses.count(advertisement.address) == 0) {
+    return false;
+  }
+  return this->clauses.empty() ||
+         std::any_of(this->clauses.begin(), this->clauses.end(),
+                     [&advertisement](const ScanFilterClause &clause) {
+                       return clause.matches(advertisement);
+                     });
+}
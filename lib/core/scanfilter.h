@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "advertisement.h"
+
+// Prefix match of advertised data. Bits clear in mask are ignored; a missing
+// mask byte counts as 0xff.
+struct DataPrefix {
+  std::vector<uint8_t> prefix;
+  std::vector<uint8_t> mask;
+
+  bool matches(const std::vector<uint8_t> &data) const;
+};
+
+// One Web Bluetooth BluetoothLEScanFilter. Every part that is set must
+// match. UUIDs are lowercase and fully expanded.
+struct ScanFilterClause {
+  bool matchName = false;
+  std::string name;
+  std::string namePrefix;
+  std::vector<std::string> services;
+  std::vector<std::pair<uint16_t, DataPrefix>> manufacturerData;
+  std::vector<std::pair<std::string, DataPrefix>> serviceData;
+
+  bool matches(const Advertisement &advertisement) const;
+};
+
+// Filter list compiled once and evaluated on the scan callback thread.
+class ScanFilter {
+public:
+  void add(ScanFilterClause clause);
+  // Restricts matches to these addresses, on top of the clauses.
+  void addAddress(std::string address);
+  bool empty() const;
+  size_t addressCount() const;
+  // True when any clause matches; an empty filter matches everything.
+  bool matches(const Advertisement &advertisement) const;
+
+private:
+  std::vector<ScanFilterClause> clauses;
+  std::unordered_set<std::string> addresses;
+};
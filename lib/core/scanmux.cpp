@@ -0,0 +1,102 @@
+#include "scanmux.h"
+#include "clock.h"
+
+ScanMultiplexer::~ScanMultiplexer() {
+  std::lock_guard<std::mutex> lock(this->state->mutex);
+  for (const auto &[id, session] : this->state->sessions) {
+    Clock::cancel(session.timer);
+  }
+  this->state->sessions.clear();
+}
+
+uint32_t ScanMultiplexer::open(ScanFilter filter, Options options,
+                               Callback callback) {
+  std::lock_guard<std::mutex> lock(this->state->mutex);
+  const uint32_t id = this->state->nextId++;
+  Session &session = this->state->sessions[id];
+  session.filter = std::move(filter);
+  session.options = std::move(options);
+  session.callback = std::move(callback);
+  session.lastNew = Clock::now();
+  if (session.options.quietPeriod != 0 && session.options.done) {
+    armQuietTimer(this->state, id, session);
+  }
+  return id;
+}
+
+bool ScanMultiplexer::close(uint32_t id, bool &last) {
+  std::lock_guard<std::mutex> lock(this->state->mutex);
+  const auto it = this->state->sessions.find(id);
+  const bool found = it != this->state->sessions.end();
+  if (found) {
+    Clock::cancel(it->second.timer);
+    this->state->sessions.erase(it);
+  }
+  last = this->state->sessions.empty();
+  return found;
+}
+
+size_t ScanMultiplexer::size() const {
+  std::lock_guard<std::mutex> lock(this->state->mutex);
+  return this->state->sessions.size();
+}
+
+size_t ScanMultiplexer::dispatch(
+    const std::shared_ptr<const Advertisement> &advertisement,
+    const std::shared_ptr<void> &handle, uint32_t only) {
+  std::lock_guard<std::mutex> lock(this->state->mutex);
+  size_t delivered = 0;
+  for (auto &[id, session] : this->state->sessions) {
+    if ((only != 0 && id != only) ||
+        !session.filter.matches(*advertisement)) {
+      continue;
+    }
+
+    const bool isNew = session.seen.insert(advertisement->address).second;
+    if (!isNew && !session.options.duplicates) {
+      continue;
+    }
+    session.callback(advertisement, handle);
+    delivered++;
+    if (!isNew) {
+      continue;
+    }
+
+    session.lastNew = Clock::now();
+    const size_t expected = session.filter.addressCount();
+    if (expected != 0 && session.seen.size() >= expected &&
+        !session.done && session.options.done) {
+      session.done = true;
+      Clock::cancel(session.timer);
+      session.options.done(true);
+    }
+  }
+  return delivered;
+}
+
+void ScanMultiplexer::armQuietTimer(const std::shared_ptr<State> &state,
+                                    uint32_t id, Session &session) {
+  // Rather than rescheduling on every new device, the timer checks when it
+  // fires whether one arrived meanwhile and sleeps again if so.
+  std::weak_ptr<State> weak = state;
+  session.timer = Clock::schedule(
+      session.lastNew + session.options.quietPeriod, [weak, id]() {
+        auto state = weak.lock();
+        if (!state) {
+          return;
+        }
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        const auto it = state->sessions.find(id);
+        if (it == state->sessions.end() || it->second.done) {
+          return;
+        }
+        Session &session = it->second;
+        if (Clock::now() < session.lastNew + session.options.quietPeriod) {
+          armQuietTimer(state, id, session);
+          return;
+        }
+        session.done = true;
+        session.options.done(false);
+      });
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+#include "advertisement.h"
+#include "scanfilter.h"
+
+// Fans one scan out to independent sessions, each with its own filter and
+// callback, so that discovery requests never have to restart the radio.
+class ScanMultiplexer {
+public:
+  // Receives a matching sighting and the opaque handle it was reported
+  // with, which may be empty. Called with the multiplexer locked, so it
+  // must not block or reenter it.
+  using Callback =
+      std::function<void(const std::shared_ptr<const Advertisement> &,
+                         const std::shared_ptr<void> &)>;
+  // Receives true once every address of the filter has been seen, or false
+  // when the quiet period passed without a new device. Called at most once,
+  // under the same rules as Callback.
+  using DoneCallback = std::function<void(bool)>;
+
+  struct Options {
+    // Report every sighting rather than each address once.
+    bool duplicates = false;
+    // Nanoseconds without a new device after which the session is done, or
+    // 0 to wait for the filter's addresses only.
+    uint64_t quietPeriod = 0;
+    DoneCallback done;
+  };
+
+  ~ScanMultiplexer();
+
+  // Returns the session id.
+  uint32_t open(ScanFilter filter, Options options, Callback callback);
+  // Returns false for an unknown id; last is set when no session remains.
+  // No callback of the session runs once this returns.
+  bool close(uint32_t id, bool &last);
+  size_t size() const;
+
+  // Delivers a sighting to every matching session, or only to the given
+  // one. Returns the number of sessions it was delivered to.
+  size_t dispatch(const std::shared_ptr<const Advertisement> &advertisement,
+                  const std::shared_ptr<void> &handle, uint32_t only = 0);
+
+private:
+  struct Session {
+    ScanFilter filter;
+    Options options;
+    Callback callback;
+    std::unordered_set<std::string> seen;
+    // Clock::now() of the last new device, and the pending quiet timer.
+    uint64_t lastNew = 0;
+    uint64_t timer = 0;
+    bool done = false;
+  };
+
+  // Shared with the quiet timers, which may fire after the multiplexer is
+  // gone.
+  struct State {
+    std::mutex mutex;
+    std::map<uint32_t, Session> sessions;
+    uint32_t nextId = 1;
+  };
+
+  std::shared_ptr<State> state = std::make_shared<State>();
+
+  static void armQuietTimer(const std::shared_ptr<State> &state, uint32_t id,
+                            Session &session);
+};
@@ -0,0 +1,305 @@
+#include "scantable.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static const struct {
+  const char *name;
+  ScanQuery::Field field;
+} FIELD_NAMES[] = {
+    {"address", ScanQuery::Address},
+    {"identifier", ScanQuery::Identifier},
+    {"addressType", ScanQuery::AddressType},
+    {"rssi", ScanQuery::Rssi},
+    {"txPower", ScanQuery::TxPower},
+    {"connectable", ScanQuery::Connectable},
+    {"manufacturerData", ScanQuery::ManufacturerData},
+    {"serviceData", ScanQuery::ServiceData},
+    {"firstSeen", ScanQuery::FirstSeen},
+    {"lastSeen", ScanQuery::LastSeen},
+    {"sightings", ScanQuery::Sightings},
+};
+
+bool ScanQuery::parseField(const std::string &name, Field &field) {
+  for (const auto &entry : FIELD_NAMES) {
+    if (name == entry.name) {
+      field = entry.field;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Length of the well-formed UTF-8 sequence at data, or 0.
+static size_t utf8Sequence(const unsigned char *data, size_t length) {
+  size_t size;
+  uint32_t minimum;
+  if (data[0] < 0x80) {
+    return 1;
+  } else if ((data[0] & 0xe0) == 0xc0) {
+    size = 2, minimum = 0x80;
+  } else if ((data[0] & 0xf0) == 0xe0) {
+    size = 3, minimum = 0x800;
+  } else if ((data[0] & 0xf8) == 0xf0) {
+    size = 4, minimum = 0x10000;
+  } else {
+    return 0;
+  }
+  if (size > length) {
+    return 0;
+  }
+
+  uint32_t codePoint = data[0] & (0x7f >> size);
+  for (size_t i = 1; i < size; i++) {
+    if ((data[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+    codePoint = (codePoint << 6) | (data[i] & 0x3f);
+  }
+  if (codePoint < minimum || codePoint > 0x10ffff ||
+      (codePoint >= 0xd800 && codePoint <= 0xdfff)) {
+    return 0;
+  }
+  return size;
+}
+
+// Device names are raw bytes off the air, so anything that is not UTF-8 is
+// escaped byte by byte rather than passed through into the JSON.
+static void putString(std::string &out, const std::string &value) {
+  out.push_back('"');
+  const auto *data = reinterpret_cast<const unsigned char *>(value.data());
+  for (size_t i = 0; i < value.size(); i++) {
+    const char c = value[i];
+    if (data[i] >= 0x80) {
+      const size_t size = utf8Sequence(data + i, value.size() - i);
+      if (size == 0) {
+        out += "\\u00";
+        out.push_back(HEX_DIGITS[data[i] >> 4]);
+        out.push_back(HEX_DIGITS[data[i] & 0x0f]);
+      } else {
+        out.append(value, i, size);
+        i += size - 1;
+      }
+      continue;
+    }
+
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        out += "\\u00";
+        out.push_back(HEX_DIGITS[(c >> 4) & 0x0f]);
+        out.push_back(HEX_DIGITS[c & 0x0f]);
+      } else {
+        out.push_back(c);
+      }
+    }
+  }
+  out.push_back('"');
+}
+
+static void putHex(std::string &out, const std::vector<uint8_t> &data) {
+  out.push_back('"');
+  for (const uint8_t byte : data) {
+    out.push_back(HEX_DIGITS[byte >> 4]);
+    out.push_back(HEX_DIGITS[byte & 0x0f]);
+  }
+  out.push_back('"');
+}
+
+static void putKey(std::string &out, bool &first, const char *key) {
+  if (!first) {
+    out.push_back(',');
+  }
+  first = false;
+  out.push_back('"');
+  out += key;
+  out += "\":";
+}
+
+static void putMilliseconds(std::string &out, uint64_t nanoseconds) {
+  char buffer[32];
+  const int length =
+      snprintf(buffer, sizeof(buffer), "%.3f", nanoseconds / 1e6);
+  out.append(buffer, length);
+}
+
+void ScanTable::update(std::shared_ptr<const Advertisement> advertisement,
+                       uint64_t seen) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  auto it = this->entries
+                .try_emplace(advertisement->address, Entry{nullptr, seen, 0, 0})
+                .first;
+  it->second.advertisement = std::move(advertisement);
+  it->second.lastSeen = seen;
+  it->second.sightings++;
+  if (this->entries.size() > MAX_ENTRIES) {
+    this->evict();
+  }
+}
+
+void ScanTable::evict() {
+  // Least recently seen first, down to three quarters of the limit, so that
+  // the sort is paid once per MAX_ENTRIES / 4 new addresses.
+  std::vector<std::pair<uint64_t, std::string>> ages;
+  ages.reserve(this->entries.size());
+  for (const auto &[address, entry] : this->entries) {
+    ages.emplace_back(entry.lastSeen, address);
+  }
+  const size_t excess = this->entries.size() - MAX_ENTRIES * 3 / 4;
+  std::nth_element(ages.begin(), ages.begin() + excess, ages.end());
+  for (size_t i = 0; i < excess; i++) {
+    this->entries.erase(ages[i].second);
+  }
+}
+
+void ScanTable::clear() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->entries.clear();
+}
+
+size_t ScanTable::size() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->entries.size();
+}
+
+void ScanTable::toJson(const ScanQuery &query, uint64_t now,
+                       std::string &out) const {
+  std::vector<Entry> matches;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    matches.reserve(this->entries.size());
+    for (const auto &[address, entry] : this->entries) {
+      const Advertisement &advertisement = *entry.advertisement;
+      if (advertisement.rssi < query.minRssi ||
+          (query.connectableOnly && !advertisement.connectable) ||
+          (query.maxAge != 0 && now > entry.lastSeen &&
+           now - entry.lastSeen > query.maxAge) ||
+          advertisement.identifier.compare(0, query.identifierPrefix.size(),
+                                           query.identifierPrefix) != 0) {
+        continue;
+      }
+      if (!query.service.empty() &&
+          std::none_of(advertisement.serviceData.begin(),
+                       advertisement.serviceData.end(),
+                       [&query](const auto &data) {
+                         return data.first == query.service;
+                       })) {
+        continue;
+      }
+      if (query.company >= 0 &&
+          std::none_of(advertisement.manufacturerData.begin(),
+                       advertisement.manufacturerData.end(),
+                       [&query](const auto &data) {
+                         return data.first == query.company;
+                       })) {
+        continue;
+      }
+      matches.push_back(entry);
+    }
+  }
+
+  std::sort(matches.begin(), matches.end(),
+            [](const Entry &a, const Entry &b) {
+              return a.advertisement->address < b.advertisement->address;
+            });
+  if (matches.size() > query.limit) {
+    matches.resize(query.limit);
+  }
+
+  out.reserve(out.size() + matches.size() * 160);
+  out.push_back('[');
+  for (size_t i = 0; i < matches.size(); i++) {
+    const Entry &entry = matches[i];
+    const Advertisement &advertisement = *entry.advertisement;
+    bool first = true;
+    if (i > 0) {
+      out.push_back(',');
+    }
+    out.push_back('{');
+    if (query.fields & ScanQuery::Address) {
+      putKey(out, first, "address");
+      putString(out, advertisement.address);
+    }
+    if (query.fields & ScanQuery::Identifier) {
+      putKey(out, first, "identifier");
+      putString(out, advertisement.identifier);
+    }
+    if (query.fields & ScanQuery::AddressType) {
+      putKey(out, first, "addressType");
+      out += std::to_string(advertisement.addressType);
+    }
+    if (query.fields & ScanQuery::Rssi) {
+      putKey(out, first, "rssi");
+      out += std::to_string(advertisement.rssi);
+    }
+    if (query.fields & ScanQuery::TxPower) {
+      putKey(out, first, "txPower");
+      out += std::to_string(advertisement.txPower);
+    }
+    if (query.fields & ScanQuery::Connectable) {
+      putKey(out, first, "connectable");
+      out += advertisement.connectable ? "true" : "false";
+    }
+    if (query.fields & ScanQuery::ManufacturerData) {
+      putKey(out, first, "manufacturerData");
+      out.push_back('{');
+      for (size_t j = 0; j < advertisement.manufacturerData.size(); j++) {
+        const auto &[company, data] = advertisement.manufacturerData[j];
+        if (j > 0) {
+          out.push_back(',');
+        }
+        out.push_back('"');
+        out += std::to_string(company);
+        out += "\":";
+        putHex(out, data);
+      }
+      out.push_back('}');
+    }
+    if (query.fields & ScanQuery::ServiceData) {
+      putKey(out, first, "serviceData");
+      out.push_back('{');
+      for (size_t j = 0; j < advertisement.serviceData.size(); j++) {
+        const auto &[uuid, data] = advertisement.serviceData[j];
+        if (j > 0) {
+          out.push_back(',');
+        }
+        putString(out, uuid);
+        out.push_back(':');
+        putHex(out, data);
+      }
+      out.push_back('}');
+    }
+    if (query.fields & ScanQuery::FirstSeen) {
+      putKey(out, first, "firstSeen");
+      putMilliseconds(out, entry.firstSeen);
+    }
+    if (query.fields & ScanQuery::LastSeen) {
+      putKey(out, first, "lastSeen");
+      putMilliseconds(out, entry.lastSeen);
+    }
+    if (query.fields & ScanQuery::Sightings) {
+      putKey(out, first, "sightings");
+      out += std::to_string(entry.sightings);
+    }
+    out.push_back('}');
+  }
+  out.push_back(']');
+}
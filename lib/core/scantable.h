@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "advertisement.h"
+
+// Field selection and filters for ScanTable::toJson().
+struct ScanQuery {
+  enum Field : uint32_t {
+    Address = 1 << 0,
+    Identifier = 1 << 1,
+    AddressType = 1 << 2,
+    Rssi = 1 << 3,
+    TxPower = 1 << 4,
+    Connectable = 1 << 5,
+    ManufacturerData = 1 << 6,
+    ServiceData = 1 << 7,
+    FirstSeen = 1 << 8,
+    LastSeen = 1 << 9,
+    Sightings = 1 << 10,
+    All = (1 << 11) - 1,
+  };
+
+  uint32_t fields = All;
+  int16_t minRssi = INT16_MIN;
+  // Nanoseconds since the last sighting; 0 keeps every entry.
+  uint64_t maxAge = 0;
+  bool connectableOnly = false;
+  std::string identifierPrefix;
+  // Lowercase UUID of a service the entry must advertise.
+  std::string service;
+  // Company identifier the entry must carry manufacturer data for, or -1.
+  int32_t company = -1;
+  size_t limit = SIZE_MAX;
+
+  // Maps a JSON key such as "rssi" to its field.
+  static bool parseField(const std::string &name, Field &field);
+};
+
+// Latest advertisement per address, kept alongside SimpleBLE's own scan
+// results so that it can be queried off the JS thread.
+class ScanTable {
+public:
+  // Past this many addresses the least recently seen are dropped, so that
+  // long-running scans of rotating private addresses stay bounded.
+  static constexpr size_t MAX_ENTRIES = 4096;
+
+  // Safe to call from any thread. seen is the Clock::now() of the
+  // sighting; replayed and simulated advertisements carry other timestamps.
+  void update(std::shared_ptr<const Advertisement> advertisement,
+              uint64_t seen);
+  void clear();
+  size_t size() const;
+
+  // Appends the matching entries to out as a JSON array ordered by
+  // address. Data is hex encoded, bytes of names that are not UTF-8 are
+  // escaped as Latin-1, and times are milliseconds on the Clock time base.
+  // The table is only locked while the entries are copied.
+  void toJson(const ScanQuery &query, uint64_t now, std::string &out) const;
+
+private:
+  struct Entry {
+    std::shared_ptr<const Advertisement> advertisement;
+    uint64_t firstSeen;
+    uint64_t lastSeen;
+    uint32_t sightings;
+  };
+
+  mutable std::mutex mutex;
+  std::unordered_map<std::string, Entry> entries;
+
+  // Caller holds mutex.
+  void evict();
+};
@@ -0,0 +1,152 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+void FairScheduler::addFlow(uint32_t flow) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->flows[flow];
+}
+
+void FairScheduler::removeFlow(uint32_t flow) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  // Stale ids left in the active list are skipped by dequeue.
+  this->flows.erase(flow);
+}
+
+bool FairScheduler::setBudget(uint32_t flow, const FlowBudget &budget) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const auto it = this->flows.find(flow);
+  if (it == this->flows.end()) {
+    return false;
+  }
+
+  it->second.budget.quantum = std::max<uint32_t>(budget.quantum, 1);
+  it->second.budget.packets = std::max<uint32_t>(budget.packets, 1);
+  it->second.budget.queueLimit = std::max<size_t>(budget.queueLimit, 1);
+  return true;
+}
+
+bool FairScheduler::setByteLimit(uint32_t flow, size_t limit) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const auto it = this->flows.find(flow);
+  if (it == this->flows.end()) {
+    return false;
+  }
+
+  it->second.byteLimit = limit;
+  return true;
+}
+
+bool FairScheduler::stats(uint32_t flow, FlowStats &out) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const auto it = this->flows.find(flow);
+  if (it == this->flows.end()) {
+    return false;
+  }
+
+  out = it->second.counters;
+  out.queued = it->second.queue.size();
+  out.queuedBytes = it->second.queuedBytes;
+  return true;
+}
+
+bool FairScheduler::enqueue(uint32_t flow, uint32_t target,
+                            const uint8_t *data, size_t length,
+                            uint64_t timestamp) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const auto it = this->flows.find(flow);
+  if (it == this->flows.end()) {
+    return false;
+  }
+
+  Flow &state = it->second;
+  if (state.queue.size() >= state.budget.queueLimit ||
+      (state.byteLimit != 0 && state.queuedBytes + length > state.byteLimit)) {
+    state.counters.dropped++;
+    return false;
+  }
+
+  state.queue.push_back(ScheduledPacket{
+      flow, target, std::vector<uint8_t>(data, data + length), timestamp});
+  state.queuedBytes += length;
+  state.counters.enqueued++;
+  if (!state.active) {
+    state.active = true;
+    this->active.push_back(flow);
+  }
+  return true;
+}
+
+size_t FairScheduler::dequeue(size_t max, std::vector<ScheduledPacket> &out) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  size_t count = 0;
+
+  while (count < max && !this->active.empty()) {
+    const auto it = this->flows.find(this->active.front());
+    if (it == this->flows.end()) {
+      this->active.pop_front();
+      continue;
+    }
+
+    Flow &flow = it->second;
+    if (!flow.inTurn) {
+      flow.inTurn = true;
+      flow.turnPackets = 0;
+      flow.deficit += flow.budget.quantum;
+    }
+
+    while (count < max && !flow.queue.empty() &&
+           flow.queue.front().data.size() <= flow.deficit &&
+           flow.turnPackets < flow.budget.packets) {
+      ScheduledPacket &packet = flow.queue.front();
+      flow.deficit -= packet.data.size();
+      flow.queuedBytes -= packet.data.size();
+      flow.turnPackets++;
+      flow.counters.delivered++;
+      flow.counters.bytes += packet.data.size();
+      out.push_back(std::move(packet));
+      flow.queue.pop_front();
+      count++;
+    }
+
+    if (flow.queue.empty()) {
+      // Idle flows do not bank credit.
+      flow.deficit = 0;
+      flow.inTurn = false;
+      flow.active = false;
+      this->active.pop_front();
+    } else if (count < max) {
+      flow.counters.throttled++;
+      flow.inTurn = false;
+      this->active.pop_front();
+      this->active.push_back(it->first);
+    }
+  }
+
+  return count;
+}
+
+void FairScheduler::requeue(std::vector<ScheduledPacket> packets) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for (auto packet = packets.rbegin(); packet != packets.rend(); ++packet) {
+    const auto it = this->flows.find(packet->flow);
+    if (it == this->flows.end()) {
+      continue;
+    }
+
+    Flow &flow = it->second;
+    flow.queuedBytes += packet->data.size();
+    flow.counters.delivered--;
+    flow.counters.bytes -= packet->data.size();
+    flow.queue.push_front(std::move(*packet));
+    if (!flow.active) {
+      flow.active = true;
+      this->active.push_front(it->first);
+    }
+  }
+}
+
+bool FairScheduler::empty() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->active.empty();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct FlowBudget {
+  // Bytes credited to the flow on each round-robin turn.
+  uint32_t quantum = 4096;
+  // Packets the flow may deliver per turn, whatever their size.
+  uint32_t packets = 16;
+  // Packets held before new arrivals are dropped.
+  size_t queueLimit = 1024;
+};
+
+struct FlowStats {
+  uint64_t enqueued = 0;
+  uint64_t delivered = 0;
+  uint64_t bytes = 0;
+  uint64_t dropped = 0;
+  // Turns that ended with packets still queued because the budget ran out.
+  uint64_t throttled = 0;
+  size_t queued = 0;
+  size_t queuedBytes = 0;
+};
+
+struct ScheduledPacket {
+  uint32_t flow;
+  uint32_t target;
+  std::vector<uint8_t> data;
+  // Estimated host time in Clock nanoseconds, 0 when there is none.
+  uint64_t timestamp;
+};
+
+// Deficit round robin across per-flow packet queues. Every backlogged flow
+// gets its quantum of bytes and at most its packet budget per turn, so one
+// flooding flow only delays the others by a single turn.
+class FairScheduler {
+public:
+  void addFlow(uint32_t flow);
+  void removeFlow(uint32_t flow);
+  bool setBudget(uint32_t flow, const FlowBudget &budget);
+  // Caps the payload bytes held for a flow, 0 for no cap. Separate from the
+  // budget so that delivery tuning does not lift a resource quota.
+  bool setByteLimit(uint32_t flow, size_t limit);
+  bool stats(uint32_t flow, FlowStats &out);
+
+  // Returns false when the flow is unknown or its queue is full.
+  bool enqueue(uint32_t flow, uint32_t target, const uint8_t *data,
+               size_t length, uint64_t timestamp = 0);
+  // Moves up to max packets into out in service order.
+  size_t dequeue(size_t max, std::vector<ScheduledPacket> &out);
+  // Puts dequeued packets that could not be delivered back at the head of
+  // their flows, in order, ahead of the queue limits. Packets of removed
+  // flows are discarded.
+  void requeue(std::vector<ScheduledPacket> packets);
+  bool empty();
+
+private:
+  struct Flow {
+    FlowBudget budget;
+    FlowStats counters;
+    std::deque<ScheduledPacket> queue;
+    size_t queuedBytes = 0;
+    size_t byteLimit = 0;
+    size_t deficit = 0;
+    uint32_t turnPackets = 0;
+    bool inTurn = false;
+    bool active = false;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<uint32_t, Flow> flows;
+  std::deque<uint32_t> active;
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Receives notifications straight from the BLE callback thread, tagged with
+// the channel id the sink was attached under. Implementations must be cheap
+// and thread-safe; they run before anything is queued for JS.
+class NotificationSink {
+public:
+  virtual ~NotificationSink() = default;
+  virtual void onNotification(uint16_t channel, uint64_t timestamp,
+                              const uint8_t *data, size_t length) = 0;
+};
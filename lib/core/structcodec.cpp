@@ -0,0 +1,300 @@
+#include "structcodec.h"
+
+#include <cmath>
+#include <cstring>
+#include <set>
+
+static uint64_t load(const uint8_t *data, size_t width, bool bigEndian) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < width; i++) {
+    const size_t byte = bigEndian ? width - 1 - i : i;
+    value |= static_cast<uint64_t>(data[byte]) << (8 * i);
+  }
+  return value;
+}
+
+static void store(uint8_t *data, size_t width, bool bigEndian,
+                  uint64_t value) {
+  for (size_t i = 0; i < width; i++) {
+    const size_t byte = bigEndian ? width - 1 - i : i;
+    data[byte] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+static uint64_t bitMask(size_t bits) {
+  return bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+}
+
+static int64_t signExtend(uint64_t value, size_t bits) {
+  if (bits >= 64) {
+    return static_cast<int64_t>(value);
+  }
+  const uint64_t sign = uint64_t(1) << (bits - 1);
+  return static_cast<int64_t>((value ^ sign) - sign);
+}
+
+// Rounds to the nearest integer representable in bits, saturating.
+static uint64_t saturate(double value, size_t bits, bool isSigned) {
+  if (std::isnan(value)) {
+    return 0;
+  }
+
+  value = std::round(value);
+  if (isSigned) {
+    const double limit = std::ldexp(1.0, static_cast<int>(bits) - 1);
+    if (value >= limit) {
+      return bitMask(bits - 1);
+    } else if (value <= -limit) {
+      return uint64_t(1) << (bits - 1);
+    }
+    return static_cast<uint64_t>(static_cast<int64_t>(value)) &
+           bitMask(bits);
+  }
+
+  if (value <= 0) {
+    return 0;
+  } else if (value >= std::ldexp(1.0, static_cast<int>(bits))) {
+    return bitMask(bits);
+  }
+  return static_cast<uint64_t>(value);
+}
+
+bool StructCodec::compile(const std::vector<FieldSpec> &fields,
+                          StructCodec &out, std::string &error) {
+  StructCodec codec;
+  std::set<std::string> names;
+
+  // The bitfield storage unit being filled, if any.
+  bool unitOpen = false;
+  uint32_t unitOffset = 0;
+  uint8_t unitWidth = 0;
+  bool unitBigEndian = false;
+  uint8_t unitUsed = 0;
+
+  for (const FieldSpec &field : fields) {
+    if (field.type == FieldType::Pad) {
+      unitOpen = false;
+      if (field.count == 0 || field.count > MAX_SIZE) {
+        error = "Invalid padding";
+        return false;
+      }
+      codec.bytes += field.count;
+      continue;
+    }
+
+    if (field.name.empty()) {
+      error = "Field without a name";
+      return false;
+    } else if (!names.insert(field.name).second) {
+      error = "Duplicate field " + field.name;
+      return false;
+    } else if (field.count == 0 || field.count > MAX_VALUES) {
+      error = "Invalid count for " + field.name;
+      return false;
+    } else if (!std::isfinite(field.scale) || field.scale == 0 ||
+               !std::isfinite(field.offset)) {
+      error = "Invalid scaling for " + field.name;
+      return false;
+    }
+
+    uint8_t width = 0;
+    Kind kind = Kind::Unsigned;
+    switch (field.type) {
+    case FieldType::U8:
+      width = 1;
+      break;
+    case FieldType::I8:
+      width = 1, kind = Kind::Signed;
+      break;
+    case FieldType::U16:
+      width = 2;
+      break;
+    case FieldType::I16:
+      width = 2, kind = Kind::Signed;
+      break;
+    case FieldType::U24:
+      width = 3;
+      break;
+    case FieldType::I24:
+      width = 3, kind = Kind::Signed;
+      break;
+    case FieldType::U32:
+      width = 4;
+      break;
+    case FieldType::I32:
+      width = 4, kind = Kind::Signed;
+      break;
+    case FieldType::U64:
+      width = 8;
+      break;
+    case FieldType::I64:
+      width = 8, kind = Kind::Signed;
+      break;
+    case FieldType::F32:
+      width = 4, kind = Kind::Float;
+      break;
+    case FieldType::F64:
+      width = 8, kind = Kind::Float;
+      break;
+    case FieldType::Pad:
+      break;
+    }
+
+    const size_t index = codec.program.size();
+    if (field.bits != 0) {
+      if (kind == Kind::Float) {
+        error = "Bitfield of a float type: " + field.name;
+        return false;
+      } else if (field.count != 1) {
+        error = "Array of bitfields: " + field.name;
+        return false;
+      } else if (field.bits > 8 * width) {
+        error = "Bitfield wider than its type: " + field.name;
+        return false;
+      }
+
+      if (!unitOpen || unitWidth != width ||
+          unitBigEndian != field.bigEndian ||
+          unitUsed + field.bits > 8 * width) {
+        unitOpen = true;
+        unitOffset = static_cast<uint32_t>(codec.bytes);
+        unitWidth = width;
+        unitBigEndian = field.bigEndian;
+        unitUsed = 0;
+        codec.bytes += width;
+      }
+      codec.program.push_back(Instruction{unitOffset, width, kind,
+                                          field.bigEndian, unitUsed,
+                                          field.bits, field.scale,
+                                          field.offset});
+      unitUsed += field.bits;
+    } else {
+      unitOpen = false;
+      for (uint32_t i = 0; i < field.count; i++) {
+        codec.program.push_back(Instruction{
+            static_cast<uint32_t>(codec.bytes), width, kind, field.bigEndian,
+            0, static_cast<uint8_t>(8 * width), field.scale, field.offset});
+        codec.bytes += width;
+      }
+    }
+
+    codec.layout.push_back(CodecColumn{field.name, field.type, index,
+                                       field.count,
+                                       field.scale != 1 || field.offset != 0});
+    if (codec.program.size() > MAX_VALUES || codec.bytes > MAX_SIZE) {
+      error = "Record too large";
+      return false;
+    }
+  }
+
+  if (codec.program.empty()) {
+    error = "No fields";
+    return false;
+  } else if (codec.bytes > MAX_SIZE) {
+    error = "Record too large";
+    return false;
+  }
+
+  out = std::move(codec);
+  return true;
+}
+
+size_t StructCodec::size() const { return this->bytes; }
+
+size_t StructCodec::width() const { return this->program.size(); }
+
+const std::vector<CodecColumn> &StructCodec::columns() const {
+  return this->layout;
+}
+
+void StructCodec::decode(const uint8_t *data, double *out) const {
+  for (const Instruction &op : this->program) {
+    const uint64_t raw = load(data + op.offset, op.width, op.bigEndian);
+    double value;
+
+    switch (op.kind) {
+    case Kind::Unsigned:
+      value = static_cast<double>((raw >> op.shift) & bitMask(op.bits));
+      break;
+    case Kind::Signed:
+      value = static_cast<double>(
+          signExtend((raw >> op.shift) & bitMask(op.bits), op.bits));
+      break;
+    case Kind::Float:
+      if (op.width == 4) {
+        const uint32_t bits = static_cast<uint32_t>(raw);
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        value = f;
+      } else {
+        std::memcpy(&value, &raw, sizeof(value));
+      }
+      break;
+    }
+
+    *out++ = value * op.scale + op.bias;
+  }
+}
+
+size_t StructCodec::decode(const uint8_t *data, size_t length,
+                           std::vector<double> &out, size_t stride) const {
+  if (stride < this->bytes) {
+    stride = this->bytes;
+  }
+  if (length < this->bytes) {
+    return 0;
+  }
+
+  const size_t records = (length - this->bytes) / stride + 1;
+  const size_t first = out.size();
+  out.resize(first + records * this->width());
+  for (size_t i = 0; i < records; i++) {
+    this->decode(data + i * stride, out.data() + first + i * this->width());
+  }
+  return records;
+}
+
+void StructCodec::encode(const double *values, uint8_t *out) const {
+  std::memset(out, 0, this->bytes);
+
+  for (const Instruction &op : this->program) {
+    const double value = (*values++ - op.bias) / op.scale;
+    uint8_t *unit = out + op.offset;
+
+    if (op.kind == Kind::Float) {
+      uint64_t raw;
+      if (op.width == 4) {
+        const float f = static_cast<float>(value);
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        raw = bits;
+      } else {
+        std::memcpy(&raw, &value, sizeof(raw));
+      }
+      store(unit, op.width, op.bigEndian, raw);
+      continue;
+    }
+
+    const uint64_t mask = bitMask(op.bits);
+    const uint64_t field =
+        saturate(value, op.bits, op.kind == Kind::Signed) & mask;
+    uint64_t raw = load(unit, op.width, op.bigEndian);
+    raw = (raw & ~(mask << op.shift)) | (field << op.shift);
+    store(unit, op.width, op.bigEndian, raw);
+  }
+}
+
+Transform StructCodec::transform() const {
+  const StructCodec codec = *this;
+  return [codec](const uint8_t *data, size_t length,
+                 std::vector<uint8_t> &out) {
+    std::vector<double> values;
+    if (codec.decode(data, length, values) == 0) {
+      return false;
+    }
+
+    out.resize(values.size() * sizeof(double));
+    std::memcpy(out.data(), values.data(), out.size());
+    return true;
+  };
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "transforms.h"
+
+enum class FieldType : uint8_t {
+  U8,
+  I8,
+  U16,
+  I16,
+  U24,
+  I24,
+  U32,
+  I32,
+  U64,
+  I64,
+  F32,
+  F64,
+  // Bytes skipped on decode and zeroed on encode.
+  Pad,
+};
+
+// One field of a packed record, in declaration order.
+struct FieldSpec {
+  std::string name;
+  FieldType type = FieldType::U8;
+  bool bigEndian = false;
+  // Elements of an array, or bytes of padding.
+  uint32_t count = 1;
+  // Width of a bitfield, 0 for a whole value. Consecutive bitfields of the
+  // same type share its storage unit, filled from the least significant bit.
+  uint8_t bits = 0;
+  // Decoded value = raw * scale + offset.
+  double scale = 1;
+  double offset = 0;
+};
+
+// Where a field's values sit among the decoded values of a record.
+struct CodecColumn {
+  std::string name;
+  FieldType type;
+  size_t index;
+  size_t count;
+  // Scaled fields decode to fractions whatever their type.
+  bool scaled;
+};
+
+// Codec for a packed record layout, compiled from field specs into a flat
+// program with one instruction per value, so that decoding a payload is a
+// single pass without any lookups. Integers wider than 53 bits lose
+// precision as doubles.
+class StructCodec {
+public:
+  static constexpr size_t MAX_VALUES = 4096;
+  static constexpr size_t MAX_SIZE = 65536;
+
+  // Returns false with a reason in error when the fields do not describe a
+  // valid record.
+  static bool compile(const std::vector<FieldSpec> &fields, StructCodec &out,
+                      std::string &error);
+
+  // Bytes per record.
+  size_t size() const;
+  // Decoded values per record.
+  size_t width() const;
+  const std::vector<CodecColumn> &columns() const;
+
+  // Decodes width() values of the record at data, which must hold size()
+  // bytes.
+  void decode(const uint8_t *data, double *out) const;
+  // Appends the values of every whole record in data, taken every stride
+  // bytes (size() when 0). Returns the number of records.
+  size_t decode(const uint8_t *data, size_t length, std::vector<double> &out,
+                size_t stride = 0) const;
+  // Writes the record for width() values to out, which must hold size()
+  // bytes. Integers are rounded and saturated to their field's range.
+  void encode(const double *values, uint8_t *out) const;
+  // Transform producing host-order float64 values of every whole record.
+  Transform transform() const;
+
+private:
+  enum class Kind : uint8_t { Unsigned, Signed, Float };
+
+  struct Instruction {
+    uint32_t offset;
+    uint8_t width;
+    Kind kind;
+    bool bigEndian;
+    // Bitfield position within the unit; bits is 8 * width for whole values.
+    uint8_t shift;
+    uint8_t bits;
+    double scale;
+    double bias;
+  };
+
+  std::vector<Instruction> program;
+  std::vector<CodecColumn> layout;
+  size_t bytes = 0;
+};
@@ -0,0 +1,212 @@
+#include "templates.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+struct RegistryState {
+  std::mutex mutex;
+  std::unordered_multimap<uint64_t, std::weak_ptr<const GattDatabase>>
+      templates;
+  // The first template of each list of service UUIDs, which devices of the
+  // same model but another firmware overlay.
+  std::unordered_multimap<uint64_t, std::weak_ptr<const GattDatabase>> models;
+  GattTemplateStats counters;
+};
+
+RegistryState &state() {
+  static RegistryState instance;
+  return instance;
+}
+
+bool sameService(const GattService &a, const GattService &b) {
+  return a.uuid == b.uuid && a.characteristics == b.characteristics;
+}
+
+bool sameStructure(const GattDatabase &a, const GattDatabase &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (!sameService(a[i], b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool sameServices(const GattDatabase &a, const GattDatabase &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].uuid != b[i].uuid) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// FNV-1a hash of the service UUIDs alone.
+uint64_t modelKey(const GattDatabase &database) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (const auto &service : database) {
+    for (const char c : service.uuid) {
+      hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    }
+    hash = (hash ^ 0xff) * 0x100000001b3;
+  }
+  return hash;
+}
+
+GattService structureOf(const GattService &service) {
+  GattService structure;
+  structure.uuid = service.uuid;
+  structure.characteristics = service.characteristics;
+  return structure;
+}
+
+// Returns a live entry under key that satisfies match, erasing expired
+// entries on the way.
+template <typename Match>
+std::shared_ptr<const GattDatabase>
+find(std::unordered_multimap<uint64_t, std::weak_ptr<const GattDatabase>> &map,
+     uint64_t key, Match match) {
+  auto [begin, end] = map.equal_range(key);
+  for (auto it = begin; it != end;) {
+    auto existing = it->second.lock();
+    if (!existing) {
+      it = map.erase(it);
+      continue;
+    }
+    if (match(*existing)) {
+      return existing;
+    }
+    ++it;
+  }
+  return nullptr;
+}
+
+// Caller holds the registry mutex.
+std::shared_ptr<const GattDatabase> internLocked(RegistryState &self,
+                                                 const GattDatabase &database,
+                                                 uint64_t fingerprint) {
+  auto structure = std::make_shared<GattDatabase>();
+  structure->reserve(database.size());
+  for (const auto &service : database) {
+    structure->push_back(structureOf(service));
+  }
+  self.templates.emplace(fingerprint, structure);
+  self.models.emplace(modelKey(database), structure);
+  self.counters.misses++;
+  return structure;
+}
+
+} // namespace
+
+const GattService &GattOverlay::service(size_t index) const {
+  for (const auto &[replaced, service] : this->services) {
+    if (replaced == index) {
+      return service;
+    }
+  }
+  return (*this->base)[index];
+}
+
+GattDatabase GattOverlay::materialize() const {
+  GattDatabase database;
+  database.reserve(this->size());
+  for (size_t i = 0; i < this->size(); i++) {
+    database.push_back(this->service(i));
+  }
+  return database;
+}
+
+size_t GattOverlay::footprint() const {
+  size_t size = this->base ? gattSize(*this->base) : 0;
+  for (const auto &[index, service] : this->services) {
+    size += sizeof(GattService) + gattSize(service);
+  }
+  return size;
+}
+
+bool GattOverlay::operator==(const GattOverlay &other) const {
+  if (this->base != other.base ||
+      this->services.size() != other.services.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < this->services.size(); i++) {
+    if (this->services[i].first != other.services[i].first ||
+        !sameService(this->services[i].second, other.services[i].second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::shared_ptr<const GattDatabase>
+GattTemplateRegistry::intern(const GattDatabase &database) {
+  const uint64_t fingerprint = gattFingerprint(database);
+  auto &self = state();
+  std::lock_guard<std::mutex> lock(self.mutex);
+
+  auto existing =
+      find(self.templates, fingerprint, [&](const GattDatabase &candidate) {
+        return sameStructure(candidate, database);
+      });
+  if (existing) {
+    self.counters.hits++;
+    return existing;
+  }
+  return internLocked(self, database, fingerprint);
+}
+
+GattOverlay GattTemplateRegistry::overlay(const GattDatabase &database) {
+  const uint64_t fingerprint = gattFingerprint(database);
+  auto &self = state();
+  std::lock_guard<std::mutex> lock(self.mutex);
+
+  GattOverlay overlay;
+  overlay.base =
+      find(self.templates, fingerprint, [&](const GattDatabase &candidate) {
+        return sameStructure(candidate, database);
+      });
+  if (overlay.base) {
+    self.counters.hits++;
+    return overlay;
+  }
+
+  overlay.base = find(self.models, modelKey(database),
+                      [&](const GattDatabase &candidate) {
+                        return sameServices(candidate, database);
+                      });
+  if (!overlay.base) {
+    overlay.base = internLocked(self, database, fingerprint);
+    return overlay;
+  }
+
+  for (size_t i = 0; i < database.size(); i++) {
+    if (!sameService((*overlay.base)[i], database[i])) {
+      overlay.services.emplace_back(i, structureOf(database[i]));
+    }
+  }
+  self.counters.overlays++;
+  return overlay;
+}
+
+GattTemplateStats GattTemplateRegistry::stats() {
+  auto &self = state();
+  std::lock_guard<std::mutex> lock(self.mutex);
+
+  // Drop templates whose last device has gone.
+  for (auto *map : {&self.templates, &self.models}) {
+    for (auto it = map->begin(); it != map->end();) {
+      it = it->second.expired() ? map->erase(it) : std::next(it);
+    }
+  }
+
+  GattTemplateStats stats = self.counters;
+  stats.templates = self.templates.size();
+  return stats;
+}
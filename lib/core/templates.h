@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gatt.h"
+
+struct GattTemplateStats {
+  size_t templates = 0;
+  // Interned databases that matched a live template.
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  // Databases stored as a model's template plus the services they differ in.
+  uint64_t overlays = 0;
+};
+
+// A device's attribute table: the template of its model, and the services
+// in which the device differs from it. Empty when base is null.
+struct GattOverlay {
+  std::shared_ptr<const GattDatabase> base;
+  // Replacements for services of base, by ascending index.
+  std::vector<std::pair<size_t, GattService>> services;
+
+  explicit operator bool() const { return this->base != nullptr; }
+  size_t size() const { return this->base ? this->base->size() : 0; }
+  const GattService &service(size_t index) const;
+  GattDatabase materialize() const;
+  // The template's footprint plus that of the replaced services.
+  size_t footprint() const;
+
+  bool operator==(const GattOverlay &other) const;
+  bool operator!=(const GattOverlay &other) const { return !(*this == other); }
+};
+
+// Immutable GATT structures shared by every device of the same model and
+// firmware. A template holds the attribute table only; per-device service
+// data stays with the device. Templates live as long as a device uses them.
+class GattTemplateRegistry {
+public:
+  // Returns the template with the structure of database, creating it when
+  // no device has that structure yet. Two devices get the same pointer
+  // exactly when their attribute tables are equal.
+  static std::shared_ptr<const GattDatabase>
+  intern(const GattDatabase &database);
+  // Like intern(), but a database listing the same services as a live
+  // template, such as another firmware of its model, only keeps the
+  // services that differ.
+  static GattOverlay overlay(const GattDatabase &database);
+  static GattTemplateStats stats();
+};
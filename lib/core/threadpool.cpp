@@ -0,0 +1,65 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) {
+  if (threads == 0) {
+    threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+
+  this->workers.reserve(threads);
+  for (size_t i = 0; i < threads; i++) {
+    this->workers.emplace_back([this]() { this->run(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->wake.notify_all();
+  for (auto &worker : this->workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->tasks.push_back(std::move(task));
+  }
+  this->wake.notify_one();
+}
+
+size_t ThreadPool::size() const { return this->workers.size(); }
+
+ThreadPool &ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+ThreadPool &ThreadPool::io() {
+  // Mostly waiting, so not limited to the hardware threads.
+  static ThreadPool pool(
+      std::max<size_t>(std::thread::hardware_concurrency(), 4));
+  return pool;
+}
+
+void ThreadPool::run() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (true) {
+    this->wake.wait(lock, [this]() {
+      return this->stopping || !this->tasks.empty();
+    });
+    if (this->tasks.empty()) {
+      return;
+    }
+
+    auto task = std::move(this->tasks.front());
+    this->tasks.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
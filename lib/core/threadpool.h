@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued tasks in submission order.
+class ThreadPool {
+public:
+  // Zero threads means one per hardware thread.
+  explicit ThreadPool(size_t threads = 0);
+  ~ThreadPool();
+
+  void submit(std::function<void()> task);
+  size_t size() const;
+
+  // Process-wide pool for payload processing and other background work.
+  static ThreadPool &shared();
+  // Process-wide pool for calls that block on the radio or the system, kept
+  // apart so that they cannot hold up payload processing.
+  static ThreadPool &io();
+
+private:
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<std::function<void()>> tasks;
+  std::vector<std::thread> workers;
+  bool stopping = false;
+
+  void run();
+};
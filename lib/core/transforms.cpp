@@ -0,0 +1,116 @@
+#include "transforms.h"
+#include "keystore.h"
+
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+static constexpr float PI = 3.14159265358979323846f;
+
+// Magnitudes of the real FFT of int16 LE samples, zero-padded to a power of
+// two, as N/2 + 1 float32 values.
+static bool fftMagnitude(const uint8_t *data, size_t length,
+                         std::vector<uint8_t> &out) {
+  const size_t samples = length / 2;
+  if (samples == 0) {
+    return false;
+  }
+
+  size_t n = 1;
+  while (n < samples) {
+    n <<= 1;
+  }
+
+  std::vector<std::complex<float>> x(n);
+  for (size_t i = 0; i < samples; i++) {
+    const int16_t sample =
+        static_cast<int16_t>(data[2 * i] | (data[2 * i + 1] << 8));
+    x[i] = static_cast<float>(sample);
+  }
+
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      std::swap(x[i], x[j]);
+    }
+  }
+
+  for (size_t len = 2; len <= n; len <<= 1) {
+    const float angle = -2 * PI / len;
+    const std::complex<float> step(std::cos(angle), std::sin(angle));
+    for (size_t i = 0; i < n; i += len) {
+      std::complex<float> w(1);
+      for (size_t k = 0; k < len / 2; k++) {
+        const auto u = x[i + k];
+        const auto v = x[i + k + len / 2] * w;
+        x[i + k] = u + v;
+        x[i + k + len / 2] = u - v;
+        w *= step;
+      }
+    }
+  }
+
+  const size_t bins = n / 2 + 1;
+  out.resize(bins * sizeof(float));
+  for (size_t i = 0; i < bins; i++) {
+    const float magnitude = std::abs(x[i]);
+    std::memcpy(out.data() + i * sizeof(float), &magnitude, sizeof(float));
+  }
+  return true;
+}
+
+Transform composeTransforms(Transform first, Transform second) {
+  return [first, second](const uint8_t *data, size_t length,
+                         std::vector<uint8_t> &out) {
+    std::vector<uint8_t> intermediate;
+    return first(data, length, intermediate) &&
+           second(intermediate.data(), intermediate.size(), out);
+  };
+}
+
+namespace {
+
+struct Registry {
+  std::mutex mutex;
+  std::map<std::string, TransformFactory> factories{
+      {"fft", [](const std::string &) { return Transform(fftMagnitude); }},
+      {"aes-ccm", aesCcmTransform},
+  };
+};
+
+Registry &registry() {
+  static Registry instance;
+  return instance;
+}
+
+} // namespace
+
+void TransformRegistry::add(const std::string &name, Transform transform) {
+  addFactory(name, [transform](const std::string &) { return transform; });
+}
+
+void TransformRegistry::addFactory(const std::string &name,
+                                   TransformFactory factory) {
+  std::lock_guard<std::mutex> lock(registry().mutex);
+  registry().factories[name] = std::move(factory);
+}
+
+Transform TransformRegistry::find(const std::string &name,
+                                  const std::string &address) {
+  TransformFactory factory;
+  {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    const auto it = registry().factories.find(name);
+    if (it == registry().factories.end()) {
+      return Transform();
+    }
+    factory = it->second;
+  }
+  return factory(address);
+}
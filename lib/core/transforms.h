@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Payload transform run off the BLE callback thread. Returns false when the
+// payload cannot be transformed; it is then counted and not delivered.
+using Transform =
+    std::function<bool(const uint8_t *data, size_t length,
+                       std::vector<uint8_t> &out)>;
+
+// Runs second on the output of first.
+Transform composeTransforms(Transform first, Transform second);
+
+// Builds a transform for the device with the given address, or returns an
+// empty function when it cannot serve that device.
+using TransformFactory = std::function<Transform(const std::string &address)>;
+
+// Named transforms selectable per subscription. Built-ins:
+//   fft      int16 little-endian samples to float32 magnitude spectrum
+//   aes-ccm  decryption with the device's key from the KeyStore
+class TransformRegistry {
+public:
+  static void add(const std::string &name, Transform transform);
+  static void addFactory(const std::string &name, TransformFactory factory);
+  // Returns an empty function for unknown names.
+  static Transform find(const std::string &name,
+                        const std::string &address = std::string());
+};
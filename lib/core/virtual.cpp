@@ -0,0 +1,308 @@
+#include "virtual.h"
+#include "clock.h"
+#include "templates.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+
+static constexpr double NS_PER_MS = 1e6;
+static constexpr uint16_t VIRTUAL_MTU = 247;
+static const char VIRTUAL_SERVICE[] = "0000fff0-0000-1000-8000-00805f9b34fb";
+static const char VIRTUAL_CHARACTERISTIC[] =
+    "0000fff1-0000-1000-8000-00805f9b34fb";
+
+bool LatencyModel::parse(const std::string &name, Kind &out) {
+  static const std::map<std::string, Kind> KINDS = {
+      {"fixed", Kind::Fixed},
+      {"uniform", Kind::Uniform},
+      {"normal", Kind::Normal},
+      {"lognormal", Kind::LogNormal},
+      {"exponential", Kind::Exponential},
+  };
+  const auto it = KINDS.find(name);
+  if (it == KINDS.end()) {
+    return false;
+  }
+  out = it->second;
+  return true;
+}
+
+uint64_t LatencyModel::sample(std::mt19937_64 &rng) const {
+  double ms = this->a;
+  switch (this->kind) {
+  case Kind::Fixed:
+    break;
+  case Kind::Uniform:
+    ms = std::uniform_real_distribution<double>(
+        this->a, std::max(this->a, this->b))(rng);
+    break;
+  case Kind::Normal:
+    ms = std::normal_distribution<double>(this->a, this->b)(rng);
+    break;
+  case Kind::LogNormal:
+    ms = std::lognormal_distribution<double>(std::log(std::max(this->a, 1e-9)),
+                                             this->b)(rng);
+    break;
+  case Kind::Exponential:
+    ms = std::exponential_distribution<double>(1 / std::max(this->a, 1e-9))(
+        rng);
+    break;
+  }
+  return static_cast<uint64_t>(std::max(ms, 0.0) * NS_PER_MS);
+}
+
+VirtualDevice::VirtualDevice(Advertisement advertisement,
+                             std::shared_ptr<const GattDatabase> gatt,
+                             const VirtualDeviceConfig &config)
+    : info(std::move(advertisement)), database(std::move(gatt)),
+      config(config), rng(config.seed) {}
+
+VirtualDevice::~VirtualDevice() { this->cancelAll(); }
+
+const Advertisement &VirtualDevice::advertisement() const { return this->info; }
+
+GattDatabase VirtualDevice::gatt() const { return *this->database; }
+
+uint16_t VirtualDevice::mtu() { return VIRTUAL_MTU; }
+
+bool VirtualDevice::connect() {
+  uint64_t latency;
+  bool fail;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    latency = this->config.connectLatency.sample(this->rng);
+    fail = std::bernoulli_distribution(this->config.failureRate)(this->rng);
+  }
+
+  // The latency is a clock event, so on the virtual clock the attempt moves
+  // time forward by it and fires whatever else falls due meanwhile.
+  struct Attempt {
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool done = false;
+  };
+  const auto attempt = std::make_shared<Attempt>();
+  Clock::scheduleAfter(latency, [attempt]() {
+    std::lock_guard<std::mutex> lock(attempt->mutex);
+    attempt->done = true;
+    attempt->ready.notify_all();
+  });
+
+  {
+    std::unique_lock<std::mutex> lock(attempt->mutex);
+    while (!attempt->done) {
+      if (Clock::isVirtual()) {
+        lock.unlock();
+        const bool stepped = Clock::step();
+        lock.lock();
+        if (stepped) {
+          continue;
+        }
+      }
+      // Another thread is firing the event, or the timer thread will.
+      attempt->ready.wait(lock);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->isConnected = !fail;
+  return !fail;
+}
+
+bool VirtualDevice::disconnect() {
+  this->cancelAll();
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const bool was = this->isConnected;
+  this->isConnected = false;
+  return was;
+}
+
+bool VirtualDevice::connected() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->isConnected;
+}
+
+const GattCharacteristic *
+VirtualDevice::find(const std::string &service,
+                    const std::string &characteristic) const {
+  for (const auto &svc : *this->database) {
+    if (svc.uuid != service) {
+      continue;
+    }
+    for (const auto &chr : svc.characteristics) {
+      if (chr.uuid == characteristic) {
+        return &chr;
+      }
+    }
+  }
+  return nullptr;
+}
+
+bool VirtualDevice::subscribe(const std::string &service,
+                              const std::string &characteristic,
+                              bool indicate) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const GattCharacteristic *chr = this->find(service, characteristic);
+  if (!this->isConnected || chr == nullptr ||
+      !(chr->canNotify || chr->canIndicate)) {
+    return false;
+  }
+
+  auto [it, inserted] = this->subscriptions.try_emplace(characteristic);
+  if (inserted) {
+    it->second.service = service;
+    this->schedule(characteristic, it->second);
+  }
+  return true;
+}
+
+bool VirtualDevice::unsubscribe(const std::string &service,
+                                const std::string &characteristic) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const auto it = this->subscriptions.find(characteristic);
+  if (it == this->subscriptions.end()) {
+    return false;
+  }
+
+  Clock::cancel(it->second.timer);
+  this->subscriptions.erase(it);
+  return true;
+}
+
+bool VirtualDevice::read(const std::string &service,
+                         const std::string &characteristic,
+                         std::vector<uint8_t> &out) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const GattCharacteristic *chr = this->find(service, characteristic);
+  if (!this->isConnected || chr == nullptr || !chr->canRead) {
+    return false;
+  }
+
+  const auto it = this->values.find(characteristic);
+  if (it != this->values.end()) {
+    out = it->second;
+  } else {
+    out.assign(this->config.payloadSize, 0);
+  }
+  return true;
+}
+
+bool VirtualDevice::write(const std::string &service,
+                          const std::string &characteristic,
+                          const uint8_t *data, size_t length, bool response) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  const GattCharacteristic *chr = this->find(service, characteristic);
+  if (!this->isConnected || chr == nullptr ||
+      !(chr->canWriteRequest || chr->canWriteCommand)) {
+    return false;
+  }
+
+  this->values[characteristic].assign(data, data + length);
+  return true;
+}
+
+void VirtualDevice::setNotifyCallback(const void *owner,
+                                      NotifyCallback callback) {
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  this->notifyOwner = owner;
+  this->notify = std::move(callback);
+}
+
+void VirtualDevice::clearNotifyCallback(const void *owner) {
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  if (this->notifyOwner == owner) {
+    this->notifyOwner = nullptr;
+    this->notify = nullptr;
+  }
+}
+
+void VirtualDevice::schedule(const std::string &characteristic,
+                             Subscription &subscription) {
+  std::weak_ptr<VirtualDevice> weak = this->shared_from_this();
+  subscription.timer = Clock::scheduleAfter(
+      this->config.notifyInterval.sample(this->rng), [weak, characteristic]() {
+        if (auto self = weak.lock()) {
+          self->fire(characteristic);
+        }
+      });
+}
+
+void VirtualDevice::fire(const std::string &characteristic) {
+  std::string service;
+  std::vector<uint8_t> payload(std::max<size_t>(this->config.payloadSize, 12));
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto it = this->subscriptions.find(characteristic);
+    if (it == this->subscriptions.end() || !this->isConnected) {
+      return;
+    }
+
+    const uint32_t sequence = it->second.sequence++;
+    const uint64_t now = Clock::now();
+    for (size_t i = 0; i < 4; i++) {
+      payload[i] = static_cast<uint8_t>(sequence >> (8 * i));
+    }
+    for (size_t i = 0; i < 8; i++) {
+      payload[4 + i] = static_cast<uint8_t>(now >> (8 * i));
+    }
+    payload.resize(this->config.payloadSize);
+    service = it->second.service;
+    this->schedule(characteristic, it->second);
+  }
+
+  // Delivered under its own lock so that clearNotifyCallback() waits for a
+  // delivery in progress, while subscribe() from inside it cannot deadlock.
+  std::lock_guard<std::mutex> lock(this->callbackMutex);
+  if (this->notify) {
+    this->notify(service, characteristic, payload.data(), payload.size());
+  }
+}
+
+void VirtualDevice::cancelAll() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for (auto &[characteristic, subscription] : this->subscriptions) {
+    Clock::cancel(subscription.timer);
+  }
+  this->subscriptions.clear();
+}
+
+std::vector<std::shared_ptr<VirtualDevice>>
+createVirtualFleet(size_t count, const VirtualDeviceConfig &config) {
+  GattCharacteristic characteristic;
+  characteristic.uuid = VIRTUAL_CHARACTERISTIC;
+  characteristic.canRead = true;
+  characteristic.canWriteRequest = true;
+  characteristic.canNotify = true;
+
+  GattService service;
+  service.uuid = VIRTUAL_SERVICE;
+  service.characteristics.push_back(characteristic);
+
+  const auto gatt = GattTemplateRegistry::intern(GattDatabase{service});
+  std::vector<std::shared_ptr<VirtualDevice>> fleet;
+  fleet.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    char address[18];
+    std::snprintf(address, sizeof(address), "C0:DE:00:%02X:%02X:%02X",
+                  static_cast<unsigned>((i >> 16) & 0xff),
+                  static_cast<unsigned>((i >> 8) & 0xff),
+                  static_cast<unsigned>(i & 0xff));
+
+    Advertisement advertisement;
+    advertisement.identifier = "Virtual " + std::to_string(i);
+    advertisement.address = address;
+    advertisement.addressType = 1;
+    advertisement.rssi = -60;
+    advertisement.connectable = true;
+    advertisement.serviceData.emplace_back(VIRTUAL_SERVICE,
+                                           std::vector<uint8_t>());
+
+    VirtualDeviceConfig deviceConfig = config;
+    deviceConfig.seed = config.seed + i;
+    fleet.push_back(std::make_shared<VirtualDevice>(std::move(advertisement),
+                                                    gatt, deviceConfig));
+  }
+  return fleet;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "advertisement.h"
+#include "gatt.h"
+#include "nativedevice.h"
+
+// Random delay in nanoseconds. Parameters are in milliseconds:
+//   Fixed        a
+//   Uniform      between a and b
+//   Normal       mean a, deviation b (clamped at 0)
+//   LogNormal    median a, shape b
+//   Exponential  mean a
+struct LatencyModel {
+  enum class Kind { Fixed, Uniform, Normal, LogNormal, Exponential };
+
+  Kind kind = Kind::Fixed;
+  double a = 0;
+  double b = 0;
+
+  static bool parse(const std::string &name, Kind &out);
+  uint64_t sample(std::mt19937_64 &rng) const;
+};
+
+struct VirtualDeviceConfig {
+  LatencyModel connectLatency;
+  LatencyModel notifyInterval{LatencyModel::Kind::Fixed, 100, 0};
+  size_t payloadSize = 20;
+  // Probability that a connection attempt fails.
+  double failureRate = 0;
+  uint64_t seed = 0;
+};
+
+// Simulated peripheral for benchmarks: connects after a sampled latency and
+// notifies subscribed characteristics on the native clock with payloads of
+// [u32 sequence][u64 Clock::now()] padded to payloadSize.
+class VirtualDevice : public NativeDevice,
+                      public std::enable_shared_from_this<VirtualDevice> {
+public:
+  VirtualDevice(Advertisement advertisement,
+                std::shared_ptr<const GattDatabase> gatt,
+                const VirtualDeviceConfig &config);
+  ~VirtualDevice() override;
+
+  const Advertisement &advertisement() const override;
+  GattDatabase gatt() const override;
+  uint16_t mtu() override;
+
+  // Blocks for the sampled latency, like a real connect. On the virtual
+  // clock it steps time to the end of the latency instead.
+  bool connect() override;
+  bool disconnect() override;
+  bool connected() override;
+
+  bool subscribe(const std::string &service, const std::string &characteristic,
+                 bool indicate) override;
+  bool unsubscribe(const std::string &service,
+                   const std::string &characteristic) override;
+  bool read(const std::string &service, const std::string &characteristic,
+            std::vector<uint8_t> &out) override;
+  bool write(const std::string &service, const std::string &characteristic,
+             const uint8_t *data, size_t length, bool response) override;
+
+  void setNotifyCallback(const void *owner, NotifyCallback callback) override;
+  void clearNotifyCallback(const void *owner) override;
+
+private:
+  struct Subscription {
+    std::string service;
+    uint64_t timer = 0;
+    uint32_t sequence = 0;
+  };
+
+  const GattCharacteristic *find(const std::string &service,
+                                 const std::string &characteristic) const;
+  void schedule(const std::string &characteristic, Subscription &subscription);
+  void fire(const std::string &characteristic);
+  void cancelAll();
+
+  Advertisement info;
+  std::shared_ptr<const GattDatabase> database;
+  VirtualDeviceConfig config;
+
+  std::mutex mutex;
+  std::mt19937_64 rng;
+  bool isConnected = false;
+  std::map<std::string, Subscription> subscriptions;
+  std::map<std::string, std::vector<uint8_t>> values;
+  std::mutex callbackMutex;
+  const void *notifyOwner = nullptr;
+  NotifyCallback notify;
+};
+
+// Builds count devices of one model, sharing a GATT template, with one
+// notify/read characteristic and addresses derived from the index so runs
+// are reproducible.
+std::vector<std::shared_ptr<VirtualDevice>>
+createVirtualFleet(size_t count, const VirtualDeviceConfig &config);
@@ -0,0 +1,149 @@
+#include "dispatcher.h"
+#include "addon.h"
+
+#include <cstring>
+
+// Packets handed to JS per wakeup before yielding back to the event loop.
+static constexpr size_t BATCH_SIZE = 64;
+
+static Napi::Value payload(Napi::Env env, TargetFormat format,
+                           const uint8_t *data, size_t length) {
+  if (format == TargetFormat::Number) {
+    double value = 0;
+    if (length < sizeof(value)) {
+      return env.Undefined();
+    }
+    std::memcpy(&value, data, sizeof(value));
+    return Napi::Number::New(env, value);
+  }
+
+  auto arrayBuffer = Napi::ArrayBuffer::New(env, length);
+  std::memcpy(arrayBuffer.Data(), data, length);
+  if (format == TargetFormat::Float64) {
+    return Napi::Float64Array::New(env, length / sizeof(double), arrayBuffer,
+                                   0);
+  }
+  return Napi::Uint8Array::New(env, length, arrayBuffer, 0);
+}
+
+void Dispatcher::Init(Napi::Env env) {
+  auto dispatcher = std::make_shared<Dispatcher>();
+  auto noop = Napi::Function::New(env, [](const Napi::CallbackInfo &) {});
+  dispatcher->pump =
+      Napi::ThreadSafeFunction::New(env, noop, "onNotificationPump", 0, 1);
+  dispatcher->pump.Unref(env);
+  AddonState::get(env).dispatcher = std::move(dispatcher);
+}
+
+std::shared_ptr<Dispatcher> Dispatcher::get(Napi::Env env) {
+  return AddonState::get(env).dispatcher;
+}
+
+uint32_t Dispatcher::addFlow() {
+  const uint32_t flow = this->nextFlow++;
+  this->flows.addFlow(flow);
+  return flow;
+}
+
+void Dispatcher::removeFlow(uint32_t flow) { this->flows.removeFlow(flow); }
+
+FairScheduler &Dispatcher::scheduler() { return this->flows; }
+
+uint32_t Dispatcher::addTarget(Napi::Function fn, TargetFormat format) {
+  const uint32_t target = this->nextTarget++;
+  this->targets.emplace(target, Target{Napi::Persistent(fn), format});
+  return target;
+}
+
+void Dispatcher::removeTarget(uint32_t target) { this->targets.erase(target); }
+
+void Dispatcher::post(uint32_t flow, uint32_t target, const uint8_t *data,
+                      size_t length, uint64_t timestamp) {
+  if (this->flows.enqueue(flow, target, data, length, timestamp)) {
+    this->wake();
+  }
+}
+
+void Dispatcher::close() {
+  this->closed = true;
+  this->targets.clear();
+}
+
+void Dispatcher::wake() {
+  if (this->closed || this->pending.exchange(true)) {
+    return;
+  }
+
+  // The pending call keeps the dispatcher alive, as posting threads may
+  // outlive the env's AddonState.
+  auto self = new std::shared_ptr<Dispatcher>(this->shared_from_this());
+  auto callback = [](Napi::Env env, Napi::Function,
+                     std::shared_ptr<Dispatcher> *self) {
+    if (env != nullptr) {
+      (*self)->drain(env);
+    }
+    delete self;
+  };
+  if (this->pump.NonBlockingCall(self, callback) != napi_ok) {
+    delete self;
+    this->pending = false;
+  }
+}
+
+// A throwing callback leaves an exception pending, so no more JS can run in
+// this wakeup. The rest of the batch goes back to the scheduler for the next.
+void Dispatcher::requeue(std::vector<ScheduledPacket> &batch, size_t next) {
+  batch.erase(batch.begin(), batch.begin() + next);
+  this->flows.requeue(std::move(batch));
+}
+
+void Dispatcher::drain(Napi::Env env) {
+  this->pending = false;
+
+  std::vector<ScheduledPacket> batch;
+  batch.reserve(BATCH_SIZE);
+  this->flows.dequeue(BATCH_SIZE, batch);
+
+  for (size_t i = 0; i < batch.size(); i++) {
+    const ScheduledPacket &packet = batch[i];
+    const auto it = this->targets.find(packet.target);
+    if (it == this->targets.end()) {
+      continue;
+    }
+
+    Napi::HandleScope scope(env);
+    if (it->second.format == TargetFormat::Tagged) {
+      if (packet.data.size() < 2) {
+        continue;
+      }
+      const uint16_t channel = packet.data[0] | (packet.data[1] << 8);
+      it->second.fn.Call(
+          {Napi::Number::New(env, channel),
+           payload(env, TargetFormat::Bytes, packet.data.data() + 2,
+                   packet.data.size() - 2),
+           Napi::Number::New(env, packet.timestamp / 1e6)});
+      if (env.IsExceptionPending()) {
+        this->requeue(batch, i + 1);
+        break;
+      }
+      continue;
+    }
+
+    const Napi::Value value = payload(env, it->second.format,
+                                      packet.data.data(), packet.data.size());
+    if (packet.timestamp != 0) {
+      it->second.fn.Call(
+          {value, Napi::Number::New(env, packet.timestamp / 1e6)});
+    } else {
+      it->second.fn.Call({value});
+    }
+    if (env.IsExceptionPending()) {
+      this->requeue(batch, i + 1);
+      break;
+    }
+  }
+
+  if (!this->flows.empty()) {
+    this->wake();
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <napi.h>
+#include <vector>
+
+#include "scheduler.h"
+
+// How a payload is handed to the JS callback. Number and Float64 expect
+// host-order doubles, as produced by ValueDecoder. Tagged payloads start with
+// a little-endian u16 channel, passed to the callback as its first argument
+// ahead of the remaining bytes.
+enum class TargetFormat { Bytes, Number, Float64, Tagged };
+
+// Delivers notification payloads to JS through one thread-safe function per
+// env. Each peripheral is a flow of a FairScheduler, and the JS thread
+// drains a bounded batch per wakeup so a flooding device cannot push the
+// others' callbacks to the back of a single FIFO.
+class Dispatcher : public std::enable_shared_from_this<Dispatcher> {
+public:
+  // Creates the env's dispatcher in its AddonState.
+  static void Init(Napi::Env env);
+  // JS thread only; threads that post hold on to the returned pointer.
+  static std::shared_ptr<Dispatcher> get(Napi::Env env);
+
+  uint32_t addFlow();
+  void removeFlow(uint32_t flow);
+  FairScheduler &scheduler();
+
+  // Targets are JS callbacks and must be managed on the JS thread.
+  uint32_t addTarget(Napi::Function fn,
+                     TargetFormat format = TargetFormat::Bytes);
+  void removeTarget(uint32_t target);
+
+  // Safe to call from any thread. A non-zero timestamp is passed to the
+  // callback as a second argument, in milliseconds like getClockTime().
+  void post(uint32_t flow, uint32_t target, const uint8_t *data,
+            size_t length, uint64_t timestamp = 0);
+
+  // Drops the JS callbacks while the env shuts down; later posts are
+  // ignored.
+  void close();
+
+private:
+  struct Target {
+    Napi::FunctionReference fn;
+    TargetFormat format;
+  };
+
+  FairScheduler flows;
+  Napi::ThreadSafeFunction pump;
+  std::map<uint32_t, Target> targets;
+  std::atomic<uint32_t> nextFlow{1};
+  uint32_t nextTarget = 1;
+  std::atomic<bool> pending{false};
+  std::atomic<bool> closed{false};
+
+  void wake();
+  void drain(Napi::Env env);
+  void requeue(std::vector<ScheduledPacket> &batch, size_t next);
+};
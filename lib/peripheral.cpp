@@ -1,7 +1,44 @@
 #include "peripheral.h"
+#include "async.h"
+#include "clock.h"
+#include "codec.h"
+#include "dispatcher.h"
+#include "format.h"
+#include "keystore.h"
+#include "pipeline.h"
 #include "simpleble_c/simpleble.h"
+#include "stringtable.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <set>
+
+static const char PRESENTATION_FORMAT[SIMPLEBLE_UUID_STR_LEN] =
+    "00002904-0000-1000-8000-00805f9b34fb";
+
+static bool isBthomeService(const std::string &uuid) {
+  static const std::string BTHOME_SERVICE =
+      "0000fcd2-0000-1000-8000-00805f9b34fb";
+  return uuid.size() == BTHOME_SERVICE.size() &&
+         std::equal(uuid.begin(), uuid.end(), BTHOME_SERVICE.begin(),
+                    [](char a, char b) { return std::tolower(a) == b; });
+}
+
+
+static simpleble_err_t result(bool success) {
+  return success ? SIMPLEBLE_SUCCESS : SIMPLEBLE_FAILURE;
+}
+
+static std::string uuidString(const simpleble_uuid_t &uuid) {
+  return std::string(uuid.value,
+                     strnlen(uuid.value, SIMPLEBLE_UUID_STR_LEN_TS));
+}
 
 Napi::FunctionReference Peripheral::constructor;
+std::atomic<uint64_t> Peripheral::bondGeneration{0};
 
 Napi::Object Peripheral::Init(Napi::Env env, Napi::Object exports) {
   // clang-format off
@@ -17,19 +54,32 @@ Napi::Object Peripheral::Init(Napi::Env env, Napi::Object exports) {
     InstanceAccessor<&Peripheral::Paired>("paired"),
     InstanceAccessor<&Peripheral::GetServices>("services"),
     InstanceAccessor<&Peripheral::GetManufacturerData>("manufacturerData"),
+    InstanceAccessor<&Peripheral::DeliveryStats>("deliveryStats"),
+    InstanceAccessor<&Peripheral::GattFingerprint>("gattFingerprint"),
+    InstanceAccessor<&Peripheral::QuotaStats>("quotaStats"),
     InstanceMethod("connect", &Peripheral::Connect),
     InstanceMethod("disconnect", &Peripheral::Disconnect),
     InstanceMethod("unpair", &Peripheral::Unpair),
+    InstanceMethod("unpairAsync", &Peripheral::UnpairAsync),
+    InstanceMethod("refreshServices", &Peripheral::RefreshServices),
     InstanceMethod("read", &Peripheral::Read),
     InstanceMethod("writeRequest", &Peripheral::WriteRequest),
     InstanceMethod("writeCommand", &Peripheral::WriteCommand),
     InstanceMethod("notify", &Peripheral::Notify),
     InstanceMethod("indicate", &Peripheral::Indicate),
     InstanceMethod("unsubscribe", &Peripheral::Unsubscribe),
+    InstanceMethod("subscribeMany", &Peripheral::SubscribeMany),
+    InstanceMethod("unsubscribeMany", &Peripheral::UnsubscribeMany),
     InstanceMethod("readDescriptor", &Peripheral::ReadDescriptor),
     InstanceMethod("writeDescriptor", &Peripheral::WriteDescriptor),
     InstanceMethod("setCallbackOnConnected", &Peripheral::SetCallbackOnConnected),
     InstanceMethod("setCallbackOnDisconnected", &Peripheral::SetCallbackOnDisconnected),
+    InstanceMethod("dumpFlightRecorder", &Peripheral::DumpFlightRecorder),
+    InstanceMethod("setDeliveryBudget", &Peripheral::SetDeliveryBudget),
+    InstanceMethod("getTransformStats", &Peripheral::GetTransformStats),
+    InstanceMethod("trackDeviceClock", &Peripheral::TrackDeviceClock),
+    InstanceMethod("getDeviceClock", &Peripheral::GetDeviceClock),
+    InstanceMethod("setQuota", &Peripheral::SetQuota),
   });
   // clang-format on
 
@@ -41,13 +91,21 @@ Napi::Object Peripheral::Init(Napi::Env env, Napi::Object exports) {
 }
 
 Peripheral::Peripheral(const Napi::CallbackInfo &info)
-    : Napi::ObjectWrap<Peripheral>(info) {
+    : Napi::ObjectWrap<Peripheral>(info),
+      quota(PeripheralQuota::defaults()) {
   Napi::Env env = info.Env();
 
   if (info.Length() != 1) {
     Napi::TypeError::New(env, "Peripheral should not be created directly")
         .ThrowAsJavaScriptException();
     return;
+  } else if (info[0].IsExternal()) {
+    // See fromAdvertisement() and fromHandle().
+    const Origin &origin = *info[0].As<Napi::External<Origin>>().Data();
+    this->advertisement = origin.advertisement;
+    this->owner = origin.handle;
+    this->handle = static_cast<simpleble_peripheral_t>(origin.handle.get());
+    return;
   } else if (!info[0].IsBigInt()) {
     Napi::Error::New(env, "Internal error - handle pointer")
         .ThrowAsJavaScriptException();
@@ -61,17 +119,36 @@ Peripheral::Peripheral(const Napi::CallbackInfo &info)
     Napi::Error::New(env, "Internal handle error").ThrowAsJavaScriptException();
     return;
   }
+  this->owner.reset(this->handle, simpleble_peripheral_release_handle);
 }
 
 #include <iostream>
 
 Peripheral::~Peripheral() {
-  if (this->handle != nullptr) {
-    simpleble_peripheral_release_handle(this->handle);
+  if (this->selfLink) {
+    std::lock_guard<std::mutex> lock(this->selfLink->mutex);
+    this->selfLink->peripheral = nullptr;
+  }
+
+  this->owner.reset();
+  if (this->device) {
+    this->device->clearNotifyCallback(this);
+    this->device->clearDisconnectCallback(this);
   }
 
-  for (auto [k, fn] : notifyFns) fn.Release();
-  for (auto [k, fn] : indicateFns) fn.Release();
+  if (this->dispatcher) {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    for (auto [k, target] : notifyFns) {
+      this->dispatcher->removeTarget(target);
+    }
+    for (auto [k, target] : indicateFns) {
+      this->dispatcher->removeTarget(target);
+    }
+    for (auto &[id, group] : groups) {
+      this->dispatcher->removeTarget(group.target);
+    }
+    this->dispatcher->removeFlow(this->flow);
+  }
 
   if (this->onConnectedFn) {
     this->onConnectedFn.Release();
@@ -84,11 +161,169 @@ Peripheral::~Peripheral() {
   this->handle = nullptr;
 }
 
+Advertisement Peripheral::snapshot(simpleble_peripheral_t handle) {
+  Advertisement advertisement;
+  advertisement.timestamp = Clock::now();
+
+  char *identifier = simpleble_peripheral_identifier(handle);
+  if (identifier != nullptr) {
+    advertisement.identifier = identifier;
+    simpleble_free(identifier);
+  }
+  char *address = simpleble_peripheral_address(handle);
+  if (address != nullptr) {
+    advertisement.address = address;
+    simpleble_free(address);
+  }
+
+  advertisement.addressType = simpleble_peripheral_address_type(handle);
+  advertisement.rssi = simpleble_peripheral_rssi(handle);
+  advertisement.txPower = simpleble_peripheral_tx_power(handle);
+  bool connectable;
+  advertisement.connectable =
+      simpleble_peripheral_is_connectable(handle, &connectable) ==
+          SIMPLEBLE_SUCCESS &&
+      connectable;
+
+  const size_t manufacturers =
+      simpleble_peripheral_manufacturer_data_count(handle);
+  for (size_t index = 0; index < manufacturers; index++) {
+    simpleble_manufacturer_data_t data;
+    if (simpleble_peripheral_manufacturer_data_get(handle, index, &data) ==
+        SIMPLEBLE_SUCCESS) {
+      advertisement.manufacturerData.emplace_back(
+          data.manufacturer_id,
+          std::vector<uint8_t>(data.data, data.data + data.data_length));
+    }
+  }
+
+  const size_t services = simpleble_peripheral_services_count(handle);
+  for (size_t index = 0; index < services; index++) {
+    simpleble_service_t service;
+    if (simpleble_peripheral_services_get(handle, index, &service) ==
+        SIMPLEBLE_SUCCESS) {
+      advertisement.serviceData.emplace_back(
+          uuidString(service.uuid),
+          std::vector<uint8_t>(service.data,
+                               service.data + service.data_length));
+    }
+  }
+
+  return advertisement;
+}
+
+Napi::Value
+Peripheral::fromAdvertisement(Napi::Env env,
+                              std::shared_ptr<const Advertisement> snapshot) {
+  Origin origin{std::move(snapshot), nullptr};
+  return constructor.New({Napi::External<Origin>::New(env, &origin)});
+}
+
+void Peripheral::activate() {
+  if (this->recorder) {
+    return;
+  }
+
+  this->recorder = std::make_shared<FlightRecorder>(this->quota.history);
+  this->dispatcher = Dispatcher::get(this->Env());
+  this->flow = this->dispatcher->addFlow();
+  this->dispatcher->scheduler().setByteLimit(this->flow,
+                                             this->quota.queuedBytes);
+}
+
+Napi::Value Peripheral::fromHandle(Napi::Env env,
+                                   std::shared_ptr<void> handle) {
+  Origin origin{nullptr, std::move(handle)};
+  return constructor.New({Napi::External<Origin>::New(env, &origin)});
+}
+
+Napi::Value
+Peripheral::fromDevice(Napi::Env env, std::shared_ptr<NativeDevice> device,
+                       std::shared_ptr<const Advertisement> sighting) {
+  if (!sighting) {
+    // The advertisement shares ownership of the device it belongs to.
+    sighting = std::shared_ptr<const Advertisement>(
+        device, &device->advertisement());
+  }
+  Napi::Value value = fromAdvertisement(env, std::move(sighting));
+  Peripheral *peripheral = Unwrap(value.As<Napi::Object>());
+  peripheral->device = device;
+  device->setNotifyCallback(
+      peripheral, [peripheral](const std::string &service,
+                               const std::string &characteristic,
+                               const uint8_t *data, size_t data_length) {
+        onDeviceNotify(peripheral, service, characteristic, data,
+                       data_length);
+      });
+  device->setDisconnectCallback(peripheral, [peripheral]() {
+    if (peripheral->onDisconnectedFn) {
+      onDisconnected(nullptr, peripheral);
+    }
+  });
+  return value;
+}
+
+std::string Peripheral::addressString() {
+  return this->gattTarget().address();
+}
+
+std::string Peripheral::GattTarget::address() const {
+  if (this->advertisement) {
+    return this->advertisement->address;
+  } else if (this->device) {
+    return this->device->advertisement().address;
+  } else if (!this->owner) {
+    return std::string();
+  }
+
+  char *address = simpleble_peripheral_address(
+      static_cast<simpleble_peripheral_t>(this->owner.get()));
+  if (address == nullptr) {
+    return std::string();
+  }
+  std::string ret(address);
+  simpleble_free(address);
+  return ret;
+}
+
+void Peripheral::GattTarget::record(RecorderEventType type,
+                                    const simpleble_uuid_t *uuid,
+                                    size_t length, simpleble_err_t err,
+                                    uint64_t start) const {
+  if (!this->recorder) {
+    return;
+  }
+
+  this->recorder->record(type, uuid != nullptr ? uuid->value : nullptr,
+                         length, err, start);
+  if (err != SIMPLEBLE_SUCCESS) {
+    const std::string address = this->address();
+    const auto path = FlightRecorder::dumpPath(address);
+    if (!path.empty()) {
+      this->recorder->dumpInBackground(path, address);
+    }
+  }
+}
+
+bool Peripheral::admitOperation(size_t queued, size_t length) {
+  if (this->quota.queuedBytes == 0 ||
+      queued + length <= this->quota.queuedBytes) {
+    return true;
+  }
+
+  this->operationsRejected++;
+  return false;
+}
+
 Napi::Value Peripheral::Identifier(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->advertisement) {
+    return StringTable::get(env, this->advertisement->identifier);
+  }
+
   char *identifier = simpleble_peripheral_identifier(this->handle);
-  auto ret = Napi::String::New(env, identifier);
+  auto ret = StringTable::get(env, identifier);
   simpleble_free(identifier);
   return ret;
 }
@@ -96,8 +331,12 @@ Napi::Value Peripheral::Identifier(const Napi::CallbackInfo &info) {
 Napi::Value Peripheral::Address(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->advertisement) {
+    return StringTable::get(env, this->advertisement->address);
+  }
+
   char *address = simpleble_peripheral_address(this->handle);
-  auto ret = Napi::String::New(env, address);
+  auto ret = StringTable::get(env, address);
   free(address);
   return ret;
 }
@@ -105,6 +344,10 @@ Napi::Value Peripheral::Address(const Napi::CallbackInfo &info) {
 Napi::Value Peripheral::AddressType(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->advertisement) {
+    return Napi::Number::New(env, this->advertisement->addressType);
+  }
+
   simpleble_address_type_t address_type =
       simpleble_peripheral_address_type(this->handle);
   return Napi::Number::New(env, address_type);
@@ -113,6 +356,10 @@ Napi::Value Peripheral::AddressType(const Napi::CallbackInfo &info) {
 Napi::Value Peripheral::RSSI(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->advertisement) {
+    return Napi::Number::New(env, this->advertisement->rssi);
+  }
+
   const int16_t rssi = simpleble_peripheral_rssi(this->handle);
   return Napi::Number::New(env, rssi);
 }
@@ -120,6 +367,10 @@ Napi::Value Peripheral::RSSI(const Napi::CallbackInfo &info) {
 Napi::Value Peripheral::TxPower(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->advertisement) {
+    return Napi::Number::New(env, this->advertisement->txPower);
+  }
+
   const uint16_t txPower = simpleble_peripheral_tx_power(this->handle);
   return Napi::Number::New(env, txPower);
 }
@@ -127,27 +378,54 @@ Napi::Value Peripheral::TxPower(const Napi::CallbackInfo &info) {
 Napi::Value Peripheral::MTU(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
-  const uint16_t mtu = simpleble_peripheral_mtu(this->handle);
+  const uint16_t mtu =
+      this->device ? this->device->mtu() : simpleble_peripheral_mtu(this->handle);
   return Napi::Number::New(env, mtu);
 }
 
 Napi::Value Peripheral::Connect(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
-  const auto ret = simpleble_peripheral_connect(this->handle);
+  this->activate();
+  const uint64_t start = FlightRecorder::timestamp();
+  GattTrace trace("connect", this->handle);
+  const auto ret = this->device ? result(this->device->connect())
+                                 : simpleble_peripheral_connect(this->handle);
+  trace.result(ret);
+  this->record(RecorderEventType::Connect, nullptr, 0, ret, start);
+  if (!this->device && ret == SIMPLEBLE_SUCCESS) {
+    // Connecting may bond with the device.
+    bondGeneration++;
+  }
+  if (this->device && ret == SIMPLEBLE_SUCCESS && this->onConnectedFn) {
+    onConnected(nullptr, this);
+  }
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
 
 Napi::Value Peripheral::Disconnect(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
-  const auto ret = simpleble_peripheral_disconnect(this->handle);
+  const uint64_t start = FlightRecorder::timestamp();
+  GattTrace trace("disconnect", this->handle);
+  const auto ret = this->device
+                       ? result(this->device->disconnect())
+                       : simpleble_peripheral_disconnect(this->handle);
+  trace.result(ret);
+  this->record(RecorderEventType::Disconnect, nullptr, 0, ret, start);
+  if (this->device && ret == SIMPLEBLE_SUCCESS && this->onDisconnectedFn) {
+    onDisconnected(nullptr, this);
+  }
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
 
 Napi::Value Peripheral::Connected(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->device) {
+    return Napi::Boolean::New(env, this->device->connected());
+  }
+
   bool connected;
   const auto ret = simpleble_peripheral_is_connected(this->handle, &connected);
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS && connected);
@@ -156,6 +434,10 @@ Napi::Value Peripheral::Connected(const Napi::CallbackInfo &info) {
 Napi::Value Peripheral::Connectable(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->advertisement) {
+    return Napi::Boolean::New(env, this->advertisement->connectable);
+  }
+
   bool connectable;
   const auto ret =
       simpleble_peripheral_is_connectable(this->handle, &connectable);
@@ -174,56 +456,143 @@ Napi::Value Peripheral::Unpair(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
   const auto ret = simpleble_peripheral_unpair(this->handle);
+  if (ret == SIMPLEBLE_SUCCESS) {
+    bondGeneration++;
+  }
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
 
-Napi::Value Peripheral::GetServices(const Napi::CallbackInfo &info) {
+Napi::Value Peripheral::UnpairAsync(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  // The owner keeps the handle valid even if this wrapper is collected
+  // before the pool gets to it.
+  std::shared_ptr<void> owner = this->owner;
+  return runOnPool<bool>(
+      env, "unpair",
+      [owner]() {
+        const auto ret = simpleble_peripheral_unpair(
+            static_cast<simpleble_peripheral_t>(owner.get()));
+        if (ret == SIMPLEBLE_SUCCESS) {
+          bondGeneration++;
+        }
+        return ret == SIMPLEBLE_SUCCESS;
+      },
+      [](Napi::Env env, bool &success) -> Napi::Value {
+        return Napi::Boolean::New(env, success);
+      });
+}
+
+static Napi::Object characteristicObject(Napi::Env env,
+                                         const GattCharacteristic &chr) {
+  Napi::Object obj = Napi::Object::New(env);
+  Napi::Array descriptors = Napi::Array::New(env, chr.descriptors.size());
+
+  for (size_t i = 0; i < chr.descriptors.size(); i++) {
+    descriptors[i] = StringTable::get(env, chr.descriptors[i]);
+  }
+
+  obj.Set("uuid", StringTable::get(env, chr.uuid));
+  obj.Set("canRead", chr.canRead);
+  obj.Set("canWriteRequest", chr.canWriteRequest);
+  obj.Set("canWriteCommand", chr.canWriteCommand);
+  obj.Set("canNotify", chr.canNotify);
+  obj.Set("canIndicate", chr.canIndicate);
+  obj.Set("descriptors", descriptors);
+  return obj;
+}
+
+
+GattDatabase Peripheral::readServices() {
+  if (this->device) {
+    return this->device->gatt();
+  }
+
+  GattDatabase database;
+  if (this->advertisement) {
+    for (const auto &[uuid, data] : this->advertisement->serviceData) {
+      GattService entry;
+      entry.uuid = uuid;
+      entry.data = data;
+      if (isBthomeService(uuid) && !data.empty() && (data[0] & 0x01)) {
+        decryptBthome(this->advertisement->address, data.data(), data.size(),
+                      entry.data);
+      }
+      database.push_back(std::move(entry));
+    }
+    return database;
+  }
+
   const size_t count = simpleble_peripheral_services_count(this->handle);
-  Napi::Array services = Napi::Array::New(env, count);
+  database.reserve(count);
+  std::string address;
 
   for (size_t index = 0; index < count; index++) {
     simpleble_service_t service;
-    Napi::Object serviceObj = Napi::Object::New(env);
     auto ret = simpleble_peripheral_services_get(this->handle, index, &service);
     if (ret != SIMPLEBLE_SUCCESS) {
       break;
     }
 
-    Napi::String uuid =
-        Napi::String::New(env, service.uuid.value, SIMPLEBLE_UUID_STR_LEN_TS);
-
-    Napi::Uint8Array data = Napi::Uint8Array::New(env, service.data_length);
-    for (size_t i = 0; i < service.data_length; i++) {
-      data[i] = service.data[i];
+    GattService entry;
+    entry.uuid = uuidString(service.uuid);
+    entry.data.assign(service.data, service.data + service.data_length);
+    if (isBthomeService(entry.uuid) && !entry.data.empty() &&
+        (entry.data[0] & 0x01)) {
+      if (address.empty()) {
+        address = this->addressString();
+      }
+      // Left encrypted when there is no key or the MIC fails.
+      decryptBthome(address, service.data, service.data_length, entry.data);
     }
+    entry.characteristics.reserve(service.characteristic_count);
 
-    Napi::Array characteristics =
-        Napi::Array::New(env, service.characteristic_count);
     for (size_t i = 0; i < service.characteristic_count; i++) {
-      simpleble_characteristic_t characteristic = service.characteristics[i];
-      Napi::Object obj = Napi::Object::New(env);
-      Napi::Array descriptors =
-          Napi::Array::New(env, characteristic.descriptor_count);
-
+      const simpleble_characteristic_t &characteristic =
+          service.characteristics[i];
+      GattCharacteristic chr;
+      chr.uuid = uuidString(characteristic.uuid);
+      chr.canRead = characteristic.can_read;
+      chr.canWriteRequest = characteristic.can_write_request;
+      chr.canWriteCommand = characteristic.can_write_command;
+      chr.canNotify = characteristic.can_notify;
+      chr.canIndicate = characteristic.can_indicate;
       for (size_t j = 0; j < characteristic.descriptor_count; j++) {
-        descriptors[j] =
-            Napi::String::New(env, characteristic.descriptors[j].uuid.value,
-                              SIMPLEBLE_UUID_STR_LEN_TS);
+        chr.descriptors.push_back(
+            uuidString(characteristic.descriptors[j].uuid));
       }
+      entry.characteristics.push_back(std::move(chr));
+    }
+
+    database.push_back(std::move(entry));
+  }
+
+  return database;
+}
+
+Napi::Value Peripheral::GetServices(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  const GattDatabase database = this->readServices();
+  Napi::Array services = Napi::Array::New(env, database.size());
 
-      obj.Set("uuid", characteristic.uuid.value);
-      obj.Set("canRead", characteristic.can_read);
-      obj.Set("canWriteRequest", characteristic.can_write_request);
-      obj.Set("canWriteCommand", characteristic.can_write_command);
-      obj.Set("canNotify", characteristic.can_notify);
-      obj.Set("canIndicate", characteristic.can_indicate);
-      obj.Set("descriptors", descriptors);
-      characteristics[i] = obj;
+  for (size_t index = 0; index < database.size(); index++) {
+    const GattService &service = database[index];
+    Napi::Object serviceObj = Napi::Object::New(env);
+
+    Napi::Uint8Array data = Napi::Uint8Array::New(env, service.data.size());
+    for (size_t i = 0; i < service.data.size(); i++) {
+      data[i] = service.data[i];
+    }
+
+    Napi::Array characteristics =
+        Napi::Array::New(env, service.characteristics.size());
+    for (size_t i = 0; i < service.characteristics.size(); i++) {
+      characteristics[i] =
+          characteristicObject(env, service.characteristics[i]);
     }
 
-    serviceObj.Set("uuid", uuid);
+    serviceObj.Set("uuid", StringTable::get(env, service.uuid));
     serviceObj.Set("data", data);
     serviceObj.Set("characteristics", characteristics);
 
@@ -233,9 +602,159 @@ Napi::Value Peripheral::GetServices(const Napi::CallbackInfo &info) {
   return services;
 }
 
+Napi::Value Peripheral::RefreshServices(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  // A device of a known model resolves to the template and overlay it
+  // already uses, so an unchanged table is confirmed without diffing. Tables
+  // over the quota are diffed from a private copy and not kept.
+  GattDatabase database = this->readServices();
+  const bool cacheable =
+      this->quota.gattBytes == 0 || gattSize(database) <= this->quota.gattBytes;
+  GattOverlay next;
+  if (cacheable) {
+    next = GattTemplateRegistry::overlay(database);
+  } else {
+    next.base = std::make_shared<const GattDatabase>(std::move(database));
+  }
+  if (!cacheable) {
+    this->gattRejected++;
+  } else if (next == this->gattCache) {
+    return Napi::Array::New(env, 0);
+  }
+
+  // Changes point into both tables.
+  const GattDatabase previous = this->gattCache.materialize();
+  const GattDatabase current = next.materialize();
+  this->gattCache = GattOverlay();
+  const auto changes = diffGattDatabase(previous, current);
+  if (!changes.empty()) {
+    this->decoders.clear();
+  }
+  Napi::Array result = Napi::Array::New(env, changes.size());
+
+  for (size_t i = 0; i < changes.size(); i++) {
+    const GattChange &change = changes[i];
+    Napi::Object obj = Napi::Object::New(env);
+
+    switch (change.type) {
+    case GattChangeType::Added:
+      obj.Set("type", "added");
+      break;
+    case GattChangeType::Removed:
+      obj.Set("type", "removed");
+      break;
+    case GattChangeType::Changed:
+      obj.Set("type", "changed");
+      break;
+    }
+    obj.Set("service", StringTable::get(env, change.service->uuid));
+
+    if (change.characteristic != nullptr) {
+      obj.Set("characteristic",
+              characteristicObject(env, *change.characteristic));
+    }
+
+    // Subscriptions only survive for characteristics that still exist.
+    if (change.type == GattChangeType::Removed) {
+      std::lock_guard<std::mutex> lock(this->sinksMutex);
+      if (change.characteristic != nullptr) {
+        this->dropSubscription(change.characteristic->uuid);
+      } else {
+        for (const auto &chr : change.service->characteristics) {
+          this->dropSubscription(chr.uuid);
+        }
+      }
+    }
+
+    result[i] = obj;
+  }
+
+  if (cacheable) {
+    this->gattCache = std::move(next);
+  }
+  return result;
+}
+
+Napi::Value Peripheral::GattFingerprint(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (!this->gattCache) {
+    return env.Undefined();
+  }
+
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx",
+           static_cast<unsigned long long>(
+               gattFingerprint(this->gattCache.materialize())));
+  return Napi::String::New(env, hex);
+}
+
+// Caller holds sinksMutex.
+void Peripheral::dropSubscription(const std::string &characteristic) {
+  if (const auto it = notifyFns.find(characteristic); it != notifyFns.end()) {
+    this->dispatcher->removeTarget(it->second);
+    notifyFns.erase(it);
+  }
+  if (const auto it = indicateFns.find(characteristic);
+      it != indicateFns.end()) {
+    this->dispatcher->removeTarget(it->second);
+    indicateFns.erase(it);
+  }
+  this->setPipeline(characteristic, Transform(), 0, false);
+}
+
+// Caller holds sinksMutex. Whether anything still needs the characteristic's
+// CCCD enabled.
+bool Peripheral::subscribed(const std::string &characteristic) {
+  return this->notifyFns.count(characteristic) != 0 ||
+         this->indicateFns.count(characteristic) != 0 ||
+         this->sinks.count(characteristic) != 0;
+}
+
+// Caller holds sinksMutex.
+size_t Peripheral::subscriptionCount() {
+  std::set<std::string> active;
+  for (const auto &[characteristic, target] : this->notifyFns) {
+    active.insert(characteristic);
+  }
+  for (const auto &[characteristic, target] : this->indicateFns) {
+    active.insert(characteristic);
+  }
+  for (const auto &[characteristic, entry] : this->sinks) {
+    active.insert(characteristic);
+  }
+  active.insert(this->reserved.begin(), this->reserved.end());
+  return active.size();
+}
+
+// Caller holds sinksMutex. Characteristics already subscribed are always
+// admitted, so replacing a callback does not count against the quota.
+bool Peripheral::admitSubscription(const std::string &characteristic) {
+  if (this->quota.subscriptions == 0 || this->subscribed(characteristic) ||
+      this->subscriptionCount() < this->quota.subscriptions) {
+    return true;
+  }
+
+  this->subscriptionsRejected++;
+  return false;
+}
+
 Napi::Value Peripheral::GetManufacturerData(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
+  if (this->advertisement) {
+    Napi::Object obj = Napi::Object::New(env);
+    for (const auto &[id, bytes] : this->advertisement->manufacturerData) {
+      Napi::Uint8Array data = Napi::Uint8Array::New(env, bytes.size());
+      for (size_t i = 0; i < bytes.size(); i++) {
+        data[i] = bytes[i];
+      }
+      obj[uint32_t(id)] = data;
+    }
+    return obj;
+  }
+
   const size_t count =
       simpleble_peripheral_manufacturer_data_count(this->handle);
   Napi::Object obj = Napi::Object::New(env);
@@ -261,6 +780,41 @@ Napi::Value Peripheral::GetManufacturerData(const Napi::CallbackInfo &info) {
   return obj;
 }
 
+// Reads the optional `{decode}` option: 'number' delivers the first value of
+// the payload, 'float64' all of them, and a Codec the values of every whole
+// record in it, as float64. Returns false with a pending exception when it
+// is invalid.
+static bool decodeOption(const Napi::CallbackInfo &info, size_t index,
+                         TargetFormat &format,
+                         std::shared_ptr<const StructCodec> &codec) {
+  if (info.Length() <= index || !info[index].IsObject()) {
+    return true;
+  }
+
+  const Napi::Value decode = info[index].As<Napi::Object>().Get("decode");
+  if (decode.IsUndefined()) {
+    return true;
+  } else if (decode.IsObject() && decode.As<Napi::Object>().InstanceOf(
+                                      Codec::constructor.Value())) {
+    codec = Codec::Unwrap(decode.As<Napi::Object>())->codec();
+    format = TargetFormat::Float64;
+    return true;
+  }
+
+  const std::string mode =
+      decode.IsString() ? decode.As<Napi::String>().Utf8Value() : "";
+  if (mode == "number") {
+    format = TargetFormat::Number;
+  } else if (mode == "float64") {
+    format = TargetFormat::Float64;
+  } else {
+    Napi::TypeError::New(info.Env(), "Decode is not 'number' or 'float64'")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  return true;
+}
+
 Napi::Value Peripheral::Read(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
@@ -283,6 +837,12 @@ Napi::Value Peripheral::Read(const Napi::CallbackInfo &info) {
     return env.Undefined();
   }
 
+  TargetFormat format = TargetFormat::Bytes;
+  std::shared_ptr<const StructCodec> codec;
+  if (!decodeOption(info, 2, format, codec)) {
+    return env.Undefined();
+  }
+
   const Napi::String cbService = info[0].As<Napi::String>();
   const Napi::String cbChar = info[1].As<Napi::String>();
 
@@ -294,14 +854,56 @@ Napi::Value Peripheral::Read(const Napi::CallbackInfo &info) {
          SIMPLEBLE_UUID_STR_LEN);
 
   uint8_t *data_ptr = nullptr;
-  size_t data_length;
+  size_t data_length = 0;
+
+  ValueDecoder decoder{PresentationFormat()};
+  if (format != TargetFormat::Bytes && !codec) {
+    decoder = this->valueDecoder(service, characteristic);
+    if (!decoder.valid()) {
+      return env.Undefined();
+    }
+  }
 
-  auto ret = simpleble_peripheral_read(this->handle, service, characteristic,
-                                       &data_ptr, &data_length);
+  const uint64_t start = FlightRecorder::timestamp();
+  GattTrace trace("read", this->handle, &service, &characteristic);
+  simpleble_err_t ret;
+  std::vector<uint8_t> value;
+  if (this->device) {
+    ret = result(
+        this->device->read(service.value, characteristic.value, value));
+    data_ptr = value.data();
+    data_length = value.size();
+  } else {
+    ret = simpleble_peripheral_read(this->handle, service, characteristic,
+                                    &data_ptr, &data_length);
+  }
+  trace.result(ret);
+  this->record(RecorderEventType::Read, &characteristic, data_length,
+               ret, start);
   if (ret != SIMPLEBLE_SUCCESS) {
     return env.Undefined();
   }
 
+  if (format != TargetFormat::Bytes) {
+    std::vector<double> values;
+    if (codec) {
+      codec->decode(data_ptr, data_length, values);
+    } else {
+      decoder.decode(data_ptr, data_length, values);
+    }
+    if (values.empty()) {
+      return env.Undefined();
+    } else if (format == TargetFormat::Number) {
+      return Napi::Number::New(env, values[0]);
+    }
+
+    Napi::Float64Array array = Napi::Float64Array::New(env, values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      array[i] = values[i];
+    }
+    return array;
+  }
+
   Napi::Uint8Array data = Napi::Uint8Array::New(env, data_length);
   for (size_t i = 0; i < data_length; i++) {
     data[i] = data_ptr[i];
@@ -351,8 +953,17 @@ Napi::Value Peripheral::WriteRequest(const Napi::CallbackInfo &info) {
   memcpy(characteristic.value, cbChar.Utf8Value().c_str(),
          SIMPLEBLE_UUID_STR_LEN);
 
-  const auto ret = simpleble_peripheral_write_request(
-      this->handle, service, characteristic, data, data_size);
+  const uint64_t start = FlightRecorder::timestamp();
+  GattTrace trace("write_request", this->handle, &service, &characteristic);
+  const auto ret =
+      this->device
+          ? result(this->device->write(service.value, characteristic.value,
+                                       data, data_size, true))
+          : simpleble_peripheral_write_request(this->handle, service,
+                                               characteristic, data, data_size);
+  trace.result(ret);
+  this->record(RecorderEventType::WriteRequest, &characteristic, data_size,
+               ret, start);
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
 
@@ -397,8 +1008,17 @@ Napi::Value Peripheral::WriteCommand(const Napi::CallbackInfo &info) {
   memcpy(characteristic.value, cbChar.Utf8Value().c_str(),
          SIMPLEBLE_UUID_STR_LEN);
 
-  const auto ret = simpleble_peripheral_write_command(
-      this->handle, service, characteristic, data, data_size);
+  const uint64_t start = FlightRecorder::timestamp();
+  GattTrace trace("write_command", this->handle, &service, &characteristic);
+  const auto ret =
+      this->device
+          ? result(this->device->write(service.value, characteristic.value,
+                                       data, data_size, false))
+          : simpleble_peripheral_write_command(this->handle, service,
+                                               characteristic, data, data_size);
+  trace.result(ret);
+  this->record(RecorderEventType::WriteCommand, &characteristic, data_size,
+               ret, start);
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
 
@@ -432,82 +1052,301 @@ Napi::Value Peripheral::Unsubscribe(const Napi::CallbackInfo &info) {
   memcpy(service.value, cbService.Utf8Value().c_str(), SIMPLEBLE_UUID_STR_LEN);
   memcpy(characteristic.value, cbChar.Utf8Value().c_str(),
          SIMPLEBLE_UUID_STR_LEN);
-  const auto ret =
-      simpleble_peripheral_unsubscribe(this->handle, service, characteristic);
+  const uint64_t start = FlightRecorder::timestamp();
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    this->dropSubscription(characteristic.value);
+
+    // Groups and streams attached to the characteristic keep it enabled.
+    if (this->subscribed(characteristic.value)) {
+      return Napi::Boolean::New(env, true);
+    }
+  }
+
+  // Written without sinksMutex, like subscribing.
+  simpleble_err_t ret;
+  {
+    GattTrace trace("unsubscribe", this->handle, &service, &characteristic);
+    ret = this->unsubscribe(service, characteristic);
+    trace.result(ret);
+  }
+  this->record(RecorderEventType::Unsubscribe, &characteristic, 0, ret, start);
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
 
-Napi::Value Peripheral::ReadDescriptor(const Napi::CallbackInfo &info) {
+// Longest attribute value, plus the channel tag.
+static constexpr size_t TAGGED_BUFFER_SIZE = 2 + 512;
+
+// Prefixes notifications of a subscribeMany() group with their channel and
+// queues them on the peripheral's flow for the group's callback.
+class ChannelSink : public NotificationSink {
+public:
+  ChannelSink(std::shared_ptr<Dispatcher> dispatcher, uint32_t flow,
+              uint32_t target)
+      : dispatcher(std::move(dispatcher)), flow(flow), target(target) {}
+
+  void onNotification(uint16_t channel, uint64_t timestamp,
+                      const uint8_t *data, size_t length) override {
+    uint8_t buffer[TAGGED_BUFFER_SIZE];
+    std::vector<uint8_t> large;
+    uint8_t *tagged = buffer;
+    if (length + 2 > sizeof(buffer)) {
+      large.resize(length + 2);
+      tagged = large.data();
+    }
+
+    tagged[0] = static_cast<uint8_t>(channel);
+    tagged[1] = static_cast<uint8_t>(channel >> 8);
+    memcpy(tagged + 2, data, length);
+    this->dispatcher->post(this->flow, this->target, tagged, length + 2,
+                           timestamp);
+  }
+
+private:
+  std::shared_ptr<Dispatcher> dispatcher;
+  uint32_t flow;
+  uint32_t target;
+};
+
+Napi::Value Peripheral::SubscribeMany(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
   if (info.Length() < 1) {
-    Napi::TypeError::New(env, "Missing service").ThrowAsJavaScriptException();
+    Napi::TypeError::New(env, "Missing characteristics")
+        .ThrowAsJavaScriptException();
     return env.Undefined();
-  } else if (!info[0].IsString()) {
-    Napi::TypeError::New(env, "Service is not a string")
+  } else if (!info[0].IsArray()) {
+    Napi::TypeError::New(env, "Characteristics is not an array")
         .ThrowAsJavaScriptException();
     return env.Undefined();
   }
 
   if (info.Length() < 2) {
-    Napi::TypeError::New(env, "Missing characteristic")
-        .ThrowAsJavaScriptException();
+    Napi::TypeError::New(env, "Missing callback").ThrowAsJavaScriptException();
     return env.Undefined();
-  } else if (!info[1].IsString()) {
-    Napi::TypeError::New(env, "Characteristic is not a string")
+  } else if (!info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Callback is not a function")
         .ThrowAsJavaScriptException();
     return env.Undefined();
   }
 
-  if (info.Length() < 3) {
-    Napi::TypeError::New(env, "Missing descriptor")
-        .ThrowAsJavaScriptException();
-    return env.Undefined();
-  } else if (!info[2].IsString()) {
-    Napi::TypeError::New(env, "Descriptor is not a string")
+  const Napi::Array list = info[0].As<Napi::Array>();
+  if (list.Length() > UINT16_MAX + 1) {
+    Napi::RangeError::New(env, "Too many channels")
         .ThrowAsJavaScriptException();
     return env.Undefined();
   }
 
-  const Napi::String cbService = info[0].As<Napi::String>();
-  const Napi::String cbChar = info[1].As<Napi::String>();
-  const Napi::String cbDesc = info[2].As<Napi::String>();
+  ChannelGroup group;
+  for (uint32_t i = 0; i < list.Length(); i++) {
+    const Napi::Value entry = list.Get(i);
+    if (!entry.IsArray() || entry.As<Napi::Array>().Length() != 2 ||
+        !entry.As<Napi::Array>().Get(uint32_t(0)).IsString() ||
+        !entry.As<Napi::Array>().Get(uint32_t(1)).IsString()) {
+      Napi::TypeError::New(env, "Channel is not a [service, characteristic]")
+          .ThrowAsJavaScriptException();
+      return env.Undefined();
+    }
 
-  simpleble_uuid_t service;
-  simpleble_uuid_t characteristic;
-  simpleble_uuid_t descriptor;
+    const Napi::Array pair = entry.As<Napi::Array>();
+    simpleble_uuid_t service;
+    memcpy(service.value,
+           pair.Get(uint32_t(0)).As<Napi::String>().Utf8Value().c_str(),
+           SIMPLEBLE_UUID_STR_LEN);
+    group.channels.emplace_back(
+        service, pair.Get(uint32_t(1)).As<Napi::String>().Utf8Value());
+  }
 
-  memcpy(service.value, cbService.Utf8Value().c_str(), SIMPLEBLE_UUID_STR_LEN);
-  memcpy(characteristic.value, cbChar.Utf8Value().c_str(),
-         SIMPLEBLE_UUID_STR_LEN);
-  memcpy(descriptor.value, cbDesc.Utf8Value().c_str(), SIMPLEBLE_UUID_STR_LEN);
+  this->activate();
+  group.target = this->dispatcher->addTarget(info[1].As<Napi::Function>(),
+                                             TargetFormat::Tagged);
+  group.sink =
+      std::make_shared<ChannelSink>(this->dispatcher, this->flow, group.target);
+
+  // Channels are admitted and reserved under sinksMutex, their CCCDs written
+  // without it, then attached together; a failure unsubscribes what was
+  // written so the group is all or nothing.
+  std::vector<bool> write;
+  bool failed = false;
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    std::set<std::string> writing;
+    for (size_t i = 0; i < group.channels.size(); i++) {
+      const std::string &key = group.channels[i].second;
+      if (this->reserved.count(key) == 0 && !this->admitSubscription(key)) {
+        failed = true;
+        group.channels.resize(i);
+        break;
+      }
+      write.push_back(!this->subscribed(key) && writing.insert(key).second);
+      this->reserved.insert(key);
+    }
+  }
 
-  uint8_t *data_ptr = nullptr;
-  size_t data_length;
+  std::vector<size_t> written;
+  for (size_t i = 0; i < group.channels.size() && !failed; i++) {
+    if (!write[i]) {
+      continue;
+    }
+    const auto &[service, key] = group.channels[i];
+    simpleble_uuid_t characteristic = {};
+    key.copy(characteristic.value, SIMPLEBLE_UUID_STR_LEN_TS);
+    GattTrace trace("notify", this->handle, &service, &characteristic);
+    const auto ret = this->subscribe(service, characteristic, false);
+    trace.result(ret);
+    if (ret != SIMPLEBLE_SUCCESS) {
+      failed = true;
+    } else {
+      written.push_back(i);
+    }
+  }
 
-  auto ret = simpleble_peripheral_read_descriptor(this->handle, service,
-                                                  characteristic, descriptor,
-                                                  &data_ptr, &data_length);
-  if (ret != SIMPLEBLE_SUCCESS) {
-    return env.Undefined();
+  std::vector<size_t> rollback;
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    for (size_t i = 0; i < group.channels.size(); i++) {
+      const std::string &key = group.channels[i].second;
+      this->reserved.erase(this->reserved.find(key));
+      if (!failed) {
+        this->sinks.emplace(key, SinkEntry{group.channels[i].first, group.sink,
+                                           static_cast<uint16_t>(i)});
+      }
+    }
+    for (const size_t i : written) {
+      if (failed && !this->subscribed(group.channels[i].second)) {
+        rollback.push_back(i);
+      }
+    }
   }
 
-  Napi::Uint8Array data = Napi::Uint8Array::New(env, data_length);
-  for (size_t i = 0; i < data_length; i++) {
-    data[i] = data_ptr[i];
+  if (failed) {
+    for (const size_t i : rollback) {
+      const auto &[service, key] = group.channels[i];
+      simpleble_uuid_t characteristic = {};
+      key.copy(characteristic.value, SIMPLEBLE_UUID_STR_LEN_TS);
+      this->unsubscribe(service, characteristic);
+    }
+    this->dispatcher->removeTarget(group.target);
+    return env.Undefined();
   }
 
-  return data;
+  const uint32_t id = this->nextGroup++;
+  this->groups.emplace(id, std::move(group));
+  return Napi::Number::New(env, id);
 }
 
-Napi::Value Peripheral::WriteDescriptor(const Napi::CallbackInfo &info) {
+Napi::Value Peripheral::UnsubscribeMany(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
   if (info.Length() < 1) {
-    Napi::TypeError::New(env, "Missing service").ThrowAsJavaScriptException();
-    return env.Undefined();
-  } else if (!info[0].IsString()) {
-    Napi::TypeError::New(env, "Service is not a string")
+    Napi::TypeError::New(env, "Missing group").ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Group is not a number")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  const auto it = this->groups.find(info[0].As<Napi::Number>().Uint32Value());
+  if (it == this->groups.end()) {
+    return Napi::Boolean::New(env, false);
+  }
+
+  const ChannelGroup &group = it->second;
+  for (size_t i = 0; i < group.channels.size(); i++) {
+    this->removeSink(group.channels[i].second, group.sink.get(),
+                     static_cast<uint16_t>(i));
+  }
+  this->dispatcher->removeTarget(group.target);
+  this->groups.erase(it);
+  return Napi::Boolean::New(env, true);
+}
+
+Napi::Value Peripheral::ReadDescriptor(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing service").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Service is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Missing characteristic")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[1].IsString()) {
+    Napi::TypeError::New(env, "Characteristic is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  if (info.Length() < 3) {
+    Napi::TypeError::New(env, "Missing descriptor")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[2].IsString()) {
+    Napi::TypeError::New(env, "Descriptor is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  const Napi::String cbService = info[0].As<Napi::String>();
+  const Napi::String cbChar = info[1].As<Napi::String>();
+  const Napi::String cbDesc = info[2].As<Napi::String>();
+
+  simpleble_uuid_t service;
+  simpleble_uuid_t characteristic;
+  simpleble_uuid_t descriptor;
+
+  memcpy(service.value, cbService.Utf8Value().c_str(), SIMPLEBLE_UUID_STR_LEN);
+  memcpy(characteristic.value, cbChar.Utf8Value().c_str(),
+         SIMPLEBLE_UUID_STR_LEN);
+  memcpy(descriptor.value, cbDesc.Utf8Value().c_str(), SIMPLEBLE_UUID_STR_LEN);
+
+  uint8_t *data_ptr = nullptr;
+  size_t data_length = 0;
+
+  const uint64_t start = FlightRecorder::timestamp();
+  GattTrace trace("read_descriptor", this->handle, &service, &characteristic);
+  simpleble_err_t ret;
+  std::vector<uint8_t> value;
+  if (this->device) {
+    ret = result(this->device->readDescriptor(
+        service.value, characteristic.value, descriptor.value, value));
+    data_ptr = value.data();
+    data_length = value.size();
+  } else {
+    ret = simpleble_peripheral_read_descriptor(this->handle, service,
+                                               characteristic, descriptor,
+                                               &data_ptr, &data_length);
+  }
+  trace.result(ret);
+  this->record(RecorderEventType::ReadDescriptor, &characteristic, data_length,
+               ret, start);
+  if (ret != SIMPLEBLE_SUCCESS) {
+    return env.Undefined();
+  }
+
+  Napi::Uint8Array data = Napi::Uint8Array::New(env, data_length);
+  for (size_t i = 0; i < data_length; i++) {
+    data[i] = data_ptr[i];
+  }
+
+  return data;
+}
+
+Napi::Value Peripheral::WriteDescriptor(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing service").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Service is not a string")
         .ThrowAsJavaScriptException();
     return env.Undefined();
   }
@@ -554,11 +1393,54 @@ Napi::Value Peripheral::WriteDescriptor(const Napi::CallbackInfo &info) {
          SIMPLEBLE_UUID_STR_LEN);
   memcpy(descriptor.value, cbDesc.Utf8Value().c_str(), SIMPLEBLE_UUID_STR_LEN);
 
-  const auto ret = simpleble_peripheral_write_descriptor(
-      this->handle, service, characteristic, descriptor, data, data_size);
+  const uint64_t start = FlightRecorder::timestamp();
+  GattTrace trace("write_descriptor", this->handle, &service, &characteristic);
+  const auto ret =
+      this->device
+          ? result(this->device->writeDescriptor(
+                service.value, characteristic.value, descriptor.value, data,
+                data_size))
+          : simpleble_peripheral_write_descriptor(
+                this->handle, service, characteristic, descriptor, data,
+                data_size);
+  trace.result(ret);
+  this->record(RecorderEventType::WriteDescriptor, &characteristic, data_size,
+               ret, start);
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
 
+// Reads the optional `{transform}` subscription option. Returns false with a
+// pending exception when they are invalid.
+static bool transformOption(const Napi::CallbackInfo &info, size_t index,
+                            const std::string &address,
+                            Transform &transform) {
+  if (info.Length() <= index || info[index].IsUndefined()) {
+    return true;
+  } else if (!info[index].IsObject()) {
+    Napi::TypeError::New(info.Env(), "Options is not an object")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+  const Napi::Value name = info[index].As<Napi::Object>().Get("transform");
+  if (name.IsUndefined()) {
+    return true;
+  } else if (!name.IsString()) {
+    Napi::TypeError::New(info.Env(), "Transform is not a string")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+  transform =
+      TransformRegistry::find(name.As<Napi::String>().Utf8Value(), address);
+  if (!transform) {
+    Napi::TypeError::New(info.Env(), "Unknown transform")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  return true;
+}
+
 Napi::Value Peripheral::Notify(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
   Napi::HandleScope scope(env);
@@ -601,11 +1483,63 @@ Napi::Value Peripheral::Notify(const Napi::CallbackInfo &info) {
   memcpy(characteristic.value, cbChar.Utf8Value().c_str(),
          SIMPLEBLE_UUID_STR_LEN);
 
-  const auto [it, _] = notifyFns.emplace(std::string(characteristic.value), Napi::ThreadSafeFunction::New(env, cbFn, "onNotify", 0, 1));
-  it->second.Unref(env);
+  Transform transform;
+  TargetFormat format = TargetFormat::Bytes;
+  std::shared_ptr<const StructCodec> codec;
+  if (!transformOption(info, 3, this->addressString(), transform) ||
+      !decodeOption(info, 3, format, codec)) {
+    return env.Undefined();
+  }
 
-  const auto ret = simpleble_peripheral_notify(this->handle, service,
-                                               characteristic, onNotify, this);
+  const bool parallel = static_cast<bool>(transform);
+  if (codec) {
+    transform = transform ? composeTransforms(transform, codec->transform())
+                          : codec->transform();
+  } else if (format != TargetFormat::Bytes) {
+    const ValueDecoder decoder = this->valueDecoder(service, characteristic);
+    if (!decoder.valid()) {
+      return Napi::Boolean::New(env, false);
+    }
+    transform = transform ? composeTransforms(transform, decoder.transform())
+                          : decoder.transform();
+  }
+
+  this->activate();
+  const std::string key(characteristic.value);
+  const uint64_t start = FlightRecorder::timestamp();
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    if (!this->admitSubscription(key)) {
+      return Napi::Boolean::New(env, false);
+    }
+    // The CCCD write blocks until the peripheral answers, and notification
+    // callbacks need sinksMutex meanwhile.
+    this->reserved.insert(key);
+  }
+
+  simpleble_err_t ret;
+  {
+    GattTrace trace("notify", this->handle, &service, &characteristic);
+    ret = this->subscribe(service, characteristic, false);
+    trace.result(ret);
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    this->reserved.erase(this->reserved.find(key));
+    if (ret != SIMPLEBLE_SUCCESS) {
+      this->dropSubscription(key);
+    } else {
+      // Registered only once subscribed, so that a failure leaves nothing
+      // behind to count against the quota.
+      uint32_t &target = this->notifyFns[key];
+      if (target != 0) {
+        this->dispatcher->removeTarget(target);
+      }
+      target = this->dispatcher->addTarget(cbFn, format);
+      this->setPipeline(key, std::move(transform), target, parallel);
+    }
+  }
+  this->record(RecorderEventType::Notify, &characteristic, 0, ret, start);
 
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
@@ -652,11 +1586,62 @@ Napi::Value Peripheral::Indicate(const Napi::CallbackInfo &info) {
   memcpy(characteristic.value, cbChar.Utf8Value().c_str(),
          SIMPLEBLE_UUID_STR_LEN);
 
-  const auto [it, _] = indicateFns.emplace(std::string(characteristic.value), Napi::ThreadSafeFunction::New(env, cbFn, "onIndicate", 0, 1));
-    it->second.Unref(env);
+  Transform transform;
+  TargetFormat format = TargetFormat::Bytes;
+  std::shared_ptr<const StructCodec> codec;
+  if (!transformOption(info, 3, this->addressString(), transform) ||
+      !decodeOption(info, 3, format, codec)) {
+    return env.Undefined();
+  }
+
+  const bool parallel = static_cast<bool>(transform);
+  if (codec) {
+    transform = transform ? composeTransforms(transform, codec->transform())
+                          : codec->transform();
+  } else if (format != TargetFormat::Bytes) {
+    const ValueDecoder decoder = this->valueDecoder(service, characteristic);
+    if (!decoder.valid()) {
+      return Napi::Boolean::New(env, false);
+    }
+    transform = transform ? composeTransforms(transform, decoder.transform())
+                          : decoder.transform();
+  }
+
+  this->activate();
+  const std::string key(characteristic.value);
+  const uint64_t start = FlightRecorder::timestamp();
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    if (!this->admitSubscription(key)) {
+      return Napi::Boolean::New(env, false);
+    }
+    // Reserved while the CCCD is written without the lock, as in Notify().
+    this->reserved.insert(key);
+  }
 
-  const auto ret = simpleble_peripheral_indicate(
-      this->handle, service, characteristic, onIndicate, this);
+  simpleble_err_t ret;
+  {
+    GattTrace trace("indicate", this->handle, &service, &characteristic);
+    ret = this->subscribe(service, characteristic, true);
+    trace.result(ret);
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    this->reserved.erase(this->reserved.find(key));
+    if (ret != SIMPLEBLE_SUCCESS) {
+      this->dropSubscription(key);
+    } else {
+      // Registered only once subscribed, so that a failure leaves nothing
+      // behind to count against the quota.
+      uint32_t &target = this->indicateFns[key];
+      if (target != 0) {
+        this->dispatcher->removeTarget(target);
+      }
+      target = this->dispatcher->addTarget(cbFn, format);
+      this->setPipeline(key, std::move(transform), target, parallel);
+    }
+  }
+  this->record(RecorderEventType::Indicate, &characteristic, 0, ret, start);
 
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
@@ -677,9 +1662,12 @@ Napi::Value Peripheral::SetCallbackOnConnected(const Napi::CallbackInfo &info) {
   this->onConnectedFn = Napi::ThreadSafeFunction::New(
       env, info[0].As<Napi::Function>(), "onConnected", 0, 1);
   this->onConnectedFn.Unref(env);
+  this->activate();
 
-  const auto ret = simpleble_peripheral_set_callback_on_connected(
-      this->handle, onConnected, this);
+  const auto ret = this->device
+                       ? SIMPLEBLE_SUCCESS
+                       : simpleble_peripheral_set_callback_on_connected(
+                             this->handle, onConnected, this);
 
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
@@ -701,15 +1689,555 @@ Peripheral::SetCallbackOnDisconnected(const Napi::CallbackInfo &info) {
   this->onDisconnectedFn = Napi::ThreadSafeFunction::New(
       env, info[0].As<Napi::Function>(), "onDisconnectedFn", 0, 1);
   this->onDisconnectedFn.Unref(env);
+  this->activate();
 
-  const auto ret = simpleble_peripheral_set_callback_on_disconnected(
-      this->handle, onDisconnected, this);
+  const auto ret = this->device
+                       ? SIMPLEBLE_SUCCESS
+                       : simpleble_peripheral_set_callback_on_disconnected(
+                             this->handle, onDisconnected, this);
 
   return Napi::Boolean::New(env, ret == SIMPLEBLE_SUCCESS);
 }
 
+Napi::Value Peripheral::DumpFlightRecorder(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing path").ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Path is not a string")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  const bool ret =
+      this->recorder &&
+      this->recorder->dump(info[0].As<Napi::String>().Utf8Value(),
+                           this->addressString());
+  return Napi::Boolean::New(env, ret);
+}
+
+Napi::Value Peripheral::SetDeliveryBudget(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing budget").ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsObject()) {
+    Napi::TypeError::New(env, "Budget is not an object")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  const Napi::Object options = info[0].As<Napi::Object>();
+  FlowBudget budget;
+  if (options.Get("bytes").IsNumber()) {
+    budget.quantum = options.Get("bytes").As<Napi::Number>().Uint32Value();
+  }
+  if (options.Get("packets").IsNumber()) {
+    budget.packets = options.Get("packets").As<Napi::Number>().Uint32Value();
+  }
+  if (options.Get("queue").IsNumber()) {
+    budget.queueLimit = options.Get("queue").As<Napi::Number>().Uint32Value();
+  }
+
+  this->activate();
+  const bool ret = this->dispatcher->scheduler().setBudget(this->flow, budget);
+  return Napi::Boolean::New(env, ret);
+}
+
+bool Peripheral::quotaOption(const Napi::Object &options,
+                             PeripheralQuota &quota) {
+  static const struct {
+    const char *name;
+    size_t PeripheralQuota::*field;
+  } FIELDS[] = {
+      {"queuedBytes", &PeripheralQuota::queuedBytes},
+      {"gattBytes", &PeripheralQuota::gattBytes},
+      {"history", &PeripheralQuota::history},
+      {"subscriptions", &PeripheralQuota::subscriptions},
+  };
+
+  for (const auto &field : FIELDS) {
+    const Napi::Value value = options.Get(field.name);
+    if (value.IsUndefined()) {
+      continue;
+    } else if (!value.IsNumber() ||
+               value.As<Napi::Number>().DoubleValue() < 0) {
+      Napi::TypeError::New(options.Env(), std::string(field.name) +
+                                              " is not a positive number")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+    quota.*field.field =
+        static_cast<size_t>(value.As<Napi::Number>().DoubleValue());
+  }
+  return true;
+}
+
+Napi::Value Peripheral::SetQuota(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing quota").ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsObject()) {
+    Napi::TypeError::New(env, "Quota is not an object")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  PeripheralQuota quota = this->quota;
+  if (!quotaOption(info[0].As<Napi::Object>(), quota)) {
+    return Napi::Boolean::New(env, false);
+  }
+
+  if (this->recorder) {
+    quota.history = this->recorder->setCapacity(quota.history);
+  }
+  this->quota = quota;
+  if (this->quota.gattBytes != 0 && this->gattCache &&
+      this->gattCache.footprint() > this->quota.gattBytes) {
+    this->gattCache = GattOverlay();
+    this->gattRejected++;
+  }
+  const bool ret = !this->dispatcher ||
+                   this->dispatcher->scheduler().setByteLimit(
+                       this->flow, this->quota.queuedBytes);
+  return Napi::Boolean::New(env, ret);
+}
+
+Napi::Value Peripheral::QuotaStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  FlowStats flow;
+  if (this->dispatcher) {
+    this->dispatcher->scheduler().stats(this->flow, flow);
+  }
+  size_t subscriptions;
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    subscriptions = this->subscriptionCount();
+  }
+
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("queuedBytes", static_cast<double>(flow.queuedBytes));
+  obj.Set("dropped", static_cast<double>(flow.dropped));
+  obj.Set("gattBytes", static_cast<double>(this->gattCache.footprint()));
+  obj.Set("gattRejected", static_cast<double>(this->gattRejected));
+  obj.Set("history", static_cast<double>(this->recorder
+                                              ? this->recorder->capacity()
+                                              : this->quota.history));
+  obj.Set("subscriptions", static_cast<double>(subscriptions));
+  obj.Set("subscriptionsRejected",
+          static_cast<double>(this->subscriptionsRejected));
+  obj.Set("operationsRejected",
+          static_cast<double>(this->operationsRejected));
+  return obj;
+}
+
+Napi::Value Peripheral::DeliveryStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  FlowStats stats;
+  if (!this->dispatcher ||
+      !this->dispatcher->scheduler().stats(this->flow, stats)) {
+    return env.Undefined();
+  }
+
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("enqueued", static_cast<double>(stats.enqueued));
+  obj.Set("delivered", static_cast<double>(stats.delivered));
+  obj.Set("bytes", static_cast<double>(stats.bytes));
+  obj.Set("dropped", static_cast<double>(stats.dropped));
+  obj.Set("throttled", static_cast<double>(stats.throttled));
+  obj.Set("queued", static_cast<double>(stats.queued));
+  return obj;
+}
+
+Napi::Value Peripheral::GetTransformStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing characteristic")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Characteristic is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  std::shared_ptr<OrderedPipeline> pipeline;
+  {
+    std::lock_guard<std::mutex> lock(this->pipelinesMutex);
+    const auto it =
+        this->pipelines.find(info[0].As<Napi::String>().Utf8Value());
+    if (it == this->pipelines.end()) {
+      return env.Undefined();
+    }
+    pipeline = it->second;
+  }
+
+  const PipelineStats stats = pipeline->stats();
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("submitted", static_cast<double>(stats.submitted));
+  obj.Set("delivered", static_cast<double>(stats.delivered));
+  obj.Set("failed", static_cast<double>(stats.failed));
+  obj.Set("dropped", static_cast<double>(stats.dropped));
+  return obj;
+}
+
+Napi::Value Peripheral::TrackDeviceClock(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing characteristic")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Characteristic is not a string")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  const std::string characteristic = info[0].As<Napi::String>().Utf8Value();
+  if (info.Length() < 2 || info[1].IsNull() || info[1].IsUndefined()) {
+    std::lock_guard<std::mutex> lock(this->clocksMutex);
+    return Napi::Boolean::New(env, this->clocks.erase(characteristic) != 0);
+  } else if (!info[1].IsObject()) {
+    Napi::TypeError::New(env, "Options is not an object")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  const Napi::Object options = info[1].As<Napi::Object>();
+  DeviceClock clock{0, 4, nullptr};
+  double window = 64;
+  if (options.Get("offset").IsNumber()) {
+    clock.offset = options.Get("offset").As<Napi::Number>().Uint32Value();
+  }
+  if (options.Get("size").IsNumber()) {
+    clock.size = options.Get("size").As<Napi::Number>().Uint32Value();
+  }
+  if (options.Get("window").IsNumber()) {
+    window = options.Get("window").As<Napi::Number>().DoubleValue();
+    if (!std::isfinite(window)) {
+      Napi::RangeError::New(env, "Window is not finite")
+          .ThrowAsJavaScriptException();
+      return Napi::Boolean::New(env, false);
+    }
+  }
+  if (clock.size != 2 && clock.size != 4 && clock.size != 8) {
+    Napi::TypeError::New(env, "Size is not 2, 4 or 8")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  clock.estimator = std::make_shared<DriftEstimator>(
+      static_cast<size_t>(std::clamp(
+          window, 2.0, static_cast<double>(DriftEstimator::MAX_WINDOW))),
+      static_cast<unsigned>(clock.size * 8));
+  std::lock_guard<std::mutex> lock(this->clocksMutex);
+  this->clocks[characteristic] = std::move(clock);
+  return Napi::Boolean::New(env, true);
+}
+
+Napi::Value Peripheral::GetDeviceClock(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing characteristic")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsString()) {
+    Napi::TypeError::New(env, "Characteristic is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  std::shared_ptr<DriftEstimator> estimator;
+  {
+    std::lock_guard<std::mutex> lock(this->clocksMutex);
+    const auto it = this->clocks.find(info[0].As<Napi::String>().Utf8Value());
+    if (it == this->clocks.end()) {
+      return env.Undefined();
+    }
+    estimator = it->second.estimator;
+  }
+
+  ClockFit fit;
+  if (!estimator->estimate(fit) || fit.slope <= 0) {
+    return env.Undefined();
+  }
+
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("tickRate", 1e9 / fit.slope);
+  obj.Set("jitter", fit.jitter / 1e6);
+  obj.Set("samples", static_cast<double>(fit.samples));
+  return obj;
+}
+
+void Peripheral::setPipeline(const std::string &characteristic,
+                             Transform transform, uint32_t target,
+                             bool parallel) {
+  std::lock_guard<std::mutex> lock(this->pipelinesMutex);
+  if (!transform) {
+    this->pipelines.erase(characteristic);
+    return;
+  }
+
+  const uint32_t flow = this->flow;
+  this->pipelines[characteristic] = std::make_shared<OrderedPipeline>(
+      std::move(transform),
+      [dispatcher = this->dispatcher, flow,
+       target](const uint8_t *data, size_t length, uint64_t timestamp) {
+        dispatcher->post(flow, target, data, length, timestamp);
+      },
+      parallel ? &ThreadPool::shared() : nullptr);
+}
+
+ValueDecoder
+Peripheral::valueDecoder(const simpleble_uuid_t &service,
+                         const simpleble_uuid_t &characteristic) {
+  const std::string key =
+      std::string(service.value) + "/" + characteristic.value;
+  if (const auto it = this->decoders.find(key); it != this->decoders.end()) {
+    return it->second;
+  }
+
+  // Only definitive answers are cached: the characteristic is known to lack
+  // the descriptor, or it was read and parsed. Failed reads are retried.
+  const auto same = [](const std::string &a, const char *b) {
+    return a.size() == strnlen(b, SIMPLEBLE_UUID_STR_LEN_TS) &&
+           std::equal(a.begin(), a.end(), b, [](char x, char y) {
+             return std::tolower(x) == std::tolower(y);
+           });
+  };
+  bool absent = false;
+  for (const auto &svc : this->gattCache ? this->gattCache.materialize()
+                                         : this->readServices()) {
+    if (!same(svc.uuid, service.value)) {
+      continue;
+    }
+    for (const auto &chr : svc.characteristics) {
+      if (same(chr.uuid, characteristic.value)) {
+        absent = std::none_of(chr.descriptors.begin(), chr.descriptors.end(),
+                              [&same](const std::string &uuid) {
+                                return same(uuid, PRESENTATION_FORMAT);
+                              });
+      }
+    }
+  }
+  PresentationFormat format;
+  bool definitive = absent;
+
+  if (!definitive) {
+    GattTrace trace("read_descriptor", this->handle, &service,
+                    &characteristic);
+    if (this->device) {
+      std::vector<uint8_t> value;
+      const bool read = this->device->readDescriptor(
+          service.value, characteristic.value, PRESENTATION_FORMAT, value);
+      trace.result(result(read));
+      definitive =
+          read && PresentationFormat::parse(value.data(), value.size(), format);
+    } else {
+      simpleble_uuid_t descriptor;
+      memcpy(descriptor.value, PRESENTATION_FORMAT, SIMPLEBLE_UUID_STR_LEN);
+      uint8_t *data_ptr = nullptr;
+      size_t data_length = 0;
+      const auto ret = simpleble_peripheral_read_descriptor(
+          this->handle, service, characteristic, descriptor, &data_ptr,
+          &data_length);
+      trace.result(ret);
+      if (ret == SIMPLEBLE_SUCCESS) {
+        definitive = PresentationFormat::parse(data_ptr, data_length, format);
+        simpleble_free(data_ptr);
+      }
+    }
+  }
+
+  const ValueDecoder decoder(format);
+  if (definitive) {
+    this->decoders.emplace(key, decoder);
+  }
+  return decoder;
+}
+
+uint64_t Peripheral::deviceTime(const std::string &characteristic,
+                                const uint8_t *data, size_t data_length) {
+  std::lock_guard<std::mutex> lock(this->clocksMutex);
+  const auto it = this->clocks.find(characteristic);
+  if (it == this->clocks.end() ||
+      data_length < it->second.offset + it->second.size) {
+    return 0;
+  }
+
+  uint64_t tick = 0;
+  for (size_t i = 0; i < it->second.size; i++) {
+    tick |= uint64_t(data[it->second.offset + i]) << (8 * i);
+  }
+  return it->second.estimator->add(tick, Clock::now());
+}
+
+void Peripheral::deliver(const std::string &characteristic, uint32_t target,
+                         const uint8_t *data, size_t data_length,
+                         uint64_t timestamp) {
+  std::shared_ptr<OrderedPipeline> pipeline;
+  {
+    std::lock_guard<std::mutex> lock(this->pipelinesMutex);
+    if (const auto it = this->pipelines.find(characteristic);
+        it != this->pipelines.end()) {
+      pipeline = it->second;
+    }
+  }
+
+  if (pipeline) {
+    pipeline->submit(data, data_length, timestamp);
+  } else {
+    this->dispatcher->post(this->flow, target, data, data_length, timestamp);
+  }
+}
+
+void Peripheral::record(RecorderEventType type, const simpleble_uuid_t *uuid,
+                        size_t length, simpleble_err_t err, uint64_t start) {
+  if (this->recorder) {
+    this->gattTarget().record(type, uuid, length, err, start);
+  }
+}
+
+void Peripheral::dumpFlightRecorder() {
+  const std::string address = this->addressString();
+  const auto path = FlightRecorder::dumpPath(address);
+  if (!path.empty()) {
+    this->recorder->dumpInBackground(path, address);
+  }
+}
+
+std::shared_ptr<Peripheral::Link> Peripheral::link() {
+  if (!this->selfLink) {
+    this->selfLink = std::make_shared<Link>();
+    this->selfLink->peripheral = this;
+  }
+  return this->selfLink;
+}
+
+bool Peripheral::addSink(const simpleble_uuid_t &service,
+                         const simpleble_uuid_t &characteristic,
+                         std::shared_ptr<NotificationSink> sink,
+                         uint16_t channel) {
+  this->activate();
+  const std::string key(characteristic.value);
+  bool write;
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    if (!this->admitSubscription(key)) {
+      return false;
+    }
+    write = !this->subscribed(key) && this->reserved.count(key) == 0;
+    this->reserved.insert(key);
+  }
+
+  simpleble_err_t ret = SIMPLEBLE_SUCCESS;
+  if (write) {
+    GattTrace trace("notify", this->handle, &service, &characteristic);
+    ret = this->subscribe(service, characteristic, false);
+    trace.result(ret);
+  }
+
+  std::lock_guard<std::mutex> lock(this->sinksMutex);
+  this->reserved.erase(this->reserved.find(key));
+  if (ret != SIMPLEBLE_SUCCESS) {
+    return false;
+  }
+  this->sinks.emplace(key, SinkEntry{service, std::move(sink), channel});
+  return true;
+}
+
+void Peripheral::removeSink(const std::string &characteristic,
+                            const NotificationSink *sink, uint16_t channel) {
+  simpleble_uuid_t service;
+  {
+    std::lock_guard<std::mutex> lock(this->sinksMutex);
+    auto [begin, end] = this->sinks.equal_range(characteristic);
+    auto it = begin;
+    while (it != end && (it->second.sink.get() != sink ||
+                         it->second.channel != channel)) {
+      ++it;
+    }
+    if (it == end) {
+      return;
+    }
+
+    service = it->second.service;
+    this->sinks.erase(it);
+    if (this->subscribed(characteristic)) {
+      return;
+    }
+  }
+
+  // Written without sinksMutex, like subscribing.
+  simpleble_uuid_t uuid;
+  memcpy(uuid.value, characteristic.c_str(), SIMPLEBLE_UUID_STR_LEN);
+  this->unsubscribe(service, uuid);
+}
+
+simpleble_err_t Peripheral::subscribe(const simpleble_uuid_t &service,
+                                      const simpleble_uuid_t &characteristic,
+                                      bool indicate) {
+  if (this->device) {
+    // Native devices notify through onDeviceNotify() either way.
+    return result(this->device->subscribe(service.value, characteristic.value,
+                                          indicate));
+  } else if (indicate) {
+    return simpleble_peripheral_indicate(this->handle, service, characteristic,
+                                         onIndicate, this);
+  }
+  return simpleble_peripheral_notify(this->handle, service, characteristic,
+                                     onNotify, this);
+}
+
+simpleble_err_t
+Peripheral::unsubscribe(const simpleble_uuid_t &service,
+                        const simpleble_uuid_t &characteristic) {
+  if (this->device) {
+    return result(
+        this->device->unsubscribe(service.value, characteristic.value));
+  }
+  return simpleble_peripheral_unsubscribe(this->handle, service,
+                                          characteristic);
+}
+
+uint32_t Peripheral::deliverToSinks(const char *characteristic,
+                                    const uint8_t *data, size_t data_length,
+                                    uint64_t timestamp, bool indicate) {
+  std::lock_guard<std::mutex> lock(this->sinksMutex);
+  const auto &targets = indicate ? this->indicateFns : this->notifyFns;
+  const auto target = targets.find(characteristic);
+  auto [begin, end] = this->sinks.equal_range(characteristic);
+  if (begin == end) {
+    return target != targets.end() ? target->second : 0;
+  }
+
+  // Sinks order by the corrected device time when there is one.
+  if (timestamp == 0) {
+    timestamp = Clock::now();
+  }
+  for (auto it = begin; it != end; ++it) {
+    it->second.sink->onNotification(it->second.channel, timestamp, data,
+                                    data_length);
+  }
+  return target != targets.end() ? target->second : 0;
+}
+
 void Peripheral::onConnected(simpleble_peripheral_t, void *userdata) {
   auto peripheral = reinterpret_cast<Peripheral *>(userdata);
+  if (peripheral->recorder) {
+    peripheral->recorder->record(RecorderEventType::Connected);
+  }
+
   auto callback = [](Napi::Env env, Napi::Function jsCallback) {
     jsCallback.Call({});
   };
@@ -718,6 +2246,11 @@ void Peripheral::onConnected(simpleble_peripheral_t, void *userdata) {
 
 void Peripheral::onDisconnected(simpleble_peripheral_t, void *userdata) {
   auto peripheral = reinterpret_cast<Peripheral *>(userdata);
+  if (peripheral->recorder) {
+    peripheral->recorder->record(RecorderEventType::Disconnected);
+    peripheral->dumpFlightRecorder();
+  }
+
   auto callback = [](Napi::Env env, Napi::Function jsCallback) {
     jsCallback.Call({});
   };
@@ -728,18 +2261,25 @@ void Peripheral::onNotify(simpleble_uuid_t service,
                           simpleble_uuid_t characteristic, const uint8_t *data,
                           size_t data_length, void *userdata) {
   auto peripheral = reinterpret_cast<Peripheral *>(userdata);
-  std::vector<uint8_t> vecData(data, data + data_length);
-  auto callback = [vecData](Napi::Env env, Napi::Function jsCallback) {
-    auto arrayBuffer = Napi::ArrayBuffer::New(env, vecData.size());
-    std::memcpy(arrayBuffer.Data(), vecData.data(), vecData.size());
-    auto uint8Array =
-        Napi::Uint8Array::New(env, vecData.size(), arrayBuffer, 0);
-    jsCallback.Call({uint8Array});
-  };
+  if (WB_PROBE_ENABLED(notify)) {
+    const std::string address = peripheral->addressString();
+    WB_PROBE(notify, address.c_str(), service.value, characteristic.value,
+             data_length, traceTimestamp());
+  }
+
+  if (peripheral->recorder) {
+    peripheral->recorder->record(RecorderEventType::NotifyReceived,
+                                 characteristic.value, data_length);
+  }
 
-  auto& notifyFns = peripheral->notifyFns;
-  if (const auto it = notifyFns.find(std::string(characteristic.value)); it != notifyFns.end())
-    it->second.NonBlockingCall(callback);
+  const uint64_t timestamp =
+      peripheral->deviceTime(characteristic.value, data, data_length);
+  const uint32_t target = peripheral->deliverToSinks(
+      characteristic.value, data, data_length, timestamp, false);
+  if (target != 0) {
+    peripheral->deliver(characteristic.value, target, data, data_length,
+                        timestamp);
+  }
 }
 
 void Peripheral::onIndicate(simpleble_uuid_t service,
@@ -747,16 +2287,44 @@ void Peripheral::onIndicate(simpleble_uuid_t service,
                             const uint8_t *data, size_t data_length,
                             void *userdata) {
   auto peripheral = reinterpret_cast<Peripheral *>(userdata);
-  std::vector<uint8_t> vecData(data, data + data_length);
-  auto callback = [vecData](Napi::Env env, Napi::Function jsCallback) {
-    auto arrayBuffer = Napi::ArrayBuffer::New(env, vecData.size());
-    std::memcpy(arrayBuffer.Data(), vecData.data(), vecData.size());
-    auto uint8Array =
-        Napi::Uint8Array::New(env, vecData.size(), arrayBuffer, 0);
-    jsCallback.Call({uint8Array});
-  };
+  if (WB_PROBE_ENABLED(indicate)) {
+    const std::string address = peripheral->addressString();
+    WB_PROBE(indicate, address.c_str(), service.value, characteristic.value,
+             data_length, traceTimestamp());
+  }
+
+  if (peripheral->recorder) {
+    peripheral->recorder->record(RecorderEventType::IndicateReceived,
+                                 characteristic.value, data_length);
+  }
 
-  auto& indicateFns = peripheral->indicateFns;
-  if (const auto it = indicateFns.find(std::string(characteristic.value)); it != indicateFns.end())
-    it->second.NonBlockingCall(callback);
+  const uint64_t timestamp =
+      peripheral->deviceTime(characteristic.value, data, data_length);
+  const uint32_t target = peripheral->deliverToSinks(
+      characteristic.value, data, data_length, timestamp, true);
+  if (target != 0) {
+    peripheral->deliver(characteristic.value, target, data, data_length,
+                        timestamp);
+  }
+}
+
+void Peripheral::onDeviceNotify(Peripheral *peripheral,
+                                const std::string &service,
+                                const std::string &characteristic,
+                                const uint8_t *data, size_t data_length) {
+  simpleble_uuid_t serviceUuid = {};
+  simpleble_uuid_t characteristicUuid = {};
+  service.copy(serviceUuid.value, SIMPLEBLE_UUID_STR_LEN_TS);
+  characteristic.copy(characteristicUuid.value, SIMPLEBLE_UUID_STR_LEN_TS);
+
+  bool indicate;
+  {
+    std::lock_guard<std::mutex> lock(peripheral->sinksMutex);
+    indicate = peripheral->indicateFns.count(characteristic) != 0;
+  }
+  if (indicate) {
+    onIndicate(serviceUuid, characteristicUuid, data, data_length, peripheral);
+  } else {
+    onNotify(serviceUuid, characteristicUuid, data, data_length, peripheral);
+  }
 }
@@ -1,9 +1,27 @@
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <napi.h>
+#include <set>
+#include <vector>
 #include <simpleble_c/peripheral.h>
 
+#include "advertisement.h"
+#include "drift.h"
+#include "format.h"
+#include "gatt.h"
+#include "pipeline.h"
+#include "quota.h"
+#include "recorder.h"
+#include "sink.h"
+#include "templates.h"
+#include "nativedevice.h"
+
+class Dispatcher;
+
 #define SIMPLEBLE_UUID_STR_LEN_TS (SIMPLEBLE_UUID_STR_LEN - 1) // remove null terminator
 
 class Peripheral : public Napi::ObjectWrap<Peripheral> {
@@ -14,12 +32,173 @@ public:
 
   static Napi::FunctionReference constructor;
 
+  // Copies what the scan reported about a handle.
+  static Advertisement snapshot(simpleble_peripheral_t handle);
+  // Creates a Peripheral backed only by an advertisement, as delivered by
+  // capture replay. GATT operations on it fail.
+  static Napi::Value
+  fromAdvertisement(Napi::Env env,
+                    std::shared_ptr<const Advertisement> snapshot);
+  // Creates a Peripheral that drives a native device instead of SimpleBLE,
+  // reporting the given sighting or else the one the device was created from.
+  static Napi::Value
+  fromDevice(Napi::Env env, std::shared_ptr<NativeDevice> device,
+             std::shared_ptr<const Advertisement> sighting = nullptr);
+  // Creates a Peripheral sharing ownership of a SimpleBLE handle, such as
+  // one held by the paired peripheral cache.
+  static Napi::Value fromHandle(Napi::Env env, std::shared_ptr<void> handle);
+
+  // Bumped whenever a bond may have been created or removed.
+  static std::atomic<uint64_t> bondGeneration;
+
+  // Reads the fields of a JS quota object that are set. Returns false with a
+  // pending exception when one is invalid.
+  static bool quotaOption(const Napi::Object &options, PeripheralQuota &quota);
+
+  // What GATT operations need to run off the JS thread. Either of owner and
+  // device keeps the peripheral usable after this wrapper is collected; both
+  // are null for peripherals backed only by an advertisement.
+  struct GattTarget {
+    std::shared_ptr<void> owner;
+    std::shared_ptr<NativeDevice> device;
+    std::shared_ptr<const Advertisement> advertisement;
+    // Null until the peripheral is activated.
+    std::shared_ptr<FlightRecorder> recorder;
+
+    std::string address() const;
+    // Records an operation in the flight recorder, dumping it on failure.
+    void record(RecorderEventType type, const simpleble_uuid_t *uuid,
+                size_t length, simpleble_err_t err, uint64_t start) const;
+  };
+  GattTarget gattTarget() const {
+    return {this->owner, this->device, this->advertisement, this->recorder};
+  }
+
+  // Admits a batched operation of length payload bytes behind queued bytes
+  // already waiting for this peripheral, within the queuedBytes quota. JS
+  // thread only.
+  bool admitOperation(size_t queued, size_t length);
+
+  // Sets up the flight recorder and the scheduler flow, which most
+  // peripherals, seen once in a scan, never need. Called on the JS thread
+  // before connecting or registering anything that calls back from the BLE
+  // thread.
+  void activate();
+
+  // Outlives the wrapper, so that native objects holding on to a peripheral,
+  // such as streams and rings, reach it without unwrapping a collected
+  // object. peripheral is null once the wrapper is gone.
+  struct Link {
+    std::mutex mutex;
+    Peripheral *peripheral;
+  };
+  // Created on first use, JS thread only.
+  std::shared_ptr<Link> link();
+
+  // Routes notifications of a characteristic to a native sink, subscribing
+  // on the first attachment and unsubscribing after the last removal.
+  bool addSink(const simpleble_uuid_t &service,
+               const simpleble_uuid_t &characteristic,
+               std::shared_ptr<NotificationSink> sink, uint16_t channel);
+  void removeSink(const std::string &characteristic,
+                  const NotificationSink *sink, uint16_t channel);
+
 private:
-  simpleble_peripheral_t handle;
-  std::map<std::string, Napi::ThreadSafeFunction> notifyFns;
-  std::map<std::string, Napi::ThreadSafeFunction> indicateFns;
+  // Where a characteristic carries the device's tick counter.
+  struct DeviceClock {
+    size_t offset;
+    size_t size;
+    std::shared_ptr<DriftEstimator> estimator;
+  };
+
+  struct SinkEntry {
+    simpleble_uuid_t service;
+    std::shared_ptr<NotificationSink> sink;
+    uint16_t channel;
+  };
+
+  // Characteristics of a subscribeMany() call, indexed by channel, and the
+  // sink that tags their notifications for one shared callback.
+  struct ChannelGroup {
+    std::shared_ptr<NotificationSink> sink;
+    uint32_t target;
+    std::vector<std::pair<simpleble_uuid_t, std::string>> channels;
+  };
+
+  // Constructor argument of the internal factories.
+  struct Origin {
+    std::shared_ptr<const Advertisement> advertisement;
+    std::shared_ptr<void> handle;
+  };
+
+  simpleble_peripheral_t handle = nullptr;
+  // Owns handle; async operations hold a copy so it outlives the wrapper.
+  std::shared_ptr<void> owner;
+  std::shared_ptr<const Advertisement> advertisement;
+  std::shared_ptr<NativeDevice> device;
+  // The env's Dispatcher, with this peripheral's scheduler flow and
+  // per-characteristic callback targets. Null and 0 until activate(); the
+  // targets are guarded by sinksMutex.
+  std::shared_ptr<Dispatcher> dispatcher;
+  uint32_t flow = 0;
+  std::map<std::string, uint32_t> notifyFns;
+  std::map<std::string, uint32_t> indicateFns;
   Napi::ThreadSafeFunction onConnectedFn;
   Napi::ThreadSafeFunction onDisconnectedFn;
+  PeripheralQuota quota;
+  // Subscriptions and tables refused by the quota, JS thread only.
+  uint64_t subscriptionsRejected = 0;
+  uint64_t gattRejected = 0;
+  uint64_t operationsRejected = 0;
+  // Null until activate(); shared with background dumps.
+  std::shared_ptr<FlightRecorder> recorder;
+  // Template shared with every device of the same model and the services
+  // this device differs in, as of the last refreshServices().
+  GattOverlay gattCache;
+  std::mutex sinksMutex;
+  std::multimap<std::string, SinkEntry> sinks;
+  // Characteristics whose CCCD is being written outside sinksMutex, counted
+  // against the subscription quota until the write settles.
+  std::multiset<std::string> reserved;
+  std::shared_ptr<Link> selfLink;
+  std::mutex pipelinesMutex;
+  std::map<std::string, std::shared_ptr<OrderedPipeline>> pipelines;
+  std::mutex clocksMutex;
+  std::map<std::string, DeviceClock> clocks;
+  // subscribeMany() groups by id, JS thread only.
+  std::map<uint32_t, ChannelGroup> groups;
+  uint32_t nextGroup = 1;
+  // Decoders compiled from Presentation Format descriptors, JS thread only.
+  std::map<std::string, ValueDecoder> decoders;
+
+  std::string addressString();
+  GattDatabase readServices();
+  simpleble_err_t subscribe(const simpleble_uuid_t &service,
+                            const simpleble_uuid_t &characteristic,
+                            bool indicate);
+  simpleble_err_t unsubscribe(const simpleble_uuid_t &service,
+                              const simpleble_uuid_t &characteristic);
+  void dropSubscription(const std::string &characteristic);
+  bool subscribed(const std::string &characteristic);
+  size_t subscriptionCount();
+  bool admitSubscription(const std::string &characteristic);
+  void setPipeline(const std::string &characteristic, Transform transform,
+                   uint32_t target, bool parallel);
+  ValueDecoder valueDecoder(const simpleble_uuid_t &service,
+                            const simpleble_uuid_t &characteristic);
+  uint64_t deviceTime(const std::string &characteristic, const uint8_t *data,
+                      size_t data_length);
+  void deliver(const std::string &characteristic, uint32_t target,
+               const uint8_t *data, size_t data_length, uint64_t timestamp);
+  // Returns the notify or indicate callback target, looked up under the
+  // same lock, or 0 when there is none.
+  uint32_t deliverToSinks(const char *characteristic, const uint8_t *data,
+                          size_t data_length, uint64_t timestamp,
+                          bool indicate);
+
+  void record(RecorderEventType type, const simpleble_uuid_t *uuid,
+              size_t length, simpleble_err_t err, uint64_t start);
+  void dumpFlightRecorder();
 
   Napi::Value Identifier(const Napi::CallbackInfo &info);
   Napi::Value Address(const Napi::CallbackInfo &info);
@@ -33,7 +212,10 @@ private:
   Napi::Value Connectable(const Napi::CallbackInfo &info);
   Napi::Value Paired(const Napi::CallbackInfo &info);
   Napi::Value Unpair(const Napi::CallbackInfo &info);
+  Napi::Value UnpairAsync(const Napi::CallbackInfo &info);
   Napi::Value GetServices(const Napi::CallbackInfo &info);
+  Napi::Value RefreshServices(const Napi::CallbackInfo &info);
+  Napi::Value GattFingerprint(const Napi::CallbackInfo &info);
   Napi::Value GetManufacturerData(const Napi::CallbackInfo &info);
   Napi::Value Read(const Napi::CallbackInfo &info);
   Napi::Value WriteRequest(const Napi::CallbackInfo &info);
@@ -41,13 +223,24 @@ private:
   Napi::Value Notify(const Napi::CallbackInfo &info);
   Napi::Value Indicate(const Napi::CallbackInfo &info);
   Napi::Value Unsubscribe(const Napi::CallbackInfo &info);
+  Napi::Value SubscribeMany(const Napi::CallbackInfo &info);
+  Napi::Value UnsubscribeMany(const Napi::CallbackInfo &info);
   Napi::Value ReadDescriptor(const Napi::CallbackInfo &info);
   Napi::Value WriteDescriptor(const Napi::CallbackInfo &info);
   Napi::Value SetCallbackOnConnected(const Napi::CallbackInfo &info);
   Napi::Value SetCallbackOnDisconnected(const Napi::CallbackInfo &info);
+  Napi::Value DumpFlightRecorder(const Napi::CallbackInfo &info);
+  Napi::Value SetDeliveryBudget(const Napi::CallbackInfo &info);
+  Napi::Value DeliveryStats(const Napi::CallbackInfo &info);
+  Napi::Value GetTransformStats(const Napi::CallbackInfo &info);
+  Napi::Value TrackDeviceClock(const Napi::CallbackInfo &info);
+  Napi::Value GetDeviceClock(const Napi::CallbackInfo &info);
+  Napi::Value SetQuota(const Napi::CallbackInfo &info);
+  Napi::Value QuotaStats(const Napi::CallbackInfo &info);
 
   static void onConnected(simpleble_peripheral_t peripheral, void *userdata);
   static void onDisconnected(simpleble_peripheral_t peripheral, void *userdata);
   static void onNotify(simpleble_uuid_t service, simpleble_uuid_t characteristic, const uint8_t* data, size_t data_length, void* userdata);
   static void onIndicate(simpleble_uuid_t service, simpleble_uuid_t characteristic, const uint8_t* data, size_t data_length, void* userdata);
+  static void onDeviceNotify(Peripheral *peripheral, const std::string &service, const std::string &characteristic, const uint8_t *data, size_t data_length);
 };
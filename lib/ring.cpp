@@ -0,0 +1,509 @@
+#include "ring.h"
+#include "opring.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <simpleble_c/simpleble.h>
+#include <vector>
+
+static constexpr uint32_t MAX_DATA_SIZE = 64 * 1024 * 1024;
+
+class GattRing::State : public std::enable_shared_from_this<GattRing::State> {
+public:
+  State(uint8_t *memory, uint32_t entries, uint32_t dataSize)
+      : ring(memory, entries, dataSize) {}
+
+  OpRing ring;
+  Napi::ThreadSafeFunction fn;
+
+  // Payload bytes of the operations queued for a peripheral.
+  size_t queued(const Target &target) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto lane = this->lanes.find(laneKey(target));
+    return lane != this->lanes.end() ? lane->second.bytes : 0;
+  }
+
+  // Queues an operation behind those already submitted for its peripheral.
+  // JS thread only.
+  void enqueue(const Target &target, const RingEntry &entry) {
+    const void *key = laneKey(target);
+    this->inFlight++;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto lane = this->lanes.find(key);
+    if (lane != this->lanes.end()) {
+      lane->second.ops.push_back(Op{target, entry});
+      lane->second.bytes += entry.length;
+      return;
+    }
+
+    Lane &created = this->lanes[key];
+    created.ops.push_back(Op{target, entry});
+    created.bytes = entry.length;
+    // Each lane holds the thread-safe function until it drains, so that
+    // its completions can still wake JS after close().
+    this->fn.Acquire();
+    std::shared_ptr<State> self = this->shared_from_this();
+    ThreadPool::io().submit([self, key]() {
+      self->drain(key);
+      self->fn.Release();
+    });
+  }
+
+  void complete(uint32_t user, int32_t result, uint32_t length) {
+    this->ring.complete(RingCompletion{user, result, length, 0});
+    this->wake();
+  }
+
+  // Publishes completions held for lack of space, waking JS for them.
+  void flush() {
+    if (this->ring.flush() > 0) {
+      this->wake();
+    }
+  }
+
+  // Keeps the event loop alive while operations are outstanding. JS thread
+  // only.
+  void track(Napi::Env env) {
+    if (!this->isClosed && !this->referenced && this->inFlight > 0) {
+      this->fn.Ref(env);
+      this->referenced = true;
+    }
+  }
+
+  // Completes operations that have not started with CANCELED. JS thread
+  // only.
+  void close() {
+    std::deque<Op> canceled;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      if (this->isClosed) {
+        return;
+      }
+      this->isClosed = true;
+      for (auto &[key, lane] : this->lanes) {
+        canceled.insert(canceled.end(), lane.ops.begin(), lane.ops.end());
+        lane.ops.clear();
+        lane.bytes = 0;
+      }
+    }
+
+    for (const Op &op : canceled) {
+      this->inFlight--;
+      this->complete(op.entry.user, CANCELED, 0);
+    }
+    this->fn.Release();
+  }
+
+  bool closed() const { return this->isClosed; }
+  size_t outstanding() const { return this->inFlight; }
+
+private:
+  struct Op {
+    Target target;
+    RingEntry entry;
+  };
+
+  struct Lane {
+    std::deque<Op> ops;
+    // Payload bytes of ops, counted against the peripheral's quota.
+    size_t bytes = 0;
+  };
+
+  std::mutex mutex;
+  // Queued operations by peripheral. A lane exists while its worker runs.
+  std::map<const void *, Lane> lanes;
+  bool isClosed = false;
+  std::atomic<size_t> inFlight{0};
+  std::atomic<bool> wakePending{false};
+  // Whether fn holds the event loop open, JS thread only.
+  bool referenced = false;
+
+  void drain(const void *key) {
+    while (true) {
+      Op op;
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto lane = this->lanes.find(key);
+        if (lane->second.ops.empty()) {
+          this->lanes.erase(lane);
+          return;
+        }
+        op = std::move(lane->second.ops.front());
+        lane->second.ops.pop_front();
+        lane->second.bytes -= op.entry.length;
+      }
+
+      uint32_t length = 0;
+      const int32_t result = this->execute(op, length);
+      this->inFlight--;
+      this->complete(op.entry.user, result, length);
+    }
+  }
+
+  static const void *laneKey(const Target &target) {
+    return target.peripheral.device
+               ? static_cast<const void *>(target.peripheral.device.get())
+               : target.peripheral.owner.get();
+  }
+
+  int32_t execute(const Op &op, uint32_t &length) {
+    const Peripheral::GattTarget &peripheral = op.target.peripheral;
+    const auto handle =
+        static_cast<simpleble_peripheral_t>(peripheral.owner.get());
+    const simpleble_uuid_t &service = op.target.service;
+    const simpleble_uuid_t &characteristic = op.target.characteristic;
+    uint8_t *data = this->ring.data(op.entry.offset, op.entry.length);
+
+    const uint64_t start = FlightRecorder::timestamp();
+    if (op.entry.opcode == READ) {
+      GattTrace trace("read", handle, &service, &characteristic);
+      std::vector<uint8_t> value;
+      bool success;
+      if (peripheral.device) {
+        success = peripheral.device->read(service.value, characteristic.value,
+                                          value);
+      } else {
+        uint8_t *data_ptr = nullptr;
+        size_t data_length = 0;
+        success = simpleble_peripheral_read(handle, service, characteristic,
+                                            &data_ptr, &data_length) ==
+                  SIMPLEBLE_SUCCESS;
+        if (success) {
+          value.assign(data_ptr, data_ptr + data_length);
+          simpleble_free(data_ptr);
+        }
+      }
+      const simpleble_err_t err =
+          success ? SIMPLEBLE_SUCCESS : SIMPLEBLE_FAILURE;
+      trace.result(err);
+      peripheral.record(RecorderEventType::Read, &characteristic, value.size(),
+                        err, start);
+      if (!success) {
+        return FAILED;
+      }
+
+      length = static_cast<uint32_t>(value.size());
+      memcpy(data, value.data(),
+             std::min<size_t>(value.size(), op.entry.length));
+      return value.size() > op.entry.length ? TRUNCATED : OK;
+    }
+
+    const bool response = op.entry.opcode == WRITE_REQUEST;
+    GattTrace trace(response ? "write_request" : "write_command", handle,
+                    &service, &characteristic);
+    bool success;
+    if (peripheral.device) {
+      success = peripheral.device->write(service.value, characteristic.value,
+                                         data, op.entry.length, response);
+    } else if (response) {
+      success = simpleble_peripheral_write_request(
+                    handle, service, characteristic, data, op.entry.length) ==
+                SIMPLEBLE_SUCCESS;
+    } else {
+      success = simpleble_peripheral_write_command(
+                    handle, service, characteristic, data, op.entry.length) ==
+                SIMPLEBLE_SUCCESS;
+    }
+    const simpleble_err_t err =
+        success ? SIMPLEBLE_SUCCESS : SIMPLEBLE_FAILURE;
+    trace.result(err);
+    peripheral.record(response ? RecorderEventType::WriteRequest
+                               : RecorderEventType::WriteCommand,
+                      &characteristic, op.entry.length, err, start);
+    length = op.entry.length;
+    return success ? OK : FAILED;
+  }
+
+  void wake() {
+    if (this->wakePending.exchange(true)) {
+      return;
+    }
+
+    auto data = new std::shared_ptr<State>(this->shared_from_this());
+    if (this->fn.NonBlockingCall(data, onWake) != napi_ok) {
+      this->wakePending = false;
+      delete data;
+    }
+  }
+
+  static void onWake(Napi::Env env, Napi::Function callback,
+                     std::shared_ptr<State> *data) {
+    std::shared_ptr<State> state = std::move(*data);
+    delete data;
+    if (env == nullptr) {
+      return;
+    }
+
+    // Cleared first, so that completions from here on wake JS again.
+    state->wakePending = false;
+    state->ring.flush();
+    if (!state->isClosed && state->referenced && state->inFlight == 0) {
+      state->fn.Unref(env);
+      state->referenced = false;
+    }
+    callback.Call({});
+    // The callback drained the ring, making room for held completions.
+    if (!state->isClosed) {
+      state->flush();
+    }
+  }
+};
+
+Napi::FunctionReference GattRing::constructor;
+
+Napi::Object GattRing::Init(Napi::Env env, Napi::Object exports) {
+  // clang-format off
+  Napi::Function func = DefineClass(env, "GattRing", {
+    InstanceAccessor<&GattRing::Buffer>("buffer"),
+    InstanceAccessor<&GattRing::Layout>("layout"),
+    InstanceAccessor<&GattRing::Stats>("stats"),
+    InstanceMethod("register", &GattRing::Register),
+    InstanceMethod("unregister", &GattRing::Unregister),
+    InstanceMethod("submit", &GattRing::Submit),
+    InstanceMethod("close", &GattRing::Close),
+  });
+  // clang-format on
+
+  constructor = Napi::Persistent(func);
+  constructor.SuppressDestruct();
+
+  exports.Set("GattRing", func);
+  return exports;
+}
+
+GattRing::GattRing(const Napi::CallbackInfo &info)
+    : Napi::ObjectWrap<GattRing>(info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing callback").ThrowAsJavaScriptException();
+    return;
+  } else if (!info[0].IsFunction()) {
+    Napi::TypeError::New(env, "Callback is not a function")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+
+  double entries = 256;
+  double dataSize = 65536;
+  if (info.Length() > 1 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    if (options.Get("entries").IsNumber()) {
+      entries = options.Get("entries").As<Napi::Number>().DoubleValue();
+    }
+    if (options.Get("dataSize").IsNumber()) {
+      dataSize = options.Get("dataSize").As<Napi::Number>().DoubleValue();
+    }
+  }
+  const uint32_t entryCount = OpRing::entryCount(static_cast<uint32_t>(
+      std::clamp(entries, 1.0, double(OpRing::MAX_ENTRIES))));
+  const uint32_t dataBytes = static_cast<uint32_t>(
+      std::clamp(dataSize, 0.0, double(MAX_DATA_SIZE)));
+
+  // N-API cannot allocate shared memory itself, so the ring lives in a
+  // SharedArrayBuffer made by JS and viewed through a Uint8Array to reach
+  // its backing store.
+  Napi::Object buffer =
+      env.Global()
+          .Get("SharedArrayBuffer")
+          .As<Napi::Function>()
+          .New({Napi::Number::New(
+              env, double(OpRing::byteLength(entryCount, dataBytes)))});
+  Napi::Uint8Array view = env.Global()
+                              .Get("Uint8Array")
+                              .As<Napi::Function>()
+                              .New({buffer})
+                              .As<Napi::Uint8Array>();
+
+  this->buffer = Napi::Persistent(buffer);
+  this->state = std::make_shared<State>(view.Data(), entryCount, dataBytes);
+  // Workers write into the buffer until their lanes drain, which may be
+  // after this wrapper is collected; the thread-safe function keeps it
+  // alive until then.
+  this->state->fn = Napi::ThreadSafeFunction::New(
+      env, info[0].As<Napi::Function>(), "onRingCompletion", 0, 1,
+      [](Napi::Env, Napi::ObjectReference *buffer) { delete buffer; },
+      new Napi::ObjectReference(Napi::Persistent(buffer)));
+  this->state->fn.Unref(env);
+}
+
+GattRing::~GattRing() { this->close(); }
+
+void GattRing::close() {
+  if (!this->state) {
+    return;
+  }
+
+  this->targets.clear();
+  this->state->close();
+}
+
+Napi::Value GattRing::Buffer(const Napi::CallbackInfo &info) {
+  return this->buffer.Value();
+}
+
+Napi::Value GattRing::Layout(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  const OpRing &ring = this->state->ring;
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("entries", static_cast<double>(ring.entries()));
+  obj.Set("completions", static_cast<double>(ring.completions()));
+  obj.Set("sqHead", static_cast<double>(OpRing::SQ_HEAD));
+  obj.Set("sqTail", static_cast<double>(OpRing::SQ_TAIL));
+  obj.Set("cqHead", static_cast<double>(OpRing::CQ_HEAD));
+  obj.Set("cqTail", static_cast<double>(OpRing::CQ_TAIL));
+  obj.Set("sqOffset", static_cast<double>(ring.sqOffset()));
+  obj.Set("cqOffset", static_cast<double>(ring.cqOffset()));
+  obj.Set("dataOffset", static_cast<double>(ring.dataOffset()));
+  obj.Set("dataSize", static_cast<double>(ring.dataSize()));
+  return obj;
+}
+
+Napi::Value GattRing::Stats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  const OpRingStats stats = this->state->ring.stats();
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("submitted", static_cast<double>(stats.submitted));
+  obj.Set("completed", static_cast<double>(stats.completed));
+  obj.Set("overflowed", static_cast<double>(stats.overflowed));
+  obj.Set("dropped", static_cast<double>(stats.dropped));
+  obj.Set("pending", static_cast<double>(stats.pending));
+  obj.Set("inFlight", static_cast<double>(this->state->outstanding()));
+  return obj;
+}
+
+Napi::Value GattRing::Register(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing peripheral")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsObject() || !info[0].As<Napi::Object>().InstanceOf(
+                                         Peripheral::constructor.Value())) {
+    Napi::TypeError::New(env, "Peripheral is not a Peripheral")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Missing service").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[1].IsString()) {
+    Napi::TypeError::New(env, "Service is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  if (info.Length() < 3) {
+    Napi::TypeError::New(env, "Missing characteristic")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[2].IsString()) {
+    Napi::TypeError::New(env, "Characteristic is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  if (this->targets.size() > UINT16_MAX) {
+    Napi::RangeError::New(env, "Too many handles")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  auto peripheral = Peripheral::Unwrap(info[0].As<Napi::Object>());
+  peripheral->activate();
+  Target target{peripheral->gattTarget(), peripheral->link(), {}, {}};
+  if (!target.peripheral.owner && !target.peripheral.device) {
+    return env.Undefined();
+  }
+
+  const Napi::String cbService = info[1].As<Napi::String>();
+  const Napi::String cbChar = info[2].As<Napi::String>();
+  memcpy(target.service.value, cbService.Utf8Value().c_str(),
+         SIMPLEBLE_UUID_STR_LEN);
+  memcpy(target.characteristic.value, cbChar.Utf8Value().c_str(),
+         SIMPLEBLE_UUID_STR_LEN);
+
+  while (this->targets.count(this->nextHandle) != 0) {
+    this->nextHandle++;
+  }
+  const uint16_t handle = this->nextHandle++;
+  this->targets.emplace(handle, target);
+  return Napi::Number::New(env, handle);
+}
+
+Napi::Value GattRing::Unregister(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing handle").ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Handle is not a number")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  // Operations already submitted for it still run.
+  const auto it = this->targets.find(info[0].As<Napi::Number>().Uint32Value());
+  if (it == this->targets.end()) {
+    return Napi::Boolean::New(env, false);
+  }
+  this->targets.erase(it);
+  return Napi::Boolean::New(env, true);
+}
+
+Napi::Value GattRing::Submit(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (this->state->closed()) {
+    return Napi::Number::New(env, 0);
+  }
+
+  // Submitting also publishes completions held while the ring was full.
+  this->state->flush();
+  std::vector<RingEntry> entries;
+  const size_t count = this->state->ring.consume(entries);
+  for (const RingEntry &entry : entries) {
+    const auto target = this->targets.find(entry.handle);
+    if (target == this->targets.end()) {
+      this->state->complete(entry.user, BAD_HANDLE, 0);
+    } else if (entry.opcode > WRITE_COMMAND) {
+      this->state->complete(entry.user, BAD_OPCODE, 0);
+    } else if (!this->state->ring.data(entry.offset, entry.length)) {
+      this->state->complete(entry.user, BAD_RANGE, 0);
+    } else if (!this->admit(target->second, entry)) {
+      this->state->complete(entry.user, REJECTED, 0);
+    } else {
+      this->state->enqueue(target->second, entry);
+    }
+  }
+  this->state->track(env);
+  return Napi::Number::New(env, static_cast<double>(count));
+}
+
+bool GattRing::admit(const Target &target, const RingEntry &entry) {
+  std::lock_guard<std::mutex> lock(target.link->mutex);
+  // Operations keep running after the wrapper, and its quota, are gone.
+  if (!target.link->peripheral) {
+    return true;
+  }
+  return target.link->peripheral->admitOperation(this->state->queued(target),
+                                                 entry.length);
+}
+
+Napi::Value GattRing::Close(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  this->close();
+  return env.Undefined();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <napi.h>
+#include <simpleble_c/types.h>
+
+#include "opring.h"
+#include "peripheral.h"
+
+// GATT operations submitted in batches through an OpRing in a
+// SharedArrayBuffer, so that many operations cost one call into the addon.
+// Operations on one peripheral run in submission order on the I/O pool;
+// those on different peripherals run concurrently. The callback is invoked
+// once for any number of new completions.
+class GattRing : public Napi::ObjectWrap<GattRing> {
+public:
+  enum Opcode : uint8_t {
+    READ = 0,
+    WRITE_REQUEST = 1,
+    WRITE_COMMAND = 2,
+  };
+
+  // Completion results; reads and writes that succeed report 0.
+  enum Result : int32_t {
+    OK = 0,
+    FAILED = -1,
+    BAD_HANDLE = -2,
+    BAD_OPCODE = -3,
+    BAD_RANGE = -4,
+    // The value was longer than the buffer; length holds its full size.
+    TRUNCATED = -5,
+    // The ring was closed before the operation started.
+    CANCELED = -6,
+    // The peripheral's queued bytes quota was full.
+    REJECTED = -7,
+  };
+
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+  GattRing(const Napi::CallbackInfo &info);
+  ~GattRing();
+
+  static Napi::FunctionReference constructor;
+
+private:
+  class State;
+
+  struct Target {
+    Peripheral::GattTarget peripheral;
+    // Reaches the wrapper's quota while it is alive.
+    std::shared_ptr<Peripheral::Link> link;
+    simpleble_uuid_t service;
+    simpleble_uuid_t characteristic;
+  };
+
+  std::shared_ptr<State> state;
+  Napi::ObjectReference buffer;
+  // Registered characteristics by handle, JS thread only.
+  std::map<uint16_t, Target> targets;
+  uint16_t nextHandle = 0;
+
+  void close();
+  bool admit(const Target &target, const RingEntry &entry);
+
+  Napi::Value Buffer(const Napi::CallbackInfo &info);
+  Napi::Value Layout(const Napi::CallbackInfo &info);
+  Napi::Value Stats(const Napi::CallbackInfo &info);
+  Napi::Value Register(const Napi::CallbackInfo &info);
+  Napi::Value Unregister(const Napi::CallbackInfo &info);
+  Napi::Value Submit(const Napi::CallbackInfo &info);
+  Napi::Value Close(const Napi::CallbackInfo &info);
+};
@@ -0,0 +1,277 @@
+#include "stream.h"
+#include "clock.h"
+#include "merge.h"
+#include "peripheral.h"
+#include "sink.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+static constexpr uint64_t NS_PER_MS = 1000000;
+
+class NotificationStream::State
+    : public NotificationSink,
+      public std::enable_shared_from_this<NotificationStream::State> {
+public:
+  State(uint64_t window, size_t capacity)
+      : merger(window, capacity),
+        interval(std::max<uint64_t>(window / 2, NS_PER_MS)) {}
+
+  ReorderMerger merger;
+  Napi::ThreadSafeFunction fn;
+
+  void onNotification(uint16_t channel, uint64_t timestamp,
+                      const uint8_t *data, size_t length) override {
+    this->merger.push(channel, timestamp, data, length);
+  }
+
+  void start() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->schedule();
+  }
+
+  void stop() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->closed) {
+      return;
+    }
+
+    this->closed = true;
+    Clock::cancel(this->timer);
+    this->deliver(true);
+    this->fn.Release();
+  }
+
+private:
+  std::mutex mutex;
+  uint64_t interval;
+  uint64_t timer = 0;
+  bool closed = false;
+
+  void schedule() {
+    std::weak_ptr<State> weak = this->shared_from_this();
+    this->timer = Clock::scheduleAfter(this->interval, [weak]() {
+      if (auto self = weak.lock()) {
+        self->tick();
+      }
+    });
+  }
+
+  void tick() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->closed) {
+      return;
+    }
+
+    this->deliver(false);
+    this->schedule();
+  }
+
+  void deliver(bool flush) {
+    auto batch = new std::vector<uint8_t>();
+    if (this->merger.drain(Clock::now(), *batch, flush) == 0) {
+      delete batch;
+      return;
+    }
+
+    auto callback = [](Napi::Env env, Napi::Function jsCallback,
+                       std::vector<uint8_t> *batch) {
+      auto buffer =
+          Napi::Buffer<uint8_t>::Copy(env, batch->data(), batch->size());
+      delete batch;
+      jsCallback.Call({buffer});
+    };
+    if (this->fn.NonBlockingCall(batch, callback) != napi_ok) {
+      delete batch;
+    }
+  }
+};
+
+Napi::FunctionReference NotificationStream::constructor;
+
+Napi::Object NotificationStream::Init(Napi::Env env, Napi::Object exports) {
+  // clang-format off
+  Napi::Function func = DefineClass(env, "NotificationStream", {
+    InstanceAccessor<&NotificationStream::Stats>("stats"),
+    InstanceMethod("addChannel", &NotificationStream::AddChannel),
+    InstanceMethod("removeChannel", &NotificationStream::RemoveChannel),
+    InstanceMethod("close", &NotificationStream::Close),
+  });
+  // clang-format on
+
+  constructor = Napi::Persistent(func);
+  constructor.SuppressDestruct();
+
+  exports.Set("NotificationStream", func);
+  return exports;
+}
+
+NotificationStream::NotificationStream(const Napi::CallbackInfo &info)
+    : Napi::ObjectWrap<NotificationStream>(info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing callback").ThrowAsJavaScriptException();
+    return;
+  } else if (!info[0].IsFunction()) {
+    Napi::TypeError::New(env, "Callback is not a function")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+
+  double window = 50;
+  double capacity = 4096;
+  if (info.Length() > 1 && info[1].IsObject()) {
+    Napi::Object options = info[1].As<Napi::Object>();
+    if (options.Get("window").IsNumber()) {
+      window = options.Get("window").As<Napi::Number>().DoubleValue();
+    }
+    if (options.Get("capacity").IsNumber()) {
+      capacity = options.Get("capacity").As<Napi::Number>().DoubleValue();
+    }
+  }
+
+  this->state = std::make_shared<State>(
+      static_cast<uint64_t>(std::max(window, 0.0) * NS_PER_MS),
+      static_cast<size_t>(std::max(capacity, 1.0)));
+  this->state->fn = Napi::ThreadSafeFunction::New(
+      env, info[0].As<Napi::Function>(), "onStreamBatch", 0, 1);
+  this->state->fn.Unref(env);
+  this->state->start();
+}
+
+NotificationStream::~NotificationStream() { this->close(); }
+
+void NotificationStream::close() {
+  if (!this->state) {
+    return;
+  }
+
+  for (auto &[id, channel] : this->channels) {
+    this->detach(id, channel);
+  }
+  this->channels.clear();
+  this->state->stop();
+}
+
+void NotificationStream::detach(uint16_t id, Channel &channel) {
+  {
+    std::lock_guard<std::mutex> lock(channel.link->mutex);
+    if (channel.link->peripheral) {
+      channel.link->peripheral->removeSink(channel.characteristic,
+                                           this->state.get(), id);
+    }
+  }
+  channel.peripheral.Unref();
+}
+
+Napi::Value NotificationStream::AddChannel(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing peripheral")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[0].IsObject() || !info[0].As<Napi::Object>().InstanceOf(
+                                         Peripheral::constructor.Value())) {
+    Napi::TypeError::New(env, "Peripheral is not a Peripheral")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  if (info.Length() < 2) {
+    Napi::TypeError::New(env, "Missing service").ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[1].IsString()) {
+    Napi::TypeError::New(env, "Service is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  if (info.Length() < 3) {
+    Napi::TypeError::New(env, "Missing characteristic")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  } else if (!info[2].IsString()) {
+    Napi::TypeError::New(env, "Characteristic is not a string")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  if (this->channels.size() > UINT16_MAX) {
+    Napi::RangeError::New(env, "Too many channels")
+        .ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+
+  Napi::Object peripheralObj = info[0].As<Napi::Object>();
+  const Napi::String cbService = info[1].As<Napi::String>();
+  const Napi::String cbChar = info[2].As<Napi::String>();
+  simpleble_uuid_t service;
+  simpleble_uuid_t characteristic;
+
+  memcpy(service.value, cbService.Utf8Value().c_str(), SIMPLEBLE_UUID_STR_LEN);
+  memcpy(characteristic.value, cbChar.Utf8Value().c_str(),
+         SIMPLEBLE_UUID_STR_LEN);
+
+  while (this->channels.count(this->nextChannel) != 0) {
+    this->nextChannel++;
+  }
+  const uint16_t id = this->nextChannel++;
+
+  this->state->merger.addChannel(id);
+  auto peripheral = Peripheral::Unwrap(peripheralObj);
+  if (!peripheral->addSink(service, characteristic, this->state, id)) {
+    this->state->merger.removeChannel(id);
+    return env.Undefined();
+  }
+
+  this->channels.emplace(id, Channel{Napi::Persistent(peripheralObj),
+                                     peripheral->link(), characteristic.value});
+  return Napi::Number::New(env, id);
+}
+
+Napi::Value NotificationStream::RemoveChannel(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1) {
+    Napi::TypeError::New(env, "Missing channel").ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  } else if (!info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Channel is not a number")
+        .ThrowAsJavaScriptException();
+    return Napi::Boolean::New(env, false);
+  }
+
+  const auto it =
+      this->channels.find(info[0].As<Napi::Number>().Uint32Value());
+  if (it == this->channels.end()) {
+    return Napi::Boolean::New(env, false);
+  }
+
+  this->detach(it->first, it->second);
+  this->state->merger.removeChannel(it->first);
+  this->channels.erase(it);
+  return Napi::Boolean::New(env, true);
+}
+
+Napi::Value NotificationStream::Close(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  this->close();
+  return env.Undefined();
+}
+
+Napi::Value NotificationStream::Stats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  const ReorderStats stats = this->state->merger.stats();
+  Napi::Object obj = Napi::Object::New(env);
+  obj.Set("delivered", static_cast<double>(stats.delivered));
+  obj.Set("late", static_cast<double>(stats.late));
+  obj.Set("forced", static_cast<double>(stats.forced));
+  obj.Set("dropped", static_cast<double>(stats.dropped));
+  obj.Set("buffered", static_cast<double>(stats.buffered));
+  return obj;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <napi.h>
+
+#include "peripheral.h"
+
+class NotificationStream : public Napi::ObjectWrap<NotificationStream> {
+public:
+  static Napi::Object Init(Napi::Env env, Napi::Object exports);
+  NotificationStream(const Napi::CallbackInfo &info);
+  ~NotificationStream();
+
+  static Napi::FunctionReference constructor;
+
+private:
+  class State;
+
+  // The reference keeps the peripheral streaming; the link is what detaches
+  // it, since the wrapper may be finalized first.
+  struct Channel {
+    Napi::ObjectReference peripheral;
+    std::shared_ptr<Peripheral::Link> link;
+    std::string characteristic;
+  };
+
+  void detach(uint16_t id, Channel &channel);
+
+  std::shared_ptr<State> state;
+  std::map<uint16_t, Channel> channels;
+  uint16_t nextChannel = 0;
+
+  void close();
+
+  Napi::Value AddChannel(const Napi::CallbackInfo &info);
+  Napi::Value RemoveChannel(const Napi::CallbackInfo &info);
+  Napi::Value Close(const Napi::CallbackInfo &info);
+  Napi::Value Stats(const Napi::CallbackInfo &info);
+};
@@ -0,0 +1,80 @@
+#include "stringtable.h"
+#include "addon.h"
+
+#include <list>
+#include <unordered_map>
+
+namespace {
+
+struct Entry {
+  std::string value;
+  Napi::Reference<Napi::String> string;
+};
+
+} // namespace
+
+struct StringTableState {
+  // Most recently used first.
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  StringTableStats counters{0, StringTable::DEFAULT_CAPACITY};
+};
+
+namespace {
+
+// Freed with the env's AddonState, while its references may still be deleted.
+StringTableState &state(Napi::Env env) {
+  auto &addon = AddonState::get(env);
+  if (!addon.strings) {
+    addon.strings = std::make_shared<StringTableState>();
+  }
+  return *addon.strings;
+}
+
+void evict(StringTableState &self, size_t capacity) {
+  while (self.entries.size() > capacity) {
+    self.index.erase(self.entries.back().value);
+    self.entries.pop_back();
+    self.counters.evictions++;
+  }
+}
+
+} // namespace
+
+Napi::String StringTable::get(Napi::Env env, const std::string &value) {
+  auto &self = state(env);
+  if (value.size() > MAX_LENGTH || self.counters.capacity == 0) {
+    return Napi::String::New(env, value);
+  }
+
+  const auto it = self.index.find(value);
+  if (it != self.index.end()) {
+    self.entries.splice(self.entries.begin(), self.entries, it->second);
+    self.counters.hits++;
+    return it->second->string.Value();
+  }
+
+  Napi::String string = Napi::String::New(env, value);
+  self.entries.push_front(Entry{value, Napi::Persistent(string)});
+  self.index.emplace(value, self.entries.begin());
+  self.counters.misses++;
+  evict(self, self.counters.capacity);
+  return string;
+}
+
+Napi::String StringTable::get(Napi::Env env, const char *value) {
+  return get(env, std::string(value != nullptr ? value : ""));
+}
+
+void StringTable::setCapacity(Napi::Env env, size_t capacity) {
+  auto &self = state(env);
+  self.counters.capacity = capacity;
+  evict(self, capacity);
+}
+
+StringTableStats StringTable::stats(Napi::Env env) {
+  const auto &self = state(env);
+  StringTableStats stats = self.counters;
+  stats.size = self.entries.size();
+  return stats;
+}
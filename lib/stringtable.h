@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <napi.h>
+#include <string>
+
+struct StringTableStats {
+  size_t size = 0;
+  size_t capacity = 0;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+};
+
+// Persistent JS strings for values that recur across events, such as
+// addresses, names and UUIDs, so repeated scans and GATT accessors hand out
+// the same string instead of allocating a new one each time. Bounded, with
+// least-recently-used eviction; values longer than MAX_LENGTH bytes are not
+// interned. Each env, such as a worker thread's, has its own table, held in
+// its AddonState. JS thread only.
+class StringTable {
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 4096;
+  static constexpr size_t MAX_LENGTH = 128;
+
+  static Napi::String get(Napi::Env env, const std::string &value);
+  // Null is treated as the empty string.
+  static Napi::String get(Napi::Env env, const char *value);
+
+  // Evicts down to the new capacity; 0 disables interning.
+  static void setCapacity(Napi::Env env, size_t capacity);
+  static StringTableStats stats(Napi::Env env);
+};
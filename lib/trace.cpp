@@ -0,0 +1,47 @@
+#include "trace.h"
+
+#include <chrono>
+#include <simpleble_c/simpleble.h>
+
+#ifdef WEBBLUETOOTH_USDT
+#define WEBBLUETOOTH_PROBE_SEMAPHORE(name)                                     \
+  extern "C" {                                                                 \
+  __attribute__((section(".probes"))) volatile unsigned short                  \
+      webbluetooth_##name##_semaphore = 0;                                     \
+  }
+WEBBLUETOOTH_PROBES(WEBBLUETOOTH_PROBE_SEMAPHORE)
+#undef WEBBLUETOOTH_PROBE_SEMAPHORE
+#endif
+
+uint64_t traceTimestamp() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+GattTrace::GattTrace(const char *op, simpleble_peripheral_t peripheral,
+                     const simpleble_uuid_t *service,
+                     const simpleble_uuid_t *characteristic)
+    : op(op), peripheral(peripheral),
+      service(service != nullptr ? service->value : ""),
+      characteristic(characteristic != nullptr ? characteristic->value : "") {
+  if (!WB_PROBE_ENABLED(gatt_entry) && !WB_PROBE_ENABLED(gatt_return)) {
+    return;
+  }
+
+  this->address = simpleble_peripheral_address(this->peripheral);
+  this->start = traceTimestamp();
+  WB_PROBE(gatt_entry, this->op, this->address, this->service,
+           this->characteristic);
+}
+
+GattTrace::~GattTrace() {
+  if (this->address == nullptr) {
+    return;
+  }
+
+  [[maybe_unused]] const uint64_t elapsed = traceTimestamp() - this->start;
+  WB_PROBE(gatt_return, this->op, this->address, this->service,
+           this->characteristic, this->status, elapsed);
+  simpleble_free(this->address);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <simpleble_c/types.h>
+
+// Static tracepoints for the "webbluetooth" USDT provider. They are only
+// compiled in when the build found <sys/sdt.h> (see WEBBLUETOOTH_USDT in
+// CMakeLists.txt); each probe is guarded by its semaphore so arguments are
+// only gathered while a tracer is attached.
+//
+//   bpftrace -e 'usdt:./build/Release/simpleble.node:webbluetooth:gatt_return
+//                { @us[str(arg0)] = hist(arg5 / 1000); }'
+//
+// scan_found, scan_updated   (address, identifier, rssi)
+// notify, indicate           (address, service, characteristic, length, ns)
+// gatt_entry                 (op, address, service, characteristic)
+// gatt_return                (op, address, service, characteristic, status, ns)
+
+#ifdef WEBBLUETOOTH_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define WEBBLUETOOTH_PROBES(X)                                                 \
+  X(scan_found)                                                                \
+  X(scan_updated)                                                              \
+  X(notify)                                                                    \
+  X(indicate)                                                                  \
+  X(gatt_entry)                                                                \
+  X(gatt_return)
+
+#define WEBBLUETOOTH_PROBE_SEMAPHORE(name)                                     \
+  extern "C" volatile unsigned short webbluetooth_##name##_semaphore;
+WEBBLUETOOTH_PROBES(WEBBLUETOOTH_PROBE_SEMAPHORE)
+#undef WEBBLUETOOTH_PROBE_SEMAPHORE
+
+#define WB_PROBE_ENABLED(name)                                                 \
+  (__builtin_expect(webbluetooth_##name##_semaphore != 0, 0))
+#define WB_PROBE(name, ...) STAP_PROBEV(webbluetooth, name, __VA_ARGS__)
+
+#else
+
+#define WB_PROBE_ENABLED(name) (false)
+#define WB_PROBE(name, ...)                                                    \
+  do {                                                                         \
+  } while (0)
+
+#endif
+
+// Monotonic timestamp in nanoseconds for probe arguments.
+uint64_t traceTimestamp();
+
+// Fires gatt_entry on construction and gatt_return on destruction. The
+// peripheral address is only looked up while one of the probes is attached.
+class GattTrace {
+public:
+  GattTrace(const char *op, simpleble_peripheral_t peripheral,
+            const simpleble_uuid_t *service = nullptr,
+            const simpleble_uuid_t *characteristic = nullptr);
+  ~GattTrace();
+
+  void result(simpleble_err_t err) { status = err; }
+
+private:
+  const char *op;
+  simpleble_peripheral_t peripheral;
+  const char *service;
+  const char *characteristic;
+  char *address = nullptr;
+  uint64_t start = 0;
+  int status = SIMPLEBLE_SUCCESS;
+};
@@ -29,13 +29,25 @@ import { BluetoothRemoteGATTServiceImpl } from '../service';
 import { BluetoothRemoteGATTCharacteristicImpl } from '../characteristic';
 import { BluetoothRemoteGATTDescriptorImpl } from '../descriptor';
 
+/**
+ * @hidden
+ * Lets a scan finish before its scan time
+ */
+export interface ScanCompletion {
+    /** Only report these devices, and complete once all of them were found */
+    deviceIds?: Array<string>;
+    /** Milliseconds without a new device after which the scan completes */
+    quietPeriod?: number;
+    completeFn: () => void;
+}
+
 /**
  * @hidden
  */
 export interface Adapter extends EventEmitter {
     getEnabled: () => Promise<boolean>;
-    startScan: (serviceUUIDs: Array<string>, foundFn: (device: Partial<BluetoothDeviceImpl>) => void) => Promise<void>;
-    stopScan: () => void;
+    startScan: (filters: Array<BluetoothLEScanFilter>, foundFn: (device: Partial<BluetoothDeviceImpl>) => void, completion?: ScanCompletion) => Promise<number>;
+    stopScan: (session: number) => void;
     connect: (handle: string, disconnectFn?: () => void) => Promise<void>;
     disconnect: (handle: string) => Promise<void>;
     discoverServices: (handle: string, serviceUUIDs?: Array<string>) => Promise<Array<Partial<BluetoothRemoteGATTServiceImpl>>>;
@@ -24,7 +24,7 @@
 */
 
 import { EventEmitter } from 'events';
-import { Adapter as BluetoothAdapter } from './adapter';
+import { Adapter as BluetoothAdapter, ScanCompletion } from './adapter';
 import { BluetoothUUID } from '../uuid';
 import { BluetoothDeviceImpl } from '../device';
 import { BluetoothRemoteGATTCharacteristicImpl } from '../characteristic';
@@ -35,39 +35,69 @@ import {
     getAdapters,
     Adapter,
     Peripheral,
-    Service,
-    Characteristic
+    Characteristic,
+    ScanFilter
 } from './simpleble';
 
+interface GattMaps {
+    characteristicsByService: Map<string, Characteristic[]>;
+    serviceByCharacteristic: Map<string, string>;
+    descriptors: Map<string, string[]>;
+    characteristicByDescriptor: Map<string, { char: string, desc: string }>;
+}
+
+interface GattLookup<T> {
+    peripheral: Peripheral;
+    gatt: GattMaps;
+    value: T;
+}
+
 /**
  * @hidden
  */
 export class SimplebleAdapter extends EventEmitter implements BluetoothAdapter {
     private adapter: Adapter;
     private peripherals = new Map<string, Peripheral>();
-    private servicesByPeripheral = new Map<Peripheral, Service[]>();
-    private peripheralByService = new Map<string, Peripheral>();
-    private serviceByCharacteristic = new Map<string, string>();
-    private characteristicsByService = new Map<string, Characteristic[]>();
-    private characteristicByDescriptor = new Map<string, { char: string, desc: string }>();
-    private descriptors = new Map<string, string[]>();
+    // Devices found by each open scan session
+    private sessionDevices = new Map<number, Set<string>>();
+    // Devices only closed sessions found, kept for connecting until the next scan
+    private staleDevices = new Set<string>();
+    // Ordered from least to most recently enumerated
+    private gatt = new Map<Peripheral, GattMaps>();
     private charEvents = new Map<string, (value: DataView) => void>();
+    private readonly injected: boolean;
+
+    /**
+     * @param adapter Native adapter to use instead of the first system one,
+     * such as one from `createVirtualAdapter()`
+     */
+    constructor(adapter?: Adapter) {
+        super();
+        this.adapter = adapter;
+        this.injected = !!adapter;
+    }
 
-    private validDevice(device: Partial<BluetoothDeviceImpl>, serviceUUIDs: Array<string>): boolean {
-        if (serviceUUIDs.length === 0) {
-            // Match any device
-            return true;
-        }
-
-        if (!device._serviceUUIDs) {
-            // No advertised services, no match
-            return false;
-        }
-
-        const advertisedUUIDs = device._serviceUUIDs.map((serviceUUID: string) => BluetoothUUID.canonicalUUID(serviceUUID));
+    private scanFilter(filter: BluetoothLEScanFilter): ScanFilter {
+        const bytes = (source?: BufferSource): Uint8Array | undefined => {
+            if (!source) return undefined;
+            return ArrayBuffer.isView(source) ? new Uint8Array(source.buffer, source.byteOffset, source.byteLength) : new Uint8Array(source);
+        };
 
-        // An advertised UUID matches our search UUIDs
-        return serviceUUIDs.some(serviceUUID => advertisedUUIDs.indexOf(serviceUUID) >= 0);
+        return {
+            name: filter.name,
+            namePrefix: filter.namePrefix,
+            services: filter.services && filter.services.map(BluetoothUUID.getService),
+            manufacturerData: filter.manufacturerData && filter.manufacturerData.map(entry => ({
+                companyIdentifier: entry.companyIdentifier,
+                dataPrefix: bytes(entry.dataPrefix),
+                mask: bytes(entry.mask)
+            })),
+            serviceData: filter.serviceData && filter.serviceData.map(entry => ({
+                service: BluetoothUUID.getService(entry.service),
+                dataPrefix: bytes(entry.dataPrefix),
+                mask: bytes(entry.mask)
+            }))
+        };
     }
 
     private buildBluetoothDevice(device: Peripheral): Partial<BluetoothDeviceImpl> {
@@ -105,38 +135,84 @@ export class SimplebleAdapter extends EventEmitter implements BluetoothAdapter {
         };
     }
 
-    private enumerate(peripheral: Peripheral): void {
-        this.servicesByPeripheral.clear();
-        this.peripheralByService.clear();
-        this.serviceByCharacteristic.clear();
-        this.characteristicsByService.clear();
-        this.characteristicByDescriptor.clear();
-        this.descriptors.clear();
-        this.charEvents.clear();
-
-        const services: Service[] = [];
-        for (const service of peripheral.services) {
-            const serviceUUID = BluetoothUUID.canonicalUUID(service.uuid);
+    private addCharacteristic(gatt: GattMaps, serviceUUID: string, char: Characteristic): void {
+        gatt.serviceByCharacteristic.set(char.uuid, serviceUUID);
+        gatt.descriptors.set(char.uuid, char.descriptors);
 
-            this.characteristicsByService.set(serviceUUID, service.characteristics);
+        for (const desc of char.descriptors) {
+            gatt.characteristicByDescriptor.set(`${char.uuid}-${desc}`, { char: char.uuid, desc });
+        }
+    }
 
-            for (const char of service.characteristics) {
-                this.serviceByCharacteristic.set(char.uuid, serviceUUID);
-                this.descriptors.set(char.uuid, char.descriptors);
+    private removeCharacteristic(gatt: GattMaps, char: Characteristic): void {
+        gatt.serviceByCharacteristic.delete(char.uuid);
+        gatt.descriptors.delete(char.uuid);
 
-                for (const desc of char.descriptors) {
-                    this.characteristicByDescriptor.set(`${char.uuid}-${desc}`, { char: char.uuid, desc });
+        for (const desc of char.descriptors) {
+            gatt.characteristicByDescriptor.delete(`${char.uuid}-${desc}`);
+        }
+    }
+
+    private enumerate(peripheral: Peripheral): void {
+        const gatt = this.gatt.get(peripheral) || {
+            characteristicsByService: new Map(),
+            serviceByCharacteristic: new Map(),
+            descriptors: new Map(),
+            characteristicByDescriptor: new Map()
+        };
+        this.gatt.delete(peripheral);
+        this.gatt.set(peripheral, gatt);
+
+        // Only apply what changed since the last connection, so unchanged characteristics keep their subscriptions
+        for (const change of peripheral.refreshServices()) {
+            const serviceUUID = BluetoothUUID.canonicalUUID(change.service);
+            const characteristics = gatt.characteristicsByService.get(serviceUUID) || [];
+
+            if (!change.characteristic) {
+                if (change.type === 'removed') {
+                    for (const char of characteristics) {
+                        this.removeCharacteristic(gatt, char);
+                        this.charEvents.delete(char.uuid);
+                    }
+                    gatt.characteristicsByService.delete(serviceUUID);
+                } else {
+                    gatt.characteristicsByService.set(serviceUUID, characteristics);
                 }
+                continue;
+            }
+
+            const char = change.characteristic;
+            const index = characteristics.findIndex(existing => existing.uuid === char.uuid);
+            if (index >= 0) {
+                this.removeCharacteristic(gatt, characteristics[index]);
+                characteristics.splice(index, 1);
             }
 
-            this.peripheralByService.set(service.uuid, peripheral);
-            services.push(service);
+            if (change.type === 'removed') {
+                this.charEvents.delete(char.uuid);
+            } else {
+                characteristics.push(char);
+                this.addCharacteristic(gatt, serviceUUID, char);
+            }
         }
+    }
 
-        this.servicesByPeripheral.set(peripheral, services);
+    // Handles are bare UUIDs, so among devices of the same model the most recently connected one answers
+    private lookup<T>(get: (gatt: GattMaps) => T | undefined): GattLookup<T> | undefined {
+        for (const [peripheral, gatt] of [...this.gatt].reverse()) {
+            const value = get(gatt);
+            if (value !== undefined) {
+                return { peripheral, gatt, value };
+            }
+        }
+        return undefined;
     }
 
     private get state(): boolean {
+        if (this.injected) {
+            return true;
+        }
+
         const adapterEnabled = isEnabled();
         return !!adapterEnabled;
     }
@@ -145,7 +221,7 @@ export class SimplebleAdapter extends EventEmitter implements BluetoothAdapter {
         return this.state;
     }
 
-    public async startScan(serviceUUIDs: Array<string>, foundFn: (device: Partial<BluetoothDevice>) => void): Promise<void> {
+    public async startScan(filters: Array<BluetoothLEScanFilter>, foundFn: (device: Partial<BluetoothDevice>) => void, completion?: ScanCompletion): Promise<number> {
         if (this.state === false) {
             throw new Error('adapter not enabled');
         }
@@ -154,31 +230,57 @@ export class SimplebleAdapter extends EventEmitter implements BluetoothAdapter {
             this.adapter = getAdapters()[0];
         }
 
-        this.adapter.setCallbackOnScanFound(peripheral => {
+        for (const id of this.staleDevices) {
+            const peripheral = this.peripherals.get(id);
+            if (!peripheral || !peripheral.connected) {
+                this.peripherals.delete(id);
+                this.gatt.delete(peripheral);
+                this.staleDevices.delete(id);
+            }
+        }
+
+        // Filtering and de-duplication happen natively, so each session only hears about new matching devices
+        const session = this.adapter.openScanSession(filters.map(filter => this.scanFilter(filter)), peripheral => {
+            const devices = this.sessionDevices.get(session);
+            if (!devices) {
+                return;
+            }
+
             const device = this.buildBluetoothDevice(peripheral);
-            if (this.validDevice(device, serviceUUIDs)) {
-                if (!this.peripherals.has(device.id)) {
-                    this.peripherals.set(device.id, peripheral);
-                    // Only call the found function the first time we find a valid device
-                    foundFn(device);
-                }
+            devices.add(device.id);
+            this.staleDevices.delete(device.id);
+            // Keep the wrapper already known, which holds the subscriptions and attribute table
+            if (!this.peripherals.has(device.id)) {
+                this.peripherals.set(device.id, peripheral);
             }
-        });
+            foundFn(device);
+        }, completion && {
+            addresses: completion.deviceIds,
+            quietPeriod: completion.quietPeriod
+        }, completion && (() => completion.completeFn()));
 
-        this.peripherals.clear();
-        const success = this.adapter.scanStart();
-        if (!success) {
+        if (session === undefined) {
             throw new Error('scan start failed');
         }
+        this.sessionDevices.set(session, new Set());
+        return session;
     }
 
-    public stopScan(_errorFn?: (errorMsg: string) => void): void {
+    public stopScan(session: number): void {
         if (this.adapter) {
-            const success = this.adapter.scanStop();
+            const success = this.adapter.closeScanSession(session);
             if (!success) {
                 throw new Error('scan stop failed');
             }
         }
+
+        const devices = this.sessionDevices.get(session) || new Set<string>();
+        this.sessionDevices.delete(session);
+        for (const id of devices) {
+            if (![...this.sessionDevices.values()].some(other => other.has(id))) {
+                this.staleDevices.add(id);
+            }
+        }
     }
 
     public async connect(id: string, disconnectFn?: () => void): Promise<void> {
@@ -240,8 +342,12 @@ export class SimplebleAdapter extends EventEmitter implements BluetoothAdapter {
     }
 
     public async discoverCharacteristics(serviceUuid: string, characteristicUUIDs?: Array<string>): Promise<Array<Partial<BluetoothRemoteGATTCharacteristicImpl>>> {
-        const peripheral = this.peripheralByService.get(serviceUuid);
-        const characteristics = this.characteristicsByService.get(serviceUuid);
+        const found = this.lookup(gatt => gatt.characteristicsByService.get(serviceUuid));
+        if (!found) {
+            throw new Error('Service not found');
+        }
+
+        const { peripheral, value: characteristics } = found;
         const discovered = [];
 
         for (const characteristic of characteristics) {
@@ -289,7 +395,12 @@ export class SimplebleAdapter extends EventEmitter implements BluetoothAdapter {
     }
 
     public async discoverDescriptors(charUuid: string, descriptorUUIDs?: Array<string>): Promise<Array<Partial<BluetoothRemoteGATTDescriptorImpl>>> {
-        const descriptors = this.descriptors.get(charUuid);
+        const found = this.lookup(gatt => gatt.descriptors.get(charUuid));
+        if (!found) {
+            throw new Error('Characteristic not found');
+        }
+
+        const descriptors = found.value;
         const discovered = [];
 
         for (const descriptor of descriptors) {
@@ -306,15 +417,23 @@ export class SimplebleAdapter extends EventEmitter implements BluetoothAdapter {
     }
 
     public async readCharacteristic(charUuid: string): Promise<DataView> {
-        const serviceUuid = this.serviceByCharacteristic.get(charUuid);
-        const peripheral = this.peripheralByService.get(serviceUuid);
+        const found = this.lookup(gatt => gatt.serviceByCharacteristic.get(charUuid));
+        if (!found) {
+            throw new Error('Characteristic not found');
+        }
+
+        const { peripheral, value: serviceUuid } = found;
         const data = peripheral.read(serviceUuid, charUuid);
         return new DataView(data.buffer);
     }
 
     public async writeCharacteristic(charUuid: string, value: DataView, withoutResponse = false): Promise<void> {
-        const serviceUuid = this.serviceByCharacteristic.get(charUuid);
-        const peripheral = this.peripheralByService.get(serviceUuid);
+        const found = this.lookup(gatt => gatt.serviceByCharacteristic.get(charUuid));
+        if (!found) {
+            throw new Error('Characteristic not found');
+        }
+
+        const { peripheral, value: serviceUuid } = found;
         let success = false;
 
         if (withoutResponse) {
@@ -337,9 +456,13 @@ export class SimplebleAdapter extends EventEmitter implements BluetoothAdapter {
     }
 
     public async readDescriptor(handle: string): Promise<DataView> {
-        const { char, desc } = this.characteristicByDescriptor.get(handle);
-        const serviceUuid = this.serviceByCharacteristic.get(char);
-        const peripheral = this.peripheralByService.get(serviceUuid);
+        const found = this.lookup(gatt => gatt.characteristicByDescriptor.get(handle));
+        if (!found) {
+            throw new Error('Descriptor not found');
+        }
+
+        const { peripheral, gatt, value: { char, desc } } = found;
+        const serviceUuid = gatt.serviceByCharacteristic.get(char);
 
         const data = peripheral.readDescriptor(serviceUuid, char, desc);
         if (!data) {
@@ -349,9 +472,13 @@ export class SimplebleAdapter extends EventEmitter implements BluetoothAdapter {
     }
 
     public async writeDescriptor(handle: string, value: DataView): Promise<void> {
-        const { char, desc } = this.characteristicByDescriptor.get(handle);
-        const serviceUuid = this.serviceByCharacteristic.get(char);
-        const peripheral = this.peripheralByService.get(serviceUuid);
+        const found = this.lookup(gatt => gatt.characteristicByDescriptor.get(handle));
+        if (!found) {
+            throw new Error('Descriptor not found');
+        }
+
+        const { peripheral, gatt, value: { char, desc } } = found;
+        const serviceUuid = gatt.serviceByCharacteristic.get(char);
 
         const success = peripheral.writeDescriptor(serviceUuid, char, desc, new Uint8Array(value.buffer));
 
@@ -55,6 +55,107 @@ export interface Service {
     characteristics: Characteristic[];
 }
 
+/** Entry in the change set returned by `Peripheral.refreshServices()`. */
+export interface GattChange {
+    type: 'added' | 'removed' | 'changed';
+    service: string;
+    /** Absent when the whole service was added or removed. */
+    characteristic?: Characteristic;
+}
+
+/** Per-turn limits on how much a peripheral may deliver to JS. */
+export interface DeliveryBudget {
+    /** Bytes credited per round-robin turn, default 4096. */
+    bytes?: number;
+    /** Packets per turn, default 16. */
+    packets?: number;
+    /** Packets queued before new notifications are dropped, default 1024. */
+    queue?: number;
+}
+
+/** Notification delivery counters of a peripheral. */
+export interface DeliveryStats {
+    enqueued: number;
+    delivered: number;
+    bytes: number;
+    dropped: number;
+    /** Turns that ended with packets still queued. */
+    throttled: number;
+    queued: number;
+}
+
+/** Options of `Peripheral.notify()` and `Peripheral.indicate()`. */
+export interface SubscribeOptions {
+    /**
+     * Native transform applied off-thread before delivery: 'fft', or
+     * 'aes-ccm' to decrypt with the key set by `setEncryptionKey()`.
+     */
+    transform?: string;
+}
+
+/**
+ * Decoding driven by the characteristic's Presentation Format descriptor:
+ * 'number' yields the first value, 'float64' every value in the payload.
+ */
+export type DecodeMode = 'number' | 'float64';
+
+/** Counters of the transform pipeline of a subscription. */
+export interface TransformStats {
+    submitted: number;
+    delivered: number;
+    failed: number;
+    dropped: number;
+}
+
+/** Location of a device tick counter in notifications, see `trackDeviceClock()`. */
+export interface DeviceClockOptions {
+    /** Byte offset of the little-endian counter, default 0. */
+    offset?: number;
+    /** Counter width in bytes: 2, 4 (default) or 8. */
+    size?: number;
+    /** Samples in the sliding fit window, default 64, at most 1024. */
+    window?: number;
+}
+
+/** Current fit of a device clock. */
+export interface DeviceClock {
+    /** Device ticks per host second, including drift. */
+    tickRate: number;
+    /** Median deviation of receive times from the fit, in milliseconds. */
+    jitter: number;
+    samples: number;
+}
+
+/** Caps on what one peripheral may hold natively; 0 means unlimited. */
+export interface PeripheralQuota {
+    /**
+     * Notification bytes queued for JS, and payload bytes of `GattRing`
+     * operations waiting to run; arrivals that do not fit are dropped.
+     */
+    queuedBytes?: number;
+    /** Attribute table size; larger tables are diffed but not cached. */
+    gattBytes?: number;
+    /** Flight recorder events, default 256, rounded down to a power of two. */
+    history?: number;
+    /** Characteristics subscribed at once; further subscriptions fail. */
+    subscriptions?: number;
+}
+
+/** Usage and overflow counters of a peripheral's quota. */
+export interface QuotaStats {
+    queuedBytes: number;
+    /** Notifications dropped by the queue or byte limit. */
+    dropped: number;
+    gattBytes: number;
+    /** Attribute tables not cached because they exceeded the quota. */
+    gattRejected: number;
+    history: number;
+    subscriptions: number;
+    subscriptionsRejected: number;
+    /** `GattRing` operations refused by the queued bytes quota. */
+    operationsRejected: number;
+}
+
 /** SimpleBLE Peripheral. */
 export interface Peripheral {
     identifier: string;
@@ -68,20 +169,105 @@ export interface Peripheral {
     paired: boolean;
     manufacturerData: Record<string, Uint8Array>;
     services: Service[];
+    deliveryStats: DeliveryStats;
+    /**
+     * Hash of the attribute table as of the last `refreshServices()`, equal for
+     * devices of the same model and firmware.
+     */
+    gattFingerprint: string | undefined;
+    quotaStats: QuotaStats;
 
     connect(): boolean;
     disconnect(): boolean;
     unpair(): boolean;
+    /** `unpair()` on the native I/O thread pool. */
+    unpairAsync(): Promise<boolean>;
+    refreshServices(): GattChange[];
     read(service: string, characteristic: string): Uint8Array;
+    read(service: string, characteristic: string, options: { decode: 'number' }): number;
+    read(service: string, characteristic: string, options: { decode: 'float64' | Codec }): Float64Array;
     writeRequest(service: string, characteristic: string, data: Uint8Array): boolean;
     writeCommand(service: string, characteristic: string, data: Uint8Array): boolean;
-    notify(service: string, characteristic: string, cb: (data: Uint8Array) => void): boolean;
-    indicate(service: string, characteristic: string, cb: (data: Uint8Array) => void): boolean;
+    notify(service: string, characteristic: string, cb: (data: Uint8Array, timestamp?: number) => void, options?: SubscribeOptions): boolean;
+    notify(service: string, characteristic: string, cb: (value: number, timestamp?: number) => void, options: SubscribeOptions & { decode: 'number' }): boolean;
+    /** With a `Codec`, values hold `codec.width` values per whole record of the payload. */
+    notify(service: string, characteristic: string, cb: (values: Float64Array, timestamp?: number) => void, options: SubscribeOptions & { decode: 'float64' | Codec }): boolean;
+    indicate(service: string, characteristic: string, cb: (data: Uint8Array, timestamp?: number) => void, options?: SubscribeOptions): boolean;
+    indicate(service: string, characteristic: string, cb: (value: number, timestamp?: number) => void, options: SubscribeOptions & { decode: 'number' }): boolean;
+    indicate(service: string, characteristic: string, cb: (values: Float64Array, timestamp?: number) => void, options: SubscribeOptions & { decode: 'float64' | Codec }): boolean;
     unsubscribe(service: string, characteristic: string): boolean;
+    /**
+     * Subscribes to every characteristic in one native call and routes all of
+     * their notifications through one callback, tagged with the index of the
+     * pair in `characteristics`. Transforms and decoding are not applied.
+     * Returns a group id for `unsubscribeMany()`, or undefined if any
+     * subscription failed, in which case none are kept.
+     */
+    subscribeMany(characteristics: [string, string][], cb: (channel: number, data: Uint8Array, timestamp: number) => void): number | undefined;
+    unsubscribeMany(group: number): boolean;
     readDescriptor(service: string, characteristic: string, descriptor: string): Uint8Array;
     writeDescriptor(service: string, characteristic: string, descriptor: string, data: Uint8Array): boolean;
     setCallbackOnConnected(cb: () => void): boolean;
     setCallbackOnDisconnected(cb: () => void): boolean;
+    dumpFlightRecorder(path: string): boolean;
+    setDeliveryBudget(budget: DeliveryBudget): boolean;
+    getTransformStats(characteristic: string): TransformStats | undefined;
+    /**
+     * Fits the device tick counter in notifications of a characteristic to
+     * native receive times. Callbacks then get the estimated host time of each
+     * notification as a second argument, in milliseconds on the
+     * `getClockTime()` base, and notification streams order by it. Pass null
+     * to stop.
+     */
+    trackDeviceClock(characteristic: string, options: DeviceClockOptions | null): boolean;
+    getDeviceClock(characteristic: string): DeviceClock | undefined;
+    /**
+     * Changes the quota fields given. History can only shrink below the size
+     * allocated when the peripheral was created.
+     */
+    setQuota(quota: PeripheralQuota): boolean;
+}
+
+/** Keys of the objects serialized by `Adapter.scanTableJson()`. */
+export type ScanTableField = 'address' | 'identifier' | 'addressType' | 'rssi' | 'txPower' | 'connectable'
+    | 'manufacturerData' | 'serviceData' | 'firstSeen' | 'lastSeen' | 'sightings';
+
+/** Field selection and filters of `Adapter.scanTableJson()`. */
+export interface ScanTableQuery {
+    /** Keys to include, default all. */
+    fields?: ScanTableField[];
+    minRssi?: number;
+    /** Only devices seen within this many milliseconds. */
+    maxAge?: number;
+    connectable?: boolean;
+    namePrefix?: string;
+    /** Only devices advertising this service UUID. */
+    service?: string;
+    /** Only devices advertising manufacturer data for this company. */
+    company?: number;
+    limit?: number;
+}
+
+/**
+ * Web Bluetooth style scan filter compiled by the addon. UUIDs may be
+ * canonical or 16 and 32-bit aliases; every part that is set must match.
+ */
+export interface ScanFilter {
+    name?: string;
+    namePrefix?: string;
+    services?: string[];
+    manufacturerData?: Array<{ companyIdentifier: number, dataPrefix?: Uint8Array, mask?: Uint8Array }>;
+    serviceData?: Array<{ service: string, dataPrefix?: Uint8Array, mask?: Uint8Array }>;
+}
+
+/** Options of `Adapter.openScanSession()`. */
+export interface ScanSessionOptions {
+    /** Report every sighting rather than each device once, default false. */
+    duplicates?: boolean;
+    /** Only report these addresses; the session is done once all were seen. */
+    addresses?: string[];
+    /** Milliseconds without a new device after which the session is done. */
+    quietPeriod?: number;
 }
 
 /** SimpleBLE Adapter. */
@@ -90,16 +276,310 @@ export interface Adapter {
     address: string;
     active: boolean;
     peripherals: Peripheral[];
+    /**
+     * Bonded peripherals. The list is cached and only enumerated again after a
+     * connect or unpair may have changed it.
+     */
     pairedPeripherals: Peripheral[];
+    /**
+     * `pairedPeripherals` enumerated on the native I/O thread pool. Pass
+     * refresh to bypass the cache, e.g. after bonds were changed outside this
+     * process.
+     */
+    getPairedPeripherals(refresh?: boolean): Promise<Peripheral[]>;
+    /**
+     * Scans for `ms` milliseconds. SimpleBLE adapters block until the scan
+     * ends; HCI adapters return once it starts and report its end through
+     * `setCallbackOnScanStop()`.
+     */
     scanFor(ms: number): boolean;
+    /**
+     * Starts a scan, or joins the one kept running by open scan sessions
+     * without clearing what they have seen.
+     */
     scanStart(): boolean;
+    /**
+     * Stops the scan, or leaves it to the last open scan session to stop.
+     */
     scanStop(): boolean;
     setCallbackOnScanStart(cb: () => void): boolean;
     setCallbackOnScanStop(cb: () => void): boolean;
     setCallbackOnScanUpdated(cb: (peripheral: Peripheral) => void): boolean;
     setCallbackOnScanFound(cb: (peripheral: Peripheral) => void): boolean;
     release(): void;
+    /** Records scan traffic to a capture file until `stopCapture()`. */
+    startCapture(path: string): boolean;
+    /** Returns the number of advertisements captured. */
+    stopCapture(): number;
+    /**
+     * Feeds a capture file through the scan callbacks on the native clock,
+     * `speed` times faster than recorded, or without delays when 0.
+     * Replayed peripherals carry advertisement data only.
+     */
+    replayCapture(path: string, speed?: number): number | undefined;
+    /**
+     * Serializes the latest advertisement of every device seen since the scan
+     * started to a JSON array, ordered by address, on a native worker. Data is
+     * hex encoded and times are milliseconds on the `getClockTime()` base.
+     */
+    scanTableJson(query?: ScanTableQuery): Promise<Buffer>;
+    /**
+     * Connects to the first connectable device matching any of the filters,
+     * or any device when there are none, without a round trip through JS.
+     * Scanning stops on the match and the callback runs once the connection
+     * has been made or has failed. The matching sighting is not reported to
+     * the scan callbacks. Replaces a request that has not matched yet.
+     */
+    connectOnMatch(filters: ScanFilter[], cb: (peripheral: Peripheral, connected: boolean) => void): boolean;
+    /** Returns false when no request was waiting for a match. */
+    cancelConnectOnMatch(): boolean;
+    /**
+     * Opens a discovery session with its own filters and callback. Sessions
+     * share one scan: the first starts it unless one is already running, and
+     * closing the last stops a scan a session started. `doneCb` runs once,
+     * with true when every address in the options was seen or false when the
+     * quiet period passed; the session keeps reporting until closed. Returns
+     * the session id, or undefined when the scan could not be started.
+     */
+    openScanSession(filters: ScanFilter[], cb: (peripheral: Peripheral) => void, options?: ScanSessionOptions,
+        doneCb?: (allSeen: boolean) => void): number | undefined;
+    closeScanSession(session: number): boolean;
+}
+
+/** Byte offsets into `GattRing.buffer`; head and tail counters are u32. */
+export interface GattRingLayout {
+    /** Submission entries, a power of two. */
+    entries: number;
+    /** Completion entries, twice `entries`. */
+    completions: number;
+    sqHead: number;
+    sqTail: number;
+    cqHead: number;
+    cqTail: number;
+    sqOffset: number;
+    cqOffset: number;
+    dataOffset: number;
+    dataSize: number;
+}
+
+/** Counters of a `GattRing`. */
+export interface GattRingStats {
+    submitted: number;
+    completed: number;
+    /** Completions that waited for room in the completion ring. */
+    overflowed: number;
+    /** Completions lost because a ring's worth were already waiting. */
+    dropped: number;
+    /** Completions waiting for room now. */
+    pending: number;
+    inFlight: number;
+}
+
+/**
+ * Batched GATT reads and writes through submission and completion rings in
+ * a SharedArrayBuffer. Submission entries are 16 bytes,
+ * `[u16 handle][u8 opcode][u8 flags = 0][u32 user][u32 offset][u32 length]`,
+ * with opcode 0 read, 1 write request, 2 write command, and offset/length
+ * selecting the payload (or read destination) in the data area. Write
+ * entries, store the tail with `Atomics.store()`, then call `submit()`.
+ * Completions are `[u32 user][i32 result][u32 length][u32 reserved]`, result
+ * 0 on success, -1 failed, -2 bad handle, -3 bad opcode, -4 bad range,
+ * -5 truncated (length holds the full value size), -6 canceled by
+ * `close()` or -7 rejected by the peripheral's `queuedBytes` quota. The
+ * callback runs once for any number of completions; advance the completion
+ * head as they are consumed. Integers are little-endian.
+ */
+export interface GattRing {
+    buffer: SharedArrayBuffer;
+    layout: GattRingLayout;
+    stats: GattRingStats;
+    /** Returns the handle for submission entries. */
+    register(peripheral: Peripheral, service: string, characteristic: string): number | undefined;
+    unregister(handle: number): boolean;
+    /** Consumes new submission entries and returns how many there were. */
+    submit(): number;
+    close(): void;
+}
+
+export interface GattRingOptions {
+    /** Submission entries, rounded up to a power of two, default 256. */
+    entries?: number;
+    /** Bytes of payload space, default 65536. */
+    dataSize?: number;
+}
+
+export declare const GattRing: {
+    new (cb: () => void, options?: GattRingOptions): GattRing;
+};
+
+export type CodecFieldType = 'u8' | 'i8' | 'u16' | 'i16' | 'u24' | 'i24' | 'u32' | 'i32' | 'u64' | 'i64' | 'f32' | 'f64' | 'pad';
+
+/** One field of a packed record, in declaration order. */
+export interface CodecField {
+    /** Required except for padding. */
+    name?: string;
+    type: CodecFieldType;
+    /** Defaults to the codec's endianness. */
+    endian?: 'little' | 'big';
+    /** Elements of an array, or bytes of padding, default 1. */
+    count?: number;
+    /**
+     * Bitfield width. Consecutive bitfields of the same type and endianness
+     * share its storage unit, filled from the least significant bit.
+     */
+    bits?: number;
+    /** Decoded value = raw * scale + offset, default 1 and 0. */
+    scale?: number;
+    offset?: number;
+}
+
+export interface CodecColumn {
+    name: string;
+    type: CodecFieldType;
+    /** Position of the field's first value among a record's values. */
+    index: number;
+    count: number;
+}
+
+/** Columns by field name, typed after the field unless it scales or is 64-bit. */
+export type CodecColumns = Record<string, Uint8Array | Int8Array | Uint16Array | Int16Array | Uint32Array | Int32Array | Float32Array | Float64Array>;
+
+/**
+ * Packed record layout compiled to a native codec. Pass it as the `decode`
+ * option of `read()`, `notify()` or `indicate()`, or use it directly.
+ */
+export interface Codec {
+    /** Bytes per record. */
+    size: number;
+    /** Values per record. */
+    width: number;
+    columns: CodecColumn[];
+    /** Undefined when data is shorter than a record. */
+    decode(data: Uint8Array): Record<string, number | CodecColumns[string]> | undefined;
+    /** Decodes every whole record, taken every `stride` bytes (default `size`). */
+    decodeColumns(data: Uint8Array, stride?: number): CodecColumns;
+    /**
+     * Encodes fields by name (missing ones as 0), or `width` values in column
+     * order. Integers are rounded and saturated.
+     */
+    encode(values: Record<string, number | boolean | ArrayLike<number>> | number[] | Float64Array): Uint8Array;
+}
+
+export declare const Codec: {
+    new (fields: CodecField[], options?: { endian?: 'little' | 'big' }): Codec;
+};
+
+/** Counters of a `NotificationStream`. */
+export interface NotificationStreamStats {
+    delivered: number;
+    /** Dropped because they arrived after newer records had been delivered. */
+    late: number;
+    /** Delivered ahead of the reorder window to stay within capacity. */
+    forced: number;
+    /** Refused on arrival while capacity records already waited to be forced out. */
+    dropped: number;
+    buffered: number;
+}
+
+/**
+ * Time-ordered merge of notifications from many peripherals. Each batch holds
+ * records packed as `[u64 timestamp ns][u16 channel][u16 length][payload]`
+ * with little-endian integers, where channel is the id from `addChannel()`.
+ */
+export interface NotificationStream {
+    stats: NotificationStreamStats;
+    addChannel(peripheral: Peripheral, service: string, characteristic: string): number | undefined;
+    removeChannel(channel: number): boolean;
+    close(): void;
+}
+
+export interface NotificationStreamOptions {
+    /** Reorder window in milliseconds, default 50. */
+    window?: number;
+    /** Records buffered before the oldest are forced out, default 4096. */
+    capacity?: number;
+}
+
+export declare const NotificationStream: {
+    new (cb: (batch: Uint8Array) => void, options?: NotificationStreamOptions): NotificationStream;
+};
+
+/** Outcome counters of decryption with a device key. */
+export interface DecryptionStats {
+    decrypted: number;
+    micFailures: number;
+}
+
+/** Delay distribution in milliseconds, see `createVirtualAdapter()`. */
+export interface LatencyModel {
+    /**
+     * fixed: `a`; uniform: between `a` and `b`; normal: mean `a`, deviation `b`;
+     * lognormal: median `a`, shape `b`; exponential: mean `a`.
+     */
+    kind: 'fixed' | 'uniform' | 'normal' | 'lognormal' | 'exponential';
+    a: number;
+    b?: number;
+}
+
+export interface VirtualAdapterOptions {
+    /** Number of simulated peripherals. */
+    count: number;
+    /** Time `connect()` blocks for, default 0. */
+    connectLatency?: number | LatencyModel;
+    /** Time between notifications, default 100. */
+    notifyInterval?: number | LatencyModel;
+    /** Notification size in bytes, default 20. */
+    payloadSize?: number;
+    /** Probability that a connection attempt fails, default 0. */
+    failureRate?: number;
+    seed?: number;
+}
+
+/** GATT tables shared between devices of the same model. */
+export interface GattTemplateStats {
+    templates: number;
+    /** Refreshes that found an existing template. */
+    hits: number;
+    misses: number;
+    /** Refreshes that kept their model's template and the services they changed. */
+    overlays: number;
+}
+
+/** Interned strings handed to JS for addresses, names and UUIDs. */
+export interface StringTableStats {
+    size: number;
+    capacity: number;
+    hits: number;
+    misses: number;
+    evictions: number;
 }
 
 export declare function getAdapters(): Adapter[];
 export declare function isEnabled(): boolean;
+export declare function setFlightRecorderDirectory(directory: string | null): void;
+/** Starts virtual time at `startMs`, or at the current time when 0; throws RangeError on negative or non-finite times. */
+export declare function setVirtualClock(enabled: boolean, startMs?: number): void;
+/** Fires the virtual timers due within `ms`, returning how many fired; throws RangeError like setVirtualClock(). */
+export declare function advanceClock(ms: number): number;
+export declare function stepClock(): boolean;
+export declare function getClockTime(): number;
+export declare function setEncryptionKey(address: string, key: Uint8Array | null): boolean;
+export declare function getDecryptionStats(address: string): DecryptionStats | undefined;
+export declare function getGattTemplateStats(): GattTemplateStats;
+/** Bounds the interned string table of the calling thread, default 4096 entries; 0 disables it. */
+export declare function setStringTableCapacity(capacity: number): void;
+export declare function getStringTableStats(): StringTableStats;
+/** Sets the quota of peripherals created afterwards. */
+export declare function setDefaultPeripheralQuota(quota: PeripheralQuota): void;
+/**
+ * Creates an adapter whose scan finds simulated peripherals, each with a
+ * notify/read characteristic 0000fff1 in service 0000fff0. Notifications carry
+ * `[u32 sequence][u64 native clock ns]` padded to `payloadSize`.
+ */
+export declare function createVirtualAdapter(options: VirtualAdapterOptions): Adapter;
+/**
+ * Opens `hci<index>` through the HCI user channel, bypassing BlueZ. Returns
+ * undefined when the controller is up or the process lacks CAP_NET_ADMIN.
+ * Only present in builds with `WEBBLUETOOTH_HCI` on Linux.
+ */
+export declare function createHciAdapter(index: number): Adapter | undefined;
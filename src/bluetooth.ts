@@ -24,6 +24,7 @@
 */
 
 import { adapter, EVENT_ENABLED } from './adapters';
+import { ScanCompletion } from './adapters/adapter';
 import { BluetoothDeviceImpl, BluetoothDeviceEvents } from './device';
 import { BluetoothUUID } from './uuid';
 import { EventDispatcher, DOMEvent } from './events';
@@ -47,6 +48,12 @@ export interface BluetoothOptions {
      */
     allowAllDevices?: boolean;
 
+    /**
+     * Seconds without a new device after which `getDevices()` resolves early.
+     * It also resolves as soon as every allowed device was found (default waits the full scan time)
+     */
+    quietPeriod?: number;
+
     /**
      * An optional referring device
      */
@@ -74,7 +81,7 @@ export class BluetoothImpl extends EventDispatcher<BluetoothEvents> implements B
 
     private deviceFound: (device: BluetoothDevice, selectFn: () => void) => boolean = undefined;
     private scanTime: number = 10.24 * 1000;
-    private scanner = undefined;
+    private sessions = new Set<() => void>();
     private allowedDevices = new Set<string>();
 
     /**
@@ -231,6 +238,55 @@ export class BluetoothImpl extends EventDispatcher<BluetoothEvents> implements B
         this.allowedDevices.delete(uuid);
     }
 
+    /**
+     * Runs a discovery session alongside any others until it is stopped or the scan time elapses
+     * @param filters Filters the adapter applies before reporting a device
+     * @param foundFn Called for each new matching device
+     * @param doneFn Called when the scan time elapses or the session completes, or with the error if it could not start
+     * @param completion Devices and quiet period allowing the session to complete early
+     * @returns Function stopping the session
+     */
+    private startSession(filters: Array<BluetoothLEScanFilter>, foundFn: (deviceInfo: Partial<BluetoothDeviceImpl>) => void, doneFn: (error?: Error) => void,
+        completion?: Omit<ScanCompletion, 'completeFn'>): () => void {
+        let session: number;
+        let stopped = false;
+
+        const stop = () => {
+            if (stopped) return;
+            stopped = true;
+            clearTimeout(timer);
+            this.sessions.delete(stop);
+            if (session !== undefined) {
+                adapter.stopScan(session);
+            }
+        };
+
+        const timer = setTimeout(() => {
+            stop();
+            doneFn();
+        }, this.scanTime);
+        this.sessions.add(stop);
+
+        adapter.startScan(filters, deviceInfo => {
+            if (!stopped) foundFn(deviceInfo);
+        }, completion && {
+            ...completion,
+            completeFn: () => {
+                if (stopped) return;
+                stop();
+                doneFn();
+            }
+        }).then(id => {
+            session = id;
+            if (stopped) adapter.stopScan(id);
+        }, error => {
+            stop();
+            doneFn(error);
+        });
+
+        return stop;
+    }
+
     /**
      * Gets the availability of a bluetooth adapter
      * @returns Promise containing a flag indicating bluetooth availability
@@ -245,10 +301,6 @@ export class BluetoothImpl extends EventDispatcher<BluetoothEvents> implements B
      * @returns Promise containing a device which matches the options
      */
     public requestDevice(options: RequestDeviceOptions = { filters: [] }): Promise<BluetoothDevice> {
-        if (this.scanner !== undefined) {
-            throw new Error('requestDevice error: request in progress');
-        }
-
         interface Filtered {
             filters: Array<BluetoothLEScanFilter>;
             optionalServices?: Array<BluetoothServiceUUID>;
@@ -265,8 +317,6 @@ export class BluetoothImpl extends EventDispatcher<BluetoothEvents> implements B
         const isAcceptAll = (maybeAcceptAll: RequestDeviceOptions): maybeAcceptAll is AcceptAll =>
             (maybeAcceptAll as AcceptAll).acceptAllDevices === true;
 
-        let searchUUIDs = [];
-
         if (isFiltered(options)) {
             // Must have a filter
             if (options.filters.length === 0) {
@@ -288,34 +338,20 @@ export class BluetoothImpl extends EventDispatcher<BluetoothEvents> implements B
             if (emptyPrefix) {
                 throw new TypeError('requestDevice error: empty namePrefix specified');
             }
-
-            options.filters.forEach(filter => {
-                if (filter.services) searchUUIDs = searchUUIDs.concat(filter.services.map(BluetoothUUID.getService));
-
-                // Unique-ify
-                searchUUIDs = searchUUIDs.filter((item, index, array) => {
-                    return array.indexOf(item) === index;
-                });
-            });
         } else if (!isAcceptAll(options)) {
             throw new TypeError('requestDevice error: specify filters or acceptAllDevices');
         }
 
         return new Promise((resolve, reject) => {
             let found = false;
-            this.scanner = setTimeout(() => {
-                this.cancelRequest();
-                if (!found) {
-                    reject('requestDevice error: no devices found');
-                }
-            }, this.scanTime);
+            const filters = isFiltered(options) ? options.filters : [];
 
-            adapter.startScan(searchUUIDs, deviceInfo => {
+            const stop = this.startSession(filters, deviceInfo => {
                 let validServices = [];
 
                 const complete = (bluetoothDevice: BluetoothDevice) => {
                     this.allowedDevices.add(bluetoothDevice.id);
-                    this.cancelRequest();
+                    stop();
                     resolve(bluetoothDevice);
                 };
 
@@ -352,6 +388,12 @@ export class BluetoothImpl extends EventDispatcher<BluetoothEvents> implements B
                         complete.call(this, bluetoothDevice);
                     }
                 }
+            }, error => {
+                if (error) {
+                    reject(`requestDevice error: ${error.message}`);
+                } else if (!found) {
+                    reject('requestDevice error: no devices found');
+                }
             });
         });
     }
@@ -360,20 +402,22 @@ export class BluetoothImpl extends EventDispatcher<BluetoothEvents> implements B
      * Get all bluetooth devices
      */
     public getDevices(): Promise<BluetoothDevice[]> {
-        if (this.scanner !== undefined) {
-            throw new Error('getDevices error: request in progress');
+        const allowAll = !!this.options?.allowAllDevices;
+        if (!allowAll && this.allowedDevices.size === 0) {
+            return Promise.resolve([]);
         }
 
-        return new Promise(resolve => {
-            const devices: BluetoothDevice[] = [];
+        // The adapter only reports allowed devices, and completes once it has seen all of them
+        const completion = {
+            deviceIds: allowAll ? undefined : [...this.allowedDevices],
+            quietPeriod: this.options?.quietPeriod ? this.options.quietPeriod * 1000 : undefined
+        };
 
-            this.scanner = setTimeout(() => {
-                this.cancelRequest();
-                resolve(devices);
-            }, this.scanTime);
+        return new Promise((resolve, reject) => {
+            const devices: BluetoothDevice[] = [];
 
-            adapter.startScan([], deviceInfo => {
-                if (this.options?.allowAllDevices || this.allowedDevices.has(deviceInfo.id)) {
+            this.startSession([], deviceInfo => {
+                if (allowAll || this.allowedDevices.has(deviceInfo.id)) {
                     Object.assign(deviceInfo, {
                         _bluetooth: this,
                         _allowedServices: []
@@ -382,19 +426,21 @@ export class BluetoothImpl extends EventDispatcher<BluetoothEvents> implements B
                     const bluetoothDevice = new BluetoothDeviceImpl(deviceInfo, () => this.forgetDevice(deviceInfo.id));
                     devices.push(bluetoothDevice);
                 }
-            });
+            }, error => {
+                if (error) {
+                    reject(`getDevices error: ${error.message}`);
+                } else {
+                    resolve(devices);
+                }
+            }, completion);
         });
     }
 
     /**
-     * Cancels the scan for devices
+     * Cancels every scan for devices in progress
      */
     public cancelRequest(): void {
-        if (this.scanner) {
-            clearTimeout(this.scanner);
-            this.scanner = undefined;
-            adapter.stopScan();
-        }
+        this.sessions.forEach(stop => stop());
     }
 
     /**
@@ -0,0 +1,107 @@
+#include "aes.h"
+#include "check.h"
+#include "keystore.h"
+
+#include <cstring>
+#include <vector>
+
+static std::vector<uint8_t> range(uint8_t first, size_t count) {
+  std::vector<uint8_t> out(count);
+  for (size_t i = 0; i < count; i++) {
+    out[i] = static_cast<uint8_t>(first + i);
+  }
+  return out;
+}
+
+// FIPS-197 appendix C.1.
+static void blockCipher() {
+  const auto key = range(0x00, 16);
+  uint8_t plaintext[16];
+  for (size_t i = 0; i < 16; i++) {
+    plaintext[i] = static_cast<uint8_t>(i * 0x11);
+  }
+  const uint8_t expected[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b,
+                                0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80,
+                                0x70, 0xb4, 0xc5, 0x5a};
+
+  uint8_t out[16];
+  Aes128(key.data()).encryptBlock(plaintext, out);
+  CHECK(std::memcmp(out, expected, 16) == 0);
+}
+
+// RFC 3610 packet vectors #1 and #2: 8-byte MIC, 8 bytes of AAD.
+static void ccmVectors() {
+  const auto key = range(0xc0, 16);
+  const auto aad = range(0x00, 8);
+  const Aes128 aes(key.data());
+
+  const uint8_t nonce1[13] = {0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00,
+                              0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5};
+  const uint8_t ciphertext1[23] = {0x58, 0x8c, 0x97, 0x9a, 0x61, 0xc6,
+                                   0x63, 0xd2, 0xf0, 0x66, 0xd0, 0xc2,
+                                   0xc0, 0xf9, 0x89, 0x80, 0x6d, 0x5f,
+                                   0x6b, 0x61, 0xda, 0xc3, 0x84};
+  uint8_t mic1[8] = {0x17, 0xe8, 0xd1, 0x2c, 0xfd, 0xf9, 0x26, 0xe0};
+  uint8_t plaintext1[23];
+  CHECK(aesCcmDecrypt(aes, nonce1, aad.data(), aad.size(), ciphertext1,
+                      sizeof(ciphertext1), mic1, sizeof(mic1), plaintext1));
+  CHECK(std::memcmp(plaintext1, range(0x08, 23).data(), 23) == 0);
+
+  // A flipped tag bit must fail verification.
+  mic1[0] ^= 1;
+  CHECK(!aesCcmDecrypt(aes, nonce1, aad.data(), aad.size(), ciphertext1,
+                       sizeof(ciphertext1), mic1, sizeof(mic1), plaintext1));
+
+  const uint8_t nonce2[13] = {0x00, 0x00, 0x00, 0x04, 0x03, 0x02, 0x01,
+                              0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5};
+  const uint8_t ciphertext2[24] = {0x72, 0xc9, 0x1a, 0x36, 0xe1, 0x35,
+                                   0xf8, 0xcf, 0x29, 0x1c, 0xa8, 0x94,
+                                   0x08, 0x5c, 0x87, 0xe3, 0xcc, 0x15,
+                                   0xc4, 0x39, 0xc9, 0xe4, 0x3a, 0x3b};
+  const uint8_t mic2[8] = {0xa0, 0x91, 0xd5, 0x6e, 0x10, 0x40, 0x09, 0x16};
+  uint8_t plaintext2[24];
+  CHECK(aesCcmDecrypt(aes, nonce2, aad.data(), aad.size(), ciphertext2,
+                      sizeof(ciphertext2), mic2, sizeof(mic2), plaintext2));
+  CHECK(std::memcmp(plaintext2, range(0x08, 24).data(), 24) == 0);
+}
+
+// The encrypted example of the BTHome v2 format documentation.
+static void bthome() {
+  const char *address = "54:48:E6:8F:80:A5";
+  const uint8_t key[16] = {0x23, 0x1d, 0x39, 0xc1, 0xd7, 0xcc, 0x1a, 0xb1,
+                           0xae, 0xe2, 0x24, 0xcd, 0x09, 0x6d, 0xb9, 0x32};
+  const uint8_t data[] = {0x41, 0xa4, 0x72, 0x66, 0xc9, 0x5f, 0x73, 0x00,
+                          0x11, 0x22, 0x33, 0x78, 0x23, 0x72, 0x14};
+
+  std::vector<uint8_t> out;
+  CHECK(!decryptBthome(address, data, sizeof(data), out));
+
+  // Keys match addresses whatever their case.
+  KeyStore::set("54:48:e6:8f:80:a5", key);
+  CHECK(decryptBthome(address, data, sizeof(data), out));
+  // Temperature 25.06 C and humidity 50.55 %, encryption flag cleared.
+  const std::vector<uint8_t> expected = {0x40, 0x02, 0xca, 0x09,
+                                         0x03, 0xbf, 0x13};
+  CHECK(out == expected);
+
+  uint8_t tampered[sizeof(data)];
+  std::memcpy(tampered, data, sizeof(data));
+  tampered[sizeof(tampered) - 1] ^= 1;
+  CHECK(!decryptBthome(address, tampered, sizeof(tampered), out));
+
+  DecryptionStats stats;
+  CHECK(KeyStore::stats(address, stats));
+  CHECK(stats.decrypted == 1 && stats.micFailures == 1);
+
+  // Unencrypted payloads are left alone.
+  const uint8_t plain[] = {0x40, 0x02, 0xca, 0x09};
+  CHECK(!decryptBthome(address, plain, sizeof(plain), out));
+  CHECK(KeyStore::remove(address));
+}
+
+int main() {
+  blockCipher();
+  ccmVectors();
+  bthome();
+  return 0;
+}
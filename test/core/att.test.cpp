@@ -0,0 +1,285 @@
+#include "att.h"
+#include "check.h"
+
+#include <algorithm>
+#include <thread>
+
+// A fake GATT server answering on its own thread:
+//   0x180d, handles 1-6: 0x2a37 notify (declaration 2, value 3, CCCD 4) and
+//     0x2a38 read (declaration 5, value 6)
+//   128-bit service, handles 7-9: 128-bit read/write (declaration 8, value 9)
+struct Server {
+  AttClient *client = nullptr;
+  std::vector<uint8_t> longValue;
+  uint16_t mtu = 23;
+  std::vector<uint8_t> cccd = {0, 0};
+  // Answers discovery past the first service with responses of no entries.
+  bool empty = false;
+  std::vector<std::vector<uint8_t>> sent;
+  std::vector<std::thread> replies;
+
+  void reply(std::vector<uint8_t> response) {
+    this->replies.emplace_back([this, response] {
+      this->client->receive(response.data(), response.size());
+    });
+  }
+
+  // Waits for the replies before the client goes away.
+  void join() {
+    for (auto &thread : this->replies) {
+      thread.join();
+    }
+    this->replies.clear();
+  }
+
+  void error(uint8_t opcode, uint16_t handle, uint8_t code) {
+    this->reply({0x01, opcode, static_cast<uint8_t>(handle),
+                 static_cast<uint8_t>(handle >> 8), code});
+  }
+
+  std::vector<uint8_t> slice(size_t offset) const {
+    const size_t end =
+        std::min<size_t>(this->longValue.size(), offset + this->mtu - 1);
+    return std::vector<uint8_t>(this->longValue.begin() + offset,
+                                this->longValue.begin() + end);
+  }
+
+  bool handle(std::vector<uint8_t> pdu) {
+    this->sent.push_back(pdu);
+    const auto u16 = [&](size_t offset) {
+      return static_cast<uint16_t>(pdu[offset] | pdu[offset + 1] << 8);
+    };
+    std::vector<uint8_t> uuid128(16);
+    for (uint8_t i = 0; i < 16; i++) {
+      uuid128[i] = i;
+    }
+
+    std::vector<uint8_t> response;
+    switch (pdu[0]) {
+    case 0x02:
+      this->mtu = std::min<uint16_t>(u16(1), 64);
+      this->reply({0x03, static_cast<uint8_t>(this->mtu), 0});
+      break;
+    case 0x10:
+      if (u16(1) <= 1) {
+        this->reply({0x11, 6, 1, 0, 6, 0, 0x0d, 0x18});
+      } else if (this->empty) {
+        this->reply({0x11, 6});
+      } else if (u16(1) <= 7) {
+        response = {0x11, 20, 7, 0, 9, 0};
+        response.insert(response.end(), uuid128.begin(), uuid128.end());
+        this->reply(response);
+      } else {
+        this->error(pdu[0], u16(1), 0x0a);
+      }
+      break;
+    case 0x08:
+      if (this->empty) {
+        this->reply({0x09, 7});
+      } else if (u16(1) <= 2 && u16(3) >= 2) {
+        this->reply({0x09, 7, 2, 0, 0x10, 3, 0, 0x37, 0x2a, 5, 0, 0x02, 6, 0,
+                     0x38, 0x2a});
+      } else if (u16(1) <= 8 && u16(3) >= 8) {
+        response = {0x09, 21, 8, 0, 0x0a, 9, 0};
+        response.insert(response.end(), uuid128.begin(), uuid128.end());
+        this->reply(response);
+      } else {
+        this->error(pdu[0], u16(1), 0x0a);
+      }
+      break;
+    case 0x04:
+      if (u16(1) <= 4 && u16(3) >= 4) {
+        this->reply({0x05, 1, 4, 0, 0x02, 0x29});
+      } else {
+        this->error(pdu[0], u16(1), 0x0a);
+      }
+      break;
+    case 0x0a:
+      if (u16(1) != 6) {
+        this->error(pdu[0], u16(1), 0x01);
+        break;
+      }
+      response = this->slice(0);
+      response.insert(response.begin(), 0x0b);
+      this->reply(response);
+      break;
+    case 0x0c:
+      if (u16(3) > this->longValue.size()) {
+        this->error(pdu[0], u16(1), 0x07);
+        break;
+      }
+      response = this->slice(u16(3));
+      response.insert(response.begin(), 0x0d);
+      this->reply(response);
+      break;
+    case 0x12:
+      if (u16(1) == 4) {
+        this->cccd.assign(pdu.begin() + 3, pdu.end());
+        this->reply({0x13});
+      } else if (u16(1) == 9) {
+        this->reply({0x13});
+      } else {
+        this->error(pdu[0], u16(1), 0x03);
+      }
+      break;
+    // Commands, confirmations and responses to the peer's requests.
+    case 0x01:
+    case 0x03:
+    case 0x1e:
+    case 0x52:
+      break;
+    default:
+      CHECK(!"unexpected request");
+    }
+    return true;
+  }
+};
+
+static const auto TIMEOUT = std::chrono::milliseconds(500);
+
+static void discovery() {
+  Server server;
+  AttClient client([&](std::vector<uint8_t> pdu) { return server.handle(pdu); },
+                   517, TIMEOUT);
+  server.client = &client;
+
+  CHECK(client.mtu() == 23);
+  CHECK(client.exchangeMtu() && client.mtu() == 64);
+
+  GattDatabase database;
+  std::vector<AttCharacteristic> characteristics;
+  CHECK(client.discover(database, characteristics));
+  CHECK(database.size() == 2);
+  CHECK(database[0].uuid == "0000180d-0000-1000-8000-00805f9b34fb");
+  // 128-bit UUIDs arrive little-endian.
+  CHECK(database[1].uuid == "0f0e0d0c-0b0a-0908-0706-050403020100");
+
+  const auto &heartRate = database[0].characteristics;
+  CHECK(heartRate.size() == 2 && database[1].characteristics.size() == 1);
+  CHECK(heartRate[0].canNotify && !heartRate[0].canRead);
+  CHECK(heartRate[0].descriptors ==
+        std::vector<std::string>{"00002902-0000-1000-8000-00805f9b34fb"});
+  CHECK(heartRate[1].canRead && heartRate[1].descriptors.empty());
+  CHECK(database[1].characteristics[0].canRead &&
+        database[1].characteristics[0].canWriteRequest);
+
+  CHECK(characteristics.size() == 3);
+  CHECK(characteristics[0].value == 3 && characteristics[0].cccd == 4);
+  CHECK(characteristics[1].value == 6 && characteristics[1].cccd == 0);
+  CHECK(characteristics[2].service == database[1].uuid &&
+        characteristics[2].value == 9);
+  server.join();
+}
+
+static void emptyResponses() {
+  Server server;
+  server.empty = true;
+  AttClient client([&](std::vector<uint8_t> pdu) { return server.handle(pdu); },
+                   517, TIMEOUT);
+  server.client = &client;
+
+  // Responses without entries end discovery instead of being requested
+  // again from the same handle.
+  GattDatabase database;
+  std::vector<AttCharacteristic> characteristics;
+  CHECK(client.discover(database, characteristics));
+  CHECK(database.size() == 1 && database[0].characteristics.empty());
+  CHECK(characteristics.empty());
+  CHECK(server.sent.size() == 3);
+  server.join();
+}
+
+static void readWrite() {
+  Server server;
+  for (int i = 0; i < 150; i++) {
+    server.longValue.push_back(static_cast<uint8_t>(i));
+  }
+  AttClient client([&](std::vector<uint8_t> pdu) { return server.handle(pdu); },
+                   517, TIMEOUT);
+  server.client = &client;
+  CHECK(client.exchangeMtu());
+
+  // Long values continue with blob reads.
+  std::vector<uint8_t> value;
+  CHECK(client.read(6, value) && value == server.longValue);
+  // Exactly MTU - 1 bytes: the blob read comes back empty.
+  server.longValue.resize(63);
+  CHECK(client.read(6, value) && value == server.longValue);
+  CHECK(!client.read(7, value));
+
+  const uint8_t enable[2] = {1, 0};
+  CHECK(client.write(4, enable, sizeof(enable), true));
+  CHECK(server.cccd[0] == 1);
+  CHECK(client.write(9, enable, sizeof(enable), false));
+  // Larger than MTU - 3.
+  const std::vector<uint8_t> large(62);
+  CHECK(!client.write(9, large.data(), large.size(), true));
+  server.join();
+}
+
+static void peerTraffic() {
+  Server server;
+  AttClient client([&](std::vector<uint8_t> pdu) { return server.handle(pdu); },
+                   517, TIMEOUT);
+  server.client = &client;
+
+  int notified = 0;
+  client.setNotifyCallback([&](uint16_t handle, const uint8_t *data,
+                               size_t length) {
+    CHECK(handle == 3 && length == 2 && data[0] == 7);
+    notified++;
+  });
+  const uint8_t notification[] = {0x1b, 3, 0, 7, 8};
+  client.receive(notification, sizeof(notification));
+  // Indications are confirmed.
+  const size_t sent = server.sent.size();
+  const uint8_t indication[] = {0x1d, 3, 0, 7, 8};
+  client.receive(indication, sizeof(indication));
+  CHECK(notified == 2 && server.sent.size() == sent + 1);
+  CHECK(server.sent.back() == std::vector<uint8_t>{0x1e});
+
+  // The peer's MTU request is answered with ours.
+  const uint8_t mtuRequest[] = {0x02, 100, 0};
+  client.receive(mtuRequest, sizeof(mtuRequest));
+  CHECK(server.sent.back()[0] == 0x03 && server.sent.back()[1] == (517 & 0xff));
+  CHECK(client.mtu() == 100);
+
+  // There is no local database to serve.
+  const uint8_t readRequest[] = {0x0a, 5, 0};
+  client.receive(readRequest, sizeof(readRequest));
+  CHECK((server.sent.back() == std::vector<uint8_t>{0x01, 0x0a, 5, 0, 0x01}));
+  const uint8_t groupRequest[] = {0x10, 1, 0, 0xff, 0xff, 0, 0x28};
+  client.receive(groupRequest, sizeof(groupRequest));
+  CHECK((server.sent.back() == std::vector<uint8_t>{0x01, 0x10, 1, 0, 0x0a}));
+  server.join();
+}
+
+static void unresponsive() {
+  std::vector<uint8_t> value;
+  AttClient silent([](std::vector<uint8_t>) { return true; }, 517,
+                   std::chrono::milliseconds(50));
+  CHECK(!silent.read(1, value));
+  // A timeout closes the bearer.
+  CHECK(!silent.exchangeMtu());
+
+  // close() fails a pending request without waiting for its timeout.
+  AttClient closing([](std::vector<uint8_t>) { return true; }, 517,
+                    std::chrono::milliseconds(5000));
+  std::thread closer([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    closing.close();
+  });
+  const auto start = std::chrono::steady_clock::now();
+  CHECK(!closing.read(1, value));
+  CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+  closer.join();
+}
+
+int main() {
+  discovery();
+  emptyResponses();
+  readWrite();
+  peerTraffic();
+  unresponsive();
+  return 0;
+}
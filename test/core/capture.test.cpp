@@ -0,0 +1,86 @@
+#include "capture.h"
+#include "check.h"
+
+#include <cstdio>
+
+static Advertisement advertisement() {
+  Advertisement out;
+  out.timestamp = 1000;
+  out.identifier = "Thermo";
+  out.address = "AA:BB:CC:DD:EE:FF";
+  out.addressType = 1;
+  out.rssi = -70;
+  out.txPower = -4;
+  out.connectable = true;
+  out.manufacturerData.push_back({0x004c, {1, 2, 3}});
+  out.serviceData.push_back(
+      {"0000fcd2-0000-1000-8000-00805f9b34fb", {0x40, 0x02, 0x03}});
+  out.serviceData.push_back({"0000180f-0000-1000-8000-00805f9b34fb", {}});
+  return out;
+}
+
+static void same(const Advertisement &a, const Advertisement &b) {
+  CHECK(a.updated == b.updated);
+  CHECK(a.identifier == b.identifier && a.address == b.address);
+  CHECK(a.addressType == b.addressType && a.connectable == b.connectable);
+  CHECK(a.rssi == b.rssi && a.txPower == b.txPower);
+  CHECK(a.manufacturerData == b.manufacturerData);
+  CHECK(a.serviceData == b.serviceData);
+}
+
+static void roundTrip() {
+  const char *path = "roundtrip.wbsc";
+  auto first = advertisement();
+  auto second = advertisement();
+  second.timestamp = 5000;
+  second.updated = true;
+  second.rssi = -60;
+  second.connectable = false;
+  second.manufacturerData.clear();
+
+  CaptureWriter writer;
+  CHECK(writer.open(path));
+  CHECK(writer.write(first) && writer.write(second));
+  CHECK(writer.close() == 2);
+
+  std::vector<Advertisement> records;
+  CHECK(CaptureReader::read(path, records));
+  CHECK(records.size() == 2);
+  // Timestamps are stored relative to the first record.
+  CHECK(records[0].timestamp == 0 && records[1].timestamp == 4000);
+  same(records[0], first);
+  same(records[1], second);
+  std::remove(path);
+}
+
+static void truncated() {
+  const char *path = "truncated.wbsc";
+  CaptureWriter writer;
+  CHECK(writer.open(path));
+  CHECK(writer.write(advertisement()) && writer.write(advertisement()));
+  writer.close();
+
+  // Cut the second record short: the first one is still returned.
+  FILE *file = std::fopen(path, "rb");
+  CHECK(file);
+  std::vector<char> bytes(4096);
+  bytes.resize(std::fread(bytes.data(), 1, bytes.size(), file));
+  std::fclose(file);
+  file = std::fopen(path, "wb");
+  std::fwrite(bytes.data(), 1, bytes.size() - 3, file);
+  std::fclose(file);
+
+  std::vector<Advertisement> records;
+  CaptureReader::read(path, records);
+  CHECK(records.size() == 1);
+  same(records[0], advertisement());
+  std::remove(path);
+
+  CHECK(!CaptureReader::read("missing.wbsc", records));
+}
+
+int main() {
+  roundTrip();
+  truncated();
+  return 0;
+}
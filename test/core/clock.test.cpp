@@ -0,0 +1,46 @@
+#include "check.h"
+#include "clock.h"
+
+#include <vector>
+
+static constexpr uint64_t MS = 1000000;
+
+static void virtualTime() {
+  Clock::setVirtual(true, 1000 * MS);
+  CHECK(Clock::isVirtual() && Clock::now() == 1000 * MS);
+  // Time only moves when advanced.
+  CHECK(Clock::advance(250 * MS) == 0);
+  CHECK(Clock::now() == 1250 * MS);
+  Clock::setVirtual(false);
+  CHECK(!Clock::isVirtual() && Clock::advance(MS) == 0);
+}
+
+static void timers() {
+  Clock::setVirtual(true, 1000 * MS);
+  std::vector<int> fired;
+  Clock::scheduleAfter(30 * MS, [&] { fired.push_back(3); });
+  Clock::scheduleAfter(10 * MS, [&] { fired.push_back(1); });
+  // Timers sharing a deadline fire in the order they were scheduled.
+  Clock::scheduleAfter(20 * MS, [&] { fired.push_back(2); });
+  Clock::scheduleAfter(20 * MS, [&] { fired.push_back(4); });
+  const uint64_t cancelled =
+      Clock::scheduleAfter(15 * MS, [&] { fired.push_back(0); });
+  CHECK(Clock::cancel(cancelled) && !Clock::cancel(cancelled));
+
+  CHECK(Clock::step() && Clock::now() == 1010 * MS);
+  CHECK(Clock::advance(15 * MS) == 2 && Clock::now() == 1025 * MS);
+  CHECK((fired == std::vector<int>{1, 2, 4}));
+  CHECK(Clock::step() && Clock::now() == 1030 * MS && fired.back() == 3);
+  CHECK(!Clock::step());
+
+  // Advancing past the end of time saturates instead of wrapping.
+  Clock::scheduleAfter(MS, [&] { fired.push_back(5); });
+  CHECK(Clock::advance(UINT64_MAX) == 1 && Clock::now() == UINT64_MAX);
+  Clock::setVirtual(false);
+}
+
+int main() {
+  virtualTime();
+  timers();
+  return 0;
+}
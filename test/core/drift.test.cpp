@@ -0,0 +1,80 @@
+#include "check.h"
+#include "drift.h"
+
+#include <cmath>
+#include <random>
+
+// A 32768 Hz counter running 50 ppm fast, starting just short of a 32-bit
+// wrap, sampled every ~100 ms with exponentially distributed delivery delay
+// on top of a fixed 5 ms.
+static void jitteredDelivery() {
+  DriftEstimator estimator(64, 32);
+  std::mt19937_64 random(3);
+  std::exponential_distribution<double> delay(1 / 2e6);
+  const double nsPerTick = 1e9 / 32768.0 / (1 + 50e-6);
+  const uint64_t firstTick = 0xffffff00;
+
+  double worstEstimate = 0;
+  double worstReceived = 0;
+  for (int i = 0; i < 2000; i++) {
+    const uint64_t ticks = uint64_t(i) * 3277;
+    const double sent = 1e9 + static_cast<double>(ticks) * nsPerTick;
+    const uint64_t received =
+        static_cast<uint64_t>(sent + 5e6 + delay(random));
+    const uint64_t estimate =
+        estimator.add((firstTick + ticks) & 0xffffffff, received);
+    if (i >= 100) {
+      worstEstimate = std::fmax(
+          worstEstimate, std::fabs(static_cast<double>(estimate) - sent - 5e6));
+      worstReceived = std::fmax(
+          worstReceived, std::fabs(static_cast<double>(received) - sent - 5e6));
+    }
+  }
+
+  ClockFit fit;
+  CHECK(estimator.estimate(fit));
+  CHECK(fit.samples == 64);
+  // A 6.4 s window against milliseconds of jitter: within a few hundred ppm.
+  CHECK(std::fabs(fit.slope / nsPerTick - 1) < 300e-6);
+  CHECK(fit.jitter > 0);
+  // The fit absorbs most of the delivery jitter.
+  CHECK(worstEstimate < worstReceived / 4);
+}
+
+static void wrapAndReset() {
+  // A 16-bit counter with exact deliveries, 1 us per tick.
+  DriftEstimator estimator(16, 16);
+  ClockFit fit;
+  CHECK(!estimator.estimate(fit));
+  CHECK(estimator.add(0xfff0, 1000000) == 1000000);
+  for (uint64_t i = 1; i <= 40; i++) {
+    const uint64_t received = 1000000 + i * 0x10 * 1000;
+    CHECK(estimator.add((0xfff0 + i * 0x10) & 0xffff, received) == received);
+  }
+  CHECK(estimator.estimate(fit));
+  CHECK(std::fabs(fit.slope - 1000) < 1e-6 && fit.jitter == 0);
+
+  // A counter that runs backwards starts a new fit.
+  CHECK(estimator.add(0x0100, 9000000000) == 9000000000);
+  CHECK(!estimator.estimate(fit));
+  CHECK(estimator.add(0x0110, 9000008000) == 9000008000);
+  CHECK(estimator.estimate(fit));
+  CHECK(fit.samples == 2 && std::fabs(fit.slope - 500) < 1e-6);
+}
+
+static void windowLimit() {
+  DriftEstimator estimator(SIZE_MAX, 32);
+  for (uint64_t i = 0; i < DriftEstimator::MAX_WINDOW + 16; i++) {
+    estimator.add(i * 1000, 1000000 + i * 1000000);
+  }
+  ClockFit fit;
+  CHECK(estimator.estimate(fit));
+  CHECK(fit.samples == DriftEstimator::MAX_WINDOW);
+}
+
+int main() {
+  jitteredDelivery();
+  wrapAndReset();
+  windowLimit();
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include "check.h"
+#include "format.h"
+
+#include <cmath>
+#include <vector>
+
+static std::vector<double> decode(uint8_t format, int8_t exponent,
+                                  std::vector<uint8_t> data) {
+  PresentationFormat presentation;
+  presentation.format = format;
+  presentation.exponent = exponent;
+  std::vector<double> out;
+  ValueDecoder(presentation).decode(data.data(), data.size(), out);
+  return out;
+}
+
+static bool near(double value, double expected) {
+  return std::fabs(value - expected) < 1e-9 * std::fmax(1, std::fabs(expected));
+}
+
+static void descriptor() {
+  // sint16, exponent -2, degrees Celsius (0x272f), Bluetooth SIG namespace.
+  const uint8_t data[7] = {0x0e, 0xfe, 0x2f, 0x27, 0x01, 0x00, 0x00};
+  PresentationFormat format;
+  CHECK(!PresentationFormat::parse(data, 6, format));
+  CHECK(PresentationFormat::parse(data, sizeof(data), format));
+  CHECK(format.format == 0x0e && format.exponent == -2);
+  CHECK(format.unit == 0x272f && format.nameSpace == 1);
+
+  // Two values back to back; a trailing partial value is ignored.
+  const uint8_t values[5] = {0xc4, 0x09, 0x3c, 0xf6, 0x01};
+  std::vector<double> out;
+  CHECK(ValueDecoder(format).decode(values, sizeof(values), out) == 2);
+  CHECK(near(out[0], 25) && near(out[1], -25));
+}
+
+static void integers() {
+  CHECK(decode(0x01, 0, {0xff}) == std::vector<double>{1});
+  CHECK(decode(0x03, 0, {0xff}) == std::vector<double>{15});
+  CHECK(decode(0x05, 0, {0xff, 0xff}) == std::vector<double>{4095});
+  CHECK(decode(0x07, 0, {0x01, 0x02, 0x03}) == std::vector<double>{0x030201});
+  CHECK(decode(0x0c, 0, {0x80}) == std::vector<double>{-128});
+  CHECK(decode(0x0d, 0, {0xff, 0x0f}) == std::vector<double>{-1});
+  CHECK(decode(0x0d, 0, {0xff, 0x07}) == std::vector<double>{2047});
+  CHECK(decode(0x0f, 0, {0x00, 0x00, 0x80}) == std::vector<double>{-8388608});
+  CHECK(decode(0x11, 0, {0xfe, 0xff, 0xff, 0xff, 0xff, 0xff}) ==
+        std::vector<double>{-2});
+  CHECK(near(decode(0x06, 3, {0x02, 0x00})[0], 2000));
+}
+
+static void floats() {
+  // float32 1.5 and float64 -0.25.
+  CHECK(decode(0x14, 0, {0x00, 0x00, 0xc0, 0x3f}) ==
+        std::vector<double>{1.5});
+  CHECK(decode(0x15, 0, {0, 0, 0, 0, 0, 0, 0xd0, 0xbf}) ==
+        std::vector<double>{-0.25});
+  // Presentation exponents do not apply to IEEE 754 values.
+  CHECK(decode(0x14, -2, {0x00, 0x00, 0xc0, 0x3f}) ==
+        std::vector<double>{1.5});
+}
+
+// IEEE 11073-20601 SFLOAT: 4-bit exponent, 12-bit mantissa.
+static void sfloat() {
+  CHECK(near(decode(0x16, 0, {0x72, 0xf1})[0], 37));
+  CHECK(near(decode(0x16, 0, {0x0e, 0x20})[0], 1400));
+  CHECK(near(decode(0x16, 0, {0xff, 0xff})[0], -0.1));
+
+  // NaN, NRes and the reserved value all decode to NaN.
+  CHECK(std::isnan(decode(0x16, 0, {0xff, 0x07})[0]));
+  CHECK(std::isnan(decode(0x16, 0, {0x00, 0x08})[0]));
+  CHECK(std::isnan(decode(0x16, 0, {0x01, 0x08})[0]));
+  CHECK(decode(0x16, 0, {0xfe, 0x07})[0] == INFINITY);
+  CHECK(decode(0x16, 0, {0x02, 0x08})[0] == -INFINITY);
+}
+
+// IEEE 11073-20601 FLOAT: 8-bit exponent, 24-bit mantissa.
+static void medicalFloat() {
+  CHECK(near(decode(0x17, 0, {0x6c, 0x01, 0x00, 0xff})[0], 36.4));
+  CHECK(near(decode(0x17, 0, {0xfd, 0xff, 0xff, 0x02})[0], -300));
+
+  CHECK(std::isnan(decode(0x17, 0, {0xff, 0xff, 0x7f, 0x00})[0]));
+  CHECK(std::isnan(decode(0x17, 0, {0x00, 0x00, 0x80, 0x00})[0]));
+  CHECK(std::isnan(decode(0x17, 0, {0x01, 0x00, 0x80, 0x00})[0]));
+  CHECK(decode(0x17, 0, {0xfe, 0xff, 0x7f, 0x00})[0] == INFINITY);
+  CHECK(decode(0x17, 0, {0x02, 0x00, 0x80, 0x00})[0] == -INFINITY);
+}
+
+static void unsupported() {
+  PresentationFormat utf8;
+  utf8.format = 0x19;
+  const ValueDecoder decoder(utf8);
+  CHECK(!decoder.valid());
+
+  std::vector<double> out;
+  const uint8_t data[2] = {'h', 'i'};
+  CHECK(decoder.decode(data, sizeof(data), out) == 0 && out.empty());
+}
+
+int main() {
+  descriptor();
+  integers();
+  floats();
+  sfloat();
+  medicalFloat();
+  unsupported();
+  return 0;
+}
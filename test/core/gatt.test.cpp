@@ -0,0 +1,70 @@
+#include "check.h"
+#include "gatt.h"
+
+static GattCharacteristic characteristic(const char *uuid, bool read = false) {
+  GattCharacteristic out;
+  out.uuid = uuid;
+  out.canRead = read;
+  return out;
+}
+
+static GattService service(const char *uuid,
+                           std::vector<GattCharacteristic> characteristics) {
+  GattService out;
+  out.uuid = uuid;
+  out.characteristics = std::move(characteristics);
+  return out;
+}
+
+static bool is(const GattChange &change, GattChangeType type,
+               const char *service, const char *characteristic) {
+  return change.type == type && change.service->uuid == service &&
+         (characteristic ? change.characteristic &&
+                               change.characteristic->uuid == characteristic
+                         : !change.characteristic);
+}
+
+static void diff() {
+  const GattDatabase previous = {
+      service("s1", {characteristic("c1", true), characteristic("c2")}),
+      service("s2", {characteristic("c3")})};
+  const GattDatabase next = {
+      service("s1", {characteristic("c1"), characteristic("c4")}),
+      service("s3", {characteristic("c5")})};
+
+  const auto changes = diffGattDatabase(previous, next);
+  CHECK(changes.size() == 6);
+  CHECK(is(changes[0], GattChangeType::Removed, "s2", nullptr));
+  CHECK(changes[0].service == &previous[1]);
+  CHECK(is(changes[1], GattChangeType::Removed, "s1", "c2"));
+  CHECK(changes[1].characteristic == &previous[0].characteristics[1]);
+  CHECK(is(changes[2], GattChangeType::Changed, "s1", "c1"));
+  CHECK(changes[2].characteristic == &next[0].characteristics[0]);
+  CHECK(is(changes[3], GattChangeType::Added, "s1", "c4"));
+  CHECK(is(changes[4], GattChangeType::Added, "s3", nullptr));
+  CHECK(is(changes[5], GattChangeType::Added, "s3", "c5"));
+
+  CHECK(diffGattDatabase(previous, previous).empty());
+  CHECK(diffGattDatabase({}, previous).size() == 5);
+  CHECK(diffGattDatabase(previous, {}).size() == 2);
+}
+
+static void fingerprint() {
+  GattDatabase a = {service("s1", {characteristic("c1", true)})};
+  GattDatabase b = a;
+  b[0].data = {1, 2, 3};
+  // Service data changes neither the fingerprint nor the diff.
+  CHECK(gattFingerprint(a) == gattFingerprint(b));
+  CHECK(diffGattDatabase(a, b).empty());
+
+  b[0].characteristics[0].descriptors.push_back("2902");
+  CHECK(gattFingerprint(a) != gattFingerprint(b));
+  CHECK(diffGattDatabase(a, b).size() == 1);
+  CHECK(gattSize(b) > gattSize(a));
+}
+
+int main() {
+  diff();
+  fingerprint();
+  return 0;
+}
@@ -0,0 +1,35 @@
+#include "check.h"
+#include "hci.h"
+
+static void advertisingData() {
+  // Flags, 16-bit service list, service data, manufacturer data, TX power.
+  const uint8_t data[] = {2,    0x01, 0x06, 3,    0x03, 0x0d, 0x18, 5,
+                          0x16, 0x0d, 0x18, 0xaa, 0xbb, 5,    0xff, 0x4c,
+                          0x00, 1,    2,    2,    0x0a, 0xf4};
+  Advertisement advertisement;
+  CHECK(parseAdvertisingData(data, sizeof(data), advertisement));
+  CHECK(advertisement.serviceData.size() == 1);
+  CHECK(advertisement.serviceData[0].first ==
+        "0000180d-0000-1000-8000-00805f9b34fb");
+  CHECK((advertisement.serviceData[0].second ==
+         std::vector<uint8_t>{0xaa, 0xbb}));
+  CHECK(advertisement.manufacturerData.size() == 1);
+  CHECK(advertisement.manufacturerData[0].first == 0x004c);
+  CHECK((advertisement.manufacturerData[0].second ==
+         std::vector<uint8_t>{1, 2}));
+  CHECK(advertisement.txPower == -12);
+}
+
+static void truncated() {
+  // The complete name parses; the structure after it overruns the data.
+  const uint8_t data[] = {3, 0x09, 'a', 'b', 9, 0x09, 'x'};
+  Advertisement advertisement;
+  CHECK(!parseAdvertisingData(data, sizeof(data), advertisement));
+  CHECK(advertisement.identifier == "ab");
+}
+
+int main() {
+  advertisingData();
+  truncated();
+  return 0;
+}
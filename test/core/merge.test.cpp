@@ -0,0 +1,107 @@
+#include "check.h"
+#include "merge.h"
+
+#include <cstring>
+
+struct Packed {
+  uint64_t timestamp;
+  uint16_t channel;
+  std::vector<uint8_t> data;
+};
+
+static std::vector<Packed> unpack(const std::vector<uint8_t> &bytes) {
+  std::vector<Packed> out;
+  for (size_t offset = 0; offset < bytes.size();) {
+    CHECK(offset + ReorderMerger::HEADER_SIZE <= bytes.size());
+    Packed record;
+    record.timestamp = 0;
+    for (int i = 0; i < 8; i++) {
+      record.timestamp |= uint64_t(bytes[offset + i]) << (8 * i);
+    }
+    record.channel = bytes[offset + 8] | bytes[offset + 9] << 8;
+    const size_t length = bytes[offset + 10] | bytes[offset + 11] << 8;
+    offset += ReorderMerger::HEADER_SIZE;
+    CHECK(offset + length <= bytes.size());
+    record.data.assign(bytes.begin() + offset, bytes.begin() + offset + length);
+    offset += length;
+    out.push_back(record);
+  }
+  return out;
+}
+
+static void ordering() {
+  ReorderMerger merger(10, 16);
+  merger.addChannel(1);
+  merger.addChannel(2);
+  const uint8_t data[2] = {0xab, 0xcd};
+  merger.push(1, 5, data, 2);
+  merger.push(2, 3, data, 1);
+  merger.push(1, 7, data, 2);
+  merger.push(2, 20, data, 0);
+
+  // Only records up to now - window go out.
+  std::vector<uint8_t> out;
+  CHECK(merger.drain(17, out) == 3);
+  auto records = unpack(out);
+  CHECK(records.size() == 3);
+  CHECK(records[0].timestamp == 3 && records[0].channel == 2);
+  CHECK(records[0].data == std::vector<uint8_t>({0xab}));
+  CHECK(records[1].timestamp == 5 && records[1].channel == 1);
+  CHECK(records[2].timestamp == 7 && records[2].data.size() == 2);
+
+  // Older than what was delivered: late.
+  merger.push(2, 4, data, 1);
+  auto stats = merger.stats();
+  CHECK(stats.late == 1 && stats.delivered == 3 && stats.buffered == 1);
+
+  out.clear();
+  CHECK(merger.drain(0, out, true) == 1);
+  CHECK(unpack(out)[0].timestamp == 20);
+  CHECK(merger.stats().buffered == 0);
+}
+
+static void capacity() {
+  ReorderMerger merger(1000, 4);
+  merger.addChannel(1);
+  merger.addChannel(2);
+  const uint8_t data[1] = {0};
+  for (int i = 0; i < 20; i++) {
+    merger.push(i % 2 ? 1 : 2, 100 + i, data, 1);
+  }
+
+  // Four held, four released early, the rest refused until a drain.
+  auto stats = merger.stats();
+  CHECK(stats.buffered == 4 && stats.forced == 4 && stats.dropped == 12);
+
+  std::vector<uint8_t> out;
+  CHECK(merger.drain(0, out) == 4);
+  const auto released = unpack(out);
+  for (size_t i = 1; i < released.size(); i++) {
+    CHECK(released[i].timestamp > released[i - 1].timestamp);
+  }
+
+  out.clear();
+  CHECK(merger.drain(0, out, true) == 4);
+  CHECK(unpack(out).front().timestamp > released.back().timestamp);
+}
+
+static void removedChannel() {
+  ReorderMerger merger(0, 4);
+  merger.addChannel(1);
+  const uint8_t data[1] = {0};
+  merger.push(1, 10, data, 1);
+  // Removing a channel discards what it buffered, and later pushes to it
+  // are ignored.
+  merger.removeChannel(1);
+  merger.push(1, 11, data, 1);
+  std::vector<uint8_t> out;
+  CHECK(merger.drain(100, out, true) == 0);
+  CHECK(merger.stats().buffered == 0);
+}
+
+int main() {
+  ordering();
+  capacity();
+  removedChannel();
+  return 0;
+}
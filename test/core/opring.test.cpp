@@ -0,0 +1,129 @@
+#include "check.h"
+#include "opring.h"
+
+#include <cstring>
+#include <thread>
+
+static std::atomic<uint32_t> &counter(std::vector<uint8_t> &memory,
+                                      size_t offset) {
+  return *reinterpret_cast<std::atomic<uint32_t> *>(memory.data() + offset);
+}
+
+static uint32_t completionUser(const std::vector<uint8_t> &memory,
+                               const OpRing &ring, uint32_t index) {
+  uint32_t user;
+  std::memcpy(&user,
+              memory.data() + ring.cqOffset() +
+                  (index & (ring.completions() - 1)) * OpRing::COMPLETION_SIZE,
+              4);
+  return user;
+}
+
+static void layout() {
+  CHECK(OpRing::entryCount(0) == 1 && OpRing::entryCount(5) == 8);
+  CHECK(OpRing::entryCount(1 << 20) == OpRing::MAX_ENTRIES);
+
+  std::vector<uint8_t> memory(OpRing::byteLength(5, 100));
+  OpRing ring(memory.data(), 5, 100);
+  CHECK(ring.entries() == 8 && ring.completions() == 16);
+  CHECK(ring.sqOffset() == OpRing::HEADER_SIZE);
+  CHECK(ring.dataOffset() + 100 == memory.size());
+  CHECK(ring.data(90, 10) && !ring.data(91, 10));
+  CHECK(!ring.data(0xffffffff, 2));
+}
+
+static void submissions() {
+  std::vector<uint8_t> memory(OpRing::byteLength(8, 100));
+  OpRing ring(memory.data(), 8, 100);
+  for (uint32_t i = 0; i < 3; i++) {
+    uint8_t *entry = memory.data() + ring.sqOffset() + i * OpRing::ENTRY_SIZE;
+    const uint16_t handle = static_cast<uint16_t>(i);
+    const uint32_t user = 100 + i;
+    const uint32_t offset = i * 10;
+    const uint32_t length = 10;
+    std::memcpy(entry, &handle, 2);
+    entry[2] = 1;
+    entry[3] = 0;
+    std::memcpy(entry + 4, &user, 4);
+    std::memcpy(entry + 8, &offset, 4);
+    std::memcpy(entry + 12, &length, 4);
+  }
+  counter(memory, OpRing::SQ_TAIL).store(3);
+
+  std::vector<RingEntry> entries;
+  CHECK(ring.consume(entries) == 3);
+  CHECK(entries[0].opcode == 1 && entries[1].handle == 1);
+  CHECK(entries[2].user == 102 && entries[2].offset == 20);
+  CHECK(counter(memory, OpRing::SQ_HEAD).load() == 3);
+  CHECK(ring.consume(entries) == 0 && entries.size() == 3);
+}
+
+static void completions() {
+  std::vector<uint8_t> memory(OpRing::byteLength(8, 0));
+  OpRing ring(memory.data(), 8, 0);
+  auto &head = counter(memory, OpRing::CQ_HEAD);
+  auto &tail = counter(memory, OpRing::CQ_TAIL);
+
+  // Sixteen fit; the rest are held.
+  for (uint32_t i = 0; i < 20; i++) {
+    CHECK(ring.complete({i, -1, i, 0}) == (i < 16));
+  }
+  CHECK(tail.load() == 16);
+  auto stats = ring.stats();
+  CHECK(stats.pending == 4 && stats.overflowed == 4 && stats.dropped == 0);
+  int32_t result;
+  std::memcpy(&result, memory.data() + ring.cqOffset() + 4, 4);
+  CHECK(result == -1);
+
+  // Held completions go out in order once there is room.
+  head.store(10);
+  CHECK(ring.flush() == 4 && tail.load() == 20);
+  CHECK(completionUser(memory, ring, 19) == 19);
+
+  // Up to another ring's worth is held, and the rest dropped.
+  for (uint32_t i = 0; i < 40; i++) {
+    ring.complete({i, 0, 0, 0});
+  }
+  stats = ring.stats();
+  CHECK(stats.pending == 16 && stats.dropped == 18);
+}
+
+// A thread completing operations against a consumer freeing the ring.
+static void threaded() {
+  std::vector<uint8_t> memory(OpRing::byteLength(64, 0));
+  OpRing ring(memory.data(), 64, 0);
+  auto &head = counter(memory, OpRing::CQ_HEAD);
+  auto &tail = counter(memory, OpRing::CQ_TAIL);
+  const uint32_t count = 100000;
+
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < count; i++) {
+      while (ring.stats().pending >= 64) {
+        std::this_thread::yield();
+      }
+      ring.complete({i, 0, 0, 0});
+    }
+  });
+
+  uint32_t next = 0;
+  while (next < count) {
+    ring.flush();
+    const uint32_t end = tail.load(std::memory_order_acquire);
+    uint32_t position = head.load();
+    for (; position != end; position++) {
+      CHECK(completionUser(memory, ring, position) == next);
+      next++;
+    }
+    head.store(position, std::memory_order_release);
+  }
+  producer.join();
+  CHECK(ring.stats().dropped == 0);
+}
+
+int main() {
+  layout();
+  submissions();
+  completions();
+  threaded();
+  return 0;
+}
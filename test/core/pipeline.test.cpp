@@ -0,0 +1,120 @@
+#include "check.h"
+#include "pipeline.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Copies the payload, failing on a leading 0xff.
+static bool copy(const uint8_t *data, size_t length,
+                 std::vector<uint8_t> &out) {
+  out.assign(data, data + length);
+  return length == 0 || data[0] != 0xff;
+}
+
+static bool waitFor(const std::function<bool()> &predicate) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!predicate() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return predicate();
+}
+
+static void ordered() {
+  ThreadPool pool(4);
+  std::vector<uint8_t> outputs;
+  std::vector<uint64_t> timestamps;
+  // Earlier packets take longer, so they finish out of order.
+  const Transform slow = [](const uint8_t *data, size_t length,
+                            std::vector<uint8_t> &out) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20 - data[0]));
+    return copy(data, length, out);
+  };
+  auto pipeline = std::make_shared<OrderedPipeline>(
+      slow,
+      [&](const uint8_t *data, size_t length, uint64_t timestamp) {
+        outputs.push_back(data[0]);
+        timestamps.push_back(timestamp);
+      },
+      &pool);
+
+  for (uint8_t i = 0; i < 16; i++) {
+    pipeline->submit(&i, 1, 100 + i);
+  }
+  CHECK(waitFor([&] { return pipeline->stats().delivered == 16; }));
+  for (uint8_t i = 0; i < 16; i++) {
+    CHECK(outputs[i] == i && timestamps[i] == 100u + i);
+  }
+}
+
+static void inlineFailures() {
+  std::vector<uint8_t> outputs;
+  auto pipeline = std::make_shared<OrderedPipeline>(
+      copy,
+      [&](const uint8_t *data, size_t length, uint64_t) {
+        outputs.push_back(data[0]);
+      },
+      nullptr);
+
+  // Without a pool the output runs before submit() returns, and failed
+  // packets are skipped without holding up later ones.
+  const uint8_t packets[3] = {1, 0xff, 2};
+  for (const uint8_t &packet : packets) {
+    pipeline->submit(&packet, 1);
+  }
+  CHECK((outputs == std::vector<uint8_t>{1, 2}));
+  const PipelineStats stats = pipeline->stats();
+  CHECK(stats.submitted == 3 && stats.delivered == 2 && stats.failed == 1);
+}
+
+static void backlog() {
+  ThreadPool pool(1);
+  std::atomic<bool> release{false};
+  const Transform blocked = [&](const uint8_t *data, size_t length,
+                                std::vector<uint8_t> &out) {
+    while (!release) {
+      std::this_thread::yield();
+    }
+    return copy(data, length, out);
+  };
+  auto pipeline = std::make_shared<OrderedPipeline>(
+      blocked, [](const uint8_t *, size_t, uint64_t) {}, &pool, 2);
+
+  // Packets beyond maxInFlight are dropped until the backlog clears.
+  const uint8_t packet = 0;
+  for (int i = 0; i < 5; i++) {
+    pipeline->submit(&packet, 1);
+  }
+  CHECK(pipeline->stats().dropped == 3);
+  release = true;
+  CHECK(waitFor([&] { return pipeline->stats().delivered == 2; }));
+  pipeline->submit(&packet, 1);
+  CHECK(waitFor([&] { return pipeline->stats().delivered == 3; }));
+}
+
+static void compose() {
+  const Transform twice = composeTransforms(
+      copy, [](const uint8_t *data, size_t length, std::vector<uint8_t> &out) {
+        out.assign(data, data + length);
+        out.insert(out.end(), data, data + length);
+        return true;
+      });
+  const uint8_t data[2] = {1, 2};
+  std::vector<uint8_t> out;
+  CHECK(twice(data, sizeof(data), out));
+  CHECK((out == std::vector<uint8_t>{1, 2, 1, 2}));
+
+  // A failing first transform stops the chain.
+  const uint8_t bad[1] = {0xff};
+  CHECK(!twice(bad, sizeof(bad), out));
+}
+
+int main() {
+  ordered();
+  inlineFailures();
+  backlog();
+  compose();
+  return 0;
+}
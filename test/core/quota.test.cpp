@@ -0,0 +1,82 @@
+#include "check.h"
+#include "gatt.h"
+#include "quota.h"
+#include "recorder.h"
+#include "scheduler.h"
+
+#include <vector>
+
+static void defaults() {
+  const PeripheralQuota original = PeripheralQuota::defaults();
+  CHECK(original.queuedBytes == 0 && original.gattBytes == 0);
+  CHECK(original.history == 256 && original.subscriptions == 0);
+
+  PeripheralQuota quota;
+  quota.queuedBytes = 4096;
+  quota.subscriptions = 2;
+  PeripheralQuota::setDefaults(quota);
+  CHECK(PeripheralQuota::defaults().queuedBytes == 4096);
+  CHECK(PeripheralQuota::defaults().subscriptions == 2);
+  PeripheralQuota::setDefaults(original);
+}
+
+static void byteLimit() {
+  FairScheduler scheduler;
+  CHECK(!scheduler.setByteLimit(1, 100));
+  scheduler.addFlow(1);
+  CHECK(scheduler.setByteLimit(1, 100));
+
+  const uint8_t data[60] = {0};
+  CHECK(scheduler.enqueue(1, 1, data, 60));
+  CHECK(!scheduler.enqueue(1, 1, data, 60));
+  CHECK(scheduler.enqueue(1, 1, data, 40));
+
+  FlowStats stats;
+  CHECK(scheduler.stats(1, stats));
+  CHECK(stats.queuedBytes == 100 && stats.dropped == 1);
+
+  // Delivering frees the bytes for new arrivals.
+  std::vector<ScheduledPacket> out;
+  CHECK(scheduler.dequeue(10, out) == 2);
+  CHECK(scheduler.stats(1, stats) && stats.queuedBytes == 0);
+  CHECK(scheduler.enqueue(1, 1, data, 60));
+}
+
+static void history() {
+  FlightRecorder recorder(256);
+  for (int i = 0; i < 300; i++) {
+    recorder.record(RecorderEventType::Read);
+  }
+  CHECK(recorder.snapshot().size() == 256);
+
+  // Shrinking rounds down to a power of two, and the ring then wraps at it.
+  CHECK(recorder.setCapacity(100) == 64);
+  CHECK(recorder.capacity() == 64);
+  CHECK(recorder.snapshot().size() <= 64);
+  for (int i = 0; i < 100; i++) {
+    recorder.record(RecorderEventType::WriteRequest);
+  }
+  const std::vector<RecorderEvent> events = recorder.snapshot();
+  CHECK(events.size() == 64);
+  CHECK(events.back().type ==
+        static_cast<uint16_t>(RecorderEventType::WriteRequest));
+
+  // Growing is bounded by the ring allocated up front.
+  CHECK(recorder.setCapacity(1024) == 256);
+}
+
+static void tableSize() {
+  GattDatabase database(1);
+  database[0].uuid = "0000180f-0000-1000-8000-00805f9b34fb";
+  const size_t empty = gattSize(database);
+  database[0].characteristics.resize(3);
+  CHECK(gattSize(database) > empty);
+}
+
+int main() {
+  defaults();
+  byteLimit();
+  history();
+  tableSize();
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include "check.h"
+#include "clock.h"
+#include "recorder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static void events() {
+  Clock::setVirtual(true, 5000);
+  FlightRecorder recorder(4);
+  recorder.record(RecorderEventType::Connect);
+  const uint64_t start = FlightRecorder::timestamp();
+  Clock::advance(3000);
+  recorder.record(RecorderEventType::Read,
+                  "0000fff1-0000-1000-8000-00805f9b34fb", 20, -1, start);
+
+  std::vector<RecorderEvent> events = recorder.snapshot();
+  CHECK(events.size() == 2);
+  CHECK(events[0].type == static_cast<uint16_t>(RecorderEventType::Connect));
+  CHECK(events[0].timestamp == 5000 && events[0].duration == 0);
+  // The tag is the UUID's leading 32 bits, the duration in microseconds.
+  CHECK(events[1].tag == 0x0000fff1 && events[1].length == 20);
+  CHECK(events[1].status == -1 && events[1].duration == 3);
+  Clock::setVirtual(false);
+
+  // The ring keeps the most recent events, oldest first.
+  for (uint32_t i = 0; i < 10; i++) {
+    recorder.record(RecorderEventType::Notify, nullptr, i);
+  }
+  events = recorder.snapshot();
+  CHECK(events.size() == 4);
+  for (uint32_t i = 0; i < 4; i++) {
+    CHECK(events[i].length == 6 + i);
+  }
+}
+
+static void concurrentWriters() {
+  FlightRecorder recorder(64);
+  std::vector<std::thread> writers;
+  for (uint32_t id = 1; id <= 4; id++) {
+    writers.emplace_back([&recorder, id] {
+      for (int i = 0; i < 10000; i++) {
+        recorder.record(RecorderEventType::Notify, nullptr, id, id);
+      }
+    });
+  }
+
+  // Readers racing the writers never see a torn record.
+  for (int i = 0; i < 100; i++) {
+    for (const auto &event : recorder.snapshot()) {
+      CHECK(event.length == static_cast<uint32_t>(event.status));
+    }
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  CHECK(recorder.snapshot().size() == 64);
+}
+
+static void dump() {
+  const char *path = "recorder.wbfr";
+  FlightRecorder recorder;
+  recorder.record(RecorderEventType::Connect);
+  recorder.record(RecorderEventType::Disconnect);
+  CHECK(recorder.dump(path, "AA:BB:CC:DD:EE:FF"));
+
+  FILE *file = std::fopen(path, "rb");
+  CHECK(file != nullptr);
+  RecorderHeader header;
+  RecorderEvent events[2];
+  CHECK(std::fread(&header, sizeof(header), 1, file) == 1);
+  CHECK(std::fread(events, sizeof(RecorderEvent), 2, file) == 2);
+  std::fclose(file);
+  std::remove(path);
+
+  CHECK(std::memcmp(header.magic, "WBFR", 4) == 0 && header.version == 1);
+  CHECK(header.recordSize == sizeof(RecorderEvent) && header.count == 2);
+  CHECK(std::strcmp(header.address, "AA:BB:CC:DD:EE:FF") == 0);
+  CHECK(events[1].type ==
+        static_cast<uint16_t>(RecorderEventType::Disconnect));
+
+  // Addresses become file names; no directory disables automatic dumps.
+  CHECK(FlightRecorder::dumpPath("AA:BB").empty());
+  FlightRecorder::setDumpDirectory("logs");
+  CHECK(FlightRecorder::dumpPath("AA:BB") == "logs/AA-BB.wbfr");
+  FlightRecorder::setDumpDirectory("");
+}
+
+static void dumpInterval() {
+  Clock::setVirtual(true, 1);
+  FlightRecorder recorder;
+  // The path is not writable, so nothing lands on disk.
+  CHECK(recorder.dumpInBackground("missing/first.wbfr", ""));
+  CHECK(!recorder.dumpInBackground("missing/second.wbfr", ""));
+  Clock::advance(FlightRecorder::DUMP_INTERVAL);
+  CHECK(recorder.dumpInBackground("missing/third.wbfr", ""));
+  Clock::setVirtual(false);
+}
+
+int main() {
+  events();
+  concurrentWriters();
+  dump();
+  dumpInterval();
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include "check.h"
+#include "scanfilter.h"
+
+static const char *ENVIRONMENTAL = "0000181a-0000-1000-8000-00805f9b34fb";
+
+static Advertisement thermometer() {
+  Advertisement out;
+  out.identifier = "Thermo 12";
+  out.address = "AA:BB:CC:DD:EE:FF";
+  out.manufacturerData.push_back({0x0059, {0x01, 0x02, 0x03}});
+  out.serviceData.push_back({ENVIRONMENTAL, {0x10, 0x20}});
+  return out;
+}
+
+static void dataPrefix() {
+  const std::vector<uint8_t> data = {0x01, 0x02, 0x03};
+  CHECK((DataPrefix{{}, {}}).matches(data));
+  CHECK((DataPrefix{{0x01, 0x02}, {}}).matches(data));
+  CHECK(!(DataPrefix{{0x01, 0x03}, {}}).matches(data));
+  // Only the bits set in the mask count; missing mask bytes are 0xff.
+  CHECK((DataPrefix{{0x01, 0xf2}, {0xff, 0x0f}}).matches(data));
+  CHECK(!(DataPrefix{{0x01, 0x02, 0x03, 0x04}, {}}).matches(data));
+}
+
+static void clauses() {
+  const auto advertisement = thermometer();
+
+  ScanFilterClause name;
+  name.matchName = true;
+  name.name = "Thermo 12";
+  CHECK(name.matches(advertisement));
+  name.name = "Thermo";
+  CHECK(!name.matches(advertisement));
+
+  ScanFilterClause prefix;
+  prefix.namePrefix = "Thermo";
+  CHECK(prefix.matches(advertisement));
+
+  ScanFilterClause manufacturer;
+  manufacturer.manufacturerData.push_back({0x0059, {{0x01}, {}}});
+  CHECK(manufacturer.matches(advertisement));
+  manufacturer.manufacturerData[0].first = 0x004c;
+  CHECK(!manufacturer.matches(advertisement));
+
+  ScanFilterClause service;
+  service.services.push_back(ENVIRONMENTAL);
+  service.serviceData.push_back({ENVIRONMENTAL, {{0x10}, {}}});
+  CHECK(service.matches(advertisement));
+
+  // Every part that is set must match.
+  service.matchName = true;
+  service.name = "other";
+  CHECK(!service.matches(advertisement));
+}
+
+static void filter() {
+  const auto advertisement = thermometer();
+
+  ScanFilter filter;
+  CHECK(filter.empty() && filter.matches(advertisement));
+
+  ScanFilterClause other;
+  other.namePrefix = "Scale";
+  filter.add(other);
+  CHECK(!filter.empty() && !filter.matches(advertisement));
+
+  // Any clause may match.
+  ScanFilterClause prefix;
+  prefix.namePrefix = "Thermo";
+  filter.add(prefix);
+  CHECK(filter.matches(advertisement));
+
+  // Addresses restrict matches on top of the clauses.
+  filter.addAddress("11:22:33:44:55:66");
+  CHECK(filter.addressCount() == 1 && !filter.matches(advertisement));
+  filter.addAddress(advertisement.address);
+  CHECK(filter.matches(advertisement));
+}
+
+int main() {
+  dataPrefix();
+  clauses();
+  filter();
+  return 0;
+}
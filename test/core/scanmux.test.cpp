@@ -0,0 +1,75 @@
+#include "check.h"
+#include "clock.h"
+#include "scanmux.h"
+
+static std::shared_ptr<const Advertisement> sighting(const char *address) {
+  auto out = std::make_shared<Advertisement>();
+  out->address = address;
+  return out;
+}
+
+static void sessions() {
+  ScanMultiplexer multiplexer;
+  int found = 0;
+  int all = 0;
+  int done = -1;
+  int quiet = -1;
+
+  // Each address once, until both have been seen.
+  ScanFilter addresses;
+  addresses.addAddress("1");
+  addresses.addAddress("3");
+  ScanMultiplexer::Options first;
+  first.done = [&](bool complete) { done = complete; };
+  const uint32_t a = multiplexer.open(addresses, first,
+                                      [&](auto &, auto &) { found++; });
+
+  // Everything, until 100 ns pass without a new device.
+  ScanMultiplexer::Options second;
+  second.duplicates = true;
+  second.quietPeriod = 100;
+  second.done = [&](bool complete) { quiet = complete; };
+  const uint32_t b =
+      multiplexer.open(ScanFilter(), second, [&](auto &, auto &) { all++; });
+  CHECK(a != b && multiplexer.size() == 2);
+
+  CHECK(multiplexer.dispatch(sighting("1"), nullptr) == 2);
+  CHECK(multiplexer.dispatch(sighting("2"), nullptr) == 1);
+  Clock::advance(60);
+  multiplexer.dispatch(sighting("2"), nullptr);
+  multiplexer.dispatch(sighting("4"), nullptr);
+  // The quiet period restarts with each new device, not with repeats.
+  Clock::advance(60);
+  CHECK(quiet == -1);
+  Clock::advance(50);
+  CHECK(quiet == 0);
+
+  CHECK(multiplexer.dispatch(sighting("1"), nullptr, a) == 0);
+  CHECK(done == -1);
+  multiplexer.dispatch(sighting("3"), nullptr);
+  CHECK(done == 1 && found == 2 && all == 5);
+
+  bool last = false;
+  CHECK(multiplexer.close(a, last) && !last);
+  CHECK(!multiplexer.close(a, last));
+  CHECK(multiplexer.close(b, last) && last);
+}
+
+static void destroyed() {
+  // Quiet timers outlive the multiplexer without calling back.
+  {
+    ScanMultiplexer multiplexer;
+    ScanMultiplexer::Options options;
+    options.quietPeriod = 10;
+    options.done = [](bool) { CHECK(false); };
+    multiplexer.open(ScanFilter(), options, [](auto &, auto &) {});
+  }
+  Clock::advance(100);
+}
+
+int main() {
+  Clock::setVirtual(true, 1000);
+  sessions();
+  destroyed();
+  return 0;
+}
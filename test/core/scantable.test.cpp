@@ -0,0 +1,133 @@
+#include "check.h"
+#include "scantable.h"
+
+static std::shared_ptr<const Advertisement>
+advertisement(const char *address, const std::string &identifier,
+              int16_t rssi = -50, bool connectable = true) {
+  auto out = std::make_shared<Advertisement>();
+  out->address = address;
+  out->identifier = identifier;
+  out->rssi = rssi;
+  out->connectable = connectable;
+  return out;
+}
+
+static std::string json(const ScanTable &table, const ScanQuery &query,
+                        uint64_t now = 0) {
+  std::string out;
+  table.toJson(query, now, out);
+  return out;
+}
+
+static void serialize() {
+  ScanTable table;
+  auto first = std::make_shared<Advertisement>(*advertisement("B", "beacon"));
+  first->manufacturerData.emplace_back(76, std::vector<uint8_t>{0x02, 0xab});
+  first->serviceData.emplace_back("180f", std::vector<uint8_t>{0x64});
+  table.update(first, 1000000);
+  table.update(first, 3500000);
+  table.update(advertisement("A", "tag", -80, false), 2000000);
+
+  ScanQuery query;
+  query.fields = ScanQuery::Address | ScanQuery::ManufacturerData |
+                 ScanQuery::ServiceData | ScanQuery::FirstSeen |
+                 ScanQuery::LastSeen | ScanQuery::Sightings;
+  // Ordered by address, data in hex and times in milliseconds.
+  CHECK(json(table, query) ==
+        "[{\"address\":\"A\",\"manufacturerData\":{},\"serviceData\":{},"
+        "\"firstSeen\":2.000,\"lastSeen\":2.000,\"sightings\":1},"
+        "{\"address\":\"B\",\"manufacturerData\":{\"76\":\"02ab\"},"
+        "\"serviceData\":{\"180f\":\"64\"},\"firstSeen\":1.000,"
+        "\"lastSeen\":3.500,\"sightings\":2}]");
+
+  query.fields = ScanQuery::Rssi | ScanQuery::Connectable;
+  query.limit = 1;
+  CHECK(json(table, query) == "[{\"rssi\":-80,\"connectable\":false}]");
+
+  ScanQuery::Field field;
+  CHECK(ScanQuery::parseField("txPower", field) &&
+        field == ScanQuery::TxPower);
+  CHECK(!ScanQuery::parseField("name", field));
+}
+
+static void escaping() {
+  ScanTable table;
+  // Quotes, backslashes and control characters are escaped, UTF-8 passes
+  // through and other bytes are escaped as Latin-1.
+  table.update(advertisement("A", "a\"b\\c\n\x01"), 0);
+  table.update(advertisement("B", "caf\xc3\xa9"), 0);
+  table.update(advertisement("C", "\xe9t\xc3"), 0);
+  // Overlong encodings and surrogates are not UTF-8 either.
+  table.update(advertisement("D", "\xc0\xaf\xed\xa0\x80"), 0);
+
+  ScanQuery query;
+  query.fields = ScanQuery::Identifier;
+  CHECK(json(table, query) ==
+        "[{\"identifier\":\"a\\\"b\\\\c\\n\\u0001\"},"
+        "{\"identifier\":\"caf\xc3\xa9\"},"
+        "{\"identifier\":\"\\u00e9t\\u00c3\"},"
+        "{\"identifier\":\"\\u00c0\\u00af\\u00ed\\u00a0\\u0080\"}]");
+}
+
+static void filters() {
+  ScanTable table;
+  auto heart = std::make_shared<Advertisement>(*advertisement("A", "hr-1"));
+  heart->serviceData.emplace_back("180d", std::vector<uint8_t>());
+  auto beacon = std::make_shared<Advertisement>(
+      *advertisement("B", "beacon", -90, false));
+  beacon->manufacturerData.emplace_back(76, std::vector<uint8_t>());
+  table.update(heart, 1000);
+  table.update(beacon, 5000);
+
+  ScanQuery query;
+  query.fields = ScanQuery::Address;
+  CHECK(json(table, query) == "[{\"address\":\"A\"},{\"address\":\"B\"}]");
+
+  const std::string onlyA = "[{\"address\":\"A\"}]";
+  const std::string onlyB = "[{\"address\":\"B\"}]";
+  ScanQuery filtered = query;
+  filtered.minRssi = -60;
+  CHECK(json(table, filtered) == onlyA);
+  filtered = query;
+  filtered.connectableOnly = true;
+  CHECK(json(table, filtered) == onlyA);
+  filtered = query;
+  filtered.identifierPrefix = "hr-";
+  CHECK(json(table, filtered) == onlyA);
+  filtered = query;
+  filtered.service = "180d";
+  CHECK(json(table, filtered) == onlyA);
+  filtered = query;
+  filtered.company = 76;
+  CHECK(json(table, filtered) == onlyB);
+  filtered = query;
+  filtered.maxAge = 2000;
+  CHECK(json(table, filtered, 6000) == onlyB);
+}
+
+static void eviction() {
+  ScanTable table;
+  for (size_t i = 0; i <= ScanTable::MAX_ENTRIES; i++) {
+    const std::string address = std::to_string(i);
+    table.update(advertisement(address.c_str(), ""), i);
+  }
+  // The least recently seen quarter goes at once.
+  CHECK(table.size() == ScanTable::MAX_ENTRIES * 3 / 4);
+  ScanQuery query;
+  query.fields = ScanQuery::Address;
+  query.maxAge = 1;
+  const size_t last = ScanTable::MAX_ENTRIES;
+  CHECK(json(table, query, last) ==
+        "[{\"address\":\"" + std::to_string(last - 1) +
+            "\"},{\"address\":\"" + std::to_string(last) + "\"}]");
+  table.clear();
+  CHECK(table.size() == 0 && json(table, query) == "[]");
+}
+
+int main() {
+  serialize();
+  escaping();
+  filters();
+  eviction();
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include "check.h"
+#include "scheduler.h"
+
+#include <vector>
+
+static const uint8_t PAYLOAD[20] = {0};
+
+// A flooding flow delivers at most its packet budget before a quiet flow
+// gets its turn.
+static void fairness() {
+  FairScheduler scheduler;
+  scheduler.addFlow(1);
+  scheduler.addFlow(2);
+  FlowBudget budget;
+  budget.packets = 4;
+  CHECK(scheduler.setBudget(1, budget));
+  CHECK(!scheduler.setBudget(3, budget));
+
+  for (uint32_t i = 0; i < 100; i++) {
+    CHECK(scheduler.enqueue(1, i, PAYLOAD, sizeof(PAYLOAD)));
+  }
+  CHECK(scheduler.enqueue(2, 1000, PAYLOAD, sizeof(PAYLOAD)));
+  CHECK(!scheduler.enqueue(3, 0, PAYLOAD, sizeof(PAYLOAD)));
+
+  std::vector<ScheduledPacket> out;
+  CHECK(scheduler.dequeue(8, out) == 8);
+  CHECK(out[0].flow == 1 && out[3].flow == 1 && out[3].target == 3);
+  CHECK(out[4].flow == 2 && out[4].target == 1000);
+  CHECK(out[5].flow == 1 && out[5].target == 4);
+
+  FlowStats stats;
+  CHECK(scheduler.stats(1, stats));
+  CHECK(stats.enqueued == 100 && stats.delivered == 7 && stats.queued == 93);
+  CHECK(stats.throttled >= 1);
+}
+
+static void queueLimit() {
+  FairScheduler scheduler;
+  scheduler.addFlow(1);
+  FlowBudget budget;
+  budget.queueLimit = 2;
+  scheduler.setBudget(1, budget);
+  CHECK(scheduler.enqueue(1, 0, PAYLOAD, sizeof(PAYLOAD)));
+  CHECK(scheduler.enqueue(1, 0, PAYLOAD, sizeof(PAYLOAD)));
+  CHECK(!scheduler.enqueue(1, 0, PAYLOAD, sizeof(PAYLOAD)));
+
+  FlowStats stats;
+  CHECK(scheduler.stats(1, stats) && stats.dropped == 1 && stats.queued == 2);
+}
+
+// Packets handed back go to the head of their flows, ahead of the limits.
+static void requeue() {
+  FairScheduler scheduler;
+  scheduler.addFlow(1);
+  scheduler.addFlow(2);
+  FlowBudget budget;
+  budget.queueLimit = 2;
+  scheduler.setBudget(1, budget);
+  for (uint32_t i = 0; i < 2; i++) {
+    scheduler.enqueue(1, i, PAYLOAD, sizeof(PAYLOAD));
+  }
+  scheduler.enqueue(2, 10, PAYLOAD, sizeof(PAYLOAD));
+
+  std::vector<ScheduledPacket> out;
+  CHECK(scheduler.dequeue(3, out) == 3);
+  scheduler.enqueue(1, 2, PAYLOAD, sizeof(PAYLOAD));
+  scheduler.removeFlow(2);
+  scheduler.requeue(std::move(out));
+
+  FlowStats stats;
+  CHECK(scheduler.stats(1, stats) && stats.queued == 3 && stats.delivered == 0);
+  std::vector<ScheduledPacket> again;
+  CHECK(scheduler.dequeue(10, again) == 3);
+  CHECK(again[0].target == 0 && again[1].target == 1 && again[2].target == 2);
+  CHECK(scheduler.empty());
+}
+
+int main() {
+  fairness();
+  queueLimit();
+  requeue();
+  return 0;
+}
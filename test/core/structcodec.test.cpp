@@ -0,0 +1,102 @@
+#include "check.h"
+#include "structcodec.h"
+
+#include <cmath>
+#include <cstring>
+
+static FieldSpec field(const char *name, FieldType type) {
+  FieldSpec out;
+  out.name = name;
+  out.type = type;
+  return out;
+}
+
+static std::vector<FieldSpec> sensorRecord() {
+  std::vector<FieldSpec> fields = {
+      field("seq", FieldType::U16),   field("temp", FieldType::I16),
+      field("flags", FieldType::U8),  field("mode", FieldType::I8),
+      field("", FieldType::Pad),      field("acc", FieldType::I16),
+      field("pressure", FieldType::F32)};
+  fields[1].scale = 0.01;
+  fields[2].bits = 3;
+  fields[3].bits = 5;
+  fields[5].count = 3;
+  fields[5].bigEndian = true;
+  return fields;
+}
+
+static void roundTrip() {
+  StructCodec codec;
+  std::string error;
+  CHECK(StructCodec::compile(sensorRecord(), codec, error));
+  CHECK(codec.size() == 16 && codec.width() == 8);
+  // Padding has no column.
+  CHECK(codec.columns().size() == 6);
+  CHECK(codec.columns()[4].name == "acc" && codec.columns()[4].index == 4 &&
+        codec.columns()[4].count == 3);
+  CHECK(codec.columns()[1].scaled && !codec.columns()[0].scaled);
+
+  // The bitfields share one byte, flags in the low three bits.
+  uint8_t record[16] = {0x34, 0x12, 0x9c, 0xff, 5 | 0x1e << 3, 0xaa,
+                        0x00, 0x01, 0xff, 0xfe, 0x7f, 0xff,
+                        0x00, 0x00, 0x80, 0x3f};
+  double values[8];
+  codec.decode(record, values);
+  CHECK(values[0] == 0x1234 && std::fabs(values[1] + 1) < 1e-9);
+  CHECK(values[2] == 5 && values[3] == -2);
+  CHECK(values[4] == 1 && values[5] == -2 && values[6] == 32767);
+  CHECK(values[7] == 1.0);
+
+  // Padding encodes as zeros.
+  uint8_t encoded[16];
+  codec.encode(values, encoded);
+  record[5] = 0;
+  CHECK(std::memcmp(encoded, record, sizeof(record)) == 0);
+
+  // Integers saturate to their field's range.
+  const double extremes[8] = {1e9, -1e9, 9, -100, 0, 0, 0, NAN};
+  codec.encode(extremes, encoded);
+  codec.decode(encoded, values);
+  CHECK(values[0] == 65535 && std::fabs(values[1] + 327.68) < 1e-9);
+  CHECK(values[2] == 7 && values[3] == -16);
+  CHECK(std::isnan(values[7]));
+}
+
+static void records() {
+  StructCodec codec;
+  std::string error;
+  CHECK(StructCodec::compile(sensorRecord(), codec, error));
+
+  std::vector<double> out;
+  const uint8_t data[40] = {};
+  CHECK(codec.decode(data, sizeof(data), out, 20) == 2 && out.size() == 16);
+  CHECK(codec.decode(data, 15, out) == 0 && out.size() == 16);
+
+  std::vector<FieldSpec> wide = {field("x", FieldType::I64)};
+  CHECK(StructCodec::compile(wide, codec, error));
+  double value = -1e30;
+  uint8_t bytes[8];
+  codec.encode(&value, bytes);
+  codec.decode(bytes, &value);
+  CHECK(value == -9223372036854775808.0);
+}
+
+static void invalid() {
+  StructCodec codec;
+  std::string error;
+  // Bitfields cannot be arrays.
+  auto fields = sensorRecord();
+  fields[2].count = 2;
+  CHECK(!StructCodec::compile(fields, codec, error) && !error.empty());
+
+  fields = sensorRecord();
+  fields[2].bits = 9;
+  CHECK(!StructCodec::compile(fields, codec, error));
+}
+
+int main() {
+  roundTrip();
+  records();
+  invalid();
+  return 0;
+}
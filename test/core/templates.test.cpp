@@ -0,0 +1,79 @@
+#include "check.h"
+#include "templates.h"
+
+static GattCharacteristic characteristic(const char *uuid, bool read = false) {
+  GattCharacteristic out;
+  out.uuid = uuid;
+  out.canRead = read;
+  return out;
+}
+
+static GattService service(const char *uuid,
+                           std::vector<GattCharacteristic> characteristics) {
+  GattService out;
+  out.uuid = uuid;
+  out.characteristics = std::move(characteristics);
+  return out;
+}
+
+static void intern() {
+  GattDatabase a = {service("s1", {characteristic("c1", true)})};
+  GattDatabase b = a;
+  b[0].data = {1, 2, 3};
+
+  // Service data is per device and stays out of the shared template.
+  const auto first = GattTemplateRegistry::intern(a);
+  const auto second = GattTemplateRegistry::intern(b);
+  CHECK(first == second && (*first)[0].data.empty());
+
+  b[0].characteristics[0].canRead = false;
+  CHECK(GattTemplateRegistry::intern(b) != first);
+}
+
+static void overlay() {
+  const GattTemplateStats before = GattTemplateRegistry::stats();
+  const GattDatabase model = {service("s2", {characteristic("c2")}),
+                              service("s3", {characteristic("c3")})};
+  const GattOverlay base = GattTemplateRegistry::overlay(model);
+  CHECK(base && base.services.empty());
+  CHECK(GattTemplateRegistry::overlay(model) == base);
+
+  // Another firmware of the model keeps only the service it changed.
+  GattDatabase firmware = model;
+  firmware[1].characteristics.push_back(characteristic("c4"));
+  const GattOverlay variant = GattTemplateRegistry::overlay(firmware);
+  CHECK(variant.base == base.base && variant.services.size() == 1);
+  CHECK(variant.services[0].first == 1);
+  CHECK(variant.materialize()[1].characteristics ==
+        firmware[1].characteristics);
+  CHECK(variant.service(0).uuid == "s2");
+  CHECK(variant != base && variant.footprint() > base.footprint());
+  CHECK(GattTemplateRegistry::overlay(firmware) == variant);
+
+  // Other services make another template.
+  const GattDatabase other = {service("s2", {characteristic("c2")})};
+  CHECK(GattTemplateRegistry::overlay(other).base != base.base);
+
+  const GattTemplateStats after = GattTemplateRegistry::stats();
+  CHECK(after.hits == before.hits + 1);
+  CHECK(after.misses == before.misses + 2);
+  CHECK(after.overlays == before.overlays + 2);
+}
+
+static void expiry() {
+  const size_t before = GattTemplateRegistry::stats().templates;
+  {
+    const auto gatt = GattTemplateRegistry::intern(
+        {service("s4", {characteristic("c5")})});
+    CHECK(GattTemplateRegistry::stats().templates == before + 1);
+  }
+  // Templates go away with their last device.
+  CHECK(GattTemplateRegistry::stats().templates == before);
+}
+
+int main() {
+  intern();
+  overlay();
+  expiry();
+  return 0;
+}
@@ -0,0 +1,332 @@
+const assert = require('assert');
+const simpleble = require('../dist/adapters/simpleble');
+const { SimplebleAdapter } = require('../dist/adapters/simpleble-adapter');
+
+// Exercises the native binding without a radio, through simulated
+// peripherals of createVirtualAdapter().
+
+const SERVICE = '0000fff0-0000-1000-8000-00805f9b34fb';
+const CHARACTERISTIC = '0000fff1-0000-1000-8000-00805f9b34fb';
+const PAYLOAD_SIZE = 20;
+
+const createAdapter = (options = {}) => simpleble.createVirtualAdapter({
+    count: 4,
+    connectLatency: { kind: 'fixed', a: 5 },
+    notifyInterval: 10,
+    payloadSize: PAYLOAD_SIZE,
+    seed: 1,
+    ...options
+});
+
+const waitFor = async (predicate, timeout = 5000) => {
+    const deadline = Date.now() + timeout;
+    while (!predicate() && Date.now() < deadline) {
+        await new Promise(resolve => setTimeout(resolve, 5));
+    }
+    return predicate();
+};
+
+const sequence = data => new DataView(data.buffer, data.byteOffset, data.byteLength).getUint32(0, true);
+
+describe('virtual adapter', () => {
+    let adapter;
+
+    beforeEach(() => {
+        adapter = createAdapter();
+    });
+
+    afterEach(() => {
+        for (const peripheral of adapter.peripherals) {
+            peripheral.disconnect();
+        }
+        adapter.release();
+    });
+
+    it('should find every peripheral in a scan', async () => {
+        const found = new Set();
+        adapter.setCallbackOnScanFound(peripheral => found.add(peripheral.address));
+        assert.equal(adapter.scanFor(0), true);
+        assert.equal(await waitFor(() => found.size === 4), true);
+        assert.deepEqual([...found].sort(), adapter.peripherals.map(peripheral => peripheral.address).sort());
+    });
+
+    it('should keep the scan running for open sessions', () => {
+        const session = adapter.openScanSession([], () => {});
+        assert.equal(adapter.scanStart(), true);
+        assert.equal(adapter.scanStop(), true);
+        assert.equal(adapter.active, true);
+
+        assert.equal(adapter.closeScanSession(session), true);
+        assert.equal(adapter.active, false);
+    });
+
+    it('should list no paired peripherals', async () => {
+        // Simulated devices never bond.
+        assert.deepEqual(adapter.pairedPeripherals, []);
+        assert.deepEqual(await adapter.getPairedPeripherals(), []);
+        assert.deepEqual(await adapter.getPairedPeripherals(true), []);
+        assert.throws(() => adapter.getPairedPeripherals('yes'), TypeError);
+    });
+
+    it('should connect on a match without a JS round trip', async () => {
+        const found = [];
+        adapter.setCallbackOnScanFound(peripheral => found.push(peripheral.identifier));
+        let match;
+        assert.equal(adapter.connectOnMatch([{ name: 'Virtual 2' }], (peripheral, connected) => {
+            match = { peripheral, connected };
+        }), true);
+        assert.equal(adapter.scanStart(), true);
+
+        assert.equal(await waitFor(() => match !== undefined), true);
+        assert.equal(match.connected, true);
+        assert.equal(match.peripheral.identifier, 'Virtual 2');
+        assert.equal(match.peripheral.connected, true);
+        // The match stopped the scan and was not reported as found.
+        assert.equal(adapter.active, false);
+        assert.equal(found.includes('Virtual 2'), false);
+        assert.equal(adapter.cancelConnectOnMatch(), false);
+    });
+
+    it('should cancel a connection on match', async () => {
+        let calls = 0;
+        adapter.connectOnMatch([{ name: 'none' }], () => calls++);
+        assert.equal(adapter.cancelConnectOnMatch(), true);
+        adapter.connectOnMatch([], () => calls++);
+        assert.equal(adapter.cancelConnectOnMatch(), true);
+
+        assert.equal(adapter.scanStart(), true);
+        await new Promise(resolve => setTimeout(resolve, 50));
+        assert.equal(calls, 0);
+        assert.equal(adapter.scanStop(), true);
+    });
+
+    it('should connect, discover and read', () => {
+        const peripheral = adapter.peripherals[0];
+        assert.equal(peripheral.connected, false);
+        assert.equal(peripheral.connect(), true);
+        assert.equal(peripheral.connected, true);
+
+        const service = peripheral.services.find(service => service.uuid === SERVICE);
+        assert.notEqual(service, undefined);
+        const characteristic = service.characteristics.find(characteristic => characteristic.uuid === CHARACTERISTIC);
+        assert.equal(characteristic.canRead && characteristic.canNotify, true);
+
+        const value = peripheral.read(SERVICE, CHARACTERISTIC);
+        assert.equal(value instanceof Uint8Array, true);
+        assert.equal(value.length, PAYLOAD_SIZE);
+
+        assert.equal(peripheral.disconnect(), true);
+        assert.equal(peripheral.connected, false);
+    });
+
+    it('should fail connections at the failure rate', () => {
+        const failing = createAdapter({ count: 1, failureRate: 1 });
+        assert.equal(failing.peripherals[0].connect(), false);
+        failing.release();
+    });
+
+    it('should notify in sequence', async () => {
+        const peripheral = adapter.peripherals[0];
+        peripheral.connect();
+        const received = [];
+        assert.equal(peripheral.notify(SERVICE, CHARACTERISTIC, data => received.push(data)), true);
+        assert.equal(await waitFor(() => received.length >= 3), true);
+        assert.equal(peripheral.unsubscribe(SERVICE, CHARACTERISTIC), true);
+
+        assert.equal(received[0].length, PAYLOAD_SIZE);
+        received.forEach((data, index) => assert.equal(sequence(data), index));
+    });
+
+    it('should merge notifications in a NotificationStream', async () => {
+        const records = [];
+        const stream = new simpleble.NotificationStream(batch => {
+            const view = new DataView(batch.buffer, batch.byteOffset, batch.byteLength);
+            for (let offset = 0; offset < batch.length;) {
+                const length = view.getUint16(offset + 10, true);
+                records.push({ timestamp: view.getBigUint64(offset, true), channel: view.getUint16(offset + 8, true), length });
+                offset += 12 + length;
+            }
+        }, { window: 20 });
+
+        const channels = adapter.peripherals.slice(0, 2).map(peripheral => {
+            peripheral.connect();
+            return stream.addChannel(peripheral, SERVICE, CHARACTERISTIC);
+        });
+        assert.notEqual(channels[0], channels[1]);
+        assert.equal(await waitFor(() => channels.every(channel => records.some(record => record.channel === channel))), true);
+        stream.close();
+
+        for (let i = 1; i < records.length; i++) {
+            assert.equal(records[i].timestamp >= records[i - 1].timestamp, true);
+        }
+        assert.equal(records.every(record => record.length === PAYLOAD_SIZE), true);
+        assert.equal(stream.stats.delivered >= records.length, true);
+    });
+
+    it('should complete reads through a GattRing', async () => {
+        const peripheral = adapter.peripherals[0];
+        peripheral.connect();
+
+        let completions = 0;
+        const ring = new simpleble.GattRing(() => completions++, { entries: 4, dataSize: 64 });
+        const { layout } = ring;
+        const counters = new Uint32Array(ring.buffer, 0, layout.cqTail / 4 + 1);
+        const view = new DataView(ring.buffer);
+
+        const handle = ring.register(peripheral, SERVICE, CHARACTERISTIC);
+        assert.equal(typeof handle, 'number');
+
+        const entry = layout.sqOffset;
+        view.setUint16(entry, handle, true);
+        view.setUint8(entry + 2, 0);
+        view.setUint8(entry + 3, 0);
+        view.setUint32(entry + 4, 42, true);
+        view.setUint32(entry + 8, 0, true);
+        view.setUint32(entry + 12, 32, true);
+        Atomics.store(counters, layout.sqTail / 4, 1);
+        assert.equal(ring.submit(), 1);
+
+        assert.equal(await waitFor(() => Atomics.load(counters, layout.cqTail / 4) === 1), true);
+        const completion = layout.cqOffset;
+        assert.equal(view.getUint32(completion, true), 42);
+        assert.equal(view.getInt32(completion + 4, true), 0);
+        assert.equal(view.getUint32(completion + 8, true), PAYLOAD_SIZE);
+        Atomics.store(counters, layout.cqHead / 4, 1);
+        assert.equal(await waitFor(() => completions > 0), true);
+        assert.equal(ring.stats.completed, 1);
+        ring.close();
+    });
+
+    it('should decode notifications with a Codec', async () => {
+        const codec = new simpleble.Codec([
+            { name: 'sequence', type: 'u32' },
+            { name: 'clock', type: 'u64' },
+            { type: 'pad', count: PAYLOAD_SIZE - 12 }
+        ]);
+        assert.equal(codec.size, PAYLOAD_SIZE);
+        assert.deepEqual(codec.decode(codec.encode({ sequence: 7, clock: 1000 })), { sequence: 7, clock: 1000 });
+        assert.throws(() => codec.decode(new Uint16Array(PAYLOAD_SIZE)), TypeError);
+
+        const peripheral = adapter.peripherals[0];
+        peripheral.connect();
+        const received = [];
+        peripheral.notify(SERVICE, CHARACTERISTIC, values => received.push(values), { decode: codec });
+        assert.equal(await waitFor(() => received.length >= 2), true);
+        peripheral.unsubscribe(SERVICE, CHARACTERISTIC);
+
+        assert.equal(received[0] instanceof Float64Array, true);
+        assert.equal(received[0][0], 0);
+        assert.equal(received[1][0], 1);
+        assert.equal(received[1][1] >= received[0][1], true);
+    });
+});
+
+describe('simpleble adapter', () => {
+    it('should start and stop scan sessions', async () => {
+        const native = createAdapter();
+        const adapter = new SimplebleAdapter(native);
+
+        const ids = [];
+        const session = await adapter.startScan([], device => ids.push(device.id));
+        assert.equal(typeof session, 'number');
+        assert.equal(await waitFor(() => ids.length === 4), true);
+        adapter.stopScan(session);
+        assert.throws(() => adapter.stopScan(session), /scan stop failed/);
+
+        // Devices found by a closed session can still be connected.
+        await adapter.connect(ids[0]);
+        const services = await adapter.discoverServices(ids[0]);
+        assert.equal(services.some(service => service.uuid === SERVICE), true);
+        await adapter.disconnect(ids[0]);
+        native.release();
+    });
+
+    it('should prune devices of closed sessions on the next scan', async () => {
+        const native = createAdapter();
+        const adapter = new SimplebleAdapter(native);
+
+        const ids = [];
+        const first = await adapter.startScan([], device => ids.push(device.id));
+        assert.equal(await waitFor(() => ids.length === 4), true);
+        adapter.stopScan(first);
+        await adapter.connect(ids[0]);
+
+        const second = await adapter.startScan([{ name: 'none' }], () => {});
+        adapter.stopScan(second);
+        await assert.rejects(adapter.connect(ids[1]), /Peripheral not found/);
+
+        // The connected device keeps its wrapper.
+        await adapter.disconnect(ids[0]);
+        native.release();
+    });
+});
+
+describe('string table', () => {
+    afterEach(() => {
+        simpleble.setStringTableCapacity(4096);
+    });
+
+    it('should intern addresses and evict past its capacity', () => {
+        const adapter = createAdapter();
+        const first = adapter.peripherals.map(peripheral => peripheral.address);
+        const before = simpleble.getStringTableStats();
+        const second = adapter.peripherals.map(peripheral => peripheral.address);
+        const after = simpleble.getStringTableStats();
+        assert.deepEqual(second, first);
+        assert.equal(after.hits - before.hits, 4);
+        assert.equal(after.misses, before.misses);
+
+        simpleble.setStringTableCapacity(2);
+        const bounded = simpleble.getStringTableStats();
+        assert.equal(bounded.capacity, 2);
+        assert.equal(bounded.size <= 2, true);
+        assert.equal(bounded.evictions > after.evictions, true);
+
+        // Without a table every string is created anew.
+        simpleble.setStringTableCapacity(0);
+        adapter.peripherals.forEach(peripheral => peripheral.address);
+        assert.equal(simpleble.getStringTableStats().size, 0);
+        adapter.release();
+    });
+});
+
+describe('virtual clock', () => {
+    afterEach(() => {
+        simpleble.setVirtualClock(false);
+    });
+
+    it('should only move when advanced', () => {
+        simpleble.setVirtualClock(true, 1000);
+        assert.equal(simpleble.getClockTime(), 1000);
+        simpleble.advanceClock(250);
+        assert.equal(simpleble.getClockTime(), 1250);
+    });
+
+    it('should reject times out of range', () => {
+        assert.throws(() => simpleble.setVirtualClock(true, -1), RangeError);
+        assert.throws(() => simpleble.setVirtualClock(true, NaN), RangeError);
+        assert.throws(() => simpleble.setVirtualClock(true, Infinity), RangeError);
+        simpleble.setVirtualClock(true, 1000);
+        assert.throws(() => simpleble.advanceClock(-1), RangeError);
+        assert.equal(simpleble.getClockTime(), 1000);
+    });
+
+    it('should step through connect latency and notify on virtual time', async () => {
+        simpleble.setVirtualClock(true, 1000);
+        const adapter = createAdapter({ count: 1 });
+        const peripheral = adapter.peripherals[0];
+        assert.equal(peripheral.connect(), true);
+        // Connecting stepped time to the end of the latency instead of sleeping.
+        assert.equal(simpleble.getClockTime(), 1005);
+
+        const received = [];
+        peripheral.notify(SERVICE, CHARACTERISTIC, data => received.push(data));
+        assert.equal(simpleble.advanceClock(105), 10);
+        assert.equal(simpleble.getClockTime(), 1110);
+        assert.equal(await waitFor(() => received.length === 10), true);
+        received.forEach((data, index) => assert.equal(sequence(data), index));
+
+        peripheral.disconnect();
+        adapter.release();
+    });
+});